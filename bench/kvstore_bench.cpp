@@ -0,0 +1,929 @@
+/*
+    Load generator for a running kvstore_server.
+
+    Every thread runs its own epoll loop over its share of the connections. A connection
+    keeps up to --pipeline requests in flight and times each one from the moment it is
+    queued until its reply is parsed; per-thread latency histograms are merged at the end.
+    The workload is either generated (GET/SET mix over a uniform or Zipfian keyspace, text
+    or binary protocol) or replayed from a file of recorded commands.
+
+    With --cluster the server is a seed node of a cluster: every connection is then a
+    ClusterClient on its own thread, sending batches of --pipeline requests split by hash
+    slot over all the nodes at once. A batch's requests are all timed from the moment the
+    batch is sent until its last reply is in.
+
+    Replay files hold one command per line, either a raw text-protocol line or a JSON
+    object with a "command" string ({"command": "SET k v"}) or "op"/"key"/"value" fields
+    ({"op": "GET", "key": "k"}). Lines with none of these are skipped.
+
+    Usage: kvstore_bench [options]   (--help for the list)
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "ClusterClient.hpp"
+#include "Encoding.hpp"
+#include "LatencyHistogram.hpp"
+#include "Protocol.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    size_t threads = 2;
+    size_t connections = 32;
+    size_t pipeline = 1;
+    uint64_t requests = 200000;  // total over all connections (0 with --duration)
+    double duration = 0;         // seconds; overrides requests when set
+    uint64_t keyspace = 100000;
+    bool zipf = false;
+    double zipf_theta = 0.99;
+    size_t key_size = 16;
+    size_t value_size = 64;
+    double get_ratio = 0.9;
+    bool binary = false;
+    bool preload = false;
+    bool cluster = false;
+    std::string replay;
+};
+
+// how a reply ends
+enum class ReplyShape : uint8_t {
+    Line,     // `lines` newline-terminated lines (MGET: one per key)
+    UntilEnd, // lines up to and including "END" (INFO, SCAN, SLABS, SLOWLOG GET, CLUSTER SLOTS)
+    Frame     // one binary response frame
+};
+
+// a recorded command and the shape of its reply
+struct ReplayCommand {
+    std::string line; // with the trailing newline
+    ReplyShape shape;
+    uint32_t lines;
+};
+
+/*
+    Zipfian ranks over [0, n) by the method of Gray et al. ("Quickly generating
+    billion-record synthetic databases"), as used by YCSB: O(n) setup, O(1) per draw.
+    Ranks are scrambled by a hash so the hot keys don't all sit next to each other.
+*/
+class ZipfGenerator {
+public:
+    ZipfGenerator(uint64_t n, double theta) : n_(n) {
+        double zeta2 = 1.0 + std::pow(0.5, theta);
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            zetan_ += 1.0 / std::pow(double(i), theta);
+        }
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+        half_pow_theta_ = 1.0 + std::pow(0.5, theta);
+    }
+
+    uint64_t next(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan_;
+        uint64_t rank;
+        if (uz < 1.0) {
+            rank = 0;
+        } else if (uz < half_pow_theta_) {
+            rank = 1;
+        } else {
+            rank = uint64_t(double(n_) * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        }
+        uint64_t h = (std::min(rank, n_ - 1) + 1) * 0x9E3779B97F4A7C15ULL; // scramble: spread hot ranks
+        return (h ^ (h >> 29)) % n_;
+    }
+
+private:
+    uint64_t n_;
+    double zetan_, alpha_, eta_, half_pow_theta_;
+};
+
+// requests still to send: a shared budget, or a deadline
+struct Budget {
+    std::atomic<uint64_t> remaining{0};
+    bool timed = false;
+    Clock::time_point deadline;
+
+    bool take() {
+        if (timed) {
+            return Clock::now() < deadline;
+        }
+        uint64_t left = remaining.load(std::memory_order_relaxed);
+        while (left > 0) {
+            if (remaining.compare_exchange_weak(left, left - 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// what every thread shares
+struct Workload {
+    const Options* opts;
+    const ZipfGenerator* zipf = nullptr;
+    const std::vector<ReplayCommand>* replay = nullptr;
+    std::atomic<uint64_t> replay_cursor{0};
+    std::atomic<uint64_t> preload_cursor{0};
+    bool preloading = false;
+    std::string value;
+    Budget budget;
+};
+
+/*
+    Draw the next key number of the workload.
+    Args:
+        work: the shared workload
+        rng: the thread's generator
+    Returns:
+        the key number, below the keyspace size
+*/
+uint64_t next_key(Workload& work, std::mt19937_64& rng) {
+    if (work.preloading) {
+        return work.preload_cursor.fetch_add(1, std::memory_order_relaxed) % work.opts->keyspace;
+    }
+    if (work.zipf != nullptr) {
+        return work.zipf->next(rng);
+    }
+    return rng() % work.opts->keyspace;
+}
+
+// whether the next generated request is a GET
+bool next_is_get(Workload& work, std::mt19937_64& rng) {
+    return !work.preloading && std::uniform_real_distribution<double>(0.0, 1.0)(rng) < work.opts->get_ratio;
+}
+
+struct ThreadStats {
+    LatencyHistogram latency;
+    uint64_t gets = 0, sets = 0, others = 0, errors = 0, misses = 0;
+};
+
+struct InFlight {
+    int64_t sent_ns;
+    ReplyShape shape;
+    uint32_t lines;
+};
+
+struct Conn {
+    int fd = -1;
+    std::string out;
+    size_t out_offset = 0;
+    std::string in;
+    size_t in_offset = 0;
+    std::vector<InFlight> inflight; // ring of size pipeline
+    size_t head = 0, count = 0;
+    uint32_t lines_seen = 0;        // lines of the reply at head parsed so far
+    bool want_write = false;
+    bool exhausted = false;         // the budget ran out for this connection
+};
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+/*
+    Extract a string field from a flat JSON object (handles the common escapes).
+    Args:
+        line: the JSON text
+        name: field name
+        out: receives the unescaped value
+    Returns:
+        true if the field was found
+*/
+bool json_string_field(std::string_view line, std::string_view name, std::string& out) {
+    std::string quoted = "\"" + std::string(name) + "\"";
+    size_t pos = line.find(quoted);
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+    pos = line.find(':', pos + quoted.size());
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+    pos = line.find('"', pos);
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+    out.clear();
+    for (size_t i = pos + 1; i < line.size(); i++) {
+        char c = line[i];
+        if (c == '"') {
+            return true;
+        }
+        if (c == '\\' && i + 1 < line.size()) {
+            char e = line[++i];
+            out += e == 'n' ? '\n' : e == 't' ? '\t' : e == 'r' ? '\r' : e;
+            continue;
+        }
+        out += c;
+    }
+    return false;
+}
+
+/*
+    How the reply to a text command ends.
+    Args:
+        cmd: the parsed command
+        tokens: scratch space for splitting the arguments
+        lines: receives the line count for ReplyShape::Line
+    Returns:
+        the reply's shape
+*/
+ReplyShape reply_shape(const Command& cmd, std::vector<std::string_view>& tokens, uint32_t& lines) {
+    lines = 1;
+    std::string_view args = cmd.args;
+    switch (cmd.type) {
+        case CommandType::MGet:
+            protocol::split_tokens(cmd.args, tokens);
+            lines = uint32_t(std::max<size_t>(1, tokens.size())); // no keys: a single error line
+            return ReplyShape::Line;
+        case CommandType::Slabs:
+        case CommandType::Info:
+        case CommandType::Scan:
+            return ReplyShape::UntilEnd;
+        case CommandType::SlowLog:
+            return protocol::next_token(args) == "GET" ? ReplyShape::UntilEnd : ReplyShape::Line;
+        case CommandType::Cluster:
+            return protocol::next_token(args) == "SLOTS" ? ReplyShape::UntilEnd : ReplyShape::Line;
+        default:
+            return ReplyShape::Line;
+    }
+}
+
+/*
+    Load a replay file.
+    Args:
+        path: file of raw command lines or JSON objects
+        skipped: receives the number of lines that held no command
+    Returns:
+        the commands in file order
+*/
+std::vector<ReplayCommand> load_replay(const std::string& path, size_t& skipped) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open replay file " + path);
+    }
+    std::vector<ReplayCommand> commands;
+    std::string line, field, command;
+    std::vector<std::string_view> tokens;
+    skipped = 0;
+    while (std::getline(file, line)) {
+        std::string_view rest(line);
+        while (!rest.empty() && protocol::is_space(rest.front())) {
+            rest.remove_prefix(1);
+        }
+        if (rest.empty()) {
+            continue;
+        }
+        if (rest.front() == '{') {
+            if (json_string_field(rest, "command", field)) {
+                command = field;
+            } else if (json_string_field(rest, "op", field)) {
+                command = field;
+                if (json_string_field(rest, "key", field)) {
+                    command += " " + field;
+                }
+                if (json_string_field(rest, "value", field)) {
+                    command += " " + field;
+                }
+            } else {
+                skipped++;
+                continue;
+            }
+        } else {
+            command = std::string(rest);
+        }
+        if (command.find('\n') != std::string::npos) { // the text protocol can't carry it
+            skipped++;
+            continue;
+        }
+
+        Command cmd;
+        if (!protocol::parse_line(command, cmd)) {
+            skipped++;
+            continue;
+        }
+        ReplayCommand rc{command + "\n", ReplyShape::Line, 1};
+        rc.shape = reply_shape(cmd, tokens, rc.lines);
+        commands.push_back(std::move(rc));
+    }
+    return commands;
+}
+
+/*
+    Open a TCP connection to the server.
+    Args:
+        opts: host and port
+    Returns:
+        a non-blocking socket with TCP_NODELAY (throws on failure)
+*/
+int connect_to(const Options& opts) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    std::string port = std::to_string(opts.port);
+    if (getaddrinfo(opts.host.c_str(), port.c_str(), &hints, &res) != 0) {
+        throw std::runtime_error("Cannot resolve " + opts.host);
+    }
+    int fd = -1;
+    for (addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot connect to " + opts.host + ":" + port);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/*
+    Render key number i, zero-padded to the configured key size.
+    Args:
+        i: key number
+        key_size: total key length (at least long enough for the number)
+        out: receives the key
+    Returns:
+        void
+*/
+void make_key(uint64_t i, size_t key_size, std::string& out) {
+    char digits[24];
+    int n = std::snprintf(digits, sizeof(digits), "%llu", (unsigned long long)i);
+    out.assign("key:");
+    if (key_size > out.size() + size_t(n)) {
+        out.append(key_size - out.size() - size_t(n), '0');
+    }
+    out.append(digits, size_t(n));
+}
+
+class Worker {
+public:
+    Worker(Workload& work, size_t connections, uint64_t seed) : work_(work), rng_(seed) {
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd_ < 0) {
+            throw std::runtime_error("epoll_create1 failed");
+        }
+        conns_.resize(connections);
+        for (size_t i = 0; i < connections; i++) {
+            Conn& c = conns_[i];
+            c.fd = connect_to(*work_.opts);
+            c.inflight.resize(work_.opts->pipeline);
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u64 = i;
+            epoll_ctl(epfd_, EPOLL_CTL_ADD, c.fd, &ev);
+        }
+    }
+
+    ~Worker() {
+        for (Conn& c : conns_) {
+            if (c.fd >= 0) {
+                close(c.fd);
+            }
+        }
+        close(epfd_);
+    }
+
+    // drive every connection until the budget is spent and all replies are in
+    void run() {
+        for (size_t i = 0; i < conns_.size(); i++) {
+            top_up(i);
+        }
+        std::vector<epoll_event> events(conns_.size());
+        while (active() > 0) {
+            int n = epoll_wait(epfd_, events.data(), int(events.size()), 1000);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("epoll_wait failed");
+            }
+            for (int e = 0; e < n; e++) {
+                size_t i = events[e].data.u64;
+                if (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    read_replies(i);
+                }
+                if (events[e].events & EPOLLOUT) {
+                    flush(i);
+                }
+                top_up(i);
+            }
+        }
+    }
+
+    ThreadStats stats;
+
+private:
+    Workload& work_;
+    std::mt19937_64 rng_;
+    int epfd_;
+    std::vector<Conn> conns_;
+    std::string key_;
+
+    size_t active() const {
+        size_t n = 0;
+        for (const Conn& c : conns_) {
+            n += c.fd >= 0 && (c.count > 0 || !c.exhausted);
+        }
+        return n;
+    }
+
+    // append one request to c.out and remember how its reply will look
+    void queue_request(Conn& c) {
+        const Options& opts = *work_.opts;
+        InFlight& slot = c.inflight[(c.head + c.count) % c.inflight.size()];
+        slot.sent_ns = now_ns();
+        slot.lines = 1;
+        c.count++;
+
+        if (work_.replay != nullptr) {
+            const ReplayCommand& rc = (*work_.replay)[work_.replay_cursor.fetch_add(1) % work_.replay->size()];
+            c.out += rc.line;
+            slot.shape = rc.shape;
+            slot.lines = rc.lines;
+            stats.others++;
+            return;
+        }
+
+        make_key(next_key(work_, rng_), opts.key_size, key_);
+        bool is_get = next_is_get(work_, rng_);
+        is_get ? stats.gets++ : stats.sets++;
+        if (opts.binary) {
+            namespace bin = protocol::binary;
+            bin::append_request(c.out, is_get ? bin::Opcode::Get : bin::Opcode::Set, key_,
+                                is_get ? std::string_view() : std::string_view(work_.value));
+            slot.shape = ReplyShape::Frame;
+            return;
+        }
+        c.out += is_get ? "GET " : "SET ";
+        c.out += key_;
+        if (!is_get) {
+            c.out += ' ';
+            c.out += work_.value;
+        }
+        c.out += '\n';
+        slot.shape = ReplyShape::Line;
+    }
+
+    // fill the pipeline from the budget and start writing
+    void top_up(size_t i) {
+        Conn& c = conns_[i];
+        if (c.fd < 0) {
+            return;
+        }
+        while (!c.exhausted && c.count < c.inflight.size()) {
+            if (!work_.budget.take()) {
+                c.exhausted = true;
+                break;
+            }
+            queue_request(c);
+        }
+        flush(i);
+    }
+
+    void flush(size_t i) {
+        Conn& c = conns_[i];
+        while (c.out_offset < c.out.size()) {
+            ssize_t n = write(c.fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    set_write_interest(i, true);
+                    return;
+                }
+                fail(i, "write failed");
+                return;
+            }
+            c.out_offset += size_t(n);
+        }
+        c.out.clear();
+        c.out_offset = 0;
+        set_write_interest(i, false);
+    }
+
+    void set_write_interest(size_t i, bool want) {
+        Conn& c = conns_[i];
+        if (c.want_write == want) {
+            return;
+        }
+        c.want_write = want;
+        epoll_event ev{};
+        ev.events = EPOLLIN | (want ? EPOLLOUT : 0);
+        ev.data.u64 = i;
+        epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    void fail(size_t i, const char* why) {
+        Conn& c = conns_[i];
+        std::cerr << "connection " << i << ": " << why << std::endl;
+        stats.errors += c.count;
+        close(c.fd);
+        c.fd = -1;
+        c.count = 0;
+    }
+
+    void complete(Conn& c, bool error, bool miss) {
+        InFlight& done = c.inflight[c.head];
+        stats.latency.record(uint64_t(now_ns() - done.sent_ns));
+        stats.errors += error;
+        stats.misses += miss;
+        c.head = (c.head + 1) % c.inflight.size();
+        c.count--;
+        c.lines_seen = 0;
+    }
+
+    void read_replies(size_t i) {
+        Conn& c = conns_[i];
+        char buf[65536];
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                return;
+            }
+            fail(i, "server closed the connection");
+            return;
+        }
+        c.in.append(buf, size_t(n));
+
+        while (c.count > 0) {
+            InFlight& head = c.inflight[c.head];
+            if (head.shape == ReplyShape::Frame) {
+                if (c.in.size() - c.in_offset < protocol::binary::HEADER_SIZE) {
+                    break;
+                }
+                const unsigned char* h = reinterpret_cast<const unsigned char*>(c.in.data() + c.in_offset);
+                size_t total = protocol::binary::HEADER_SIZE + encoding::get_u32(h + 4);
+                if (c.in.size() - c.in_offset < total) {
+                    break;
+                }
+                auto status = static_cast<protocol::binary::Status>(h[1]);
+                c.in_offset += total;
+                complete(c, status == protocol::binary::Status::Error, status == protocol::binary::Status::NotFound);
+                continue;
+            }
+            size_t nl = c.in.find('\n', c.in_offset);
+            if (nl == std::string::npos) {
+                break;
+            }
+            std::string_view line(c.in.data() + c.in_offset, nl - c.in_offset);
+            c.in_offset = nl + 1;
+            c.lines_seen++;
+            bool error = line.compare(0, 5, "ERROR") == 0;
+            bool last = head.shape == ReplyShape::UntilEnd ? (line == "END" || error) : c.lines_seen >= head.lines;
+            if (last) {
+                complete(c, error, line == "NOT_FOUND");
+            }
+        }
+        if (c.in_offset == c.in.size()) {
+            c.in.clear();
+            c.in_offset = 0;
+        } else if (c.in_offset > (1 << 20)) {
+            c.in.erase(0, c.in_offset);
+            c.in_offset = 0;
+        }
+    }
+};
+
+// one ClusterClient, driven a batch at a time
+class ClusterWorker {
+public:
+    ClusterWorker(Workload& work, uint64_t seed)
+        : work_(work), rng_(seed), client_(work.opts->host, work.opts->port) {}
+
+    // send batches until the budget is spent
+    void run() {
+        using protocol::binary::Status;
+        const Options& opts = *work_.opts;
+        while (true) {
+            while (client_.pending() < opts.pipeline && work_.budget.take()) {
+                make_key(next_key(work_, rng_), opts.key_size, key_);
+                if (next_is_get(work_, rng_)) {
+                    client_.get(key_);
+                    stats.gets++;
+                } else {
+                    client_.set(key_, work_.value);
+                    stats.sets++;
+                }
+            }
+            if (client_.pending() == 0) {
+                return;
+            }
+            int64_t start = now_ns();
+            client_.execute(replies_);
+            uint64_t elapsed = uint64_t(now_ns() - start);
+            for (const ClusterClient::Reply& reply : replies_) {
+                stats.latency.record(elapsed);
+                stats.errors += reply.status == Status::Error;
+                stats.misses += reply.status == Status::NotFound;
+            }
+        }
+    }
+
+    uint64_t redirects() const { return client_.redirects(); }
+    size_t nodes() const { return client_.slots().nodes(); }
+
+    ThreadStats stats;
+
+private:
+    Workload& work_;
+    std::mt19937_64 rng_;
+    ClusterClient client_;
+    std::vector<ClusterClient::Reply> replies_;
+    std::string key_;
+};
+
+struct Report {
+    ThreadStats total;
+    double seconds;
+};
+
+/*
+    Run one phase with fresh connections on every thread.
+    Args:
+        work: the shared workload (budget already set)
+        opts: thread and connection counts
+    Returns:
+        merged statistics and the wall time of the phase
+*/
+Report run_phase(Workload& work, const Options& opts) {
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t t = 0; t < opts.threads; t++) {
+        size_t share = opts.connections / opts.threads + (t < opts.connections % opts.threads ? 1 : 0);
+        if (share > 0) {
+            workers.push_back(std::make_unique<Worker>(work, share, 0x5EED + t));
+        }
+    }
+    auto start = Clock::now();
+    if (work.budget.timed) {
+        work.budget.deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                           std::chrono::duration<double>(opts.duration));
+    }
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(workers.size());
+    for (size_t t = 0; t < workers.size(); t++) {
+        threads.emplace_back([&, t] {
+            try {
+                workers[t]->run();
+            } catch (const std::exception& e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    Report report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (size_t t = 0; t < workers.size(); t++) {
+        if (!errors[t].empty()) {
+            throw std::runtime_error(errors[t]);
+        }
+        const ThreadStats& s = workers[t]->stats;
+        report.total.latency.merge(s.latency);
+        report.total.gets += s.gets;
+        report.total.sets += s.sets;
+        report.total.others += s.others;
+        report.total.errors += s.errors;
+        report.total.misses += s.misses;
+    }
+    return report;
+}
+
+/*
+    Run one phase against a cluster, one thread per connection.
+    Args:
+        work: the shared workload (budget already set)
+        opts: connection count (the seed node is host and port)
+    Returns:
+        merged statistics and the wall time of the phase
+*/
+Report run_cluster_phase(Workload& work, const Options& opts) {
+    std::vector<std::unique_ptr<ClusterWorker>> workers;
+    for (size_t t = 0; t < opts.connections; t++) {
+        workers.push_back(std::make_unique<ClusterWorker>(work, 0x5EED + t));
+    }
+    auto start = Clock::now();
+    if (work.budget.timed) {
+        work.budget.deadline = start + std::chrono::duration_cast<Clock::duration>(
+                                           std::chrono::duration<double>(opts.duration));
+    }
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(workers.size());
+    for (size_t t = 0; t < workers.size(); t++) {
+        threads.emplace_back([&, t] {
+            try {
+                workers[t]->run();
+            } catch (const std::exception& e) {
+                errors[t] = e.what();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    Report report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    uint64_t redirects = 0;
+    for (size_t t = 0; t < workers.size(); t++) {
+        if (!errors[t].empty()) {
+            throw std::runtime_error(errors[t]);
+        }
+        const ThreadStats& s = workers[t]->stats;
+        report.total.latency.merge(s.latency);
+        report.total.gets += s.gets;
+        report.total.sets += s.sets;
+        report.total.errors += s.errors;
+        report.total.misses += s.misses;
+        redirects += workers[t]->redirects();
+    }
+    std::printf("cluster of %zu nodes, %llu redirects followed\n", workers.front()->nodes(),
+                (unsigned long long)redirects);
+    return report;
+}
+
+void print_report(const char* name, const Report& r) {
+    const LatencyHistogram& h = r.total.latency;
+    std::printf("%s: %llu requests in %.2f s, %.0f req/s\n", name, (unsigned long long)h.count(), r.seconds,
+                double(h.count()) / r.seconds);
+    std::printf("  GET %llu (%llu missed)  SET %llu  other %llu  errors %llu\n",
+                (unsigned long long)r.total.gets, (unsigned long long)r.total.misses,
+                (unsigned long long)r.total.sets, (unsigned long long)r.total.others,
+                (unsigned long long)r.total.errors);
+    std::printf("  latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", h.percentile(0.50) / 1e3,
+                h.percentile(0.90) / 1e3, h.percentile(0.99) / 1e3, h.percentile(0.999) / 1e3, h.max() / 1e3);
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --host H           server host (default 127.0.0.1)\n"
+              << "  --port N           server port (default 8080)\n"
+              << "  --threads N        client threads, one epoll loop each (default 2)\n"
+              << "  --connections N    connections over all threads (default 32)\n"
+              << "  --pipeline N       requests in flight per connection (default 1)\n"
+              << "  --requests N       total requests (default 200000)\n"
+              << "  --duration S       run for S seconds instead of a request count\n"
+              << "  --keys N           keyspace size (default 100000)\n"
+              << "  --dist D           uniform (default) or zipf[:theta] (theta default 0.99)\n"
+              << "  --key-size N       key length in bytes (default 16)\n"
+              << "  --value-size N     value length in bytes (default 64)\n"
+              << "  --get-ratio R      fraction of requests that are GETs (default 0.9)\n"
+              << "  --binary           use the binary protocol\n"
+              << "  --cluster          host:port is a cluster node: route by hash slot with ClusterClient,\n"
+              << "                     one thread per connection, batches of --pipeline requests (not with --replay)\n"
+              << "  --preload          SET every key once before the measured run\n"
+              << "  --replay FILE      send the commands in FILE (text lines or JSON lines) instead\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (arg == "--binary") {
+            opts.binary = true;
+            continue;
+        }
+        if (arg == "--preload") {
+            opts.preload = true;
+            continue;
+        }
+        if (arg == "--cluster") {
+            opts.cluster = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--host") {
+            opts.host = value;
+        } else if (arg == "--port") {
+            opts.port = std::atoi(value.c_str());
+        } else if (arg == "--threads") {
+            opts.threads = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--connections") {
+            opts.connections = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--pipeline") {
+            opts.pipeline = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--requests") {
+            opts.requests = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--duration") {
+            opts.duration = std::atof(value.c_str());
+        } else if (arg == "--keys") {
+            opts.keyspace = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--dist") {
+            if (value.rfind("zipf", 0) == 0) {
+                opts.zipf = true;
+                if (value.size() > 5 && value[4] == ':') {
+                    opts.zipf_theta = std::atof(value.c_str() + 5);
+                }
+            } else if (value != "uniform") {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--key-size") {
+            opts.key_size = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--value-size") {
+            opts.value_size = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--get-ratio") {
+            opts.get_ratio = std::atof(value.c_str());
+        } else if (arg == "--replay") {
+            opts.replay = value;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opts.threads == 0 || opts.connections == 0 || opts.pipeline == 0 || opts.keyspace == 0 ||
+        (opts.zipf && (opts.zipf_theta <= 0 || opts.zipf_theta == 1.0)) || (opts.cluster && !opts.replay.empty())) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    opts.threads = opts.cluster ? opts.connections : std::min(opts.threads, opts.connections);
+
+    try {
+        Workload work;
+        work.opts = &opts;
+        work.value.assign(opts.value_size, 'x');
+
+        std::vector<ReplayCommand> replay;
+        std::unique_ptr<ZipfGenerator> zipf;
+        if (!opts.replay.empty()) {
+            size_t skipped = 0;
+            replay = load_replay(opts.replay, skipped);
+            if (replay.empty()) {
+                std::cerr << "No commands in " << opts.replay << " (" << skipped << " lines skipped)" << std::endl;
+                return 1;
+            }
+            std::printf("replaying %zu commands from %s (%zu lines skipped)\n", replay.size(), opts.replay.c_str(), skipped);
+        } else if (opts.zipf) {
+            zipf = std::make_unique<ZipfGenerator>(opts.keyspace, opts.zipf_theta);
+        }
+
+        if (opts.preload && opts.replay.empty()) {
+            work.preloading = true;
+            work.budget.remaining = opts.keyspace;
+            print_report("preload", opts.cluster ? run_cluster_phase(work, opts) : run_phase(work, opts));
+            work.preloading = false;
+        }
+
+        work.zipf = zipf.get();
+        work.replay = replay.empty() ? nullptr : &replay;
+        if (opts.duration > 0) {
+            work.budget.timed = true;
+        } else {
+            work.budget.remaining = opts.requests;
+        }
+        std::printf("%zu threads, %zu connections, pipeline %zu, %s\n", opts.threads, opts.connections, opts.pipeline,
+                    work.replay ? "replay" : (opts.zipf ? "zipfian keys" : "uniform keys"));
+        print_report("run", opts.cluster ? run_cluster_phase(work, opts) : run_phase(work, opts));
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
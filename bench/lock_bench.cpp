@@ -0,0 +1,106 @@
+/*
+    Read scaling of the two shard lock modes (LockMode::Shared and LockMode::ReaderSlots).
+    For 1, 2, 4, ... max_readers threads, every reader GETs random keys of a preloaded
+    store for a fixed time while one writer SETs a key every writer_interval_us (0 = no
+    writer), so the writer's rate also shows whether readers starve it. Keys are drawn
+    from a small hot set to put many readers on the same shard locks.
+
+    Usage: kvstore_lock_bench [max_readers] [ms_per_run] [writer_interval_us] [hot_keys]
+*/
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "KVStore.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+    double reads_per_sec;
+    double writes_per_sec;
+};
+
+static Result run(LockMode mode, size_t readers, std::chrono::milliseconds duration,
+                  std::chrono::microseconds writer_interval, const std::vector<std::string>& keys) {
+    KVStore store(KVStore::DEFAULT_SHARDS, mode);
+    for (const auto& key : keys) {
+        store.set(key, "value-of-" + key);
+    }
+
+    std::atomic<bool> start{false};
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> reads{0};
+    std::atomic<size_t> writes{0};
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < readers; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            std::string out;
+            size_t count = 0;
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; i++) {
+                    out.clear();
+                    store.get(keys[rng() % keys.size()], out);
+                }
+                count += 256;
+            }
+            reads += count;
+        });
+    }
+    if (writer_interval.count() > 0) {
+        threads.emplace_back([&] {
+            std::mt19937_64 rng(0);
+            size_t count = 0;
+            while (!start.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                store.set(keys[rng() % keys.size()], "updated");
+                count++;
+                std::this_thread::sleep_for(writer_interval);
+            }
+            writes += count;
+        });
+    }
+
+    auto begin = Clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    return {reads / seconds, writes / seconds};
+}
+
+int main(int argc, char* argv[]) {
+    size_t max_readers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    std::chrono::milliseconds duration(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 500);
+    std::chrono::microseconds writer_interval(argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100);
+    size_t hot_keys = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 16;
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < std::max<size_t>(1, hot_keys); i++) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+
+    std::printf("%zu hot keys, %lld ms per run, writer every %lld us, %u hardware threads\n", keys.size(),
+                (long long)duration.count(), (long long)writer_interval.count(), std::thread::hardware_concurrency());
+    std::printf("%8s  %22s  %22s\n", "readers", "shared_mutex Mreads/s", "reader slots Mreads/s");
+    for (size_t readers = 1; readers <= max_readers; readers *= 2) {
+        Result shared = run(LockMode::Shared, readers, duration, writer_interval, keys);
+        Result slots = run(LockMode::ReaderSlots, readers, duration, writer_interval, keys);
+        std::printf("%8zu  %10.2f (%6.0f w/s)  %10.2f (%6.0f w/s)\n", readers, shared.reads_per_sec / 1e6,
+                    shared.writes_per_sec, slots.reads_per_sec / 1e6, slots.writes_per_sec);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+    Compare the two KVStore storage backends (std::unordered_map and FlatHashMap)
+    outside the store: insert, hit lookups, miss lookups and erase over N string keys,
+    plus the heap growth each map causes.
+
+    Usage: kvstore_map_bench [num_keys] [value_size]
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <malloc.h>
+#include "FlatHashMap.hpp"
+#include "KVStore.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// bytes currently allocated from the heap
+static size_t heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+template <typename F>
+static double ns_per_op(size_t ops, F&& fn) {
+    auto start = Clock::now();
+    fn();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    return double(elapsed) / ops;
+}
+
+template <typename Map>
+static void run(const char* name, const std::vector<std::string>& keys,
+                const std::vector<size_t>& order, const std::string& value) {
+    size_t n = keys.size();
+    size_t heap_before = heap_in_use();
+    size_t found = 0;
+    {
+        Map map;
+        double insert = ns_per_op(n, [&] {
+            for (const auto& key : keys) {
+                map.emplace(key, value);
+            }
+        });
+        size_t heap_bytes = heap_in_use() - heap_before;
+
+        double hit = ns_per_op(n, [&] {
+            for (size_t i : order) {
+                auto it = map.find(std::string_view(keys[i]));
+                found += it != map.end() ? it->second.size() : 0;
+            }
+        });
+
+        double miss = ns_per_op(n, [&] {
+            std::string probe;
+            for (size_t i : order) {
+                probe = keys[i];
+                probe[0] = '#'; // never a stored key
+                found += map.find(std::string_view(probe)) != map.end();
+            }
+        });
+
+        double erase = ns_per_op(n, [&] {
+            for (size_t i : order) {
+                auto it = map.find(std::string_view(keys[i]));
+                if (it != map.end()) {
+                    map.erase(it);
+                }
+            }
+        });
+
+        std::printf("%-20s insert %7.1f  hit %7.1f  miss %7.1f  erase %7.1f ns/op   heap %8.1f MB (%.1f B/key)\n",
+                    name, insert, hit, miss, erase, heap_bytes / 1e6, double(heap_bytes) / n);
+    }
+    if (found == size_t(-1)) { // keep the lookups from being optimised away
+        std::printf("unreachable\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t value_size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 12;
+
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        keys.push_back("key:" + std::to_string(i));
+    }
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42)); // random access pattern
+    std::string value(value_size, 'v');
+
+    std::printf("%zu keys, %zu-byte values\n", n, value_size);
+    run<std::unordered_map<std::string, std::string, KeyHash, std::equal_to<>>>("std::unordered_map", keys, order, value);
+    run<FlatHashMap<std::string, std::string, KeyHash, std::equal_to<>>>("FlatHashMap", keys, order, value);
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+    In-process microbenchmarks (Google Benchmark) for the store and the request path,
+    without the network in the way.
+
+    Store benchmarks run over key counts chosen to land the working set in L2, L3 and
+    DRAM, under 1..N threads sharing one store. Build with -DKVSTORE_FLAT_MAP=ON to get
+    the numbers for the flat map backend. Parser benchmarks feed pipelined buffers through
+    ReadBuffer::next_line + protocol::parse_line (what every connection does per read), and
+    through CommandHandler::process including execution.
+
+    Usage: kvstore_microbench [--benchmark_filter=...] [other Google Benchmark flags]
+*/
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CommandHandler.hpp"
+#include "KVStore.hpp"
+#include "Protocol.hpp"
+
+namespace {
+
+constexpr size_t VALUE_SIZE = 64;
+
+std::string key_name(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+// a preloaded store per key count, shared by every benchmark and thread that asks for it
+struct Dataset {
+    KVStore store;
+    std::vector<std::string> keys;
+};
+
+Dataset& dataset(size_t n) {
+    static std::mutex mtx;
+    static std::map<size_t, std::unique_ptr<Dataset>> cache;
+    std::lock_guard<std::mutex> lock(mtx);
+    std::unique_ptr<Dataset>& data = cache[n];
+    if (!data) {
+        data = std::make_unique<Dataset>();
+        std::string value(VALUE_SIZE, 'v');
+        for (size_t i = 0; i < n; i++) {
+            data->keys.push_back(key_name(i));
+            data->store.set(data->keys.back(), value);
+        }
+    }
+    return *data;
+}
+
+int max_threads() {
+    return int(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+// key counts whose working sets (~150 B per key) sit in L2, L3 and DRAM
+void KeyCounts(benchmark::internal::Benchmark* b) {
+    for (int64_t n : {1 << 10, 1 << 16, 1 << 20}) {
+        b->Arg(n);
+    }
+    b->ThreadRange(1, max_threads())->UseRealTime();
+}
+
+void BM_StoreGetHit(benchmark::State& state) {
+    Dataset& data = dataset(size_t(state.range(0)));
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        benchmark::DoNotOptimize(data.store.get(data.keys[rng() % data.keys.size()], out));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StoreGetHit)->Apply(KeyCounts);
+
+void BM_StoreGetMiss(benchmark::State& state) {
+    Dataset& data = dataset(size_t(state.range(0)));
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::string out;
+    std::string probe;
+    for (auto _ : state) {
+        probe = data.keys[rng() % data.keys.size()];
+        probe[0] = '#'; // never stored
+        benchmark::DoNotOptimize(data.store.get(probe, out));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StoreGetMiss)->Apply(KeyCounts);
+
+void BM_StoreSetOverwrite(benchmark::State& state) {
+    Dataset& data = dataset(size_t(state.range(0)));
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::string value(VALUE_SIZE, 'w');
+    for (auto _ : state) {
+        data.store.set(data.keys[rng() % data.keys.size()], value);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StoreSetOverwrite)->Apply(KeyCounts);
+
+// insert and remove fresh keys (every thread its own range), so the map grows and shrinks
+void BM_StoreSetRemove(benchmark::State& state) {
+    static KVStore store;
+    std::string value(VALUE_SIZE, 'v');
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 4096; i++) {
+        keys.push_back("t" + std::to_string(state.thread_index()) + ":" + std::to_string(i));
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        const std::string& key = keys[i++ % keys.size()];
+        store.set(key, value);
+        benchmark::DoNotOptimize(store.remove(key));
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+BENCHMARK(BM_StoreSetRemove)->ThreadRange(1, max_threads())->UseRealTime();
+
+// 90% GET / 10% SET over 1M keys
+void BM_StoreMixed(benchmark::State& state) {
+    Dataset& data = dataset(1 << 20);
+    std::mt19937_64 rng(state.thread_index() + 1);
+    std::string value(VALUE_SIZE, 'm');
+    std::string out;
+    for (auto _ : state) {
+        uint64_t r = rng();
+        const std::string& key = data.keys[(r >> 8) % data.keys.size()];
+        if ((r & 0xFF) < 26) {
+            data.store.set(key, value);
+        } else {
+            out.clear();
+            benchmark::DoNotOptimize(data.store.get(key, out));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StoreMixed)->ThreadRange(1, max_threads())->UseRealTime();
+
+// a pipelined burst of `depth` commands, 90% GET / 10% SET
+std::string pipelined_buffer(size_t depth) {
+    std::mt19937_64 rng(7);
+    std::string buf;
+    std::string value(VALUE_SIZE, 'p');
+    for (size_t i = 0; i < depth; i++) {
+        std::string key = key_name(rng() % 1024);
+        buf += i % 10 == 9 ? "SET " + key + " " + value + "\n" : "GET " + key + "\n";
+    }
+    return buf;
+}
+
+void BM_ParsePipelined(benchmark::State& state) {
+    std::string burst = pipelined_buffer(size_t(state.range(0)));
+    ReadBuffer in;
+    std::string_view line;
+    Command cmd;
+    for (auto _ : state) {
+        std::memcpy(in.prepare(burst.size()), burst.data(), burst.size());
+        in.commit(burst.size());
+        while (in.next_line(line)) {
+            benchmark::DoNotOptimize(protocol::parse_line(line, cmd));
+            benchmark::DoNotOptimize(cmd.args.data());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * int64_t(burst.size()));
+}
+BENCHMARK(BM_ParsePipelined)->Arg(1)->Arg(16)->Arg(256);
+
+void BM_ProcessPipelined(benchmark::State& state) {
+    Dataset& data = dataset(1 << 10);
+    CommandHandler handler(data.store);
+    std::string burst = pipelined_buffer(size_t(state.range(0)));
+    ReadBuffer in;
+    WriteBuffer out;
+    Framing framing = Framing::Unknown;
+    for (auto _ : state) {
+        std::memcpy(in.prepare(burst.size()), burst.data(), burst.size());
+        in.commit(burst.size());
+        out.clear();
+        handler.process(in, out, framing);
+        benchmark::DoNotOptimize(out.bytes().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * int64_t(burst.size()));
+}
+BENCHMARK(BM_ProcessPipelined)->Arg(1)->Arg(16)->Arg(256);
+
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// when the append-only file is fdatasync'ed
+enum class FsyncPolicy {
+    Always,   // every batch is synced before the commands in it are acknowledged
+    Interval, // synced at most once per interval; a crash may lose the last interval
+    Never     // left to the OS page cache
+};
+
+/*
+    Append-only log of store mutations with group commit. Callers append records into an
+    in-memory buffer; a dedicated writer thread swaps that buffer out and persists every
+    record gathered so far with a single write (plus one fdatasync in Always mode), so
+    concurrent clients share the cost of each sync.
+
+    Record layout (little-endian):
+        u32 body length | u32 crc32c(body) | body = u8 op | u32 key length | key | value
+    SetExpiring and ExpireAt records carry a u64 deadline (unix ms) in front of the value.
+*/
+class AppendLog {
+public:
+    enum class Op : uint8_t { Set = 1, Del = 2, SetExpiring = 3, ExpireAt = 4 };
+
+    // callback used by replay(); expires_at is 0 for records without a deadline
+    using ApplyFn = std::function<void(Op op, std::string_view key, std::string_view value, int64_t expires_at)>;
+
+    // one decoded record; key and value point into the bytes it was decoded from
+    struct Record {
+        Op op;
+        std::string_view key;
+        std::string_view value;
+        int64_t expires_at;
+    };
+
+    // constructor - opens (or creates) path for appending and starts the writer thread
+    AppendLog(const std::string& path, FsyncPolicy policy,
+              std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+
+    ~AppendLog(); // writes out everything appended so far, then stops the writer
+
+    // prevent copying the log
+    AppendLog(const AppendLog&) = delete;
+    AppendLog& operator=(const AppendLog&) = delete;
+
+    void append_set(std::string_view key, std::string_view value, int64_t expires_at = 0);
+    void append_del(std::string_view key);
+    void append_expire(std::string_view key, int64_t expires_at); // 0 clears the expiry
+
+    // block until every record up to seq has been written (and synced in Always mode);
+    // returns false if the log failed and the records may not be durable
+    bool wait_durable(uint64_t seq);
+
+    FsyncPolicy policy() const { return policy_; }
+
+    // start a checkpoint before taking a snapshot: the records logged so far are moved to
+    // checkpoint_path() and new records go to a fresh file. If an earlier checkpoint was
+    // never completed its file is kept and the log is not rotated; the snapshot covers its
+    // records too. Returns false if the checkpoint file must outlive the snapshot: the
+    // rotation failed, or an earlier one left the writer appending to that file
+    bool begin_checkpoint();
+
+    // the snapshot started after a begin_checkpoint() that returned true is durable: drop
+    // the checkpointed records
+    void end_checkpoint();
+
+    // where begin_checkpoint() moves the records that a snapshot supersedes
+    static std::string checkpoint_path(const std::string& path) { return path + ".1"; }
+
+    // sequence number of the last record appended by the calling thread
+    static uint64_t thread_sequence();
+
+    // read every intact record in path and pass it to apply; a torn record at the tail
+    // (from a crash mid-write) ends the replay and is cut off the file.
+    // returns the number of records applied (0 if the file doesn't exist)
+    static size_t replay(const std::string& path, const ApplyFn& apply);
+
+    // append one encoded record to out (the layout above, also used on the replication stream)
+    static void encode(Op op, std::string_view key, std::string_view value, int64_t expires_at, std::string& out);
+
+    // pass every intact record at the front of data to apply, stopping at the first torn
+    // or corrupt one; returns the bytes consumed
+    static size_t decode(std::string_view data, const ApplyFn& apply);
+
+private:
+    std::string path_;
+    int fd_;
+    FsyncPolicy policy_;
+    std::chrono::milliseconds interval_;
+
+    std::mutex mtx_;
+    std::condition_variable work_cv_;    // writer: new records or stop
+    std::condition_variable durable_cv_; // waiters: durable_seq_ advanced
+    std::string pending_;                // encoded records not yet handed to the writer
+    uint64_t appended_seq_ = 0;
+    uint64_t durable_seq_ = 0;
+    bool stop_ = false;
+    bool failed_ = false;
+    bool rotate_requested_ = false; // begin_checkpoint() waiting for the writer to rotate
+    bool rotate_ok_ = false;
+    bool appending_to_checkpoint_ = false; // a rotation could neither reopen the log nor undo itself
+
+    std::thread writer_;
+
+    void append_record(Op op, std::string_view key, std::string_view value, int64_t expires_at = 0);
+    void writer_loop();
+    bool rotate();
+};
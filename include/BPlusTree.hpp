@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+class SlabArena;
+
+/*
+    Ordered set of byte-string keys, kept beside a shard's hash map so keys can be
+    enumerated in order and by prefix. A B+tree: every key lives in a leaf, leaves are
+    linked left to right, and inner nodes only hold separator copies that route a search.
+
+    Nodes are a few hundred bytes and store, next to each key pointer, the key's first
+    8 bytes as a big-endian integer, so most comparisons while searching a node are one
+    integer compare on data already in cache; only equal heads look at the key bytes.
+    Nodes and keys are allocated from the shard's arena and counted like its entries.
+    Not thread-safe: the shard lock covers it.
+*/
+class BPlusTree {
+private:
+    struct Key;
+    struct Node;
+    struct Leaf;
+    struct Inner;
+
+public:
+    // position in key order; invalidated by any insert or erase
+    class Cursor {
+    public:
+        bool valid() const { return leaf_ != nullptr; }
+        std::string_view key() const;
+        void next();
+
+    private:
+        friend class BPlusTree;
+        const Leaf* leaf_ = nullptr;
+        unsigned pos_ = 0;
+
+        Cursor(const Leaf* leaf, unsigned pos);
+    };
+
+    explicit BPlusTree(SlabArena* arena);
+    ~BPlusTree();
+
+    // prevent copying the tree
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    // add a key; false if it is already present
+    bool insert(std::string_view key);
+
+    // remove a key; false if it is absent
+    bool erase(std::string_view key);
+
+    size_t size() const { return size_; }
+
+    // first key not less than key / greater than key (invalid cursor if none)
+    Cursor lower_bound(std::string_view key) const;
+    Cursor upper_bound(std::string_view key) const;
+
+private:
+    // what a node split hands its parent: a separator and the new right node
+    struct Split {
+        uint64_t head = 0;
+        Key* key = nullptr;
+        Node* right = nullptr;
+    };
+
+    SlabArena* arena_;
+    Node* root_ = nullptr;
+    unsigned height_ = 0; // inner levels above the leaves
+    size_t size_ = 0;
+
+    Key* make_key(std::string_view bytes);
+    void free_key(Key* key);
+    Leaf* make_leaf();
+    Inner* make_inner();
+    void free_node(Node* node, unsigned depth, bool recursive);
+
+    bool insert_at(Node* node, unsigned depth, std::string_view key, uint64_t head, Split& split);
+    bool erase_at(Node* node, unsigned depth, std::string_view key, uint64_t head);
+    void rebalance_leaf(Inner* parent, unsigned c);
+    void rebalance_inner(Inner* parent, unsigned c);
+    Cursor seek(std::string_view key, bool inclusive) const;
+};
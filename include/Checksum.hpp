@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli); uses the SSE4.2 crc32 instruction when the CPU has it.
+// Pass a previous result as seed to checksum data in pieces.
+uint32_t crc32c(const void* data, size_t len, uint32_t seed = 0);
+
+// CRC-16/XMODEM (polynomial 0x1021, no reflection, zero seed), table driven.
+uint16_t crc16(const void* data, size_t len);
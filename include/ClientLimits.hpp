@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <Protocol.hpp>
+
+// overload and shutdown limits for client connections (0 = unbounded)
+struct ClientLimits {
+    size_t max_clients = 10000;            // connections served at once; more are turned away
+    size_t max_input = size_t(1) << 30;    // unparsed request bytes buffered per connection
+    size_t output_limit = size_t(1) << 20; // unsent reply bytes at which a connection stops being read
+    size_t drain_timeout_ms = 5000;        // after shutdown begins, how long connections get to finish
+};
+
+/*
+    Admission and overload policy shared by every thread serving clients.
+
+    A connection past max_clients gets a one-line error and is closed right away, before
+    any per-connection state (or, in threaded mode, a thread) exists for it. A connection
+    whose buffered request outgrows max_input is sent an error and dropped. Replies are
+    bounded by output_limit: requests stop being executed once that many reply bytes
+    wait to be written, and the connection isn't read again until they drain, so a
+    client that doesn't read its replies is held back by TCP instead of growing the
+    server's buffers.
+
+    The gate is also where a graceful shutdown starts: shut_down() stops admitting and
+    makes shutdown_fd() readable, and every thread serving clients then stops accepting,
+    stops reading its connections, answers the requests they already sent and returns
+    once they are all written (or drain_timeout_ms has passed).
+*/
+class ClientGate {
+public:
+    explicit ClientGate(const ClientLimits& limits); // throws std::runtime_error if the eventfd can't be created
+    ~ClientGate(); // closes the eventfd
+
+    // prevent copying the gate
+    ClientGate(const ClientGate&) = delete;
+    ClientGate& operator=(const ClientGate&) = delete;
+
+    // count a newly accepted client in; at the limit or once shutting down, reject it and
+    // close fd (returns false)
+    bool admit(int fd);
+
+    // a client admitted by admit() disconnected. Release ordering: a shutdown that sees
+    // clients() reach 0 also sees everything the client threads did before leaving
+    void release() { clients_.fetch_sub(1, std::memory_order_release); }
+
+    // whether a connection's buffered request bytes (plus the known rest of a partly
+    // received binary frame) exceed max_input
+    bool input_exceeded(size_t buffered, size_t missing = 0) const {
+        return limits_.max_input != 0 && buffered + missing > limits_.max_input;
+    }
+
+    // append the error for an oversized request in the connection's framing, and count it
+    void reject_input(Framing framing, WriteBuffer& out) const;
+
+    // begin a graceful shutdown; async-signal-safe, so a signal handler may call it
+    void shut_down();
+
+    bool shutting_down() const { return shutting_down_.load(std::memory_order_acquire); }
+
+    // eventfd that becomes (and stays) readable once shut_down() was called
+    int shutdown_fd() const { return shutdown_fd_; }
+
+    const ClientLimits& limits() const { return limits_; }
+    size_t clients() const { return clients_.load(std::memory_order_acquire); }
+
+private:
+    ClientLimits limits_;
+    std::atomic<size_t> clients_{0};
+    std::atomic<bool> shutting_down_{false};
+    int shutdown_fd_ = -1;
+};
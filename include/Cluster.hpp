@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+    Hash-slot sharding across servers. Every key hashes to one of SLOTS slots, and each
+    node of a cluster serves some ranges of slots; a node answers a request for a key in
+    a slot it doesn't serve with
+        ERROR: MOVED <slot> <host>:<port>
+    naming the node that does, and lists the whole layout with CLUSTER SLOTS. MGET and
+    MSET are served by a node only if it serves all of their keys; keys spread over
+    several nodes get ERROR: CROSSSLOT rather than a redirect. Clients (see
+    ClusterClient) cache that layout and send each key straight to its node.
+
+    The layout is static: every node is started with the same map, and moving slots means
+    restarting the nodes with a new one (keys are not migrated).
+*/
+namespace cluster {
+
+constexpr size_t SLOTS = 16384;
+
+// slot of a key: CRC-16 of the key mod SLOTS, or of only the part between the first '{'
+// and the next '}' if that is non-empty (a hash tag), so related keys can share a node
+uint16_t key_slot(std::string_view key);
+
+// split "host:port" (the port after the last ':'); false if the port is missing or invalid
+bool parse_address(std::string_view text, std::string& host, int& port);
+
+}
+
+// which node serves each hash slot
+class SlotMap {
+public:
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+    struct Node {
+        std::string host;
+        int port;
+    };
+
+    struct Range {
+        uint16_t first;
+        uint16_t last; // inclusive
+        uint32_t node;
+    };
+
+    SlotMap();
+
+    // parse a layout such as "0-8191@10.0.0.1:8080,8192-16383@10.0.0.2:8080" (a single slot
+    // may be given without "-last"); throws std::runtime_error on bad syntax or overlaps
+    static SlotMap parse(std::string_view spec);
+
+    // give slots first..last to host:port; false if they are out of range or already taken
+    bool assign(uint16_t first, uint16_t last, std::string_view host, int port);
+
+    // node serving slot, or NO_NODE
+    uint32_t owner(uint16_t slot) const { return owners_[slot]; }
+
+    const Node& node(uint32_t index) const { return nodes_[index]; }
+    size_t nodes() const { return nodes_.size(); }
+
+    // index of the node at host:port, or NO_NODE
+    uint32_t find(std::string_view host, int port) const;
+
+    // the assigned ranges, in slot order
+    std::vector<Range> ranges() const;
+
+    // slots that have a node
+    size_t assigned() const { return assigned_; }
+
+private:
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> owners_; // node index per slot
+    size_t assigned_ = 0;
+};
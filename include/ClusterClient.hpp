@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <Cluster.hpp>
+#include <Protocol.hpp>
+
+/*
+    Client for a cluster of servers (see Cluster.hpp), over the binary protocol.
+
+    It loads the slot layout with CLUSTER SLOTS from a seed node and keeps one connection
+    per node it has talked to. Requests are queued into a batch; execute() hands every
+    node its share, pipelined on its connection, writes to and reads from all the nodes
+    at once, and returns the replies in request order. A MOVED reply means the cached
+    layout is stale: it is reloaded from the node the reply names and the redirected
+    requests are sent again, up to MAX_REDIRECTS times.
+
+    Not thread-safe; use one client per thread.
+*/
+class ClusterClient {
+public:
+    static constexpr int MAX_REDIRECTS = 5;
+    static constexpr int TIMEOUT_MS = 5000; // a node silent this long fails the batch
+
+    struct Reply {
+        protocol::binary::Status status = protocol::binary::Status::Error;
+        std::string body; // the value, the error message, or the text reply
+    };
+
+    // connects to the seed node and loads the layout (throws std::runtime_error on failure)
+    ClusterClient(std::string host, int port);
+    ~ClusterClient(); // closes the connections
+
+    // prevent copying the client
+    ClusterClient(const ClusterClient&) = delete;
+    ClusterClient& operator=(const ClusterClient&) = delete;
+
+    // queue a request in the batch
+    void get(std::string_view key);
+    void set(std::string_view key, std::string_view value);
+    void del(std::string_view key);
+
+    // queue a text command line (without its newline), routed by its first argument: a
+    // single-key command such as "INCR counter" or "TTL session", or an MGET/MSET whose
+    // keys share a node (hash tags); the reply to one spanning nodes is a CROSSSLOT error,
+    // which is not retried
+    void command(std::string_view line);
+
+    // requests queued since the last execute()
+    size_t pending() const { return batch_.size(); }
+
+    // send the batch and wait for every reply; replies[i] answers the i-th request queued.
+    // Throws std::runtime_error if a node fails or times out (the batch is dropped, and the
+    // layout is reloaded before the next one)
+    void execute(std::vector<Reply>& replies);
+
+    // reload the layout from the seed node, or from the first node of the cached layout
+    // that answers if the seed doesn't
+    void refresh();
+
+    const SlotMap& slots() const { return slots_; }
+
+    // MOVED replies followed since construction
+    uint64_t redirects() const { return redirects_; }
+
+private:
+    struct Request {
+        protocol::binary::Opcode op;
+        uint16_t slot;
+        uint32_t key_offset; // key and value in data_
+        uint32_t key_length;
+        uint32_t value_length; // the value follows the key
+    };
+
+    struct Link {
+        std::string host;
+        int port = 0;
+        int fd = -1;
+        std::string out; // frames not yet written
+        size_t out_offset = 0;
+        std::string in; // replies not yet parsed
+        size_t in_offset = 0;
+        std::vector<size_t> waiting; // the request each reply on this connection answers, in order
+        size_t answered = 0;
+    };
+
+    std::string seed_host_;
+    int seed_port_;
+    SlotMap slots_;
+    std::vector<Link> links_;        // one per node connected to so far
+    std::vector<size_t> node_links_; // link of each node of slots_, or npos before connecting
+    std::vector<Request> batch_;
+    std::string data_; // keys and values of the batch, back to back
+    uint64_t redirects_ = 0;
+    bool stale_ = false; // a node failed: reload the layout before the next batch
+
+    void queue(protocol::binary::Opcode op, std::string_view key, std::string_view value, uint16_t slot);
+    size_t link_for(std::string_view host, int port);
+    void load_slots(size_t link);
+    void disconnect();
+
+    // write every link's frames and read until each has its replies, calling
+    // on_reply(link, nth reply, response) for them in order
+    template <typename OnReply>
+    void exchange(OnReply&& on_reply);
+    bool write_some(Link& link);
+    template <typename OnReply>
+    bool read_some(Link& link, OnReply& on_reply);
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <KVStore.hpp>
+#include <Protocol.hpp>
+
+class BackgroundSaver;
+class ReplicationServer;
+class ReplicaLink;
+class SlotMap;
+
+// lets a connection hand requests for keys another thread owns to that thread (thread-per-core
+// serving), and decides where the replies of the requests run here go
+class RequestRouter {
+public:
+    virtual ~RequestRouter() = default;
+
+    // request (a text line or a binary frame) only touches shard; returns false if it is to
+    // run here, true if it was taken to run elsewhere (its reply arrives later)
+    virtual bool forward(size_t shard, Framing framing, std::string_view request) = 0;
+
+    // whether requests taken by forward() are still unanswered
+    virtual bool forwarding() const = 0;
+
+    // where the reply of a request run here is appended, behind those still unanswered
+    virtual WriteBuffer& reply_buffer() = 0;
+
+    // reply bytes of the connection not yet written, for process()'s output limit
+    virtual size_t backlog() const = 0;
+};
+
+class CommandHandler {
+public:
+    // constructor - takes reference to store
+    explicit CommandHandler(KVStore& store);
+
+    // execute every complete request buffered in `in`, appending the responses to out
+    // (large GET values by reference). framing starts as Unknown and is fixed by the
+    // connection's first byte. returns false if the client violated the protocol and the
+    // connection should be closed. With an output_limit, the loop stops (leaving the rest
+    // buffered) before a request once out holds that many bytes; at least one request runs
+    bool process(ReadBuffer& in, WriteBuffer& out, Framing& framing, size_t output_limit = 0);
+
+    // like process, but single-key requests are offered to router and replies go to its
+    // reply buffer. A request that may touch several shards (or none) is held back while
+    // forwarded requests are unanswered, and the loop stops there; call again to resume.
+    // output_limit applies to router.backlog()
+    bool process(ReadBuffer& in, Framing& framing, RequestRouter& router, size_t output_limit = 0);
+
+    // run one raw request taken by RequestRouter::forward and append its reply to out
+    // (values copied in: out crosses to another thread as plain bytes)
+    void execute_request(Framing framing, std::string_view request, std::string& out);
+
+    KVStore& store() { return store_; }
+
+    // enable BGSAVE/LASTSAVE (nullptr disables them)
+    void set_saver(BackgroundSaver* saver) { saver_ = saver; }
+
+    // report on replication in INFO. with a replica link the server is a read-only replica:
+    // writes are refused, since the primary's stream would overwrite them
+    void set_replication(ReplicationServer* primary) { primary_ = primary; }
+    void set_replica_link(ReplicaLink* link) { link_ = link; }
+
+    // serve only the hash slots slots gives to node self, redirecting the others with MOVED
+    // (nullptr: not a cluster, every key is served)
+    void set_cluster(const SlotMap* slots, uint32_t self) {
+        cluster_ = slots;
+        self_ = self;
+    }
+
+    // execute one parsed command and append the newline-terminated response to out
+    void execute(const Command& cmd, WriteBuffer& out);
+
+private:
+    KVStore& store_;
+    BackgroundSaver* saver_ = nullptr;
+    ReplicationServer* primary_ = nullptr;
+    ReplicaLink* link_ = nullptr;
+    const SlotMap* cluster_ = nullptr;
+    uint32_t self_ = 0;
+
+    // execute without timing, and account a finished command in the stats and the slow log
+    void dispatch(const Command& cmd, WriteBuffer& reply);
+    static void finish(CommandType type, uint64_t start, uint64_t lock_wait, std::string_view verb,
+                       std::string_view args);
+
+    // framing-specific request loops
+    void process_text(ReadBuffer& in, WriteBuffer& out, size_t output_limit);
+    bool process_binary(ReadBuffer& in, WriteBuffer& out, size_t output_limit);
+    void process_text(ReadBuffer& in, RequestRouter& router, size_t output_limit);
+    bool process_binary(ReadBuffer& in, RequestRouter& router, size_t output_limit);
+    void execute_binary(const protocol::binary::Request& req, WriteBuffer& reply);
+
+    // SET with its optional trailing EX seconds / PX milliseconds, and the expiry commands
+    void execute_set(std::string_view args, std::string& out);
+    void execute_expire(std::string_view args, std::string& out);
+    void execute_ttl(std::string_view args, std::string& out);
+
+    // INCR / INCRBY / DECR / DECRBY (sign -1 for the decrements) and CAS
+    void execute_incr(std::string_view verb, std::string_view args, int64_t sign, bool with_delta, std::string& out);
+    void execute_cas(std::string_view args, std::string& out);
+
+    // append the MOVED (or CLUSTERDOWN) error, without its newline, for a key of a slot
+    // this node doesn't serve; returns false, appending nothing, for a key served here
+    bool redirect(std::string_view key, std::string& out);
+
+    // redirect() for the keys of cmd: MOVED if they all belong to one other node, a
+    // CROSSSLOT error if they belong to several
+    bool redirect(const Command& cmd, std::string& out);
+
+    // CLUSTER SLOTS | KEYSLOT key
+    void execute_cluster(std::string_view args, std::string& out);
+
+    // SLOWLOG GET [count] | LEN | RESET
+    void execute_slowlog(std::string_view args, std::string& out);
+
+    // multi-key commands
+    void execute_mget(std::string_view args, std::string& out);
+    void execute_mset(std::string_view args, std::string& out);
+
+    // SCAN cursor [MATCH pattern] [COUNT n], over the ordered index; keys that would break
+    // the line framing come back quoted
+    void execute_scan(std::string_view args, std::string& out);
+
+    // multi-line SLABS report terminated by END
+    void append_slab_stats(std::string& out);
+
+    // multi-line INFO report terminated by END
+    void append_info(std::string& out);
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <Protocol.hpp>
+#include <SpscQueue.hpp>
+
+// requests one core hands to the core owning their keys, sent back with the replies filled in
+struct ForwardBatch {
+    struct Item {
+        int fd;            // connection the request came from, on the sending core
+        uint64_t conn;     // its connection id (fds are reused)
+        uint64_t slot;     // reply slot the answer goes to
+        uint32_t length;   // request bytes in requests
+        Framing framing;
+    };
+
+    bool answered = false;  // replies are filled in
+    std::string requests;   // the raw requests, back to back
+    std::vector<Item> items;
+    std::string replies;    // the replies, back to back, one per item
+    std::vector<uint32_t> reply_lengths;
+    uint64_t log_seq = 0;   // append-log sequence the owner reached running the batch
+
+    void clear() {
+        answered = false;
+        requests.clear();
+        items.clear();
+        replies.clear();
+        reply_lengths.clear();
+        log_seq = 0;
+    }
+};
+
+/*
+    Message passing for thread-per-core serving. Every core (a reactor thread) owns the
+    store shards with shard % cores == core and is the only thread that touches them, so
+    the store runs with LockMode::Owner and takes no locks.
+
+    Requests for keys owned elsewhere travel as batches through one SPSC queue per ordered
+    pair of cores, and come back through the reverse queue with their replies. A core
+    sleeping in epoll_wait is woken through its eventfd, but only if it announced it was
+    going to sleep, so a busy core receives batches without any syscall.
+
+    Everything else that needs some other core's shards (multi-key commands, INFO, the
+    expiry reaper, snapshots) goes through run_on(), installed as the store's shard
+    executor: the closure is queued for the owner and the caller waits for it.
+*/
+class CoreRouter {
+public:
+    static constexpr size_t QUEUE_CAPACITY = 128; // batches in flight per pair of cores
+
+    explicit CoreRouter(size_t cores);
+    ~CoreRouter(); // closes the eventfds
+
+    // prevent copying the router
+    CoreRouter(const CoreRouter&) = delete;
+    CoreRouter& operator=(const CoreRouter&) = delete;
+
+    size_t cores() const { return cores_.size(); }
+    size_t owner(size_t shard) const { return shard % cores_.size(); }
+
+    // register the calling thread as core; called by the core's event loop before serving
+    void attach(size_t core);
+
+    // eventfd that becomes readable when core has been sent work
+    int wake_fd(size_t core) const { return cores_[core]->wake_fd; }
+
+    // queue a batch from core from to core to; false if that queue is full
+    bool send(size_t from, size_t to, ForwardBatch* batch);
+
+    // take the next batch core to received from core from
+    bool receive(size_t from, size_t to, ForwardBatch*& batch) { return queue(from, to).pop(batch); }
+
+    // core is about to block (idle = true) or has woken up; returns, after announcing
+    // sleep, whether work already arrived and the core must not block
+    bool set_idle(size_t core, bool idle);
+
+    // run fn on the core owning shard and wait for it: inline if the calling thread is
+    // that core. A core waiting here keeps running the closures queued for itself, so two
+    // cores waiting on each other can't deadlock
+    void run_on(size_t shard, const std::function<void()>& fn);
+
+    // run the closures queued for core
+    void run_tasks(size_t core);
+
+    // during a shutdown, core has no clients left; returns whether every core is done.
+    // Until then a finished core keeps answering the others' batches and closures
+    bool finish(size_t core);
+
+    // the cores stopped for good: from now on run_on() runs closures on the calling thread,
+    // one at a time, for the threads that still need the shards (the expiry reaper, a
+    // final snapshot)
+    void retire() { retired_.store(true, std::memory_order_release); }
+
+private:
+    struct Task {
+        const std::function<void()>* fn;
+        std::atomic<bool> done{false};
+    };
+
+    struct alignas(64) Core {
+        int wake_fd = -1;
+        std::atomic<bool> idle{false};
+        std::atomic<bool> has_tasks{false};
+        std::atomic<bool> finished{false};
+        std::mutex mtx; // guards tasks
+        std::vector<Task*> tasks;
+    };
+
+    std::vector<std::unique_ptr<Core>> cores_;
+    std::vector<std::unique_ptr<SpscQueue<ForwardBatch*>>> queues_; // from * cores + to
+    std::atomic<size_t> finished_{0};  // cores done draining
+    std::atomic<bool> retired_{false};
+    std::mutex retired_mtx_;           // serializes closures once retired
+
+    SpscQueue<ForwardBatch*>& queue(size_t from, size_t to) { return *queues_[from * cores_.size() + to]; }
+
+    // make core's epoll_wait return
+    void wake(size_t core);
+
+    // index of the calling thread's core, or SIZE_MAX for other threads
+    static size_t& current_core();
+};
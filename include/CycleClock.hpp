@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    Cheap interval timing for instrumentation that stays on in production. On x86 a tick
+    is one count of the time stamp counter (a plain RDTSC, ~20 cycles, no syscall, no
+    serialization); every x86-64 CPU of the last decade runs it at a constant rate across
+    cores and frequency changes. Elsewhere ticks are steady_clock nanoseconds.
+    Ticks are only meaningful as differences; convert them with to_ns().
+*/
+namespace cycleclock {
+
+inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// nanoseconds per tick, measured against steady_clock on first use (takes ~10 ms once)
+double ns_per_tick();
+
+inline uint64_t to_ns(uint64_t ticks) { return uint64_t(double(ticks) * ns_per_tick()); }
+inline uint64_t from_ns(uint64_t ns) { return uint64_t(double(ns) / ns_per_tick()); }
+
+}
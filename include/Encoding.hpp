@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// little-endian integer encoding shared by the on-disk and wire formats
+namespace encoding {
+
+inline void put_u32(std::string& out, uint32_t v) {
+    char bytes[4] = {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+    out.append(bytes, 4);
+}
+
+inline void put_u64(std::string& out, uint64_t v) {
+    put_u32(out, uint32_t(v));
+    put_u32(out, uint32_t(v >> 32));
+}
+
+inline uint32_t get_u32(const unsigned char* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+inline uint64_t get_u64(const unsigned char* p) {
+    return uint64_t(get_u32(p)) | uint64_t(get_u32(p + 4)) << 32;
+}
+
+// overwrite 4 bytes at offset (for length/checksum fields filled in after the payload)
+inline void set_u32(std::string& out, size_t offset, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[offset + i] = char(v >> (8 * i));
+    }
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cstddef>
+#include <KVStore.hpp>
+
+// background thread that deletes expired keys through KVStore::reap_expired
+class ExpiryReaper {
+public:
+    // budget bounds the expirations handled per shard lock hold; while a backlog is left
+    // the reaper keeps going (releasing each lock in between), otherwise it sleeps for interval
+    explicit ExpiryReaper(KVStore& store, std::chrono::milliseconds interval = std::chrono::milliseconds(100),
+                          size_t budget = 256);
+    ~ExpiryReaper(); // stops the thread
+
+    // prevent copying the reaper
+    ExpiryReaper(const ExpiryReaper&) = delete;
+    ExpiryReaper& operator=(const ExpiryReaper&) = delete;
+
+private:
+    KVStore& store_;
+    std::chrono::milliseconds interval_;
+    size_t budget_;
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread worker_;
+
+    void run();
+};
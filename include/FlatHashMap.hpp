@@ -0,0 +1,350 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Open-addressing hash map in the style of a Swiss table.
+
+    Slots live in one flat array, split into aligned groups of 16. Every slot has a
+    control byte: the high bit set means empty or deleted, otherwise the byte holds 7 bits
+    of the key's hash (H2). A lookup picks a starting group from the remaining hash bits
+    (H1), compares all 16 control bytes of the group against H2 at once (one SSE2 compare),
+    and only touches the slots whose control byte matched. Probing moves on to the next
+    group in a triangular sequence and stops at the first group that still has an empty slot.
+
+    The API mirrors the subset of std::unordered_map the store uses (find, emplace, erase,
+    iteration). Keys and values are stored inline in the slot array, so short std::string
+    keys and values (SSO) cost no allocation and no pointer chase beyond the slot itself.
+    Unlike std::unordered_map, inserting may move elements: iterators and references are
+    invalidated by any insert that grows the table.
+*/
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class FlatHashMap {
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = size_t;
+
+    static constexpr size_t GROUP_SIZE = 16;
+
+private:
+    static constexpr int8_t CTRL_EMPTY = -128;  // 0b10000000
+    static constexpr int8_t CTRL_DELETED = -2;  // 0b11111110
+
+    template <bool Const>
+    class Iter {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatHashMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+
+        Iter() = default;
+        Iter(const int8_t* ctrl, const int8_t* ctrl_end, pointer slot)
+            : ctrl_(ctrl), ctrl_end_(ctrl_end), slot_(slot) { skip_free(); }
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        Iter(const Iter<false>& other) : ctrl_(other.ctrl_), ctrl_end_(other.ctrl_end_), slot_(other.slot_) {}
+
+        reference operator*() const { return *slot_; }
+        pointer operator->() const { return slot_; }
+        Iter& operator++() { ++ctrl_; ++slot_; skip_free(); return *this; }
+        Iter operator++(int) { Iter tmp = *this; ++*this; return tmp; }
+        bool operator==(const Iter& other) const { return ctrl_ == other.ctrl_; }
+        bool operator!=(const Iter& other) const { return ctrl_ != other.ctrl_; }
+
+    private:
+        friend class FlatHashMap;
+        friend class Iter<!Const>;
+        const int8_t* ctrl_ = nullptr;
+        const int8_t* ctrl_end_ = nullptr;
+        pointer slot_ = nullptr;
+
+        void skip_free() {
+            while (ctrl_ != ctrl_end_ && *ctrl_ < 0) {
+                ++ctrl_;
+                ++slot_;
+            }
+        }
+    };
+
+public:
+    using iterator = Iter<false>;
+    using const_iterator = Iter<true>;
+
+    FlatHashMap() = default;
+    explicit FlatHashMap(size_t expected) { reserve(expected); }
+    ~FlatHashMap() { destroy(); }
+
+    FlatHashMap(FlatHashMap&& other) noexcept { swap(other); }
+    FlatHashMap& operator=(FlatHashMap&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            swap(other);
+        }
+        return *this;
+    }
+    FlatHashMap(const FlatHashMap&) = delete;
+    FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+    iterator begin() { return iterator(ctrl_, ctrl_ + capacity_, slots_); }
+    iterator end() { return iterator(ctrl_ + capacity_, ctrl_ + capacity_, slots_ + capacity_); }
+    const_iterator begin() const { return const_iterator(ctrl_, ctrl_ + capacity_, slots_); }
+    const_iterator end() const { return const_iterator(ctrl_ + capacity_, ctrl_ + capacity_, slots_ + capacity_); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return capacity_; }
+    // inserts into empty slots left before the next one grows or rebuilds the table
+    size_t growth_left() const { return growth_left_; }
+
+    // iterator to slot i if it holds an element, end() otherwise (used for random sampling)
+    iterator slot(size_t i) {
+        if (i >= capacity_ || ctrl_[i] < 0) {
+            return end();
+        }
+        return iterator(ctrl_ + i, ctrl_ + capacity_, slots_ + i);
+    }
+
+    template <typename Key>
+    iterator find(const Key& key) {
+        size_t pos = find_index(key, hash_(key));
+        return pos == NPOS ? end() : iterator(ctrl_ + pos, ctrl_ + capacity_, slots_ + pos);
+    }
+
+    template <typename Key>
+    const_iterator find(const Key& key) const {
+        size_t pos = find_index(key, hash_(key));
+        return pos == NPOS ? end() : const_iterator(ctrl_ + pos, ctrl_ + capacity_, slots_ + pos);
+    }
+
+    template <typename Key>
+    size_t count(const Key& key) const { return find_index(key, hash_(key)) == NPOS ? 0 : 1; }
+
+    // insert key -> V(args...) unless key is present; key may be any type K is constructible from
+    template <typename Key, typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args) {
+        size_t h = hash_(key);
+        size_t pos = find_index(key, h);
+        if (pos != NPOS) {
+            return {iterator(ctrl_ + pos, ctrl_ + capacity_, slots_ + pos), false};
+        }
+        pos = prepare_insert(h);
+        new (slots_ + pos) value_type(std::piecewise_construct,
+                                      std::forward_as_tuple(std::forward<Key>(key)),
+                                      std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator(ctrl_ + pos, ctrl_ + capacity_, slots_ + pos), true};
+    }
+
+    template <typename Key, typename Value>
+    std::pair<iterator, bool> emplace(Key&& key, Value&& value) {
+        return try_emplace(std::forward<Key>(key), std::forward<Value>(value));
+    }
+
+    V& operator[](const K& key) { return try_emplace(key).first->second; }
+
+    void erase(iterator it) {
+        size_t pos = it.ctrl_ - ctrl_;
+        slots_[pos].~value_type();
+        size_--;
+        // if the group still has an empty slot, no probe ever continued past it, so the slot
+        // can go straight back to empty; otherwise leave a tombstone to keep chains intact
+        size_t group = pos & ~(GROUP_SIZE - 1);
+        if (match_empty(ctrl_ + group) != 0) {
+            ctrl_[pos] = CTRL_EMPTY;
+            growth_left_++;
+        } else {
+            ctrl_[pos] = CTRL_DELETED;
+        }
+    }
+
+    template <typename Key>
+    size_t erase(const Key& key) {
+        iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear() {
+        destroy();
+    }
+
+    // size the table so that n elements fit without growing
+    void reserve(size_t n) {
+        size_t needed = GROUP_SIZE;
+        while (needed * 7 / 8 < n) {
+            needed *= 2;
+        }
+        if (needed > capacity_) {
+            resize(needed);
+        }
+    }
+
+    void swap(FlatHashMap& other) noexcept {
+        std::swap(ctrl_, other.ctrl_);
+        std::swap(slots_, other.slots_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(growth_left_, other.growth_left_);
+    }
+
+    // bytes held by the control and slot arrays (excludes heap memory owned by K and V)
+    size_t table_bytes() const { return capacity_ * (sizeof(value_type) + 1); }
+
+private:
+    static constexpr size_t NPOS = ~size_t(0);
+
+    int8_t* ctrl_ = nullptr;
+    value_type* slots_ = nullptr;
+    size_t capacity_ = 0;    // number of slots, a power of two and a multiple of GROUP_SIZE
+    size_t size_ = 0;
+    size_t growth_left_ = 0; // inserts allowed into empty slots before the table must grow
+    [[no_unique_address]] Hash hash_;
+    [[no_unique_address]] Eq eq_;
+
+    static int8_t h2(size_t hash) { return static_cast<int8_t>(hash & 0x7F); }
+    static size_t h1(size_t hash) { return hash >> 7; }
+
+#if defined(__SSE2__)
+    // bitmask of the slots in the group whose control byte equals h
+    static uint32_t match(const int8_t* group, int8_t h) {
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h))));
+    }
+    // bitmask of empty slots in the group
+    static uint32_t match_empty(const int8_t* group) { return match(group, CTRL_EMPTY); }
+    // bitmask of empty or deleted slots in the group (high bit set)
+    static uint32_t match_free(const int8_t* group) {
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+    }
+#else
+    static uint32_t match(const int8_t* group, int8_t h) {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++) {
+            mask |= uint32_t(group[i] == h) << i;
+        }
+        return mask;
+    }
+    static uint32_t match_empty(const int8_t* group) { return match(group, CTRL_EMPTY); }
+    static uint32_t match_free(const int8_t* group) {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++) {
+            mask |= uint32_t(group[i] < 0) << i;
+        }
+        return mask;
+    }
+#endif
+
+    template <typename Key>
+    size_t find_index(const Key& key, size_t hash) const {
+        if (capacity_ == 0) {
+            return NPOS;
+        }
+        size_t group_mask = capacity_ / GROUP_SIZE - 1;
+        size_t group = h1(hash) & group_mask;
+        int8_t tag = h2(hash);
+        for (size_t step = 1;; step++) {
+            const int8_t* g = ctrl_ + group * GROUP_SIZE;
+            for (uint32_t m = match(g, tag); m != 0; m &= m - 1) {
+                size_t pos = group * GROUP_SIZE + __builtin_ctz(m);
+                if (eq_(slots_[pos].first, key)) {
+                    return pos;
+                }
+            }
+            if (match_empty(g) != 0 || step > group_mask) {
+                return NPOS;
+            }
+            group = (group + step) & group_mask; // triangular probing visits every group
+        }
+    }
+
+    // first free slot on the probe sequence for hash (hash known to be absent)
+    size_t find_free(size_t hash) const {
+        size_t group_mask = capacity_ / GROUP_SIZE - 1;
+        size_t group = h1(hash) & group_mask;
+        for (size_t step = 1;; step++) {
+            uint32_t m = match_free(ctrl_ + group * GROUP_SIZE);
+            if (m != 0) {
+                return group * GROUP_SIZE + __builtin_ctz(m);
+            }
+            group = (group + step) & group_mask;
+        }
+    }
+
+    // claim a slot for a new element with the given hash, growing the table if needed
+    size_t prepare_insert(size_t hash) {
+        size_t pos = capacity_ ? find_free(hash) : NPOS;
+        if (pos == NPOS || (growth_left_ == 0 && ctrl_[pos] == CTRL_EMPTY)) {
+            // out of empty slots: double, or rebuild at the same size when tombstones dominate
+            size_t target = capacity_ == 0 ? GROUP_SIZE
+                          : (size_ * 16 < capacity_ * 7 ? capacity_ : capacity_ * 2);
+            resize(target);
+            pos = find_free(hash);
+        }
+        if (ctrl_[pos] == CTRL_EMPTY) {
+            growth_left_--;
+        }
+        ctrl_[pos] = h2(hash);
+        size_++;
+        return pos;
+    }
+
+    void resize(size_t new_capacity) {
+        int8_t* old_ctrl = ctrl_;
+        value_type* old_slots = slots_;
+        size_t old_capacity = capacity_;
+
+        ctrl_ = static_cast<int8_t*>(::operator new(new_capacity));
+        std::memset(ctrl_, CTRL_EMPTY, new_capacity);
+        slots_ = static_cast<value_type*>(::operator new(new_capacity * sizeof(value_type),
+                                                         std::align_val_t(alignof(value_type))));
+        capacity_ = new_capacity;
+        growth_left_ = new_capacity * 7 / 8 - size_;
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_ctrl[i] >= 0) {
+                size_t h = hash_(old_slots[i].first);
+                size_t pos = find_free(h);
+                ctrl_[pos] = h2(h);
+                new (slots_ + pos) value_type(std::move(old_slots[i]));
+                old_slots[i].~value_type();
+            }
+        }
+        free_arrays(old_ctrl, old_slots);
+    }
+
+    void destroy() {
+        for (size_t i = 0; i < capacity_; i++) {
+            if (ctrl_[i] >= 0) {
+                slots_[i].~value_type();
+            }
+        }
+        free_arrays(ctrl_, slots_);
+        ctrl_ = nullptr;
+        slots_ = nullptr;
+        capacity_ = size_ = growth_left_ = 0;
+    }
+
+    static void free_arrays(int8_t* ctrl, value_type* slots) {
+        if (ctrl != nullptr) {
+            ::operator delete(ctrl);
+            ::operator delete(slots, std::align_val_t(alignof(value_type)));
+        }
+    }
+};
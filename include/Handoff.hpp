@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <thread>
+#include <KVStore.hpp>
+
+/*
+    Hands a running server over to a new process without closing its port.
+
+    The running server listens on a unix socket (--handoff PATH). A successor started with
+    --takeover PATH connects to it and is sent the TCP listening socket itself
+    (SCM_RIGHTS), so clients connecting during the switch wait in its backlog instead of
+    being refused. The old server then shuts down gracefully and streams a snapshot image
+    of the store over the unix socket, which the successor loads straight from memory,
+    without a round trip through the disk. The successor starts serving once the old
+    process has exited, releasing its other ports and its append-only log.
+
+    Stream: u32 "KVHO" (carrying the listening socket) | snapshot image | end of stream
+*/
+class Handoff {
+public:
+    // listen on the unix socket at path (throws std::runtime_error on failure). The first
+    // successor to connect is sent listen_fd, then on_takeover runs: it should stop the server
+    Handoff(const std::string& path, int listen_fd, std::function<void()> on_takeover);
+    ~Handoff(); // stops listening and removes path
+
+    // prevent copying the handoff
+    Handoff(const Handoff&) = delete;
+    Handoff& operator=(const Handoff&) = delete;
+
+    // whether a successor has taken the listening socket
+    bool taken_over() const { return successor_fd_.load() != -1; }
+
+    // stream the store to the successor, once the server has stopped; throws
+    // std::runtime_error on I/O errors. The connection is left for the kernel to close when
+    // this process exits: that is how the successor learns the old one is gone
+    void send_data(KVStore& store);
+
+    // take over from the server whose --handoff is path: returns its listening socket once
+    // its data is loaded into store (keys receives the count) and the old process has
+    // exited. Throws std::runtime_error on failure
+    static int take_over(const std::string& path, KVStore& store, size_t& keys);
+
+private:
+    std::string path_;
+    int listen_fd_;  // the TCP listening socket handed over
+    int unix_fd_ = -1;
+    std::atomic<int> successor_fd_{-1};
+    std::atomic<bool> stop_{false};
+    std::function<void()> on_takeover_;
+    std::thread worker_;
+
+    void run();
+};
@@ -1,14 +1,418 @@
 #pragma once
 #include <unordered_map>
 #include <string>
-#include <shared_mutex>
+#include <string_view>
+#include <functional>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "FlatHashMap.hpp"
+#include "RehashingMap.hpp"
+#include "BPlusTree.hpp"
+#include "SlabAllocator.hpp"
+#include "TimerWheel.hpp"
+#include "ShardLock.hpp"
+#include "SharedValue.hpp"
+#include "AppendLog.hpp"
+
+class ReplicationServer;
+
+// transparent hash so maps keyed by std::string can be probed with a std::string_view
+struct KeyHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const noexcept {
+        return std::hash<std::string_view>{}(key);
+    }
+};
+
+// which entries a memory-bounded store evicts first
+enum class EvictionPolicy : uint8_t {
+    Lru, // least recently used (per-entry access clock, 64 ms resolution)
+    Lfu  // least frequently used (logarithmic access counter that decays while idle)
+};
+
+// strings whose heap bytes come from a shard's slab arena
+using SlabString = std::basic_string<char, std::char_traits<char>, SlabStlAllocator<char>>;
 
 class KVStore {
-private:
-    std::unordered_map<std::string, std::string> data_;
-    mutable std::shared_timed_mutex mtx_; 
 public:
-    void set(const std::string& key, const std::string& value);
-    std::string get(const std::string& key);
-    bool remove(const std::string& key);
-};
\ No newline at end of file
+    // default number of lock stripes
+    static constexpr size_t DEFAULT_SHARDS = 64;
+
+    // values at least this long are kept in a SharedValue instead of the shard arena
+    static constexpr size_t LARGE_VALUE = 16384;
+
+    // a value is only kept compressed if that saves at least 1/COMPRESS_MIN_SAVING of it
+    static constexpr size_t COMPRESS_MIN_SAVING = 8;
+
+    // constructor - num_shards is rounded up to a power of two (1 = single global lock);
+    // lock_mode picks how readers and writers of a shard synchronize
+    explicit KVStore(size_t num_shards = DEFAULT_SHARDS, LockMode lock_mode = LockMode::Shared);
+
+    // prevent copying the store
+    KVStore(const KVStore&) = delete;
+    KVStore& operator=(const KVStore&) = delete;
+
+    // expires_at: unix time in ms after which the key is gone (0 = never). A set without
+    // one clears any expiry the key had
+    void set(std::string_view key, std::string_view value, int64_t expires_at = 0);
+    std::string get(std::string_view key);
+    bool remove(std::string_view key);
+    bool exists(std::string_view key);
+
+    // append the value for key to out; returns false (leaving out untouched) if missing
+    bool get(std::string_view key, std::string& out);
+
+    // like get(key, out), but a large value is handed out as a reference in shared (out is
+    // then left untouched), so the caller can send it without copying or holding the lock
+    bool get(std::string_view key, std::string& out, SharedValue& shared);
+
+    // like get(key, out, shared), but a compressed value is handed out as stored, in shared,
+    // and compressed is set: a u32 (little-endian) raw size followed by one LZ4 block
+    bool get_stored(std::string_view key, std::string& out, SharedValue& shared, bool& compressed);
+
+    // call fn(std::string_view value) under the shard's read lock; returns false if missing.
+    // the view must not escape fn. an expired key is deleted on the spot and reported missing
+    template <typename F>
+    bool view(std::string_view key, F&& fn);
+
+    // batch operations: keys are grouped by shard and each shard's lock is taken once.
+    // mset applies entries for the same key in order (last one wins)
+    void mset(const std::vector<std::pair<std::string_view, std::string_view>>& entries);
+
+    // call fn(size_t i, std::string_view value) for every keys[i] that exists, under the
+    // shard read locks; calls arrive shard by shard, not in key order
+    template <typename F>
+    void multi_view(const std::vector<std::string_view>& keys, F&& fn);
+
+    // set or clear (expires_at = 0) the expiry of an existing key; a deadline already in the
+    // past deletes it. returns false if the key doesn't exist
+    bool expire_at(std::string_view key, int64_t expires_at);
+
+    // remaining time to live in ms: -1 if the key never expires, -2 if it doesn't exist
+    int64_t ttl(std::string_view key);
+
+    // add delta to the integer stored at key (a missing key counts as 0) and set result to
+    // the sum. a string value counts if it is a decimal integer written the way GET would
+    // return it; the key's expiry is kept. the sum is stored natively
+    enum class IncrResult : uint8_t { Ok, NotInteger, Overflow };
+    IncrResult incr(std::string_view key, int64_t delta, int64_t& result);
+
+    // replace key's value with value only if it currently equals expected; the key's
+    // expiry is kept
+    enum class CasResult : uint8_t { Ok, Mismatch, NotFound };
+    CasResult cas(std::string_view key, std::string_view expected, std::string_view value);
+
+    // delete expired keys: each shard's timer wheel is advanced and at most budget of its due
+    // timers are handled per lock hold. a shard whose table is growing also moves up to
+    // REHASH_BUDGET entries to the new table. returns the number of due timers left over
+    size_t reap_expired(size_t budget);
+
+    size_t shard_count() const { return shards_.size(); }
+    LockMode lock_mode() const { return shards_[0].mtx.mode(); }
+
+    // index of the shard a key lives in
+    size_t shard_index(std::string_view key) const;
+
+    // keep every shard's keys in an ordered index too, for scan(). not thread-safe; call
+    // before loading or serving
+    void enable_ordered_index() { ordered_ = true; }
+    bool ordered_index() const { return ordered_; }
+
+    // largest count scan() accepts
+    static constexpr size_t MAX_SCAN_COUNT = 10000;
+
+    // up to count live keys matching a glob pattern (* ? and \ escapes), in key order,
+    // starting after the key after (empty = from the start). each shard's read lock is
+    // held for at most count keys. returns true with next set to pass as after if there
+    // may be more. needs the ordered index
+    bool scan(std::string_view after, std::string_view pattern, size_t count, std::vector<std::string>& keys,
+              std::string& next);
+
+    // call fn(std::string_view key, std::string_view value, int64_t expires_at) for every live
+    // entry of one shard, holding only that shard's read lock
+    template <typename F>
+    void for_each_in_shard(size_t shard, F&& fn);
+
+    // log every subsequent set/remove to log (nullptr to stop); not thread-safe with writers
+    void attach_log(AppendLog* log) { log_ = log; }
+    AppendLog* log() const { return log_; }
+
+    // feed every subsequent set/remove to a replication stream too (nullptr to stop), in
+    // the same order as the log; not thread-safe with writers
+    void attach_replication(ReplicationServer* replication) { replication_ = replication; }
+
+    // apply logged records (from a log or a replication stream), grouped by shard with
+    // each shard's lock taken once; records for the same key are applied in order
+    void apply(const std::vector<AppendLog::Record>& records);
+
+    // delete every key (logged like DELs), one shard at a time
+    void clear();
+
+    // bound memory: every shard keeps its arena and table bytes under max_bytes / shard_count()
+    // by evicting sampled entries when a write pushes it over (0 = unlimited).
+    // not thread-safe with readers or writers; call before serving
+    void set_memory_limit(size_t max_bytes, EvictionPolicy policy = EvictionPolicy::Lru);
+
+    size_t memory_limit() const { return shard_limit_ * shards_.size(); }
+    EvictionPolicy eviction_policy() const { return policy_; }
+
+    // LZ4-compress values of at least min_bytes when they are set (0 = off); readers get
+    // them back decompressed, except through get_stored(). Values already stored stay as
+    // they are. not thread-safe with writers; call before serving
+    void set_compression(size_t min_bytes) { compress_min_ = min_bytes; }
+    size_t compression_min() const { return compress_min_; }
+
+    // size the shard tables for about keys keys in total, so filling the store never has
+    // to grow them. not thread-safe with readers or writers; call before serving
+    void reserve(size_t keys);
+
+    // shards whose table is still moving entries to the new one after growing
+    size_t rehashing_shards();
+
+    // bytes charged against the limit, summed over all shards
+    size_t memory_used();
+
+    // keys evicted for memory since startup
+    size_t evicted_keys();
+
+    // keys stored, summed over all shards (counts expired keys not yet reaped)
+    size_t size();
+
+    // slab utilization per size class summed over all shards (last entry: oversized blocks)
+    std::vector<SlabArena::ClassStats> slab_stats();
+
+    // contended lock acquisitions and time spent waiting, per shard (no lock taken)
+    std::vector<ShardLock::WaitStats> lock_wait_stats() const;
+
+    // runs fn on a thread allowed to touch shard, returning once it has run
+    using ShardExecutor = std::function<void(size_t shard, const std::function<void()>& fn)>;
+
+    // route every multi-shard operation (batches, reaping, snapshots, the aggregate
+    // counters) through exec, one shard at a time. For LockMode::Owner, where only a
+    // shard's owning thread may touch it; single-key operations are the caller's to route.
+    // not thread-safe; install before serving (nullptr removes it)
+    void set_shard_executor(ShardExecutor exec) { executor_ = std::move(exec); }
+
+private:
+    // a stored value and its expiry. timer_at is the deadline of the key's armed wheel timer
+    // (0 if none): extending a TTL leaves that timer in place and re-arms it when it fires,
+    // so refreshing a session key over and over doesn't pile up timers
+    // access holds the eviction policy's recency/frequency bits. readers update it with
+    // relaxed atomic stores under the shared lock, so GET never needs the exclusive lock.
+    // a large or compressed value lives in large, and value is left empty. an integer
+    // written by incr() is kept as its 8 native bytes in value, which always fit inline
+    enum class Form : uint8_t {
+        Bytes,      // value or large holds the value as set
+        Compressed, // large holds the value's compressed form
+        Integer     // value holds an int64_t, read back as its decimal form
+    };
+    struct Entry {
+        SlabString value;
+        SharedValue large;
+        int64_t expires_at = 0;
+        int64_t timer_at = 0;
+        uint32_t access = 0;
+        Form form = Form::Bytes;
+
+        explicit Entry(SlabString v) : value(std::move(v)) {}
+        bool expired(int64_t now) const { return expires_at != 0 && expires_at <= now; }
+        std::string_view view() const { return large ? large.view() : std::string_view(value); }
+        int64_t integer() const {
+            int64_t v;
+            std::memcpy(&v, value.data(), sizeof(v));
+            return v;
+        }
+    };
+
+    // storage backend, chosen at build time (cmake -DKVSTORE_FLAT_MAP=ON), grown incrementally
+#ifdef KVSTORE_FLAT_MAP
+    using Map = RehashingMap<FlatHashMap<SlabString, Entry, KeyHash, std::equal_to<>>>;
+#else
+    using Map = RehashingMap<std::unordered_map<SlabString, Entry, KeyHash, std::equal_to<>,
+                                                SlabStlAllocator<std::pair<const SlabString, Entry>>>>;
+#endif
+
+    // one lock stripe; aligned so neighbouring shard locks never share a cache line.
+    // key, value and map node bytes come from the shard's own arena, used under mtx.
+    struct alignas(64) Shard {
+        SlabArena arena; // declared first so it outlives data
+        Map data;
+        BPlusTree index;  // the keys of data in order, if the ordered index is on
+        TimerWheel wheel; // expiry timers of the keys in data
+        size_t evicted = 0;
+        size_t large_bytes = 0; // bytes of the entries' SharedValues
+        mutable ShardLock mtx;
+
+        Shard();
+        SlabString make_string(std::string_view s) { return SlabString(s, SlabStlAllocator<char>(&arena)); }
+    };
+
+    std::vector<Shard> shards_;
+    unsigned shard_bits_; // log2 of the shard count
+    AppendLog* log_ = nullptr; // appended to under the shard lock so per-key order matches the store
+    ReplicationServer* replication_ = nullptr; // sent the same records, under the same lock
+    size_t shard_limit_ = 0;   // memory budget per shard (0 = unlimited)
+    EvictionPolicy policy_ = EvictionPolicy::Lru;
+    size_t compress_min_ = 0;  // smallest value compressed (0 = compression off)
+    bool ordered_ = false;     // shards keep their index
+    ShardExecutor executor_;
+
+    // entries compared per eviction
+    static constexpr size_t EVICTION_SAMPLES = 5;
+
+    // entries of a growing table moved per shard by each reap_expired() pass
+    static constexpr size_t REHASH_BUDGET = 2048;
+
+    // helper to map a key to its shard
+    Shard& shard_for(std::string_view key) { return shards_[shard_index(key)]; }
+
+    // call fn(Shard&) for one shard, through the executor if one is installed
+    template <typename F>
+    void on_shard(size_t index, F&& fn) {
+        Shard& shard = shards_[index];
+        if (executor_) {
+            executor_(index, [&fn, &shard] { fn(shard); });
+        } else {
+            fn(shard);
+        }
+    }
+
+    // a value ready to go into an entry: compressed if that paid off, and in a SharedValue
+    // if it was compressed or is large. made before the shard lock is taken where possible
+    struct StoredValue {
+        std::string_view bytes; // what the entry keeps (may point into a thread-local buffer)
+        SharedValue large;      // set_locked() leaves the replaced value's here, to release unlocked
+        bool compressed = false;
+    };
+    void prepare_value(std::string_view value, StoredValue& stored) const;
+
+    // insert or update with the shard's exclusive lock already held; value is logged,
+    // stored is what the entry keeps (from prepare_value)
+    void set_locked(Shard& shard, std::string_view key, std::string_view value, int64_t expires_at,
+                    StoredValue& stored);
+
+    // an entry's value, decompressed or formatted into a thread-local buffer if it is
+    // compressed or an integer (valid until the thread's next call)
+    static std::string_view expanded(const Entry& entry);
+
+    // call fn(Entry&) for key's live entry under the shard's read lock; false if missing.
+    // an expired key is deleted on the spot and reported missing
+    template <typename F>
+    bool view_entry(std::string_view key, F&& fn);
+
+    // give an entry a wheel timer unless the one it has fires early enough
+    static void arm_timer(Shard& shard, std::string_view key, Entry& entry);
+
+    // erase an entry with the shard's exclusive lock held, logging the delete
+    void erase_locked(Shard& shard, Map::iterator it, std::string_view key);
+
+    // expire_at() with the shard's exclusive lock already held
+    bool expire_locked(Shard& shard, std::string_view key, int64_t expires_at);
+
+    // hand a write to the append-only log and the replication stream, whichever are attached;
+    // called under the shard's exclusive lock
+    void log_set(std::string_view key, std::string_view value, int64_t expires_at);
+    void log_del(std::string_view key);
+    void log_expire(std::string_view key, int64_t expires_at);
+
+    // lazily delete a key a reader found expired (takes the exclusive lock)
+    void expire_now(Shard& shard, std::string_view key);
+
+    // note a read or write of an entry for the eviction policy (no-op without a limit)
+    void touch(Entry& entry) const {
+        if (shard_limit_ != 0) {
+            record_access(entry);
+        }
+    }
+    void record_access(Entry& entry) const;
+    uint32_t initial_access() const;
+
+    // bytes a shard charges against its budget; caller holds the shard lock
+    static size_t shard_memory(const Shard& shard);
+
+    // evict sampled entries until the shard fits its budget again, never evicting keep;
+    // caller holds the shard's exclusive lock
+    void evict_locked(Shard& shard, std::string_view keep);
+
+    // how strongly the policy wants an entry gone (higher = evict first)
+    uint32_t eviction_rank(const Entry& entry, uint32_t now_clock) const;
+
+    // a uniformly chosen entry of a non-empty shard
+    static Map::iterator random_entry(Shard& shard);
+
+    // fill order with (shard, position) for n keys and sort it so each shard's keys are adjacent
+    template <typename KeyAt>
+    void group_by_shard(size_t n, KeyAt&& key_at, std::vector<std::pair<uint32_t, uint32_t>>& order) const;
+};
+
+template <typename KeyAt>
+void KVStore::group_by_shard(size_t n, KeyAt&& key_at, std::vector<std::pair<uint32_t, uint32_t>>& order) const {
+    order.clear();
+    order.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        order.emplace_back(uint32_t(shard_index(key_at(i))), uint32_t(i));
+    }
+    std::sort(order.begin(), order.end()); // position breaks ties, so same-shard order is kept
+}
+
+template <typename F>
+void KVStore::multi_view(const std::vector<std::string_view>& keys, F&& fn) {
+    thread_local std::vector<std::pair<uint32_t, uint32_t>> groups;
+    auto& order = groups; // a closure naming groups would get the executing thread's copy
+    group_by_shard(keys.size(), [&keys](size_t i) { return keys[i]; }, order);
+
+    int64_t now = TimerWheel::now_ms();
+    for (size_t g = 0; g < order.size();) {
+        on_shard(order[g].first, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            for (uint32_t current = order[g].first; g < order.size() && order[g].first == current; g++) {
+                auto it = shard.data.find(keys[order[g].second]);
+                if (it != shard.data.end() && !it->second.expired(now)) { // expired keys are left to the reaper
+                    touch(it->second);
+                    fn(size_t(order[g].second), expanded(it->second));
+                }
+            }
+        });
+    }
+}
+
+template <typename F>
+void KVStore::for_each_in_shard(size_t shard, F&& fn) {
+    int64_t now = TimerWheel::now_ms();
+    on_shard(shard, [&](Shard& s) {
+        std::shared_lock<ShardLock> lock(s.mtx);
+        for (const auto& entry : s.data) {
+            if (!entry.second.expired(now)) {
+                fn(std::string_view(entry.first), expanded(entry.second), entry.second.expires_at);
+            }
+        }
+    });
+}
+
+template <typename F>
+bool KVStore::view(std::string_view key, F&& fn) {
+    return view_entry(key, [&fn](Entry& entry) { fn(expanded(entry)); });
+}
+
+template <typename F>
+bool KVStore::view_entry(std::string_view key, F&& fn) {
+    Shard& shard = shard_for(key);
+    {
+        std::shared_lock<ShardLock> lock(shard.mtx);
+        auto it = shard.data.find(key);
+        if (it == shard.data.end()) {
+            return false;
+        }
+        if (it->second.expires_at == 0 || !it->second.expired(TimerWheel::now_ms())) {
+            touch(it->second);
+            fn(it->second);
+            return true;
+        }
+    }
+    expire_now(shard, key);
+    return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Log-linear latency histogram in the style of HdrHistogram. Values (ns) are bucketed by
+    their power of two and, within it, by the next SUB_BITS bits, so every recorded value is
+    known to within 1 / 2^SUB_BITS (under 1%) at a fixed 64 * 2^SUB_BITS counters, whatever
+    the range. Recording is a couple of shifts and an increment; histograms of different
+    threads are merged after a run.
+*/
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 7;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+
+    void record(uint64_t value) {
+        counts_[index_of(value)]++;
+        total_++;
+        if (value > max_) {
+            max_ = value;
+        }
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        if (other.max_ > max_) {
+            max_ = other.max_;
+        }
+    }
+
+    // value at quantile q in [0, 1] (upper edge of its bucket, capped at the max seen)
+    uint64_t percentile(double q) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = uint64_t(q * double(total_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint64_t upper = upper_bound_of(i);
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+
+private:
+    std::array<uint64_t, 64 * SUB_BUCKETS> counts_{};
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+
+    // values below SUB_BUCKETS map one to one; above, the top SUB_BITS + 1 bits pick the bucket
+    static size_t index_of(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return size_t(value);
+        }
+        unsigned magnitude = 63 - unsigned(__builtin_clzll(value)); // >= SUB_BITS
+        unsigned shift = magnitude - SUB_BITS;
+        return size_t(shift + 1) * SUB_BUCKETS + size_t((value >> shift) - SUB_BUCKETS);
+    }
+
+    static uint64_t upper_bound_of(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        unsigned shift = unsigned(index / SUB_BUCKETS) - 1;
+        uint64_t base = (uint64_t(index % SUB_BUCKETS) + SUB_BUCKETS) << shift;
+        return base + ((uint64_t(1) << shift) - 1);
+    }
+};
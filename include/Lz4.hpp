@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// LZ4 block format (github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), so anything
+// this encodes can be decoded by the reference library and vice versa. Greedy single-probe
+// matcher: fast, with ratios close to LZ4's default level
+namespace lz4 {
+
+// largest encoding of n bytes (incompressible input grows slightly)
+constexpr size_t compress_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+// append the block encoding of in to out; returns the bytes appended
+size_t compress(std::string_view in, std::string& out);
+
+// decode a block that holds exactly raw_size bytes into dst; false if it is malformed
+// (it never reads or writes out of bounds, whatever block holds)
+bool decompress(std::string_view block, char* dst, size_t raw_size);
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <KVStore.hpp>
+
+/*
+    Minimal HTTP listener serving GET /metrics in the Prometheus text exposition format,
+    on its own port and thread, so scrapes never take a data-port connection or go
+    through the command parser. Requests are answered one at a time with
+    "Connection: close"; anything but GET/HEAD /metrics gets a 404 or 405.
+
+    Exported: per-command call counters and latency summaries (p50/p99/p99.9), GET hits and
+    misses, bytes in/out, client connections, keys, memory, evictions, process RSS, and
+    per-shard lock contention (acquisitions that waited and total wait time).
+    Throughput is left to the scraper: rate(kvstore_commands_total[1m]).
+*/
+class MetricsServer {
+public:
+    // binds the port (throws std::runtime_error on failure) and starts serving
+    MetricsServer(KVStore& store, int port);
+    ~MetricsServer(); // stops the thread
+
+    // prevent copying the server
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    // the current metrics page
+    std::string render();
+
+private:
+    KVStore& store_;
+    int listen_fd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::thread worker_;
+
+    void run();
+    void serve(int client_fd);
+};
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <sys/uio.h>
+#include <SharedValue.hpp>
+
+// command verbs understood by the text protocol
+enum class CommandType : uint8_t {
+    None,    // blank line
+    Set,
+    Get,
+    Del,
+    MGet,    // MGET k1 k2 ...: one reply line per key
+    MSet,    // MSET k1 v1 k2 v2 ...
+    Slabs,   // slab allocator utilization report
+    BgSave,  // start a background snapshot
+    LastSave,
+    Expire,  // EXPIRE key seconds
+    Ttl,     // TTL key: seconds left, -1 without expiry
+    Info,    // server statistics report
+    SlowLog, // SLOWLOG GET [n] | LEN | RESET
+    Scan,    // SCAN cursor [MATCH pattern] [COUNT n]: keys in order, a chunk at a time
+    Incr,    // INCR key: add 1 to an integer value, replying with the result
+    IncrBy,  // INCRBY key delta
+    Decr,    // DECR key
+    DecrBy,  // DECRBY key delta
+    Cas,     // CAS key expected new: set only if the value is still expected
+    Cluster, // CLUSTER SLOTS | KEYSLOT key
+    Unknown
+};
+
+// one parsed command line; views point into the read buffer and are only valid until it is refilled
+struct Command {
+    CommandType type = CommandType::None;
+    std::string_view verb; // command word as sent
+    std::string_view args; // everything after the verb, leading whitespace skipped
+};
+
+namespace protocol {
+
+// pack up to 8 bytes into an integer so verbs can be matched with a switch
+constexpr uint64_t pack_verb(std::string_view verb) {
+    uint64_t packed = 0;
+    for (size_t i = 0; i < verb.size() && i < 8; i++) {
+        packed |= uint64_t(static_cast<unsigned char>(verb[i])) << (8 * i);
+    }
+    return packed;
+}
+
+// whitespace as istream >> sees it
+constexpr bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+// map a verb to its command type
+CommandType classify(std::string_view verb);
+
+// lower-case name of a command type for reports
+std::string_view command_name(CommandType type);
+
+// split one whitespace-delimited token off the front of rest (empty if none left)
+std::string_view next_token(std::string_view& rest);
+
+// split one whitespace-delimited token off the back of rest (empty if none left)
+std::string_view last_token(std::string_view& rest);
+
+// split all remaining whitespace-delimited tokens of rest into tokens (cleared first)
+void split_tokens(std::string_view rest, std::vector<std::string_view>& tokens);
+
+// parse a whole token as a signed decimal integer; false on anything else or overflow
+bool parse_int(std::string_view token, int64_t& value);
+
+// parse a single line (without its '\n') into cmd; returns false for blank lines
+bool parse_line(std::string_view line, Command& cmd);
+
+}
+
+// wire format of a connection, decided by its first byte
+enum class Framing : uint8_t {
+    Unknown, // nothing received yet
+    Text,    // newline-terminated commands
+    Binary   // length-prefixed frames (see protocol::binary)
+};
+
+/*
+    Binary framing. Every request is an 8-byte header followed by the key and the value:
+        u8 magic (0x80) | u8 opcode | u16 key length | u32 value length | key | value
+    and every response an 8-byte header followed by the body:
+        u8 magic (0x81) | u8 status | u8 flags | u8 reserved (0) | u32 body length | body
+    Integers are little-endian. Lengths are known up front, so payload bytes are never
+    scanned and a value is copied exactly once, from the read buffer into the store.
+    The Text opcode carries a full text-protocol command line as its value (for the
+    commands that have no dedicated opcode); its reply is the text reply without the
+    final newline.
+    GetCompressed is Get for clients that decompress values themselves: a value the store
+    keeps compressed comes back as stored, flagged FLAG_LZ4, as a u32 raw size followed by
+    one LZ4 block. Other values come back as Get returns them, unflagged.
+*/
+namespace protocol::binary {
+
+constexpr uint8_t REQUEST_MAGIC = 0x80;
+constexpr uint8_t RESPONSE_MAGIC = 0x81;
+constexpr size_t HEADER_SIZE = 8;
+constexpr uint32_t MAX_VALUE = 512u << 20; // frames claiming more are rejected as invalid
+
+enum class Opcode : uint8_t { Text = 0, Get = 1, Set = 2, Del = 3, GetCompressed = 4 };
+constexpr Opcode LAST_OPCODE = Opcode::GetCompressed;
+enum class Status : uint8_t { Ok = 0, NotFound = 1, Error = 2 };
+
+// response flags
+constexpr uint8_t FLAG_LZ4 = 1; // the body is an LZ4-compressed value
+
+struct Request {
+    Opcode op;
+    std::string_view key;
+    std::string_view value;
+};
+
+struct Response {
+    Status status;
+    uint8_t flags;
+    std::string_view body;
+};
+
+enum class ParseResult { Ok, Incomplete, Invalid };
+
+// parse one frame from the front of input; on Ok, consumed is the frame's total size
+ParseResult parse_request(std::string_view input, Request& req, size_t& consumed);
+
+// bytes of the frame at the front of input that haven't arrived yet, once its header has
+// (0 before that, for a complete frame, or for a malformed header)
+size_t missing_bytes(std::string_view input);
+
+// parse one response frame from the front of input (the client side); on Ok, consumed is
+// the frame's total size
+ParseResult parse_response(std::string_view input, Response& resp, size_t& consumed);
+
+// append a complete request
+void append_request(std::string& out, Opcode op, std::string_view key, std::string_view value = std::string_view());
+
+// append a response header announcing body_len bytes of body
+void append_header(std::string& out, Status status, uint32_t body_len, uint8_t flags = 0);
+
+// append a complete response
+void append_response(std::string& out, Status status, std::string_view body = std::string_view());
+
+}
+
+// contiguous receive buffer with an advancing read cursor; consumed bytes are
+// reclaimed lazily, only when space is needed at the tail
+class ReadBuffer {
+public:
+    static constexpr size_t MIN_READ = 16384;      // free space offered to a read to begin with
+    static constexpr size_t MAX_READ = 1u << 20;   // cap of the adaptive read size
+
+    explicit ReadBuffer(size_t initial_capacity = MIN_READ);
+
+    // make room for at least n more bytes and return where to write them
+    char* prepare(size_t n);
+
+    // bytes that can be written at prepare()'s pointer without growing
+    size_t writable() const { return capacity_ - tail_; }
+
+    // mark n bytes written at the prepared position as readable
+    void commit(size_t n) { tail_ += n; }
+
+    // make room for the next read() from a socket: at least want bytes (the known rest of
+    // a partly received request) and at least the adaptive read size, which doubles after
+    // every read that filled all the space it was offered and halves after one that used
+    // less than half. A drained buffer far larger than that is given back first
+    char* prepare_read(size_t want = 0);
+
+    // mark n bytes read into prepare_read()'s space as readable
+    void commit_read(size_t n);
+
+    // unread bytes
+    std::string_view data() const { return std::string_view(buf_.get() + head_, tail_ - head_); }
+    size_t size() const { return tail_ - head_; }
+    bool empty() const { return head_ == tail_; }
+
+    // advance the read cursor by n bytes
+    void consume(size_t n);
+
+    // pop the next complete line (without its '\n', and without a trailing '\r');
+    // returns false if no full line is buffered yet
+    bool next_line(std::string_view& line);
+
+    // like next_line, but leave the line buffered: consume(length) pops it
+    bool peek_line(std::string_view& line, size_t& length);
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t capacity_;
+    size_t initial_capacity_;
+    size_t read_size_ = MIN_READ; // adaptive read size
+    size_t offered_ = 0;          // free space the last prepare_read() offered
+    size_t head_ = 0;    // read cursor
+    size_t tail_ = 0;    // end of valid data
+    size_t scanned_ = 0; // bytes after head_ already known not to contain '\n'
+};
+
+// reply stream of a connection: text and headers are appended to bytes(), while large
+// values can be appended by reference (written straight from the store's copy with
+// writev) instead of being copied in
+class WriteBuffer {
+public:
+    // plain reply bytes; only ever appended to, or truncated back to a length at or after
+    // the last appended value
+    std::string& bytes() { return bytes_; }
+    const std::string& bytes() const { return bytes_; }
+
+    // append a value by reference, behind the bytes appended so far
+    void append(SharedValue value);
+
+    // move all of other (left empty) behind what this buffer holds
+    void append(WriteBuffer&& other);
+
+    // total bytes to send, values included
+    size_t size() const { return bytes_.size() + spliced_; }
+    bool empty() const { return size() == 0; }
+    bool has_values() const { return !values_.empty(); }
+
+    void clear();
+
+    // fill up to max iovecs describing the bytes from offset on, in order; returns the count
+    size_t gather(size_t offset, iovec* iov, size_t max) const;
+
+    // copy the values into bytes(), leaving a buffer without references
+    void flatten();
+
+private:
+    struct Splice {
+        size_t at; // position in bytes_ the value is sent before
+        SharedValue value;
+    };
+
+    std::string bytes_;
+    std::vector<Splice> values_; // in stream order
+    size_t spliced_ = 0;         // bytes in values_
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <CommandHandler.hpp>
+
+class AppendLog;
+class ClientGate;
+class CoreRouter;
+struct ForwardBatch;
+
+// per-connection state for the event loop
+struct Connection {
+    int fd;
+    ReadBuffer in;           // bytes read but not yet parsed into complete requests
+    Framing framing = Framing::Unknown;
+    WriteBuffer out;         // responses waiting to be written
+    size_t out_offset = 0;   // how much of out has already been written
+    bool want_write = false; // EPOLLOUT currently registered
+    bool held = false;       // the output limit left complete requests in `in`
+    bool paused = false;     // EPOLLIN dropped until the replies drain (output limit reached)
+    bool reading = true;     // EPOLLIN currently registered
+    bool eof = false;        // input ended (peer closed, or shutdown): close once it is answered
+    bool awaiting_sync = false; // replies held for the log (fsync-always mode)
+
+    // thread-per-core mode: forwarded requests are answered after later local ones, so
+    // while any is unanswered every reply gets a slot, and slots move to out in order
+    struct Slot {
+        WriteBuffer reply;
+        bool ready;
+    };
+    uint64_t id = 0;          // tells a reused fd's connections apart
+    std::deque<Slot> slots;
+    uint64_t slots_base = 0;  // sequence number of slots.front()
+    size_t forwarded = 0;     // forwarded requests not answered yet
+    bool answered = false;    // on the reactor's list of connections that got answers
+
+    explicit Connection(int fd) : fd(fd) {}
+};
+
+class Reactor : private RequestRouter {
+public:
+    // constructor - listen_fd must be non-blocking and is shared between reactors, as is
+    // gate, which admits their clients and bounds their buffers. With a router the reactor
+    // runs as core `core`: it alone touches that core's shards and forwards requests for
+    // keys of the other cores' shards to them
+    Reactor(int listen_fd, CommandHandler& handler, ClientGate& gate, CoreRouter* router = nullptr,
+            size_t core = 0);
+
+    ~Reactor(); // closes the epoll instance and all client sockets
+
+    // prevent copying the reactor
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // event loop: accept clients and serve their commands. Returns once the gate's shutdown
+    // has drained every connection (in thread-per-core mode, every core's)
+    void run();
+
+private:
+    int listen_fd_;
+    int epoll_fd_;
+    CommandHandler& handler_;
+    ClientGate& gate_;
+    AppendLog* log_; // store's append-only log, if any
+    std::unordered_map<int, std::unique_ptr<Connection>> connections_;
+
+    // connections whose replies wait for the log to sync (fsync-always mode); flushed
+    // together once per loop iteration so one sync covers every client in the batch
+    std::vector<Connection*> awaiting_sync_;
+    uint64_t synced_seq_ = 0; // last log record this reactor has waited for
+
+    // graceful shutdown
+    bool draining_ = false;
+    std::chrono::steady_clock::time_point drain_deadline_;
+
+    // thread-per-core mode
+    CoreRouter* router_;
+    size_t core_;
+    uint64_t next_id_ = 0;
+    Connection* current_ = nullptr;      // connection whose requests are being processed
+    std::vector<ForwardBatch*> filling_; // per core: this iteration's requests for it
+    std::vector<std::unique_ptr<ForwardBatch>> spare_;
+    std::vector<std::pair<size_t, ForwardBatch*>> unsent_; // batches waiting for room in a full queue
+    std::vector<Connection*> answered_;
+    uint64_t forwarded_seq_ = 0; // highest log record other cores appended for our requests
+
+    void accept_clients();
+    void handle_readable(Connection& conn);
+    bool serve(Connection& conn);
+    bool send_replies(Connection& conn);
+    bool flush(Connection& conn);
+    void reject_input(Connection& conn);
+    void update_interest(Connection& conn, bool want_write);
+    void close_connection(Connection& conn);
+    bool close_if_answered(Connection& conn);
+    void flush_after_sync();
+    void begin_drain();
+    bool drained();
+    int drain_wait() const;
+    bool needs_sync() const;
+
+    // thread-per-core message handling
+    void drain_inbox();
+    void run_batch(ForwardBatch& batch);
+    void deliver(ForwardBatch& batch);
+    void send_batches();
+    void send_batch(size_t to, ForwardBatch* batch);
+
+    // RequestRouter, for the connection in current_
+    bool forward(size_t shard, Framing framing, std::string_view request) override;
+    bool forwarding() const override { return current_->forwarded > 0; }
+    WriteBuffer& reply_buffer() override;
+    size_t backlog() const override;
+};
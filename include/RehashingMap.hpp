@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include "FlatHashMap.hpp"
+
+/*
+    Hash map that grows without stopping the world. A plain table rehashes every element
+    inside the one insert that crosses its load factor, which at millions of keys holds
+    the shard's exclusive lock for a long time. Here a large table that is due to grow is
+    instead moved aside as the draining table, and a new active table sized for twice the
+    elements takes the inserts. Each later insert first moves REHASH_STEP elements across,
+    and rehash_step() lets a background task move more, so the work is spread out in
+    bounded pieces. While both tables hold elements, lookups try the active table and
+    then the draining one.
+
+    The new table is reserved for twice the elements up front, and migration moves more
+    elements per insert than the insert adds, so it finishes long before the new table
+    fills: the underlying tables never rehash themselves past MIN_INCREMENTAL elements.
+    Small tables just grow in place.
+
+    Table is std::unordered_map or FlatHashMap; the few operations that differ between
+    them are the overloads at the bottom of this file. Iterators are invalidated as the
+    underlying table's are, and also by any insert or rehash_step() while draining: the
+    elements moved may be any of the draining table's.
+*/
+template <typename Table>
+class RehashingMap {
+public:
+    using key_type = typename Table::key_type;
+    using mapped_type = typename Table::mapped_type;
+    using value_type = typename Table::value_type;
+    using size_type = size_t;
+
+    static constexpr size_t MIN_INCREMENTAL = 4096; // tables smaller than this grow in place
+    static constexpr size_t REHASH_STEP = 4;       // elements moved per insert while draining
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = RehashingMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type*;
+        using reference = value_type&;
+
+        iterator() = default;
+
+        reference operator*() const { return *it_; }
+        pointer operator->() const { return &*it_; }
+        iterator& operator++() {
+            ++it_;
+            skip_table();
+            return *this;
+        }
+        iterator operator++(int) { iterator tmp = *this; ++*this; return tmp; }
+        bool operator==(const iterator& other) const { return table_ == other.table_ && it_ == other.it_; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        friend class RehashingMap;
+        RehashingMap* map_ = nullptr;
+        size_t table_ = 0; // ACTIVE or DRAINING
+        typename Table::iterator it_;
+
+        iterator(RehashingMap* map, size_t table, typename Table::iterator it) : map_(map), table_(table), it_(it) {
+            skip_table();
+        }
+
+        // the end of the active table continues at the start of the draining one
+        void skip_table() {
+            if (table_ == ACTIVE && it_ == map_->tables_[ACTIVE].end()) {
+                table_ = DRAINING;
+                it_ = map_->tables_[DRAINING].begin();
+            }
+        }
+    };
+
+    // args are passed to the constructor of both tables (hasher, allocator, ...)
+    template <typename... Args>
+    explicit RehashingMap(const Args&... args) : tables_{Table(args...), Table(args...)} {}
+
+    RehashingMap(const RehashingMap&) = delete;
+    RehashingMap& operator=(const RehashingMap&) = delete;
+
+    iterator begin() { return iterator(this, ACTIVE, tables_[ACTIVE].begin()); }
+    iterator end() { return iterator(this, DRAINING, tables_[DRAINING].end()); }
+
+    size_t size() const { return tables_[ACTIVE].size() + tables_[DRAINING].size(); }
+    bool empty() const { return size() == 0; }
+
+    // true while elements are still being moved to the active table
+    bool rehashing() const { return !tables_[DRAINING].empty(); }
+
+    template <typename Key>
+    iterator find(const Key& key) {
+        auto it = tables_[ACTIVE].find(key);
+        if (it != tables_[ACTIVE].end()) {
+            return iterator(this, ACTIVE, it);
+        }
+        if (!tables_[DRAINING].empty()) {
+            it = tables_[DRAINING].find(key);
+            if (it != tables_[DRAINING].end()) {
+                return iterator(this, DRAINING, it);
+            }
+        }
+        return end();
+    }
+
+    // insert key -> value unless key is present; this is where migration happens
+    template <typename Key, typename Value>
+    std::pair<iterator, bool> emplace(Key&& key, Value&& value) {
+        if (!rehashing() && tables_[ACTIVE].size() >= MIN_INCREMENTAL && rehash_due(tables_[ACTIVE])) {
+            start_rehash(); // key may be present: it is now in the draining table
+        }
+        if (rehashing()) {
+            migrate(REHASH_STEP);
+            if (rehashing()) {
+                auto it = tables_[DRAINING].find(key);
+                if (it != tables_[DRAINING].end()) {
+                    return {iterator(this, DRAINING, it), false};
+                }
+            }
+        }
+        auto result = tables_[ACTIVE].emplace(std::forward<Key>(key), std::forward<Value>(value));
+        return {iterator(this, ACTIVE, result.first), result.second};
+    }
+
+    void erase(iterator it) {
+        tables_[it.table_].erase(it.it_);
+        if (it.table_ == DRAINING && tables_[DRAINING].empty()) {
+            release(tables_[DRAINING]);
+        }
+    }
+
+    // move up to n elements to the active table; returns how many are left to move
+    size_t rehash_step(size_t n) {
+        if (rehashing()) {
+            migrate(n);
+        }
+        return tables_[DRAINING].size();
+    }
+
+    // size the active table so that n elements fit without growing (finishes a rehash first)
+    void reserve(size_t n) {
+        while (rehashing()) {
+            migrate(tables_[DRAINING].size());
+        }
+        tables_[ACTIVE].reserve(n);
+    }
+
+    // an iterator to a random-ish element, or end() if the probe hit an empty spot; a
+    // table is picked in proportion to its elements when both have some
+    iterator probe(uint64_t r) {
+        size_t table = ACTIVE;
+        if (rehashing() && (r >> 32) % size() >= tables_[ACTIVE].size()) {
+            table = DRAINING;
+        }
+        auto it = probe_table(tables_[table], r);
+        return it == tables_[table].end() ? end() : iterator(this, table, it);
+    }
+
+    // bytes held by the tables' own arrays (FlatHashMap only; see table_bytes() there)
+    size_t table_bytes() const { return tables_[ACTIVE].table_bytes() + tables_[DRAINING].table_bytes(); }
+
+private:
+    static constexpr size_t ACTIVE = 0;
+    static constexpr size_t DRAINING = 1;
+
+    Table tables_[2];
+    size_t cursor_ = 0; // FlatHashMap: slot of the draining table migration continues at
+
+    void start_rehash() {
+        tables_[DRAINING].swap(tables_[ACTIVE]);
+        tables_[ACTIVE].reserve(tables_[DRAINING].size() * 2);
+        cursor_ = 0;
+    }
+
+    void migrate(size_t n) {
+        migrate_some(tables_[DRAINING], tables_[ACTIVE], cursor_, n);
+        if (tables_[DRAINING].empty()) {
+            release(tables_[DRAINING]);
+        }
+    }
+
+    // std::unordered_map: nodes are spliced across, so nothing is copied or reallocated
+    template <typename... P>
+    static bool rehash_due(const std::unordered_map<P...>& table) {
+        return double(table.size() + 1) > double(table.bucket_count()) * table.max_load_factor();
+    }
+    template <typename... P>
+    static void migrate_some(std::unordered_map<P...>& from, std::unordered_map<P...>& to, size_t&, size_t n) {
+        for (; n > 0 && !from.empty(); n--) {
+            to.insert(from.extract(from.begin()));
+        }
+    }
+    template <typename... P>
+    static void release(std::unordered_map<P...>& table) {
+        table.rehash(0); // an empty table shrinks to its minimal bucket array
+    }
+    template <typename... P>
+    static auto probe_table(std::unordered_map<P...>& table, uint64_t r) {
+        size_t bucket = r % table.bucket_count();
+        if (table.bucket_size(bucket) == 0) {
+            return table.end();
+        }
+        return table.find(table.begin(bucket)->first);
+    }
+
+    // FlatHashMap: elements are moved slot by slot, visiting at most 4n slots per call
+    template <typename... P>
+    static bool rehash_due(const FlatHashMap<P...>& table) {
+        return table.growth_left() == 0;
+    }
+    template <typename... P>
+    static void migrate_some(FlatHashMap<P...>& from, FlatHashMap<P...>& to, size_t& cursor, size_t n) {
+        for (size_t visits = 4 * n; n > 0 && visits > 0 && !from.empty(); visits--, cursor++) {
+            auto it = from.slot(cursor);
+            if (it != from.end()) {
+                to.emplace(std::move(it->first), std::move(it->second));
+                from.erase(it);
+                n--;
+            }
+        }
+    }
+    template <typename... P>
+    static void release(FlatHashMap<P...>& table) {
+        table.clear();
+    }
+    template <typename... P>
+    static auto probe_table(FlatHashMap<P...>& table, uint64_t r) {
+        return table.slot(r % table.capacity());
+    }
+};
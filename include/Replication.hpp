@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <KVStore.hpp>
+
+/*
+    Primary side of asynchronous replication, on its own port and threads.
+
+    A replica connects and sends "SYNC\n". The primary answers "FULLRESYNC\n" and a
+    snapshot image (Snapshot::write, read back with Snapshot::receive), then streams
+    every later write as frames:
+        u32 length | append-only log records (AppendLog::encode)
+    Writes that pile up while a replica's thread is sending go out together in the next
+    frame, and an empty frame is sent as a heartbeat after HEARTBEAT_MS without writes.
+
+    A replica's queue is filled from the moment it registers, before its snapshot is
+    taken, so the stream may repeat writes the snapshot already holds; each record sets
+    a whole value or deadline, so applying them again is harmless.
+
+    There is no partial resync: a replica that loses the connection, or falls more than
+    MAX_BACKLOG bytes behind (and is dropped), reconnects and syncs again from scratch.
+*/
+class ReplicationServer {
+public:
+    static constexpr size_t MAX_BACKLOG = 256 << 20; // bytes queued for one replica before dropping it
+    static constexpr int HEARTBEAT_MS = 1000;
+
+    // binds the port (throws std::runtime_error on failure) and starts accepting replicas
+    ReplicationServer(KVStore& store, int port);
+    ~ReplicationServer(); // disconnects the replicas and stops the threads
+
+    // prevent copying the server
+    ReplicationServer(const ReplicationServer&) = delete;
+    ReplicationServer& operator=(const ReplicationServer&) = delete;
+
+    // queue a write for every replica (called by the store under the shard lock)
+    void append_set(std::string_view key, std::string_view value, int64_t expires_at);
+    void append_del(std::string_view key);
+    void append_expire(std::string_view key, int64_t expires_at);
+
+    // replicas syncing or streaming right now
+    size_t replicas() const { return active_.load(std::memory_order_relaxed); }
+
+    // full resyncs sent since startup
+    uint64_t full_syncs() const { return full_syncs_.load(std::memory_order_relaxed); }
+
+private:
+    struct Replica {
+        int fd = -1;
+        std::string queue;       // records not yet sent
+        bool registered = false; // queue is being filled
+        bool dropped = false;    // fell MAX_BACKLOG behind
+        bool done = false;       // the thread has finished and can be joined
+        std::thread worker;
+    };
+
+    KVStore& store_;
+    int listen_fd_ = -1;
+    std::atomic<bool> stop_{false};
+    std::atomic<size_t> active_{0}; // registered replicas; appends are skipped while there are none
+    std::atomic<uint64_t> full_syncs_{0};
+    std::mutex mtx_; // guards replicas_ and their queues
+    std::condition_variable cv_;
+    std::list<Replica> replicas_;
+    std::thread acceptor_;
+
+    void append_record(AppendLog::Op op, std::string_view key, std::string_view value, int64_t expires_at);
+    void run();
+    void serve(Replica& replica);
+    void stream(Replica& replica);
+};
+
+/*
+    Replica side of replication: one thread keeps a connection to the primary, loads
+    each full resync into the store and then applies the stream as it arrives, a frame
+    at a time through KVStore::apply (so the writes also reach this server's own log and
+    replicas). On any error it reconnects after RETRY_MS and syncs again.
+
+    The store is cleared when a resync has been received, just before it is loaded, so
+    reads during the load see a partial data set.
+*/
+class ReplicaLink {
+public:
+    static constexpr int RETRY_MS = 1000;
+    static constexpr int READ_TIMEOUT_MS = 5 * ReplicationServer::HEARTBEAT_MS; // primary presumed gone
+
+    // starts the thread; primary is host:port of the primary's replication port
+    ReplicaLink(KVStore& store, std::string host, int port);
+    ~ReplicaLink(); // closes the connection and stops the thread
+
+    // prevent copying the link
+    ReplicaLink(const ReplicaLink&) = delete;
+    ReplicaLink& operator=(const ReplicaLink&) = delete;
+
+    const std::string& host() const { return host_; }
+    int port() const { return port_; }
+
+    // synced and streaming
+    bool up() const { return up_.load(std::memory_order_relaxed); }
+
+    // full resyncs loaded and stream records applied since startup
+    uint64_t full_syncs() const { return full_syncs_.load(std::memory_order_relaxed); }
+    uint64_t records_applied() const { return applied_.load(std::memory_order_relaxed); }
+
+private:
+    KVStore& store_;
+    std::string host_;
+    int port_;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> up_{false};
+    std::atomic<uint64_t> full_syncs_{0};
+    std::atomic<uint64_t> applied_{0};
+    std::mutex mtx_; // guards fd_ and the retry wait
+    std::condition_variable cv_;
+    int fd_ = -1;
+    std::thread worker_;
+
+    void run();
+    int connect_primary();
+    void session(int fd);
+};
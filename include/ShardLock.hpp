@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <shared_mutex>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+
+// how a store shard's readers synchronize with its writers
+enum class LockMode : uint8_t {
+    Shared,      // std::shared_mutex: every reader does an atomic RMW on the lock's one counter
+    ReaderSlots, // per-thread reader slots: a reader only writes its own cache line
+    Owner        // no locking at all: the shard is only ever touched by the thread that owns it
+};
+
+/*
+    Reader/writer lock for one store shard, usable with std::shared_lock and std::unique_lock.
+
+    In ReaderSlots mode every thread is assigned one of READER_SLOTS counters, each on its
+    own cache line. A reader increments its counter and then checks the writer flag; a
+    writer raises the flag and waits for every counter to drain. Readers never write a
+    line another reader writes, so read throughput scales with cores instead of bouncing
+    the lock word between them, and because new readers back off as soon as the flag is
+    up, a stream of readers can't starve a writer. The price is on the write side: every
+    exclusive lock scans all slots, which suits read-mostly shards.
+    Writers serialize among themselves on the shared_mutex, which readers then never touch.
+
+    Both modes count the acquisitions that had to wait and the time spent waiting. Every
+    acquisition first tries without blocking; only one that fails reads the clock, so an
+    uncontended lock costs what it did before.
+
+    Owner mode turns the lock into a no-op, for thread-per-core serving where every shard
+    is confined to one thread and other threads reach it through that thread (CoreRouter).
+*/
+class ShardLock {
+public:
+    static constexpr size_t READER_SLOTS = 64; // threads beyond this share slots
+
+    ShardLock() = default;
+
+    // prevent copying the lock
+    ShardLock(const ShardLock&) = delete;
+    ShardLock& operator=(const ShardLock&) = delete;
+
+    // choose the mode; only while no thread uses the lock
+    void set_mode(LockMode mode);
+    LockMode mode() const { return mode_; }
+
+    void lock() {
+        if (mode_ == LockMode::Owner) {
+            return;
+        }
+        if (!rw_.try_lock()) {
+            auto start = std::chrono::steady_clock::now();
+            rw_.lock();
+            record_wait(start);
+        }
+        if (mode_ == LockMode::ReaderSlots) {
+            writer_.store(true, std::memory_order_seq_cst);
+            wait_for_readers();
+        }
+    }
+
+    void unlock() {
+        if (mode_ == LockMode::Owner) {
+            return;
+        }
+        if (mode_ == LockMode::ReaderSlots) {
+            writer_.store(false, std::memory_order_release);
+        }
+        rw_.unlock();
+    }
+
+    void lock_shared() {
+        if (mode_ == LockMode::Shared) {
+            if (!rw_.try_lock_shared()) {
+                auto start = std::chrono::steady_clock::now();
+                rw_.lock_shared();
+                record_wait(start);
+            }
+            return;
+        }
+        if (mode_ == LockMode::Owner) {
+            return;
+        }
+        std::atomic<uint32_t>& readers = slots_[reader_slot()].readers;
+        while (true) {
+            // the RMW is a full barrier, so either we see the writer's flag or it sees our count
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!writer_.load(std::memory_order_seq_cst)) {
+                return;
+            }
+            readers.fetch_sub(1, std::memory_order_release);
+            wait_for_writer();
+        }
+    }
+
+    void unlock_shared() {
+        if (mode_ == LockMode::Shared) {
+            rw_.unlock_shared();
+            return;
+        }
+        if (mode_ == LockMode::Owner) {
+            return;
+        }
+        slots_[reader_slot()].readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    // acquisitions that could not be granted immediately, and the total time they waited
+    struct WaitStats {
+        uint64_t contended = 0;
+        uint64_t wait_ns = 0;
+    };
+    WaitStats wait_stats() const {
+        return {contended_.load(std::memory_order_relaxed), wait_ns_.load(std::memory_order_relaxed)};
+    }
+
+    // total time the calling thread has waited for any shard lock (read it before and after
+    // an operation to see how much of it was lock wait)
+    static uint64_t& thread_wait_ns() {
+        thread_local uint64_t ns = 0;
+        return ns;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> readers{0};
+    };
+
+    LockMode mode_ = LockMode::Shared;
+    std::shared_mutex rw_;
+    alignas(64) std::atomic<bool> writer_{false}; // read by every reader, so kept off rw_'s line
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<uint64_t> contended_{0}; // only written by waiters
+    std::atomic<uint64_t> wait_ns_{0};
+
+    // slot of the calling thread, assigned round-robin on first use
+    static size_t reader_slot() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % READER_SLOTS;
+        return slot;
+    }
+
+    void wait_for_readers();
+    void wait_for_writer();
+    void record_wait(std::chrono::steady_clock::time_point start);
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+    Immutable, reference-counted copy of a value. The store keeps large values in these
+    instead of its slab strings: a reader takes its own reference under the shard lock and
+    writes the reply straight from the stored bytes after releasing it, and an overwrite
+    or delete only drops the store's reference, so bytes still being sent stay valid.
+    The count is atomic, so references may be released on any thread.
+*/
+class SharedValue {
+public:
+    SharedValue() = default;
+
+    // a new block holding a copy of bytes, with one reference
+    static SharedValue copy_of(std::string_view bytes) {
+        void* memory = ::operator new(sizeof(Block) + bytes.size());
+        Block* block = new (memory) Block();
+        block->size = bytes.size();
+        std::memcpy(reinterpret_cast<char*>(block + 1), bytes.data(), bytes.size()); // the bytes after the header, not a Block
+        return SharedValue(block);
+    }
+
+    ~SharedValue() { reset(); }
+
+    SharedValue(const SharedValue& other) : block_(other.block_) {
+        if (block_ != nullptr) {
+            block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    SharedValue& operator=(const SharedValue& other) {
+        SharedValue copy(other);
+        swap(copy);
+        return *this;
+    }
+    SharedValue(SharedValue&& other) noexcept : block_(std::exchange(other.block_, nullptr)) {}
+    SharedValue& operator=(SharedValue&& other) noexcept {
+        SharedValue moved(std::move(other));
+        swap(moved);
+        return *this;
+    }
+
+    void swap(SharedValue& other) noexcept { std::swap(block_, other.block_); }
+
+    // drop this reference; the last one frees the block
+    void reset() {
+        if (block_ != nullptr && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block_->~Block();
+            ::operator delete(block_);
+        }
+        block_ = nullptr;
+    }
+
+    explicit operator bool() const { return block_ != nullptr; }
+    size_t size() const { return block_ != nullptr ? block_->size : 0; }
+    std::string_view view() const {
+        return block_ != nullptr ? std::string_view(reinterpret_cast<const char*>(block_ + 1), block_->size)
+                                 : std::string_view();
+    }
+
+private:
+    // header of the allocation; the bytes follow it
+    struct Block {
+        std::atomic<uint32_t> refs{1};
+        size_t size = 0;
+    };
+
+    Block* block_ = nullptr;
+
+    explicit SharedValue(Block* block) : block_(block) {}
+};
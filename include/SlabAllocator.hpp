@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/*
+    Size-class slab allocator. Requests up to MAX_SLOT bytes are rounded up to one of a
+    fixed set of slot sizes; each class carves SLAB_SIZE pages into equal slots and keeps
+    freed slots on an intrusive free list for reuse, so SET/DEL churn recycles the same
+    memory instead of fragmenting the general heap. Larger requests go to operator new.
+
+    An arena is not thread-safe: KVStore keeps one per shard and only allocates or frees
+    from it under that shard's exclusive lock.
+*/
+class SlabArena {
+public:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t MAX_SLOT = 16 * 1024;
+
+    // utilization of one size class
+    struct ClassStats {
+        size_t slot_size = 0;
+        size_t slabs = 0;      // pages carved for this class
+        size_t slots = 0;      // total slots in those pages
+        size_t used = 0;       // slots currently handed out
+        size_t requested = 0;  // bytes callers actually asked for in the used slots
+    };
+
+    SlabArena();
+    ~SlabArena(); // returns every slab to the system
+
+    // prevent copying the arena
+    SlabArena(const SlabArena&) = delete;
+    SlabArena& operator=(const SlabArena&) = delete;
+
+    void* allocate(size_t n);
+    void deallocate(void* p, size_t n); // n must match the size passed to allocate
+
+    // bytes handed out and not yet freed, counting whole slots (what the store charges for)
+    size_t bytes_in_use() const { return in_use_; }
+
+    // per-class utilization; the last entry (slot_size 0) describes oversized allocations
+    std::vector<ClassStats> stats() const;
+
+    // the slot sizes used by every arena
+    static const std::vector<size_t>& class_sizes();
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct SizeClass {
+        FreeSlot* free_list = nullptr; // freed slots, reused first
+        char* bump = nullptr;          // next never-used slot in the newest slab
+        size_t bump_left = 0;          // never-used slots remaining in the newest slab
+        ClassStats stats;
+    };
+
+    std::vector<SizeClass> classes_;
+    std::vector<void*> slabs_;
+    ClassStats large_; // allocations above MAX_SLOT
+    size_t in_use_ = 0;
+
+    static size_t class_index(size_t n);
+    void refill(SizeClass& cls);
+};
+
+// std::allocator-compatible adapter so containers and strings can draw from an arena
+template <typename T>
+class SlabStlAllocator {
+public:
+    using value_type = T;
+
+    explicit SlabStlAllocator(SlabArena* arena) noexcept : arena_(arena) {}
+    template <typename U>
+    SlabStlAllocator(const SlabStlAllocator<U>& other) noexcept : arena_(other.arena()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena_->allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) noexcept { arena_->deallocate(p, n * sizeof(T)); }
+
+    SlabArena* arena() const noexcept { return arena_; }
+
+    template <typename U>
+    bool operator==(const SlabStlAllocator<U>& other) const noexcept { return arena_ == other.arena(); }
+
+private:
+    SlabArena* arena_;
+};
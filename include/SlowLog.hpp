@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Log of the commands that took longer than a threshold, for SLOWLOG. Each entry splits
+    the time into waiting for the store's shard locks, executing (the rest of the command,
+    e.g. copying a large value or a rehash), and writing the reply.
+
+    Commands are timed with cycleclock, and the threshold test is a compare against a
+    precomputed tick count, so the log can stay on in production. The reply of a command
+    is written together with the rest of its read batch, so the connection calls
+    batch_written() once the batch is flushed: slow commands of the batch are held
+    per thread until then and get the batch's write time. A batch whose write alone goes
+    over the threshold (socket backpressure) is logged as a "(reply write)" entry.
+*/
+class SlowLog {
+public:
+    static constexpr size_t DEFAULT_MAX_LEN = 128;
+    static constexpr int64_t DEFAULT_THRESHOLD_US = 10000;
+    static constexpr size_t MAX_COMMAND_BYTES = 128; // longer commands are truncated
+
+    struct Entry {
+        uint64_t id = 0;
+        int64_t unix_ms = 0; // when the command finished
+        uint64_t lock_ns = 0;
+        uint64_t exec_ns = 0;
+        uint64_t write_ns = 0;
+        bool write_blocked = false; // the socket was full: part of the reply waited in the buffer
+        std::string command;
+    };
+
+    // the process-wide instance (never destroyed)
+    static SlowLog& instance();
+
+    // threshold_us < 0 disables the log, 0 logs every command; keeps the newest max_len entries
+    void configure(int64_t threshold_us, size_t max_len);
+    int64_t threshold_us() const { return threshold_us_; }
+
+    // a command finished: ticks is its cycleclock duration, lock_ns the lock wait within it.
+    // static so the common case is one compare against a global, without reaching the instance
+    static void command_done(uint64_t ticks, uint64_t lock_ns, std::string_view verb, std::string_view args) {
+        if (ticks >= threshold_ticks_.load(std::memory_order_relaxed)) {
+            instance().hold(ticks, lock_ns, verb, args);
+        }
+    }
+
+    // the replies of the current thread's batch were written, taking ticks (blocked: some
+    // of the output had to wait for the socket to drain)
+    void batch_written(uint64_t ticks, bool blocked);
+
+    // newest first
+    std::vector<Entry> latest(size_t count);
+    size_t size();
+    void reset();
+
+private:
+    static inline std::atomic<uint64_t> threshold_ticks_{UINT64_MAX};
+    int64_t threshold_us_ = -1;
+    size_t max_len_ = DEFAULT_MAX_LEN;
+
+    std::mutex mtx_; // guards the entries; only taken for slow commands and SLOWLOG itself
+    std::deque<Entry> entries_;
+    uint64_t next_id_ = 0;
+
+    SlowLog() = default;
+
+    void hold(uint64_t ticks, uint64_t lock_ns, std::string_view verb, std::string_view args);
+    void append(std::vector<Entry>& batch);
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <ctime>
+#include <KVStore.hpp>
+
+/*
+    Binary point-in-time image of a KVStore.
+
+    The file is a header, a run of checksummed blocks and a trailing block index:
+        header:  "KVSNAP01" | u32 version | u32 shard count
+        block:   u32 "KVBK" | u32 shard | u32 records | u32 payload length | u32 crc32c(payload)
+                 payload = records x (u32 key length | u32 value length | u64 expires_at | key | value)
+        index:   u64 offset per block
+        trailer: u32 block count | u32 crc32c(index) | u64 index offset | "KVSNAPEN"
+    Every block holds entries of a single store shard (large shards span several blocks),
+    so a loader can hand whole shards to different threads without lock contention.
+    expires_at is the key's deadline in unix ms (0 = never); version 1 images, which predate
+    expiry, lack the field and are still accepted. All integers are little-endian.
+*/
+class Snapshot {
+public:
+    static constexpr size_t BLOCK_TARGET = 4 << 20; // payload bytes per block before starting a new one
+
+    // stream a snapshot of store to fd, one shard at a time; each shard's read lock is held
+    // only while that shard is copied. throws std::runtime_error on I/O errors
+    static void write(KVStore& store, int fd);
+
+    // write a snapshot to path atomically (temp file, fsync, rename); throws on failure
+    static void save(KVStore& store, const std::string& path);
+
+    // load a snapshot image into store using up to `threads` threads (0 = one per core).
+    // returns the number of keys loaded; throws std::runtime_error if the image is corrupt
+    static size_t load(KVStore& store, const char* data, size_t len, size_t threads = 0);
+
+    // mmap a snapshot file and load it; returns 0 if the file doesn't exist
+    static size_t load_file(KVStore& store, const std::string& path, size_t threads = 0);
+
+    // read exactly one image, as written by write(), off a stream such as a socket, leaving
+    // whatever follows it unread. throws std::runtime_error on errors or bad framing
+    static void receive(int fd, std::string& image);
+
+    // call fn(key, value, expires_at) for every record of an image, in order, on the calling
+    // thread; returns the number of records. throws std::runtime_error if the image is corrupt
+    using RecordFn = std::function<void(std::string_view key, std::string_view value, int64_t expires_at)>;
+    static size_t visit(const char* data, size_t len, const RecordFn& fn);
+};
+
+// runs Snapshot::save on a background thread, checkpointing the append-only log around it
+class BackgroundSaver {
+public:
+    BackgroundSaver(KVStore& store, std::string path);
+    ~BackgroundSaver(); // waits for a running save
+
+    // prevent copying the saver
+    BackgroundSaver(const BackgroundSaver&) = delete;
+    BackgroundSaver& operator=(const BackgroundSaver&) = delete;
+
+    // start a save; returns false if one is already running
+    bool start();
+
+    // save on the calling thread, after waiting for a running save; returns false if it failed
+    bool save();
+
+    bool in_progress() const { return running_.load(); }
+
+    // unix time of the last successful save (0 if none yet)
+    std::time_t last_save() const { return last_save_.load(); }
+
+    const std::string& path() const { return path_; }
+
+private:
+    KVStore& store_;
+    std::string path_;
+    std::atomic<bool> running_{false};
+    std::atomic<std::time_t> last_save_{0};
+    std::mutex mtx_; // guards worker_
+    std::thread worker_;
+
+    bool run();
+};
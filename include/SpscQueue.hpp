@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+/*
+    Bounded lock-free queue for exactly one producer thread and one consumer thread.
+    The producer only writes tail_ and the consumer only writes head_, each on its own
+    cache line, and each side keeps a private copy of the other's index so it only reads
+    the shared one (taking the cache miss) when the copy says the queue looks full/empty.
+*/
+template <typename T>
+class SpscQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity = 64) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots_ = std::make_unique<T[]>(size);
+        mask_ = size - 1;
+    }
+
+    // prevent copying the queue
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side: false if the queue is full
+    bool push(T value) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side: false if the queue is empty
+    bool pop(T& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        value = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // either side: whether anything is queued (a hint while the other side is active)
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::unique_ptr<T[]> slots_;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> head_{0}; // next slot to pop, written by the consumer
+    size_t tail_cache_ = 0;                   // consumer's copy of tail_
+    alignas(64) std::atomic<size_t> tail_{0}; // next slot to fill, written by the producer
+    size_t head_cache_ = 0;                   // producer's copy of head_
+};
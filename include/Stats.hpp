@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "Protocol.hpp"
+
+/*
+    Server-wide counters for INFO. Every thread that records anything gets its own block of
+    counters, aligned and padded to whole cache lines, and only ever writes that block
+    (a plain load + store, no locked RMW), so instrumenting the hot path adds no sharing
+    between cores. INFO sums the blocks when it is asked. Blocks of exited threads are
+    handed to the next new thread with their counts intact, so totals never go backwards.
+
+    Latencies are kept per command type in log-linear buckets: 2^LATENCY_SUB_BITS buckets
+    per power of two of nanoseconds (within 25%).
+*/
+class Stats {
+public:
+    static constexpr size_t COMMAND_TYPES = size_t(CommandType::Unknown) + 1;
+    static constexpr unsigned LATENCY_SUB_BITS = 2;
+    static constexpr size_t LATENCY_BUCKETS = size_t(64) << LATENCY_SUB_BITS;
+
+    // the process-wide instance (never destroyed, so detached threads can always record)
+    static Stats& instance();
+
+    void command(CommandType type, uint64_t ns) {
+        Counters& c = local();
+        bump(c.calls[size_t(type)]);
+        bump(c.latency_sum[size_t(type)], ns);
+        bump(c.latency[size_t(type)][bucket_of(ns)]);
+    }
+    void lookups(uint64_t hits, uint64_t misses) {
+        Counters& c = local();
+        bump(c.hits, hits);
+        bump(c.misses, misses);
+    }
+    void bytes_in(uint64_t n) { bump(local().bytes_in, n); }
+    void bytes_out(uint64_t n) { bump(local().bytes_out, n); }
+    void connection_opened() {
+        Counters& c = local();
+        bump(c.connections_total);
+        bump(c.connected);
+    }
+    void connection_closed() { bump(local().connected, uint64_t(-1)); } // sums wrap back to the gauge
+
+    // overload handling: a client turned away at the connection limit, a client dropped for
+    // an oversized request, and an event loop that stopped reading a client until its replies drained
+    void connection_rejected() { bump(local().rejected); }
+    void input_overflow() { bump(local().input_overflows); }
+    void read_paused() { bump(local().read_pauses); }
+
+    // a value of raw bytes was compressed to stored bytes in ns; kept says whether it
+    // saved enough to be stored compressed
+    void compressed(uint64_t raw, uint64_t stored, bool kept, uint64_t ns) {
+        Counters& c = local();
+        bump(c.compress_calls);
+        bump(c.compress_ns, ns);
+        if (kept) {
+            bump(c.compress_kept);
+            bump(c.compress_raw_bytes, raw);
+            bump(c.compress_stored_bytes, stored);
+        }
+    }
+    void decompressed(uint64_t ns) {
+        Counters& c = local();
+        bump(c.decompress_calls);
+        bump(c.decompress_ns, ns);
+    }
+
+    // totals over all threads
+    struct Totals {
+        uint64_t calls[COMMAND_TYPES] = {};
+        uint64_t latency_sum[COMMAND_TYPES] = {}; // ns
+        uint64_t latency[COMMAND_TYPES][LATENCY_BUCKETS] = {};
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        uint64_t connections_total = 0;
+        uint64_t connected = 0;
+        uint64_t rejected = 0;
+        uint64_t input_overflows = 0;
+        uint64_t read_pauses = 0;
+        uint64_t compress_calls = 0;        // values offered to the compressor
+        uint64_t compress_kept = 0;         // of those, stored compressed
+        uint64_t compress_raw_bytes = 0;    // their size before
+        uint64_t compress_stored_bytes = 0; // and after
+        uint64_t compress_ns = 0;           // time compressing, kept or not
+        uint64_t decompress_calls = 0;
+        uint64_t decompress_ns = 0;
+    };
+    std::unique_ptr<Totals> collect();
+
+    // latency (ns, upper edge of the bucket) at quantile q of one command's histogram
+    static uint64_t percentile(const uint64_t (&buckets)[LATENCY_BUCKETS], double q);
+
+    // resident set size of the process (0 if /proc is unavailable)
+    static uint64_t resident_bytes();
+
+    // seconds since the process started recording
+    double uptime() const;
+
+    // commands per second since the previous call (over the uptime on the first call)
+    double rate_since_last(uint64_t total_calls);
+
+private:
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> calls[COMMAND_TYPES];
+        std::atomic<uint64_t> latency_sum[COMMAND_TYPES];
+        std::atomic<uint64_t> hits, misses, bytes_in, bytes_out, connections_total, connected;
+        std::atomic<uint64_t> rejected, input_overflows, read_pauses;
+        std::atomic<uint64_t> compress_calls, compress_kept, compress_raw_bytes, compress_stored_bytes, compress_ns;
+        std::atomic<uint64_t> decompress_calls, decompress_ns;
+        std::atomic<uint64_t> latency[COMMAND_TYPES][LATENCY_BUCKETS];
+    };
+
+    std::mutex mtx_; // guards the lists and the rate sample
+    std::vector<std::unique_ptr<Counters>> blocks_;
+    std::vector<Counters*> free_;
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_sample_time_ = start_;
+    uint64_t last_sample_calls_ = 0;
+
+    Stats() = default;
+
+    // only the owning thread writes a block, so a relaxed load + store is enough
+    static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static size_t bucket_of(uint64_t ns) {
+        if (ns < (uint64_t(1) << LATENCY_SUB_BITS)) {
+            return size_t(ns);
+        }
+        unsigned magnitude = 63 - unsigned(__builtin_clzll(ns));
+        unsigned shift = magnitude - LATENCY_SUB_BITS;
+        return (size_t(shift) + 1) * (size_t(1) << LATENCY_SUB_BITS) +
+               size_t((ns >> shift) - (uint64_t(1) << LATENCY_SUB_BITS));
+    }
+
+    Counters& local();
+    Counters* acquire();
+    void release(Counters* block);
+    friend struct StatsThreadHandle;
+};
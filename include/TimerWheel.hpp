@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Hierarchical timer wheel of key deadlines, in the style of the classic kernel timer wheel.
+
+    Time is divided into ticks of TICK_MS. Level 0 has one slot per tick for the next
+    SLOTS ticks, and every level above covers SLOTS times the span of the one below. A
+    timer is filed in the lowest level whose span reaches its deadline; whenever level 0
+    wraps, the next slot of level 1 is cascaded (re-filed into level 0), and so on upwards.
+    Scheduling is O(1) and advancing costs one slot per elapsed tick plus the cascades,
+    so no operation ever scans the whole set of timers.
+
+    The wheel only knows deadlines: expired timers are handed back through pop_due() and
+    the owner decides whether the key still expires at that time. Timers are never
+    cancelled in place; a stale one is simply dropped when it comes due.
+    Not thread-safe: each store shard owns a wheel and uses it under its exclusive lock.
+*/
+class TimerWheel {
+public:
+    static constexpr int64_t TICK_MS = 10;
+    static constexpr unsigned LEVEL_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << LEVEL_BITS;
+    static constexpr size_t LEVELS = 6; // 10 ms * 64^6 ~ 21 years before deadlines are clamped
+
+    struct Timer {
+        std::string key;
+        int64_t deadline; // unix time in ms
+    };
+
+    // constructor - now_ms is the current time, the wheel starts at its tick
+    explicit TimerWheel(int64_t now_ms);
+
+    // arm a timer for key at deadline_ms; a deadline already in the past is due immediately
+    void schedule(std::string_view key, int64_t deadline_ms);
+    void schedule(Timer timer);
+
+    // run the clock forward to now_ms, moving every timer whose deadline has passed to the due list
+    void advance(int64_t now_ms);
+
+    // take one due timer; returns false if none are waiting
+    bool pop_due(Timer& out);
+
+    size_t due_count() const { return due_.size(); }
+    size_t size() const { return pending_ + due_.size(); }
+
+    // current unix time in ms from the coarse clock (a few ms resolution, no syscall)
+    static int64_t now_ms();
+
+private:
+    std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> levels_;
+    std::vector<Timer> due_;
+    int64_t current_; // next tick to process
+    size_t pending_ = 0; // timers still in the wheel (not yet due)
+
+    void file(Timer&& timer, int64_t tick);
+    void cascade(size_t level);
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <CommandHandler.hpp>
+
+class AppendLog;
+class ClientGate;
+
+// per-connection state for the io_uring event loop
+struct UringConnection {
+    int fd;
+    ReadBuffer in;             // bytes received but not yet parsed into complete requests
+    Framing framing = Framing::Unknown;
+    static constexpr size_t SEND_IOVECS = 16;
+
+    WriteBuffer out;           // replies not yet handed to the kernel
+    WriteBuffer sending;       // replies of the send in flight; must not move until it completes
+    size_t sent = 0;           // how much of sending the kernel has taken
+    iovec iov[SEND_IOVECS];    // sendmsg pieces while sending references large values
+    msghdr msg{};
+    bool recv_armed = false;   // a multishot recv is active
+    bool paused = false;       // the output limit is reached: recv cancelled until the replies drain
+    bool send_inflight = false;
+    bool hangup = false;       // close once the pending replies are sent (protocol violation)
+    bool eof = false;          // input ended (peer closed, or shutdown): close once it is answered
+    bool closing = false;      // shut down; freed when no operation is left in flight
+    bool queued = false;       // on the reactor's list of connections with new replies
+    bool released = false;     // on the reactor's list of connections to free
+
+    explicit UringConnection(int fd) : fd(fd) {}
+};
+
+/*
+    Event loop on io_uring, driven through the raw syscalls (no liburing).
+
+    One multishot accept keeps delivering new clients, and every client has one multishot
+    recv that keeps delivering data into buffers the kernel picks from a provided buffer
+    ring shared by all of the reactor's connections, so idle connections pin no receive
+    memory. Replies produced while handling a batch of completions are queued as sends
+    and submitted together with the next wait: one io_uring_enter per loop iteration
+    covers every send, re-arm and wait, where epoll needs a read and a write per request.
+
+    Needs Linux 6.0 (multishot recv). Where the buffer ring can't be used, buffers are
+    returned with provide-buffers requests instead, batched into the same io_uring_enter.
+    Which of the two works is decided once, by a throwaway reactor, before the first real
+    one is built; a live reactor never unregisters its ring to switch over. The
+    constructor checks the kernel can do all of it and throws std::runtime_error
+    otherwise, so the server can fall back to epoll.
+*/
+class UringReactor {
+public:
+    // constructor - listen_fd is shared between reactors; each one arms its own accept.
+    // gate admits the clients of all reactors and bounds their buffers
+    UringReactor(int listen_fd, CommandHandler& handler, ClientGate& gate);
+
+    ~UringReactor(); // unmaps the rings and closes all client sockets
+
+    // prevent copying the reactor
+    UringReactor(const UringReactor&) = delete;
+    UringReactor& operator=(const UringReactor&) = delete;
+
+    // event loop: accept clients and serve their commands. Returns once the gate's shutdown
+    // has drained every connection
+    void run();
+
+private:
+    // how receive buffers go back to the kernel
+    enum class BufferMode { Ring, Provided };
+
+    // the mode the reactors of this process use, tried out on the first call
+    static BufferMode buffer_mode(CommandHandler& handler, ClientGate& gate);
+
+    UringReactor(int listen_fd, CommandHandler& handler, ClientGate& gate, BufferMode mode);
+
+    // submission and completion rings, mapped from the kernel
+    struct Rings {
+        int fd = -1;
+        void* sq_map = nullptr;
+        size_t sq_map_size = 0;
+        void* cq_map = nullptr;
+        size_t cq_map_size = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqes_size = 0;
+        unsigned* sq_head = nullptr;
+        unsigned* sq_tail = nullptr;
+        unsigned sq_mask = 0;
+        unsigned sq_entries = 0;
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned cq_mask = 0;
+        io_uring_cqe* cqes = nullptr;
+    };
+
+    int listen_fd_;
+    CommandHandler& handler_;
+    ClientGate& gate_;
+    AppendLog* log_; // store's append-only log, if any
+    Rings ring_;
+    unsigned unsubmitted_ = 0; // SQEs queued since the last io_uring_enter
+
+    // provided receive buffers: BUFFERS slots of BUFFER_SIZE bytes, returned to the kernel
+    // through buf_ring_, or with provide-buffers requests when it is null
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    std::unique_ptr<char[]> buffers_;
+    uint16_t buf_tail_ = 0;
+
+    std::unordered_map<int, std::unique_ptr<UringConnection>> connections_;
+    std::vector<UringConnection*> replies_;   // connections with replies to send this iteration
+    std::vector<UringConnection*> finished_;  // closed connections to free this iteration
+    uint64_t synced_seq_ = 0; // last log record this reactor has waited for
+
+    // graceful shutdown
+    bool accept_armed_ = false;
+    bool draining_ = false;
+    __kernel_timespec drain_timeout_{}; // read by the kernel while the drain timeout is armed
+
+    void setup_rings();
+    void setup_buffers(BufferMode mode);
+    void provide_buffers(uint16_t first, unsigned count);
+    bool probe();
+    void teardown();
+
+    io_uring_sqe* next_sqe();
+    bool pop_cqe(io_uring_cqe& cqe);
+    int enter(unsigned wait_for);
+    void recycle_buffer(uint16_t id);
+
+    void arm_accept();
+    void arm_shutdown_poll();
+    void arm_recv(UringConnection& conn);
+    void cancel_recv(UringConnection& conn);
+    void start_send(UringConnection& conn);
+
+    void on_accept(const io_uring_cqe& cqe);
+    void on_shutdown();
+    void on_recv(UringConnection& conn, const io_uring_cqe& cqe);
+    void on_send(UringConnection& conn, const io_uring_cqe& cqe);
+    void serve(UringConnection& conn);
+    void send_replies();
+    void begin_close(UringConnection& conn);
+    void release_if_idle(UringConnection& conn);
+};
@@ -1,13 +1,39 @@
 #pragma once
 
 #include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
 #include <netinet/in.h>
 #include <KVStore.hpp>
+#include <CommandHandler.hpp>
+#include <ClientLimits.hpp>
+
+// how client connections are served
+enum class ServerMode {
+    Threaded, // one blocking thread per connection
+    Epoll,    // fixed pool of event-loop threads with non-blocking sockets
+    Uring,    // like Epoll but on io_uring; falls back to Epoll where the kernel lacks it
+    PerCore   // Epoll reactors that each own a subset of the shards, without locks
+};
+
+struct ServerConfig {
+    int port = 8080;
+    ServerMode mode = ServerMode::Epoll;
+    size_t threads = 0; // reactor threads in the event loop modes, 0 = one per core
+    std::vector<int> cpus; // reactor i runs on CPU cpus[i % size] (empty = not pinned)
+    ClientLimits limits;   // connection count and per-connection buffer bounds, in every mode
+    int listen_fd = -1;    // serve this listening socket (handed over by a predecessor) instead of binding port
+};
+
+class CoreRouter;
 
 class Server {
 public:
     // constructor - takes reference to store
     explicit Server(KVStore& store, int port = 8080);
+    Server(KVStore& store, const ServerConfig& config);
 
     ~Server(); // destructor to clean up socket descriptors
 
@@ -15,14 +41,52 @@ public:
     Server(const Server&) = delete;
     Server& operator=(const Server&) = delete;
 
-    // main loop: accept connections and spawn threads
+    // main loop: accept connections and serve them according to the configured mode.
+    // Returns after stop(), once the connections have drained
     void start();
 
+    // graceful shutdown: stop accepting, answer the requests the clients already sent, then
+    // let start() return. Async-signal-safe, so a signal handler may call it
+    void stop() { gate_.shut_down(); }
+
+    // the listening socket, for handing it over to a successor
+    int listen_fd() const { return server_fd_; }
+
+    // command handler shared by all connections, for wiring optional features before start()
+    CommandHandler& handler() { return handler_; }
+
 private:
     KVStore& store_;
+    CommandHandler handler_;
+    ServerConfig config_;
     int port_;
     int server_fd_; // file descriptor for the server socket
+    ClientGate gate_; // shared by every thread serving clients
+    std::unique_ptr<CoreRouter> router_; // PerCore mode only
+    std::mutex clients_mtx_;               // guards client_fds_
+    std::unordered_set<int> client_fds_;   // Threaded mode: sockets of the client threads
+
+    // bind and listen on port_, or adopt the handed over config_.listen_fd
+    void open_listener();
+
+    // accept loop spawning one thread per connection
+    void run_threaded();
+
+    // Threaded mode shutdown: stop the client threads reading and wait for them to finish
+    void drain_client_threads();
+
+    // run config_.threads reactors sharing the listening socket
+    void run_event_loop();
+
+    // run config_.threads io_uring reactors, or run_event_loop() if io_uring is unavailable
+    void run_uring();
+
+    // run config_.threads reactors as the cores of router_
+    void run_per_core();
+
+    // pin the calling thread to the CPU configured for reactor i (no-op without cpus)
+    void pin_reactor(size_t i) const;
 
     // helper to handle single client connection
     void handle_client(int client_socket);
-};
\ No newline at end of file
+};
@@ -0,0 +1,436 @@
+#include "AppendLog.hpp"
+#include "Checksum.hpp"
+#include "Encoding.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+constexpr size_t RECORD_HEADER = 8; // u32 body length + u32 checksum
+constexpr size_t BODY_HEADER = 5;   // u8 op + u32 key length
+
+// whether records of this kind carry a u64 deadline after the key
+bool has_deadline(AppendLog::Op op) {
+    return op == AppendLog::Op::SetExpiring || op == AppendLog::Op::ExpireAt;
+}
+
+thread_local uint64_t t_last_sequence = 0;
+
+/*
+    Write a whole buffer to a file descriptor, retrying short writes.
+    Args:
+        fd: destination file descriptor
+        data: bytes to write
+        len: number of bytes
+    Returns:
+        true on success, false on error
+*/
+bool write_fully(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+    Sync the directory containing a file so that a rename or create in it is durable.
+    Args:
+        path: path of a file in the directory
+    Returns:
+        void
+*/
+void sync_parent_dir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+}
+
+/*
+    Constructor method for AppendLog class.
+    Args:
+        path: file to append records to
+        policy: when to fdatasync
+        interval: sync interval for FsyncPolicy::Interval
+    Returns:
+        void
+*/
+AppendLog::AppendLog(const std::string& path, FsyncPolicy policy, std::chrono::milliseconds interval)
+    : path_(path), fd_(-1), policy_(policy), interval_(interval) {
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw std::runtime_error("Failed to open append-only file " + path);
+    }
+    writer_ = std::thread(&AppendLog::writer_loop, this);
+}
+
+/*
+    Destructor method for AppendLog class.
+*/
+AppendLog::~AppendLog() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    work_cv_.notify_one();
+    writer_.join();
+    if (policy_ != FsyncPolicy::Never) {
+        fdatasync(fd_);
+    }
+    close(fd_);
+}
+
+/*
+    Encode a record into the pending buffer and wake the writer.
+    Args:
+        op: the mutation
+        key: key it applies to
+        value: new value (empty for deletes)
+        expires_at: deadline stored by SetExpiring and ExpireAt records
+    Returns:
+        void
+*/
+void AppendLog::append_record(Op op, std::string_view key, std::string_view value, int64_t expires_at) {
+    // build the record outside the lock; only the copy into pending_ is serialized
+    thread_local std::string record;
+    record.clear();
+    encode(op, key, value, expires_at, record);
+
+    bool was_empty;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        was_empty = pending_.empty();
+        pending_ += record;
+        t_last_sequence = ++appended_seq_;
+    }
+    if (was_empty) { // the writer only sleeps when nothing is pending
+        work_cv_.notify_one();
+    }
+}
+
+/*
+    Encode one record.
+    Args:
+        op: the mutation
+        key: key it applies to
+        value: new value (empty for deletes)
+        expires_at: deadline stored by SetExpiring and ExpireAt records
+        out: buffer the record is appended to
+    Returns:
+        void
+*/
+void AppendLog::encode(Op op, std::string_view key, std::string_view value, int64_t expires_at, std::string& out) {
+    size_t deadline_len = has_deadline(op) ? 8 : 0;
+    size_t base = out.size();
+    out.reserve(base + RECORD_HEADER + BODY_HEADER + key.size() + deadline_len + value.size());
+    encoding::put_u32(out, uint32_t(BODY_HEADER + key.size() + deadline_len + value.size()));
+    encoding::put_u32(out, 0); // checksum, filled in below
+    out.push_back(char(op));
+    encoding::put_u32(out, uint32_t(key.size()));
+    out.append(key);
+    if (deadline_len != 0) {
+        encoding::put_u64(out, uint64_t(expires_at));
+    }
+    out.append(value);
+    uint32_t crc = crc32c(out.data() + base + RECORD_HEADER, out.size() - base - RECORD_HEADER);
+    encoding::set_u32(out, base + 4, crc);
+}
+
+/*
+    Log a SET.
+    Args:
+        key: the key written
+        value: the value written
+        expires_at: unix time in ms at which the key expires (0 = never)
+    Returns:
+        void
+*/
+void AppendLog::append_set(std::string_view key, std::string_view value, int64_t expires_at) {
+    append_record(expires_at != 0 ? Op::SetExpiring : Op::Set, key, value, expires_at);
+}
+
+/*
+    Log a DEL.
+    Args:
+        key: the key removed
+    Returns:
+        void
+*/
+void AppendLog::append_del(std::string_view key) {
+    append_record(Op::Del, key, std::string_view());
+}
+
+/*
+    Log a change of expiry.
+    Args:
+        key: the key
+        expires_at: its new deadline in unix ms (0 = never expires)
+    Returns:
+        void
+*/
+void AppendLog::append_expire(std::string_view key, int64_t expires_at) {
+    append_record(Op::ExpireAt, key, std::string_view(), expires_at);
+}
+
+/*
+    Get the sequence number of the last record the calling thread appended.
+    Args:
+        none
+    Returns:
+        the sequence number (0 if this thread never appended)
+*/
+uint64_t AppendLog::thread_sequence() {
+    return t_last_sequence;
+}
+
+/*
+    Wait until a record is durable. Only Always mode makes callers wait; in the other
+    modes the reply is allowed to race ahead of the disk.
+    Args:
+        seq: sequence number returned by thread_sequence()
+    Returns:
+        false if writing the log failed, true otherwise
+*/
+bool AppendLog::wait_durable(uint64_t seq) {
+    if (policy_ != FsyncPolicy::Always) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(mtx_);
+    durable_cv_.wait(lock, [&] { return durable_seq_ >= seq || failed_; });
+    return !failed_;
+}
+
+/*
+    Writer thread: repeatedly take every pending record, write them with one syscall
+    and sync according to the policy, then release the waiting clients.
+    Args:
+        none
+    Returns:
+        void
+*/
+void AppendLog::writer_loop() {
+    std::string batch;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool unsynced = false;
+
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (true) {
+        if (pending_.empty() && !stop_ && !rotate_requested_) {
+            if (policy_ == FsyncPolicy::Interval && unsynced) {
+                work_cv_.wait_until(lock, last_sync + interval_); // wake for the deferred sync
+            } else {
+                work_cv_.wait(lock);
+            }
+        }
+        if (pending_.empty() && stop_) {
+            return;
+        }
+
+        batch.swap(pending_); // appenders keep filling the (now empty) other buffer
+        uint64_t batch_seq = appended_seq_;
+        lock.unlock();
+
+        bool ok = batch.empty() || write_fully(fd_, batch.data(), batch.size());
+        unsynced = unsynced || !batch.empty();
+        batch.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        bool sync = policy_ == FsyncPolicy::Always ||
+                    (policy_ == FsyncPolicy::Interval && unsynced && now - last_sync >= interval_);
+        if (ok && sync && unsynced) {
+            ok = fdatasync(fd_) == 0;
+            last_sync = now;
+            unsynced = false;
+        }
+        if (!ok) {
+            std::cerr << "Append-only file write failed: " << std::strerror(errno) << std::endl;
+        }
+
+        lock.lock();
+        if (ok) {
+            durable_seq_ = batch_seq;
+        } else {
+            failed_ = true;
+        }
+        if (rotate_requested_ && pending_.empty()) { // everything before the checkpoint is written
+            lock.unlock();
+            bool rotated = ok && rotate();
+            unsynced = false;
+            lock.lock();
+            rotate_ok_ = rotated;
+            rotate_requested_ = false;
+        }
+        durable_cv_.notify_all();
+    }
+}
+
+/*
+    Writer thread only: sync the current file, move it to the checkpoint path and
+    continue in a fresh file.
+    Args:
+        none
+    Returns:
+        true if the log was rotated
+*/
+bool AppendLog::rotate() {
+    std::string target = checkpoint_path(path_);
+    if (fdatasync(fd_) != 0 || rename(path_.c_str(), target.c_str()) != 0) {
+        std::cerr << "Append-only file rotation failed: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Failed to reopen append-only file: " << std::strerror(errno) << std::endl;
+        if (rename(target.c_str(), path_.c_str()) != 0) {
+            // keep appending to the renamed file; startup replays it before the main file
+            appending_to_checkpoint_ = true;
+        }
+        return false;
+    }
+    close(fd_);
+    fd_ = fd;
+    sync_parent_dir(path_);
+    return true;
+}
+
+/*
+    Begin a checkpoint by rotating the log (see header).
+    Args:
+        none
+    Returns:
+        true if end_checkpoint() may drop the checkpoint file once the snapshot is durable
+*/
+bool AppendLog::begin_checkpoint() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (access(checkpoint_path(path_).c_str(), F_OK) == 0) {
+        return !appending_to_checkpoint_; // else an earlier rotation failed halfway
+    }
+    rotate_requested_ = true;
+    work_cv_.notify_one();
+    durable_cv_.wait(lock, [&] { return !rotate_requested_; });
+    return rotate_ok_;
+}
+
+/*
+    Complete a checkpoint once its snapshot is durable.
+    Args:
+        none
+    Returns:
+        void
+*/
+void AppendLog::end_checkpoint() {
+    std::string target = checkpoint_path(path_);
+    if (unlink(target.c_str()) == 0) {
+        sync_parent_dir(target);
+    }
+}
+
+/*
+    Replay an append-only file.
+    Args:
+        path: the file to read
+        apply: called once per intact record, in log order
+    Returns:
+        number of records applied
+*/
+size_t AppendLog::replay(const std::string& path, const ApplyFn& apply) {
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0; // nothing logged yet
+        }
+        throw std::runtime_error("Failed to open append-only file " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat append-only file " + path);
+    }
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map append-only file " + path);
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    size_t applied = 0;
+    size_t offset = decode(std::string_view(static_cast<const char*>(map), size),
+                           [&](Op op, std::string_view key, std::string_view value, int64_t expires_at) {
+                               apply(op, key, value, expires_at);
+                               applied++;
+                           });
+    munmap(map, size);
+
+    if (offset < size) {
+        std::cerr << "Append-only file " << path << ": discarding " << (size - offset)
+                  << " trailing bytes of a torn record" << std::endl;
+        if (ftruncate(fd, offset) < 0) {
+            close(fd);
+            throw std::runtime_error("Failed to truncate append-only file " + path);
+        }
+    }
+    close(fd);
+    return applied;
+}
+
+/*
+    Decode the intact records at the front of a buffer.
+    Args:
+        data: encoded records, possibly ending in a partial one
+        apply: called once per intact record, in order
+    Returns:
+        bytes of data taken up by the records passed to apply
+*/
+size_t AppendLog::decode(std::string_view data, const ApplyFn& apply) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    size_t size = data.size();
+    size_t offset = 0;
+    while (offset + RECORD_HEADER <= size) {
+        uint32_t body_len = encoding::get_u32(bytes + offset);
+        uint32_t crc = encoding::get_u32(bytes + offset + 4);
+        const unsigned char* body = bytes + offset + RECORD_HEADER;
+        if (body_len < BODY_HEADER || body_len > size - offset - RECORD_HEADER ||
+            crc32c(body, body_len) != crc) {
+            break; // torn or corrupt record
+        }
+        uint32_t key_len = encoding::get_u32(body + 1);
+        if (key_len > body_len - BODY_HEADER) {
+            break;
+        }
+        Op op = static_cast<Op>(body[0]);
+        size_t deadline_len = has_deadline(op) ? 8 : 0;
+        if (deadline_len > body_len - BODY_HEADER - key_len) {
+            break;
+        }
+        std::string_view key(reinterpret_cast<const char*>(body) + BODY_HEADER, key_len);
+        int64_t expires_at = deadline_len ? int64_t(encoding::get_u64(body + BODY_HEADER + key_len)) : 0;
+        std::string_view value(key.data() + key_len + deadline_len, body_len - BODY_HEADER - key_len - deadline_len);
+        apply(op, key, value, expires_at);
+        offset += RECORD_HEADER + body_len;
+    }
+    return offset;
+}
@@ -0,0 +1,562 @@
+#include "BPlusTree.hpp"
+#include "SlabAllocator.hpp"
+#include <cstring>
+#include <new>
+
+namespace {
+constexpr unsigned LEAF_KEYS = 32;
+constexpr unsigned INNER_KEYS = 32;
+constexpr unsigned MIN_LEAF = LEAF_KEYS / 2;   // a non-root node below these is rebalanced
+constexpr unsigned MIN_INNER = INNER_KEYS / 2;
+
+/*
+    The first 8 bytes of a key as a big-endian integer, zero-padded. Heads order like
+    the keys themselves wherever they differ (bytes compare unsigned either way).
+    Args:
+        key: the key
+    Returns:
+        the head
+*/
+uint64_t head_of(std::string_view key) {
+    uint64_t head = 0;
+    size_t n = key.size() < 8 ? key.size() : 8;
+    for (size_t i = 0; i < n; i++) {
+        head |= uint64_t(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+    }
+    return head;
+}
+}
+
+// key bytes follow the header in the same allocation
+struct BPlusTree::Key {
+    uint32_t size;
+    std::string_view view() const { return std::string_view(reinterpret_cast<const char*>(this + 1), size); }
+};
+
+struct BPlusTree::Node {
+    unsigned count = 0; // keys held
+};
+
+struct BPlusTree::Leaf : Node {
+    Leaf* next = nullptr;
+    uint64_t heads[LEAF_KEYS];
+    Key* keys[LEAF_KEYS];
+};
+
+// children[i] holds the keys in [keys[i - 1], keys[i])
+struct BPlusTree::Inner : Node {
+    uint64_t heads[INNER_KEYS];
+    Key* keys[INNER_KEYS];
+    Node* children[INNER_KEYS + 1];
+};
+
+namespace {
+// three-way comparison of (head, key) against a stored key with its head
+template <typename N>
+int compare(const N* node, unsigned i, uint64_t head, std::string_view key) {
+    if (head != node->heads[i]) {
+        return head < node->heads[i] ? -1 : 1;
+    }
+    return key.compare(node->keys[i]->view());
+}
+
+// index of the first stored key >= key (inclusive) or > key
+template <typename N>
+unsigned search(const N* node, uint64_t head, std::string_view key, bool inclusive) {
+    unsigned lo = 0;
+    unsigned hi = node->count;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        int c = compare(node, mid, head, key);
+        if (c < 0 || (c == 0 && inclusive)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// open a gap at i in a node's key arrays / close the one at i
+template <typename N>
+void shift_keys_right(N* node, unsigned i) {
+    std::memmove(node->heads + i + 1, node->heads + i, (node->count - i) * sizeof(uint64_t));
+    std::memmove(node->keys + i + 1, node->keys + i, (node->count - i) * sizeof(node->keys[0]));
+}
+template <typename N>
+void shift_keys_left(N* node, unsigned i) {
+    std::memmove(node->heads + i, node->heads + i + 1, (node->count - i - 1) * sizeof(uint64_t));
+    std::memmove(node->keys + i, node->keys + i + 1, (node->count - i - 1) * sizeof(node->keys[0]));
+}
+}
+
+/*
+    Constructor method for BPlusTree::Cursor.
+    Args:
+        leaf: the leaf, or nullptr for an invalid cursor
+        pos: index in the leaf; a position past its end moves on to the next leaf
+    Returns:
+        void
+*/
+BPlusTree::Cursor::Cursor(const Leaf* leaf, unsigned pos) : leaf_(leaf), pos_(pos) {
+    if (leaf_ != nullptr && pos_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        pos_ = 0;
+    }
+}
+
+/*
+    The key at the cursor.
+    Args:
+        none
+    Returns:
+        the key's bytes, owned by the tree
+*/
+std::string_view BPlusTree::Cursor::key() const {
+    return leaf_->keys[pos_]->view();
+}
+
+/*
+    Advance to the next key in order; the cursor becomes invalid after the last one.
+    Args:
+        none
+    Returns:
+        void
+*/
+void BPlusTree::Cursor::next() {
+    if (++pos_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        pos_ = 0;
+    }
+}
+
+/*
+    Constructor method for BPlusTree class.
+    Args:
+        arena: where nodes and keys are allocated
+    Returns:
+        void
+*/
+BPlusTree::BPlusTree(SlabArena* arena) : arena_(arena) {}
+
+/*
+    Destructor method for BPlusTree class: frees every node and key.
+*/
+BPlusTree::~BPlusTree() {
+    if (root_ != nullptr) {
+        free_node(root_, height_, true);
+    }
+}
+
+/*
+    Copy key bytes into a new arena allocation.
+    Args:
+        bytes: the key
+    Returns:
+        the copy
+*/
+BPlusTree::Key* BPlusTree::make_key(std::string_view bytes) {
+    void* memory = arena_->allocate(sizeof(Key) + bytes.size());
+    Key* key = new (memory) Key{uint32_t(bytes.size())};
+    std::memcpy(key + 1, bytes.data(), bytes.size());
+    return key;
+}
+
+/*
+    Free a key made by make_key().
+    Args:
+        key: the key
+    Returns:
+        void
+*/
+void BPlusTree::free_key(Key* key) {
+    arena_->deallocate(key, sizeof(Key) + key->size);
+}
+
+/*
+    Allocate an empty leaf.
+    Args:
+        none
+    Returns:
+        the leaf
+*/
+BPlusTree::Leaf* BPlusTree::make_leaf() {
+    return new (arena_->allocate(sizeof(Leaf))) Leaf();
+}
+
+/*
+    Allocate an empty inner node.
+    Args:
+        none
+    Returns:
+        the node
+*/
+BPlusTree::Inner* BPlusTree::make_inner() {
+    return new (arena_->allocate(sizeof(Inner))) Inner();
+}
+
+/*
+    Free a node, and with recursive its keys and whole subtree too.
+    Args:
+        node: the node
+        depth: its height above the leaves (0 = leaf)
+        recursive: also free the keys it owns and its children
+    Returns:
+        void
+*/
+void BPlusTree::free_node(Node* node, unsigned depth, bool recursive) {
+    if (depth == 0) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        for (unsigned i = 0; recursive && i < leaf->count; i++) {
+            free_key(leaf->keys[i]);
+        }
+        leaf->~Leaf();
+        arena_->deallocate(leaf, sizeof(Leaf));
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (unsigned i = 0; recursive && i <= inner->count; i++) {
+        if (i < inner->count) {
+            free_key(inner->keys[i]);
+        }
+        free_node(inner->children[i], depth - 1, true);
+    }
+    inner->~Inner();
+    arena_->deallocate(inner, sizeof(Inner));
+}
+
+/*
+    Add a key.
+    Args:
+        key: the key
+    Returns:
+        true if it was added, false if it was already present
+*/
+bool BPlusTree::insert(std::string_view key) {
+    if (root_ == nullptr) {
+        root_ = make_leaf();
+        height_ = 0;
+    }
+    Split split;
+    if (!insert_at(root_, height_, key, head_of(key), split)) {
+        return false;
+    }
+    if (split.right != nullptr) { // the root split: grow a level
+        Inner* root = make_inner();
+        root->count = 1;
+        root->heads[0] = split.head;
+        root->keys[0] = split.key;
+        root->children[0] = root_;
+        root->children[1] = split.right;
+        root_ = root;
+        height_++;
+    }
+    size_++;
+    return true;
+}
+
+/*
+    Insert into a subtree, splitting full nodes on the way back up.
+    Args:
+        node: root of the subtree
+        depth: its height above the leaves
+        key, head: the key and its head
+        split: receives the separator and new right node if node split
+    Returns:
+        false if the key was already present
+*/
+bool BPlusTree::insert_at(Node* node, unsigned depth, std::string_view key, uint64_t head, Split& split) {
+    split.right = nullptr;
+    if (depth == 0) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        unsigned i = search(leaf, head, key, true);
+        if (i < leaf->count && compare(leaf, i, head, key) == 0) {
+            return false;
+        }
+        Leaf* target = leaf;
+        if (leaf->count == LEAF_KEYS) { // split: the upper half moves to a new right leaf
+            Leaf* right = make_leaf();
+            unsigned half = LEAF_KEYS / 2;
+            right->count = LEAF_KEYS - half;
+            std::memcpy(right->heads, leaf->heads + half, right->count * sizeof(uint64_t));
+            std::memcpy(right->keys, leaf->keys + half, right->count * sizeof(Key*));
+            leaf->count = half;
+            right->next = leaf->next;
+            leaf->next = right;
+            if (i > half) {
+                target = right;
+                i -= half;
+            }
+            split.right = right;
+        }
+        shift_keys_right(target, i);
+        target->heads[i] = head;
+        target->keys[i] = make_key(key);
+        target->count++;
+        if (split.right != nullptr) {
+            Leaf* right = static_cast<Leaf*>(split.right);
+            split.head = right->heads[0];
+            split.key = make_key(right->keys[0]->view());
+        }
+        return true;
+    }
+
+    Inner* inner = static_cast<Inner*>(node);
+    unsigned c = search(inner, head, key, false);
+    Split below;
+    if (!insert_at(inner->children[c], depth - 1, key, head, below)) {
+        return false;
+    }
+    if (below.right == nullptr) {
+        return true;
+    }
+    if (inner->count < INNER_KEYS) {
+        shift_keys_right(inner, c);
+        std::memmove(inner->children + c + 2, inner->children + c + 1, (inner->count - c) * sizeof(Node*));
+        inner->heads[c] = below.head;
+        inner->keys[c] = below.key;
+        inner->children[c + 1] = below.right;
+        inner->count++;
+        return true;
+    }
+
+    // full: lay out the INNER_KEYS + 1 separators in order, keep the lower half, push the
+    // middle one up and move the rest to a new right node
+    uint64_t heads[INNER_KEYS + 1];
+    Key* keys[INNER_KEYS + 1];
+    Node* children[INNER_KEYS + 2];
+    for (unsigned j = 0, src = 0; j <= INNER_KEYS; j++) {
+        if (j == c) {
+            heads[j] = below.head;
+            keys[j] = below.key;
+        } else {
+            heads[j] = inner->heads[src];
+            keys[j] = inner->keys[src];
+            src++;
+        }
+    }
+    for (unsigned j = 0, src = 0; j <= INNER_KEYS + 1; j++) {
+        children[j] = j == c + 1 ? below.right : inner->children[src++];
+    }
+    unsigned mid = (INNER_KEYS + 1) / 2;
+    Inner* right = make_inner();
+    inner->count = mid;
+    std::memcpy(inner->heads, heads, mid * sizeof(uint64_t));
+    std::memcpy(inner->keys, keys, mid * sizeof(Key*));
+    std::memcpy(inner->children, children, (mid + 1) * sizeof(Node*));
+    right->count = INNER_KEYS - mid;
+    std::memcpy(right->heads, heads + mid + 1, right->count * sizeof(uint64_t));
+    std::memcpy(right->keys, keys + mid + 1, right->count * sizeof(Key*));
+    std::memcpy(right->children, children + mid + 1, (right->count + 1) * sizeof(Node*));
+    split.head = heads[mid];
+    split.key = keys[mid];
+    split.right = right;
+    return true;
+}
+
+/*
+    Remove a key.
+    Args:
+        key: the key
+    Returns:
+        true if it was removed, false if it was absent
+*/
+bool BPlusTree::erase(std::string_view key) {
+    if (root_ == nullptr || !erase_at(root_, height_, key, head_of(key))) {
+        return false;
+    }
+    size_--;
+    if (height_ > 0 && root_->count == 0) { // the root lost its last separator: drop a level
+        Inner* old = static_cast<Inner*>(root_);
+        root_ = old->children[0];
+        free_node(old, height_, false);
+        height_--;
+    } else if (height_ == 0 && root_->count == 0) {
+        free_node(root_, 0, false);
+        root_ = nullptr;
+    }
+    return true;
+}
+
+/*
+    Erase from a subtree, rebalancing a child that fell below the minimum on the way
+    back up.
+    Args:
+        node: root of the subtree
+        depth: its height above the leaves
+        key, head: the key and its head
+    Returns:
+        false if the key was absent
+*/
+bool BPlusTree::erase_at(Node* node, unsigned depth, std::string_view key, uint64_t head) {
+    if (depth == 0) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        unsigned i = search(leaf, head, key, true);
+        if (i == leaf->count || compare(leaf, i, head, key) != 0) {
+            return false;
+        }
+        free_key(leaf->keys[i]);
+        shift_keys_left(leaf, i);
+        leaf->count--;
+        return true;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    unsigned c = search(inner, head, key, false);
+    if (!erase_at(inner->children[c], depth - 1, key, head)) {
+        return false;
+    }
+    if (depth == 1 && inner->children[c]->count < MIN_LEAF) {
+        rebalance_leaf(inner, c);
+    } else if (depth > 1 && inner->children[c]->count < MIN_INNER) {
+        rebalance_inner(inner, c);
+    }
+    return true;
+}
+
+/*
+    Bring an underfull leaf back to the minimum: borrow a key from a sibling that can
+    spare one, or merge with a sibling. The parent's separators are copies, so they are
+    remade when a leaf's first key changes.
+    Args:
+        parent: the leaf's parent
+        c: the leaf's index among its children
+    Returns:
+        void
+*/
+void BPlusTree::rebalance_leaf(Inner* parent, unsigned c) {
+    Leaf* child = static_cast<Leaf*>(parent->children[c]);
+    Leaf* left = c > 0 ? static_cast<Leaf*>(parent->children[c - 1]) : nullptr;
+    Leaf* right = c < parent->count ? static_cast<Leaf*>(parent->children[c + 1]) : nullptr;
+    if (left != nullptr && left->count > MIN_LEAF) {
+        shift_keys_right(child, 0);
+        left->count--;
+        child->heads[0] = left->heads[left->count];
+        child->keys[0] = left->keys[left->count];
+        child->count++;
+        free_key(parent->keys[c - 1]);
+        parent->heads[c - 1] = child->heads[0];
+        parent->keys[c - 1] = make_key(child->keys[0]->view());
+        return;
+    }
+    if (right != nullptr && right->count > MIN_LEAF) {
+        child->heads[child->count] = right->heads[0];
+        child->keys[child->count] = right->keys[0];
+        child->count++;
+        shift_keys_left(right, 0);
+        right->count--;
+        free_key(parent->keys[c]);
+        parent->heads[c] = right->heads[0];
+        parent->keys[c] = make_key(right->keys[0]->view());
+        return;
+    }
+    // merge the pair (left, child) or (child, right) into its left leaf
+    unsigned i = left != nullptr ? c - 1 : c;
+    Leaf* into = static_cast<Leaf*>(parent->children[i]);
+    Leaf* from = static_cast<Leaf*>(parent->children[i + 1]);
+    std::memcpy(into->heads + into->count, from->heads, from->count * sizeof(uint64_t));
+    std::memcpy(into->keys + into->count, from->keys, from->count * sizeof(Key*));
+    into->count += from->count;
+    into->next = from->next;
+    free_node(from, 0, false);
+    free_key(parent->keys[i]);
+    shift_keys_left(parent, i);
+    std::memmove(parent->children + i + 1, parent->children + i + 2, (parent->count - i - 1) * sizeof(Node*));
+    parent->count--;
+}
+
+/*
+    Bring an underfull inner node back to the minimum, rotating a separator through
+    the parent from a sibling that can spare one, or merging with a sibling around the
+    parent's separator.
+    Args:
+        parent: the node's parent
+        c: the node's index among its children
+    Returns:
+        void
+*/
+void BPlusTree::rebalance_inner(Inner* parent, unsigned c) {
+    Inner* child = static_cast<Inner*>(parent->children[c]);
+    Inner* left = c > 0 ? static_cast<Inner*>(parent->children[c - 1]) : nullptr;
+    Inner* right = c < parent->count ? static_cast<Inner*>(parent->children[c + 1]) : nullptr;
+    if (left != nullptr && left->count > MIN_INNER) {
+        shift_keys_right(child, 0);
+        std::memmove(child->children + 1, child->children, (child->count + 1) * sizeof(Node*));
+        child->heads[0] = parent->heads[c - 1];
+        child->keys[0] = parent->keys[c - 1];
+        child->children[0] = left->children[left->count];
+        child->count++;
+        left->count--;
+        parent->heads[c - 1] = left->heads[left->count];
+        parent->keys[c - 1] = left->keys[left->count];
+        return;
+    }
+    if (right != nullptr && right->count > MIN_INNER) {
+        child->heads[child->count] = parent->heads[c];
+        child->keys[child->count] = parent->keys[c];
+        child->children[child->count + 1] = right->children[0];
+        child->count++;
+        parent->heads[c] = right->heads[0];
+        parent->keys[c] = right->keys[0];
+        shift_keys_left(right, 0);
+        std::memmove(right->children, right->children + 1, right->count * sizeof(Node*));
+        right->count--;
+        return;
+    }
+    unsigned i = left != nullptr ? c - 1 : c;
+    Inner* into = static_cast<Inner*>(parent->children[i]);
+    Inner* from = static_cast<Inner*>(parent->children[i + 1]);
+    into->heads[into->count] = parent->heads[i];
+    into->keys[into->count] = parent->keys[i];
+    std::memcpy(into->heads + into->count + 1, from->heads, from->count * sizeof(uint64_t));
+    std::memcpy(into->keys + into->count + 1, from->keys, from->count * sizeof(Key*));
+    std::memcpy(into->children + into->count + 1, from->children, (from->count + 1) * sizeof(Node*));
+    into->count += from->count + 1;
+    free_node(from, 1, false);
+    shift_keys_left(parent, i);
+    std::memmove(parent->children + i + 1, parent->children + i + 2, (parent->count - i - 1) * sizeof(Node*));
+    parent->count--;
+}
+
+/*
+    Position a cursor at the first key not less than a key.
+    Args:
+        key: the bound
+    Returns:
+        the cursor (invalid if every key is less)
+*/
+BPlusTree::Cursor BPlusTree::lower_bound(std::string_view key) const {
+    return seek(key, true);
+}
+
+/*
+    Position a cursor at the first key greater than a key.
+    Args:
+        key: the bound
+    Returns:
+        the cursor (invalid if no key is greater)
+*/
+BPlusTree::Cursor BPlusTree::upper_bound(std::string_view key) const {
+    return seek(key, false);
+}
+
+/*
+    Descend to the leaf that holds key's position.
+    Args:
+        key: the bound
+        inclusive: stop at a key equal to it rather than after it
+    Returns:
+        the cursor
+*/
+BPlusTree::Cursor BPlusTree::seek(std::string_view key, bool inclusive) const {
+    if (root_ == nullptr) {
+        return Cursor(nullptr, 0);
+    }
+    uint64_t head = head_of(key);
+    const Node* node = root_;
+    for (unsigned depth = height_; depth > 0; depth--) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        node = inner->children[search(inner, head, key, false)];
+    }
+    const Leaf* leaf = static_cast<const Leaf*>(node);
+    return Cursor(leaf, search(leaf, head, key, inclusive));
+}
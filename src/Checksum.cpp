@@ -0,0 +1,123 @@
+#include "Checksum.hpp"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+constexpr uint32_t CRC32C_POLY = 0x82F63B78; // reflected Castagnoli polynomial
+constexpr uint16_t CRC16_POLY = 0x1021;       // XMODEM / CCITT polynomial
+
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+struct Crc16Table {
+    uint16_t entries[256];
+
+    Crc16Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint16_t crc = uint16_t(i << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = uint16_t(crc << 1) ^ (crc & 0x8000 ? CRC16_POLY : 0);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+/*
+    Portable byte-at-a-time CRC-32C.
+    Args:
+        p: data to checksum
+        len: number of bytes
+        crc: running (inverted) checksum
+    Returns:
+        the updated running checksum
+*/
+uint32_t crc32c_table(const unsigned char* p, size_t len, uint32_t crc) {
+    static const Crc32cTable table;
+    while (len--) {
+        crc = table.entries[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+/*
+    CRC-32C using the SSE4.2 crc32 instruction, 8 bytes per step.
+    Args:
+        p: data to checksum
+        len: number of bytes
+        crc: running (inverted) checksum
+    Returns:
+        the updated running checksum
+*/
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(const unsigned char* p, size_t len, uint32_t crc) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+}
+
+/*
+    Compute the CRC-32C of a buffer.
+    Args:
+        data: bytes to checksum
+        len: number of bytes
+        seed: checksum of the preceding data, or 0 to start fresh
+    Returns:
+        the checksum
+*/
+uint32_t crc32c(const void* data, size_t len, uint32_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint32_t crc = ~seed;
+#if defined(__x86_64__)
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) {
+        return ~crc32c_hw(p, len, crc);
+    }
+#endif
+    return ~crc32c_table(p, len, crc);
+}
+
+/*
+    Compute the CRC-16/XMODEM of a buffer.
+    Args:
+        data: bytes to checksum
+        len: number of bytes
+    Returns:
+        the checksum
+*/
+uint16_t crc16(const void* data, size_t len) {
+    static const Crc16Table table;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint16_t crc = 0;
+    while (len--) {
+        crc = uint16_t(crc << 8) ^ table.entries[((crc >> 8) ^ *p++) & 0xFF];
+    }
+    return crc;
+}
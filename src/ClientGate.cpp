@@ -0,0 +1,100 @@
+#include "ClientLimits.hpp"
+#include "Stats.hpp"
+#include <stdexcept>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+constexpr char MAX_CLIENTS_ERROR[] = "ERROR: max number of clients reached\n";
+constexpr char SHUTTING_DOWN_ERROR[] = "ERROR: server is shutting down\n";
+constexpr char INPUT_LIMIT_ERROR[] = "ERROR: request exceeds the input buffer limit";
+
+// best effort, without blocking: the socket is closed right after
+void refuse(int fd, const char* message, size_t length) {
+    ssize_t sent = send(fd, message, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+    (void)sent;
+    close(fd);
+}
+}
+
+/*
+    Constructor method for ClientGate class.
+    Args:
+        limits: the limits enforced for every client
+    Returns:
+        void
+*/
+ClientGate::ClientGate(const ClientLimits& limits) : limits_(limits) {
+    shutdown_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shutdown_fd_ < 0) {
+        throw std::runtime_error("Failed to create eventfd");
+    }
+}
+
+/*
+    Destructor method for ClientGate class.
+*/
+ClientGate::~ClientGate() {
+    close(shutdown_fd_);
+}
+
+/*
+    Admit a newly accepted client, or turn it away if max_clients are already connected.
+    A rejected client gets a text error line (best effort, without blocking) and its
+    socket is closed. So does one accepted in the moment between shut_down() and its
+    reactor noticing it.
+    Args:
+        fd: the accepted socket
+    Returns:
+        true if the client may be served (release() it when it disconnects)
+*/
+bool ClientGate::admit(int fd) {
+    if (shutting_down()) {
+        refuse(fd, SHUTTING_DOWN_ERROR, sizeof(SHUTTING_DOWN_ERROR) - 1);
+        return false;
+    }
+    size_t before = clients_.fetch_add(1, std::memory_order_relaxed);
+    if (limits_.max_clients == 0 || before < limits_.max_clients) {
+        return true;
+    }
+    clients_.fetch_sub(1, std::memory_order_relaxed);
+    refuse(fd, MAX_CLIENTS_ERROR, sizeof(MAX_CLIENTS_ERROR) - 1);
+    Stats::instance().connection_rejected();
+    return false;
+}
+
+/*
+    Begin a graceful shutdown. Only an atomic store and a write(), so it is safe to call
+    from a signal handler; the eventfd is never read, so it stays readable for every
+    thread that watches it.
+    Args:
+        none
+    Returns:
+        void
+*/
+void ClientGate::shut_down() {
+    shutting_down_.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    ssize_t written = write(shutdown_fd_, &one, sizeof(one));
+    (void)written;
+}
+
+/*
+    Reply to a request that outgrew max_input; the caller closes the connection after
+    sending it.
+    Args:
+        framing: the connection's framing
+        out: output buffer the error is appended to
+    Returns:
+        void
+*/
+void ClientGate::reject_input(Framing framing, WriteBuffer& out) const {
+    if (framing == Framing::Binary) {
+        protocol::binary::append_response(out.bytes(), protocol::binary::Status::Error, INPUT_LIMIT_ERROR);
+    } else {
+        out.bytes().append(INPUT_LIMIT_ERROR).push_back('\n');
+    }
+    Stats::instance().input_overflow();
+}
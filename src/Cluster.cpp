@@ -0,0 +1,166 @@
+#include "Cluster.hpp"
+#include "Checksum.hpp"
+#include <charconv>
+#include <stdexcept>
+
+namespace cluster {
+
+/*
+    Hash a key to its slot, honouring a {hash tag}.
+    Args:
+        key: the key
+    Returns:
+        the slot, below SLOTS
+*/
+uint16_t key_slot(std::string_view key) {
+    size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close > open + 1) {
+            key = key.substr(open + 1, close - open - 1);
+        }
+    }
+    return uint16_t(crc16(key.data(), key.size()) & (SLOTS - 1));
+}
+
+/*
+    Split a node address into host and port.
+    Args:
+        text: "host:port"
+        host: receives the host
+        port: receives the port
+    Returns:
+        false if there is no host or no valid port
+*/
+bool parse_address(std::string_view text, std::string& host, int& port) {
+    size_t colon = text.rfind(':');
+    if (colon == std::string_view::npos || colon == 0) {
+        return false;
+    }
+    std::string_view digits = text.substr(colon + 1);
+    auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), port);
+    if (ec != std::errc() || end != digits.data() + digits.size() || port <= 0 || port > 65535) {
+        return false;
+    }
+    host.assign(text.substr(0, colon));
+    return true;
+}
+
+}
+
+/*
+    Constructor method for SlotMap class: no slot has a node yet.
+    Args:
+        none
+    Returns:
+        void
+*/
+SlotMap::SlotMap() : owners_(cluster::SLOTS, NO_NODE) {}
+
+/*
+    Parse a layout specification.
+    Args:
+        spec: comma-separated "first[-last]@host:port" entries
+    Returns:
+        the map (throws std::runtime_error on a malformed or overlapping entry)
+*/
+SlotMap SlotMap::parse(std::string_view spec) {
+    SlotMap map;
+    while (!spec.empty()) {
+        size_t comma = spec.find(',');
+        std::string_view entry = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+
+        size_t at = entry.find('@');
+        std::string host;
+        int port = 0;
+        unsigned first = 0, last = 0;
+        bool valid = at != std::string_view::npos && cluster::parse_address(entry.substr(at + 1), host, port);
+        if (valid) {
+            const char* p = entry.data();
+            const char* end = entry.data() + at;
+            auto [next, ec] = std::from_chars(p, end, first);
+            last = first;
+            valid = ec == std::errc();
+            if (valid && next != end) {
+                auto [tail, ec2] = std::from_chars(next + 1, end, last);
+                valid = *next == '-' && ec2 == std::errc() && tail == end;
+            }
+        }
+        if (!valid || first > last || last >= cluster::SLOTS || !map.assign(uint16_t(first), uint16_t(last), host, port)) {
+            throw std::runtime_error("Invalid cluster slot range '" + std::string(entry) + "'");
+        }
+    }
+    return map;
+}
+
+/*
+    Give a range of slots to a node.
+    Args:
+        first: first slot
+        last: last slot (inclusive)
+        host: node host
+        port: node port
+    Returns:
+        false if the range is invalid or overlaps slots already assigned (nothing changes)
+*/
+bool SlotMap::assign(uint16_t first, uint16_t last, std::string_view host, int port) {
+    if (first > last || last >= cluster::SLOTS) {
+        return false;
+    }
+    for (size_t slot = first; slot <= last; slot++) {
+        if (owners_[slot] != NO_NODE) {
+            return false;
+        }
+    }
+    uint32_t index = find(host, port);
+    if (index == NO_NODE) {
+        index = uint32_t(nodes_.size());
+        nodes_.push_back(Node{std::string(host), port});
+    }
+    for (size_t slot = first; slot <= last; slot++) {
+        owners_[slot] = index;
+    }
+    assigned_ += size_t(last - first) + 1;
+    return true;
+}
+
+/*
+    Look a node up by address.
+    Args:
+        host: node host, as given in the layout
+        port: node port
+    Returns:
+        the node's index, or NO_NODE
+*/
+uint32_t SlotMap::find(std::string_view host, int port) const {
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        if (nodes_[i].port == port && nodes_[i].host == host) {
+            return uint32_t(i);
+        }
+    }
+    return NO_NODE;
+}
+
+/*
+    The layout as ranges of consecutive slots served by the same node.
+    Args:
+        none
+    Returns:
+        the ranges in slot order; unassigned slots are left out
+*/
+std::vector<SlotMap::Range> SlotMap::ranges() const {
+    std::vector<Range> ranges;
+    for (size_t slot = 0; slot < cluster::SLOTS; slot++) {
+        uint32_t node = owners_[slot];
+        if (node == NO_NODE) {
+            continue;
+        }
+        if (!ranges.empty() && ranges.back().node == node && ranges.back().last + 1u == slot) {
+            ranges.back().last = uint16_t(slot);
+        } else {
+            ranges.push_back(Range{uint16_t(slot), uint16_t(slot), node});
+        }
+    }
+    return ranges;
+}
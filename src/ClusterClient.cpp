@@ -0,0 +1,485 @@
+#include "ClusterClient.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+constexpr size_t NO_LINK = size_t(-1);
+constexpr std::string_view MOVED = "ERROR: MOVED ";
+
+/*
+    Open a connection to a node.
+    Args:
+        host: node host
+        port: node port
+    Returns:
+        a non-blocking socket with TCP_NODELAY (throws std::runtime_error on failure)
+*/
+int connect_node(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0) {
+        throw std::runtime_error("Cannot resolve " + host);
+    }
+    int fd = -1;
+    for (addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot connect to cluster node " + host + ":" + service);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/*
+    Parse a CLUSTER SLOTS reply.
+    Args:
+        body: "<first> <last> <host>:<port>" lines, then END
+        slots: receives the layout
+    Returns:
+        false if the reply is malformed
+*/
+bool parse_slots(std::string_view body, SlotMap& slots) {
+    slots = SlotMap();
+    while (!body.empty()) {
+        size_t nl = body.find('\n');
+        std::string_view line = body.substr(0, nl);
+        body = nl == std::string_view::npos ? std::string_view() : body.substr(nl + 1);
+        if (line == "END") {
+            return true;
+        }
+        int64_t first = 0, last = 0;
+        std::string host;
+        int port = 0;
+        bool valid = protocol::parse_int(protocol::next_token(line), first) &&
+                     protocol::parse_int(protocol::next_token(line), last) &&
+                     cluster::parse_address(protocol::next_token(line), host, port) && first >= 0 &&
+                     first <= last && last < int64_t(cluster::SLOTS) && // both fit a uint16_t slot
+                     slots.assign(uint16_t(first), uint16_t(last), host, port);
+        if (!valid) {
+            return false;
+        }
+    }
+    return false;
+}
+}
+
+/*
+    Constructor method for ClusterClient class.
+    Args:
+        host: seed node host
+        port: seed node port
+    Returns:
+        void
+*/
+ClusterClient::ClusterClient(std::string host, int port) : seed_host_(std::move(host)), seed_port_(port) {
+    refresh();
+}
+
+/*
+    Destructor method for ClusterClient class.
+    Args:
+        none
+    Returns:
+        void
+*/
+ClusterClient::~ClusterClient() {
+    for (Link& link : links_) {
+        if (link.fd >= 0) {
+            close(link.fd);
+        }
+    }
+}
+
+/*
+    Queue a GET.
+    Args:
+        key: the key
+    Returns:
+        void
+*/
+void ClusterClient::get(std::string_view key) {
+    queue(protocol::binary::Opcode::Get, key, std::string_view(), cluster::key_slot(key));
+}
+
+/*
+    Queue a SET.
+    Args:
+        key: the key
+        value: the value
+    Returns:
+        void
+*/
+void ClusterClient::set(std::string_view key, std::string_view value) {
+    queue(protocol::binary::Opcode::Set, key, value, cluster::key_slot(key));
+}
+
+/*
+    Queue a DEL.
+    Args:
+        key: the key
+    Returns:
+        void
+*/
+void ClusterClient::del(std::string_view key) {
+    queue(protocol::binary::Opcode::Del, key, std::string_view(), cluster::key_slot(key));
+}
+
+/*
+    Queue a text command, sent wrapped in a Text frame to the node of its first argument
+    (a command without arguments goes to the node of slot 0).
+    Args:
+        line: the command line
+    Returns:
+        void
+*/
+void ClusterClient::command(std::string_view line) {
+    std::string_view rest = line;
+    protocol::next_token(rest); // the verb
+    queue(protocol::binary::Opcode::Text, std::string_view(), line, cluster::key_slot(protocol::next_token(rest)));
+}
+
+/*
+    Append a request to the batch.
+    Args:
+        op: request opcode
+        key: the key (empty for Text)
+        value: the value, or the command line for Text
+        slot: the slot the request is routed by
+    Returns:
+        void
+*/
+void ClusterClient::queue(protocol::binary::Opcode op, std::string_view key, std::string_view value, uint16_t slot) {
+    batch_.push_back(Request{op, slot, uint32_t(data_.size()), uint32_t(key.size()), uint32_t(value.size())});
+    data_.append(key);
+    data_.append(value);
+}
+
+/*
+    Write as much of a link's frames as the socket takes.
+    Args:
+        link: the link
+    Returns:
+        true if frames are left to write (wait for POLLOUT), false when all are written
+*/
+bool ClusterClient::write_some(Link& link) {
+    while (link.out_offset < link.out.size()) {
+        ssize_t n = send(link.fd, link.out.data() + link.out_offset, link.out.size() - link.out_offset, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            throw std::runtime_error("write to cluster node " + link.host + ":" + std::to_string(link.port) +
+                                     " failed: " + std::strerror(errno));
+        }
+        link.out_offset += size_t(n);
+    }
+    link.out.clear();
+    link.out_offset = 0;
+    return false;
+}
+
+/*
+    Read what a link has received and hand over its complete replies.
+    Args:
+        link: the link
+        on_reply: called for each complete reply, in order
+    Returns:
+        false if the node closed the connection or sent a malformed frame
+*/
+template <typename OnReply>
+bool ClusterClient::read_some(Link& link, OnReply& on_reply) {
+    using namespace protocol::binary;
+    char buf[65536];
+    ssize_t n = read(link.fd, buf, sizeof(buf));
+    if (n <= 0) {
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    link.in.append(buf, size_t(n));
+    Response resp;
+    size_t consumed = 0;
+    while (link.answered < link.waiting.size()) {
+        ParseResult result = parse_response(std::string_view(link.in).substr(link.in_offset), resp, consumed);
+        if (result == ParseResult::Incomplete) {
+            break;
+        }
+        if (result == ParseResult::Invalid) {
+            return false;
+        }
+        on_reply(link, link.answered++, resp);
+        link.in_offset += consumed;
+    }
+    if (link.in_offset == link.in.size()) {
+        link.in.clear();
+        link.in_offset = 0;
+    } else if (link.in_offset > (1 << 20)) {
+        link.in.erase(0, link.in_offset);
+        link.in_offset = 0;
+    }
+    return true;
+}
+
+/*
+    Drive all links until every queued frame is written and answered.
+    Args:
+        on_reply: called with the link, the reply's position on it and the reply
+    Returns:
+        void (throws std::runtime_error on a connection error or timeout)
+*/
+template <typename OnReply>
+void ClusterClient::exchange(OnReply&& on_reply) {
+    std::vector<pollfd> fds;
+    std::vector<size_t> polled;
+    while (true) {
+        fds.clear();
+        polled.clear();
+        for (size_t i = 0; i < links_.size(); i++) {
+            Link& link = links_[i];
+            bool writing = link.out_offset < link.out.size() && write_some(link);
+            if (link.answered == link.waiting.size()) {
+                continue;
+            }
+            fds.push_back(pollfd{link.fd, short(POLLIN | (writing ? POLLOUT : 0)), 0});
+            polled.push_back(i);
+        }
+        if (fds.empty()) {
+            return;
+        }
+        int n = poll(fds.data(), nfds_t(fds.size()), TIMEOUT_MS);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(n == 0 ? "cluster node timed out" : "poll failed");
+        }
+        for (size_t k = 0; k < fds.size(); k++) {
+            Link& link = links_[polled[k]];
+            if ((fds[k].revents & (POLLIN | POLLERR | POLLHUP)) && !read_some(link, on_reply)) {
+                throw std::runtime_error("lost connection to cluster node " + link.host + ":" + std::to_string(link.port));
+            }
+        }
+    }
+}
+
+/*
+    Run the batch: every node gets its requests in one pipelined stream, all nodes are
+    served at once, and redirected requests are resent once the layout is reloaded.
+    Args:
+        replies: receives one reply per queued request, in queue order
+    Returns:
+        void (throws std::runtime_error if a node fails)
+*/
+void ClusterClient::execute(std::vector<Reply>& replies) {
+    using namespace protocol::binary;
+    if (stale_) {
+        try {
+            refresh();
+        } catch (...) {
+            batch_.clear();
+            data_.clear();
+            throw;
+        }
+    }
+    replies.resize(batch_.size());
+    std::vector<size_t> todo(batch_.size());
+    for (size_t i = 0; i < todo.size(); i++) {
+        todo[i] = i;
+    }
+    std::vector<size_t> moved;
+    std::string target; // the node the last redirect named
+    try {
+        for (int attempt = 0; !todo.empty(); attempt++) {
+            for (size_t i : todo) {
+                const Request& req = batch_[i];
+                uint32_t node = slots_.owner(req.slot);
+                if (node == SlotMap::NO_NODE) {
+                    replies[i].status = Status::Error;
+                    replies[i].body = "ERROR: CLUSTERDOWN hash slot " + std::to_string(req.slot) + " is not served";
+                    continue;
+                }
+                if (node_links_[node] == NO_LINK) {
+                    node_links_[node] = link_for(slots_.node(node).host, slots_.node(node).port);
+                }
+                Link& link = links_[node_links_[node]];
+                std::string_view key(data_.data() + req.key_offset, req.key_length);
+                std::string_view value(data_.data() + req.key_offset + req.key_length, req.value_length);
+                append_request(link.out, req.op, key, value);
+                link.waiting.push_back(i);
+            }
+
+            moved.clear();
+            exchange([&](Link& link, size_t nth, const Response& resp) {
+                Reply& reply = replies[link.waiting[nth]];
+                reply.status = resp.status;
+                reply.body.assign(resp.body);
+                if (resp.status == Status::Error && resp.body.compare(0, MOVED.size(), MOVED) == 0) {
+                    moved.push_back(link.waiting[nth]);
+                    std::string_view rest = resp.body.substr(MOVED.size());
+                    protocol::next_token(rest); // the slot
+                    target.assign(protocol::next_token(rest));
+                }
+            });
+            for (Link& link : links_) {
+                link.waiting.clear();
+                link.answered = 0;
+            }
+            if (moved.empty() || attempt == MAX_REDIRECTS) {
+                break; // still moved after MAX_REDIRECTS: the MOVED errors are the replies
+            }
+            redirects_ += moved.size();
+            std::string host;
+            int port = 0;
+            if (!cluster::parse_address(target, host, port)) {
+                break;
+            }
+            load_slots(link_for(host, port));
+            todo.swap(moved);
+        }
+    } catch (...) {
+        batch_.clear();
+        data_.clear();
+        disconnect();
+        throw;
+    }
+    batch_.clear();
+    data_.clear();
+}
+
+/*
+    Reload the layout, from the seed node or else from any node of the cached layout.
+    Args:
+        none
+    Returns:
+        void (throws std::runtime_error if no node could provide it)
+*/
+void ClusterClient::refresh() {
+    std::vector<SlotMap::Node> candidates{SlotMap::Node{seed_host_, seed_port_}};
+    for (size_t node = 0; node < slots_.nodes(); node++) {
+        candidates.push_back(slots_.node(uint32_t(node)));
+    }
+    std::string error;
+    for (const SlotMap::Node& node : candidates) {
+        try {
+            load_slots(link_for(node.host, node.port));
+            stale_ = false;
+            return;
+        } catch (const std::exception& e) {
+            disconnect();
+            if (error.empty()) {
+                error = e.what();
+            }
+        }
+    }
+    throw std::runtime_error(error);
+}
+
+/*
+    Find the connection to a node, opening it if there is none.
+    Args:
+        host: node host
+        port: node port
+    Returns:
+        the index of the link
+*/
+size_t ClusterClient::link_for(std::string_view host, int port) {
+    size_t index = 0;
+    while (index < links_.size() && !(links_[index].port == port && links_[index].host == host)) {
+        index++;
+    }
+    if (index == links_.size()) {
+        links_.emplace_back();
+        links_.back().host.assign(host);
+        links_.back().port = port;
+    }
+    if (links_[index].fd < 0) {
+        links_[index].fd = connect_node(links_[index].host, port);
+    }
+    return index;
+}
+
+/*
+    Fetch the layout with CLUSTER SLOTS over a link and map its nodes to links.
+    Args:
+        link: the link to ask
+    Returns:
+        void (throws std::runtime_error if the reply is an error or malformed)
+*/
+void ClusterClient::load_slots(size_t link) {
+    using namespace protocol::binary;
+    append_request(links_[link].out, Opcode::Text, std::string_view(), "CLUSTER SLOTS");
+    links_[link].waiting.push_back(0);
+    SlotMap slots;
+    std::string error;
+    exchange([&](Link&, size_t, const Response& resp) {
+        if (resp.status != Status::Ok) {
+            error.assign(resp.body);
+        } else if (!parse_slots(resp.body, slots)) {
+            error = "malformed CLUSTER SLOTS reply";
+        }
+    });
+    links_[link].waiting.clear();
+    links_[link].answered = 0;
+    if (!error.empty()) {
+        throw std::runtime_error(links_[link].host + ":" + std::to_string(links_[link].port) + ": " + error);
+    }
+    slots_ = std::move(slots);
+    node_links_.assign(slots_.nodes(), NO_LINK);
+    for (size_t node = 0; node < slots_.nodes(); node++) {
+        for (size_t i = 0; i < links_.size(); i++) {
+            if (links_[i].fd >= 0 && links_[i].port == slots_.node(uint32_t(node)).port &&
+                links_[i].host == slots_.node(uint32_t(node)).host) {
+                node_links_[node] = i;
+            }
+        }
+    }
+}
+
+/*
+    Close every connection after a failure, dropping whatever was in flight on them
+    (their replies could no longer be matched to requests).
+    Args:
+        none
+    Returns:
+        void
+*/
+void ClusterClient::disconnect() {
+    for (Link& link : links_) {
+        if (link.fd >= 0) {
+            close(link.fd);
+            link.fd = -1;
+        }
+        link.out.clear();
+        link.out_offset = 0;
+        link.in.clear();
+        link.in_offset = 0;
+        link.waiting.clear();
+        link.answered = 0;
+    }
+    node_links_.assign(slots_.nodes(), NO_LINK);
+    stale_ = true;
+}
@@ -0,0 +1,1170 @@
+#include "CommandHandler.hpp"
+#include "Snapshot.hpp"
+#include "Replication.hpp"
+#include "Cluster.hpp"
+#include "Encoding.hpp"
+#include "Stats.hpp"
+#include "SlowLog.hpp"
+#include "CycleClock.hpp"
+#include <cstdio>
+#include <cstdint>
+
+/*
+    Constructor method for CommandHandler class.
+    Args:
+        store: reference to the KVStore instance
+    Returns:
+        void
+*/
+CommandHandler::CommandHandler(KVStore& store) : store_(store) {}
+
+/*
+    Execute all complete requests in a read buffer. Responses are appended so that
+    callers can batch the replies of a whole pipelined read into one write; a trailing
+    partial request stays buffered until the rest of it arrives. The first byte a
+    connection sends selects its framing: the binary request magic, or text otherwise.
+    Args:
+        in: receive buffer; complete requests are consumed from it
+        out: output buffer responses are appended to
+        framing: the connection's framing (Unknown until the first byte arrives)
+        output_limit: stop before a request once out holds this many bytes (0 = never)
+    Returns:
+        false if the connection sent a malformed binary frame, true otherwise
+*/
+bool CommandHandler::process(ReadBuffer& in, WriteBuffer& out, Framing& framing, size_t output_limit) {
+    if (framing == Framing::Unknown) {
+        if (in.empty()) {
+            return true;
+        }
+        framing = uint8_t(in.data()[0]) == protocol::binary::REQUEST_MAGIC ? Framing::Binary : Framing::Text;
+    }
+    if (framing == Framing::Binary) {
+        return process_binary(in, out, output_limit);
+    }
+    process_text(in, out, output_limit);
+    return true;
+}
+
+/*
+    Execute all complete text command lines in a read buffer.
+    Args:
+        in: receive buffer; complete lines are consumed from it
+        out: output buffer responses are appended to
+        output_limit: stop before a line once out holds this many bytes (0 = never)
+    Returns:
+        void
+*/
+void CommandHandler::process_text(ReadBuffer& in, WriteBuffer& out, size_t output_limit) {
+    std::string_view line;
+    Command cmd;
+    size_t start = out.size();
+    while ((output_limit == 0 || out.size() == start || out.size() < output_limit) && in.next_line(line)) {
+        if (!protocol::parse_line(line, cmd)) {
+            continue; // skip empty lines
+        }
+        execute(cmd, out);
+    }
+}
+
+namespace {
+/*
+    The key a command touches, if it touches exactly one.
+    Args:
+        cmd: the parsed command
+    Returns:
+        the key, or empty for commands that touch several keys or none
+*/
+std::string_view single_key(const Command& cmd) {
+    switch (cmd.type) {
+        case CommandType::Set:
+        case CommandType::Get:
+        case CommandType::Del:
+        case CommandType::Expire:
+        case CommandType::Ttl:
+        case CommandType::Incr:
+        case CommandType::IncrBy:
+        case CommandType::Decr:
+        case CommandType::DecrBy:
+        case CommandType::Cas: {
+            std::string_view args = cmd.args;
+            return protocol::next_token(args);
+        }
+        default:
+            return std::string_view();
+    }
+}
+
+/*
+    Whether a command changes the store.
+    Args:
+        type: the command type
+    Returns:
+        true for writes
+*/
+bool is_write(CommandType type) {
+    switch (type) {
+        case CommandType::Set:
+        case CommandType::Del:
+        case CommandType::MSet:
+        case CommandType::Expire:
+        case CommandType::Incr:
+        case CommandType::IncrBy:
+        case CommandType::Decr:
+        case CommandType::DecrBy:
+        case CommandType::Cas:
+            return true;
+        default:
+            return false;
+    }
+}
+
+constexpr std::string_view READ_ONLY_ERROR = "ERROR: READONLY this server is a replica; write to the primary";
+constexpr std::string_view CROSSSLOT_ERROR = "ERROR: CROSSSLOT the keys are served by different nodes";
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+/*
+    Append a key as one reply line's worth of text. Binary SETs can store any bytes as a
+    key, so a key that could break line framing or be mistaken for a reply line (a byte
+    outside printable ASCII, END, a leading ERROR or a leading quote) is written in double
+    quotes with \\, \", \n, \r, \t and \xHH escapes; any other key is written as is.
+    Args:
+        key: the key
+        out: output buffer
+    Returns:
+        void
+*/
+void append_key(std::string_view key, std::string& out) {
+    bool plain = key != "END" && key.substr(0, 5) != "ERROR" && (key.empty() || key[0] != '"');
+    for (size_t i = 0; plain && i < key.size(); i++) {
+        plain = key[i] >= ' ' && key[i] <= '~';
+    }
+    if (plain) {
+        out += key;
+        return;
+    }
+    out += '"';
+    for (unsigned char c : key) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += char(c);
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\r') {
+            out += "\\r";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c < ' ' || c > '~') {
+            out += "\\x";
+            out += HEX_DIGITS[c >> 4];
+            out += HEX_DIGITS[c & 15];
+        } else {
+            out += char(c);
+        }
+    }
+    out += '"';
+}
+}
+
+/*
+    Execute all complete requests in a read buffer, handing those for keys owned by
+    another thread to the router.
+    Args:
+        in: receive buffer; handled requests are consumed from it
+        framing: the connection's framing (Unknown until the first byte arrives)
+        router: decides where requests run and where replies go
+        output_limit: stop before a request once router.backlog() reaches this (0 = never)
+    Returns:
+        false if the connection sent a malformed binary frame, true otherwise
+*/
+bool CommandHandler::process(ReadBuffer& in, Framing& framing, RequestRouter& router, size_t output_limit) {
+    if (framing == Framing::Unknown) {
+        if (in.empty()) {
+            return true;
+        }
+        framing = uint8_t(in.data()[0]) == protocol::binary::REQUEST_MAGIC ? Framing::Binary : Framing::Text;
+    }
+    if (framing == Framing::Binary) {
+        return process_binary(in, router, output_limit);
+    }
+    process_text(in, router, output_limit);
+    return true;
+}
+
+/*
+    Routed text loop: lines are peeked first so one that has to wait stays buffered.
+    Args:
+        in: receive buffer; handled lines are consumed from it
+        router: decides where requests run and where replies go
+        output_limit: stop before a line once router.backlog() reaches this (0 = never)
+    Returns:
+        void
+*/
+void CommandHandler::process_text(ReadBuffer& in, RequestRouter& router, size_t output_limit) {
+    std::string_view line;
+    size_t length;
+    Command cmd;
+    bool ran = false;
+    while ((output_limit == 0 || !ran || router.backlog() < output_limit) && in.peek_line(line, length)) {
+        if (protocol::parse_line(line, cmd)) {
+            std::string_view key = single_key(cmd);
+            if (key.empty() && router.forwarding()) {
+                return; // may read what the forwarded requests write: wait for them
+            }
+            if (key.empty() || !router.forward(store_.shard_index(key), Framing::Text, line)) {
+                execute(cmd, router.reply_buffer());
+            }
+            ran = true;
+        }
+        in.consume(length);
+    }
+}
+
+/*
+    Routed binary loop. A text-opcode frame is routed by the key of the command it wraps;
+    one without a single key is held back like a multi-key text command.
+    Args:
+        in: receive buffer; handled frames are consumed from it
+        router: decides where requests run and where replies go
+        output_limit: stop before a frame once router.backlog() reaches this (0 = never)
+    Returns:
+        false if a frame header was malformed (an error response is appended), true otherwise
+*/
+bool CommandHandler::process_binary(ReadBuffer& in, RequestRouter& router, size_t output_limit) {
+    using namespace protocol::binary;
+    Request req;
+    size_t consumed = 0;
+    for (bool ran = false; output_limit == 0 || !ran || router.backlog() < output_limit; ran = true) {
+        ParseResult result = parse_request(in.data(), req, consumed);
+        if (result == ParseResult::Incomplete) {
+            return true;
+        }
+        if (result == ParseResult::Invalid) {
+            append_response(router.reply_buffer().bytes(), Status::Error, "ERROR: malformed binary frame");
+            return false;
+        }
+        std::string_view key = req.key;
+        if (req.op == Opcode::Text) { // a wrapped text command goes where its key lives, if it has one
+            Command cmd;
+            key = protocol::parse_line(req.value, cmd) ? single_key(cmd) : std::string_view();
+        }
+        if (key.empty() && router.forwarding()) {
+            return true;
+        }
+        if (key.empty() || !router.forward(store_.shard_index(key), Framing::Binary, in.data().substr(0, consumed))) {
+            execute_binary(req, router.reply_buffer());
+        }
+        in.consume(consumed);
+    }
+    return true;
+}
+
+/*
+    Execute a request another thread forwarded.
+    Args:
+        framing: the request's framing
+        request: one text line (without its newline) or one complete binary frame
+        out: output buffer the reply is appended to
+    Returns:
+        void
+*/
+void CommandHandler::execute_request(Framing framing, std::string_view request, std::string& out) {
+    thread_local WriteBuffer reply;
+    reply.bytes().swap(out); // append in place; only referenced values need copying
+    if (framing == Framing::Binary) {
+        protocol::binary::Request req;
+        size_t consumed = 0;
+        if (protocol::binary::parse_request(request, req, consumed) == protocol::binary::ParseResult::Ok) {
+            execute_binary(req, reply);
+        }
+    } else {
+        Command cmd;
+        if (protocol::parse_line(request, cmd)) {
+            execute(cmd, reply);
+        }
+    }
+    reply.flatten();
+    reply.bytes().swap(out);
+    reply.clear();
+}
+
+/*
+    Execute all complete binary frames in a read buffer.
+    Args:
+        in: receive buffer; complete frames are consumed from it
+        out: output buffer responses are appended to
+        output_limit: stop before a frame once out holds this many bytes (0 = never)
+    Returns:
+        false if a frame header was malformed (an error response is appended), true otherwise
+*/
+bool CommandHandler::process_binary(ReadBuffer& in, WriteBuffer& out, size_t output_limit) {
+    using namespace protocol::binary;
+    Request req;
+    size_t consumed = 0;
+    size_t start = out.size();
+    while (output_limit == 0 || out.size() == start || out.size() < output_limit) {
+        ParseResult result = parse_request(in.data(), req, consumed);
+        if (result == ParseResult::Incomplete) {
+            return true;
+        }
+        if (result == ParseResult::Invalid) {
+            append_response(out.bytes(), Status::Error, "ERROR: malformed binary frame");
+            return false;
+        }
+        execute_binary(req, out);
+        in.consume(consumed);
+    }
+    return true;
+}
+
+/*
+    Execute one binary request.
+    Args:
+        req: the parsed frame (views into the read buffer)
+        reply: output buffer the response frame is appended to
+    Returns:
+        void
+*/
+void CommandHandler::execute_binary(const protocol::binary::Request& req, WriteBuffer& reply) {
+    using namespace protocol::binary;
+    std::string& out = reply.bytes();
+    uint64_t lock_wait = ShardLock::thread_wait_ns();
+    uint64_t start = cycleclock::now();
+    auto moved = [&](std::string_view key) {
+        thread_local std::string error;
+        error.clear();
+        if (cluster_ == nullptr || !redirect(key, error)) {
+            return false;
+        }
+        append_response(out, Status::Error, error);
+        return true;
+    };
+    switch (req.op) {
+        case Opcode::Get:
+        case Opcode::GetCompressed: {
+            if (req.key.empty()) {
+                append_response(out, Status::Error, "ERROR: GET requires key");
+                break;
+            }
+            if (moved(req.key)) {
+                break;
+            }
+            // write the header first and copy the value straight behind it, or for a large
+            // value send it from the store's copy
+            size_t header = out.size();
+            append_header(out, Status::Ok, 0);
+            SharedValue shared;
+            bool compressed = false;
+            bool found = req.op == Opcode::Get ? store_.get(req.key, out, shared)
+                                               : store_.get_stored(req.key, out, shared, compressed);
+            if (found) {
+                size_t length = shared ? shared.size() : out.size() - header - HEADER_SIZE;
+                encoding::set_u32(out, header + 4, uint32_t(length));
+                if (compressed) {
+                    out[header + 2] = char(FLAG_LZ4);
+                }
+                if (shared) {
+                    reply.append(std::move(shared));
+                }
+                Stats::instance().lookups(1, 0);
+            } else {
+                out.resize(header);
+                append_response(out, Status::NotFound);
+                Stats::instance().lookups(0, 1);
+            }
+            finish(CommandType::Get, start, lock_wait, "GET", req.key);
+            break;
+        }
+        case Opcode::Set:
+            if (req.key.empty()) {
+                append_response(out, Status::Error, "ERROR: SET requires key");
+                break;
+            }
+            if (moved(req.key)) {
+                break;
+            }
+            if (link_ != nullptr) {
+                append_response(out, Status::Error, READ_ONLY_ERROR);
+                break;
+            }
+            store_.set(req.key, req.value);
+            append_response(out, Status::Ok);
+            finish(CommandType::Set, start, lock_wait, "SET", req.key);
+            break;
+        case Opcode::Del:
+            if (req.key.empty()) {
+                append_response(out, Status::Error, "ERROR: DEL requires key");
+                break;
+            }
+            if (moved(req.key)) {
+                break;
+            }
+            if (link_ != nullptr) {
+                append_response(out, Status::Error, READ_ONLY_ERROR);
+                break;
+            }
+            append_response(out, store_.remove(req.key) ? Status::Ok : Status::NotFound);
+            finish(CommandType::Del, start, lock_wait, "DEL", req.key);
+            break;
+        case Opcode::Text: {
+            // run a text command and wrap its reply
+            thread_local WriteBuffer text;
+            text.clear();
+            Command cmd;
+            if (!protocol::parse_line(req.value, cmd)) {
+                append_response(out, Status::Error, "ERROR: empty command");
+                break;
+            }
+            execute(cmd, text);
+            text.flatten();
+            std::string& body = text.bytes();
+            if (!body.empty() && body.back() == '\n') {
+                body.pop_back();
+            }
+            bool error = body.compare(0, 5, "ERROR") == 0;
+            append_response(out, error ? Status::Error : Status::Ok, body);
+            break;
+        }
+    }
+}
+
+/*
+    Execute a single command and record its latency.
+    Args:
+        cmd: the parsed command
+        out: output buffer the newline-terminated response is appended to
+    Returns:
+        void
+*/
+void CommandHandler::execute(const Command& cmd, WriteBuffer& out) {
+    uint64_t lock_wait = ShardLock::thread_wait_ns();
+    uint64_t start = cycleclock::now();
+    dispatch(cmd, out);
+    finish(cmd.type, start, lock_wait, cmd.verb, cmd.args);
+}
+
+/*
+    Count a finished command in the server statistics and offer it to the slow log.
+    Args:
+        type: the command type
+        start: cycleclock time the command started executing
+        lock_wait: the thread's ShardLock::thread_wait_ns() at that time
+        verb: command word, for the slow log
+        args: arguments, for the slow log
+    Returns:
+        void
+*/
+void CommandHandler::finish(CommandType type, uint64_t start, uint64_t lock_wait, std::string_view verb,
+                            std::string_view args) {
+    uint64_t ticks = cycleclock::now() - start;
+    Stats::instance().command(type, cycleclock::to_ns(ticks));
+    SlowLog::command_done(ticks, ShardLock::thread_wait_ns() - lock_wait, verb, args);
+}
+
+/*
+    Execute a single command against the store.
+    Args:
+        cmd: the parsed command
+        reply: output buffer the newline-terminated response is appended to
+    Returns:
+        void
+*/
+void CommandHandler::dispatch(const Command& cmd, WriteBuffer& reply) {
+    std::string& out = reply.bytes();
+    std::string_view args = cmd.args;
+
+    if (cluster_ != nullptr && redirect(cmd, out)) {
+        out += '\n';
+        return;
+    }
+    if (link_ != nullptr && is_write(cmd.type)) {
+        out += READ_ONLY_ERROR;
+        out += '\n';
+        return;
+    }
+
+    // based on command, call the appropriate KVStore function
+    switch (cmd.type) {
+        case CommandType::Set: // handle SET command
+            execute_set(args, out);
+            break;
+        case CommandType::Get: { // handle GET command
+            std::string_view key = protocol::next_token(args);
+
+            if (!key.empty()) {
+                // copy the value straight into the response buffer, or reference a large one
+                SharedValue shared;
+                if (store_.get(key, out, shared)) {
+                    if (shared) {
+                        reply.append(std::move(shared));
+                    }
+                    out += '\n';
+                    Stats::instance().lookups(1, 0);
+                } else {
+                    out += "NOT_FOUND\n";
+                    Stats::instance().lookups(0, 1);
+                }
+            } else {
+                out += "ERROR: GET requires key\n";
+            }
+            break;
+        }
+        case CommandType::Del: { // handle DEL command
+            std::string_view key = protocol::next_token(args);
+
+            if (!key.empty()) {
+                bool deleted = store_.remove(key);
+                out += deleted ? "DELETED\n" : "NOT_FOUND\n";
+            } else {
+                out += "ERROR: DEL requires key\n";
+            }
+            break;
+        }
+        case CommandType::Expire: // handle EXPIRE command
+            execute_expire(args, out);
+            break;
+        case CommandType::Ttl: // handle TTL command
+            execute_ttl(args, out);
+            break;
+        case CommandType::Incr: // handle INCR command
+            execute_incr(cmd.verb, args, 1, false, out);
+            break;
+        case CommandType::IncrBy: // handle INCRBY command
+            execute_incr(cmd.verb, args, 1, true, out);
+            break;
+        case CommandType::Decr: // handle DECR command
+            execute_incr(cmd.verb, args, -1, false, out);
+            break;
+        case CommandType::DecrBy: // handle DECRBY command
+            execute_incr(cmd.verb, args, -1, true, out);
+            break;
+        case CommandType::Cas: // handle CAS command
+            execute_cas(args, out);
+            break;
+        case CommandType::MGet: // handle MGET command
+            execute_mget(args, out);
+            break;
+        case CommandType::MSet: // handle MSET command
+            execute_mset(args, out);
+            break;
+        case CommandType::Slabs: // handle SLABS command
+            append_slab_stats(out);
+            break;
+        case CommandType::BgSave: // handle BGSAVE command
+            if (saver_ == nullptr) {
+                out += "ERROR: snapshots are not configured\n";
+            } else if (saver_->start()) {
+                out += "OK: background save started\n";
+            } else {
+                out += "ERROR: background save already in progress\n";
+            }
+            break;
+        case CommandType::Info: // handle INFO command
+            append_info(out);
+            break;
+        case CommandType::SlowLog: // handle SLOWLOG command
+            execute_slowlog(args, out);
+            break;
+        case CommandType::Scan: // handle SCAN command
+            execute_scan(args, out);
+            break;
+        case CommandType::Cluster: // handle CLUSTER command
+            execute_cluster(args, out);
+            break;
+        case CommandType::LastSave: // handle LASTSAVE command
+            if (saver_ == nullptr) {
+                out += "ERROR: snapshots are not configured\n";
+            } else {
+                out += std::to_string(saver_->last_save());
+                out += '\n';
+            }
+            break;
+        default:
+            out += "ERROR: Unknown command\n";
+            break;
+    }
+}
+
+/*
+    SET: the value is the rest of the line, except that a trailing "EX <seconds>" or
+    "PX <milliseconds>" is taken as an expiry. A value that itself ends in such a pair
+    can't be stored with a plain SET.
+    Args:
+        args: key, value and the optional expiry
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_set(std::string_view args, std::string& out) {
+    std::string_view key = protocol::next_token(args);
+    std::string_view value = args; // value is the rest of the line
+
+    if (!value.empty() && value[0] == ' ') {
+        value.remove_prefix(1); // remove the separating space
+    }
+    if (key.empty() || value.empty()) { // invalid command
+        out += "ERROR: SET requires key and value\n";
+        return;
+    }
+
+    int64_t expires_at = 0;
+    std::string_view head = value;
+    std::string_view amount = protocol::last_token(head);
+    std::string_view unit = protocol::last_token(head);
+    int64_t ttl;
+    if ((unit == "EX" || unit == "PX") && protocol::parse_int(amount, ttl)) {
+        while (!head.empty() && protocol::is_space(head.back())) {
+            head.remove_suffix(1);
+        }
+        if (head.empty()) {
+            out += "ERROR: SET requires key and value\n";
+            return;
+        }
+        int64_t now = TimerWheel::now_ms();
+        int64_t limit = unit == "EX" ? (INT64_MAX - now) / 1000 : INT64_MAX - now;
+        if (ttl <= 0 || ttl > limit) {
+            out += "ERROR: invalid expire time\n";
+            return;
+        }
+        expires_at = now + (unit == "EX" ? ttl * 1000 : ttl);
+        value = head;
+    }
+
+    store_.set(key, value, expires_at);
+    out += "OK\n";
+}
+
+/*
+    EXPIRE: give a key a time to live in seconds; zero or less deletes it.
+    Args:
+        args: key and seconds
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_expire(std::string_view args, std::string& out) {
+    std::string_view key = protocol::next_token(args);
+    int64_t seconds;
+    if (key.empty() || !protocol::parse_int(protocol::next_token(args), seconds)) {
+        out += "ERROR: EXPIRE requires key and seconds\n";
+        return;
+    }
+    int64_t now = TimerWheel::now_ms();
+    if (seconds > (INT64_MAX - now) / 1000) {
+        out += "ERROR: invalid expire time\n";
+        return;
+    }
+    int64_t expires_at = seconds > 0 ? now + seconds * 1000 : now; // a deadline of now deletes the key
+    out += store_.expire_at(key, expires_at) ? "OK\n" : "NOT_FOUND\n";
+}
+
+/*
+    TTL: seconds (rounded) until a key expires, -1 if it has no expiry.
+    Args:
+        args: the key
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_ttl(std::string_view args, std::string& out) {
+    std::string_view key = protocol::next_token(args);
+    if (key.empty()) {
+        out += "ERROR: TTL requires key\n";
+        return;
+    }
+    int64_t ms = store_.ttl(key);
+    if (ms == -2) {
+        out += "NOT_FOUND\n";
+        return;
+    }
+    out += std::to_string(ms < 0 ? ms : (ms + 500) / 1000);
+    out += '\n';
+}
+
+/*
+    INCR / DECR key, INCRBY / DECRBY key delta: add to the integer at a key (a missing
+    key starts at 0) and reply with the new value.
+    Args:
+        verb: the command word, for error replies
+        args: key and, for the BY forms, the delta
+        sign: 1 to add, -1 to subtract
+        with_delta: whether a delta follows the key (otherwise it is 1)
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_incr(std::string_view verb, std::string_view args, int64_t sign, bool with_delta,
+                                  std::string& out) {
+    std::string_view key = protocol::next_token(args);
+    int64_t delta = 1;
+    if (key.empty() || (with_delta && !protocol::parse_int(protocol::next_token(args), delta))) {
+        out += "ERROR: ";
+        out += verb;
+        out += with_delta ? " requires key and delta\n" : " requires key\n";
+        return;
+    }
+    if (sign < 0 && delta == INT64_MIN) {
+        out += "ERROR: increment or decrement would overflow\n";
+        return;
+    }
+    int64_t result;
+    switch (store_.incr(key, sign * delta, result)) {
+        case KVStore::IncrResult::Ok:
+            out += std::to_string(result);
+            out += '\n';
+            break;
+        case KVStore::IncrResult::NotInteger:
+            out += "ERROR: value is not an integer or out of range\n";
+            break;
+        case KVStore::IncrResult::Overflow:
+            out += "ERROR: increment or decrement would overflow\n";
+            break;
+    }
+}
+
+/*
+    CAS key expected new: set key to new only if its value is still expected. expected
+    is one token; new is the rest of the line, as for SET (without an expiry: the key's
+    own is kept).
+    Args:
+        args: key, expected value and new value
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_cas(std::string_view args, std::string& out) {
+    std::string_view key = protocol::next_token(args);
+    std::string_view expected = protocol::next_token(args);
+    std::string_view value = args;
+    if (!value.empty() && value[0] == ' ') {
+        value.remove_prefix(1); // remove the separating space
+    }
+    if (key.empty() || expected.empty() || value.empty()) {
+        out += "ERROR: CAS requires key, expected value and new value\n";
+        return;
+    }
+    switch (store_.cas(key, expected, value)) {
+        case KVStore::CasResult::Ok:
+            out += "OK\n";
+            break;
+        case KVStore::CasResult::Mismatch:
+            out += "MISMATCH\n";
+            break;
+        case KVStore::CasResult::NotFound:
+            out += "NOT_FOUND\n";
+            break;
+    }
+}
+
+/*
+    Check that a key's slot is served here.
+    Args:
+        key: the key
+        out: output buffer the error is appended to
+    Returns:
+        true if the key belongs elsewhere and the error was appended
+*/
+bool CommandHandler::redirect(std::string_view key, std::string& out) {
+    uint16_t slot = cluster::key_slot(key);
+    uint32_t owner = cluster_->owner(slot);
+    if (owner == self_) {
+        return false;
+    }
+    if (owner == SlotMap::NO_NODE) {
+        out += "ERROR: CLUSTERDOWN hash slot ";
+        out += std::to_string(slot);
+        out += " is not served";
+        return true;
+    }
+    const SlotMap::Node& node = cluster_->node(owner);
+    out += "ERROR: MOVED ";
+    out += std::to_string(slot);
+    out += ' ';
+    out += node.host;
+    out += ':';
+    out += std::to_string(node.port);
+    return true;
+}
+
+/*
+    Check that every key a command touches is served here. Multi-key commands are served
+    only if all their keys are, and redirected if all of them belong to one other node.
+    Keys spread over several nodes get a CROSSSLOT error: no single node can serve them,
+    so redirecting by one key would only send the client back and forth.
+    Args:
+        cmd: the parsed command
+        out: output buffer the error is appended to
+    Returns:
+        true if the command can't be served here and the error was appended
+*/
+bool CommandHandler::redirect(const Command& cmd, std::string& out) {
+    std::string_view key = single_key(cmd);
+    if (!key.empty()) {
+        return redirect(key, out);
+    }
+    if (cmd.type != CommandType::MGet && cmd.type != CommandType::MSet) {
+        return false;
+    }
+    thread_local std::vector<std::string_view> tokens;
+    protocol::split_tokens(cmd.args, tokens);
+    size_t step = cmd.type == CommandType::MSet ? 2 : 1; // MSET: keys and values alternate
+    uint32_t owner = SlotMap::NO_NODE;
+    for (size_t i = 0; i < tokens.size(); i += step) {
+        uint32_t node = cluster_->owner(cluster::key_slot(tokens[i]));
+        if (node == SlotMap::NO_NODE) {
+            return redirect(tokens[i], out); // CLUSTERDOWN
+        }
+        if (owner != SlotMap::NO_NODE && node != owner) {
+            out += CROSSSLOT_ERROR;
+            return true;
+        }
+        owner = node;
+    }
+    return !tokens.empty() && redirect(tokens[0], out);
+}
+
+/*
+    CLUSTER SLOTS: the layout, one "<first> <last> <host>:<port>" line per range of slots
+    served by one node, in slot order and terminated by END.
+    CLUSTER KEYSLOT key: the slot of key (also when cluster mode is off).
+    Args:
+        args: the subcommand and its argument
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_cluster(std::string_view args, std::string& out) {
+    std::string_view sub = protocol::next_token(args);
+    if (sub == "SLOTS") {
+        if (cluster_ == nullptr) {
+            out += "ERROR: cluster mode is not enabled\n";
+            return;
+        }
+        char line[96];
+        for (const SlotMap::Range& range : cluster_->ranges()) {
+            const SlotMap::Node& node = cluster_->node(range.node);
+            snprintf(line, sizeof(line), "%u %u ", unsigned(range.first), unsigned(range.last));
+            out += line;
+            out += node.host;
+            out += ':';
+            out += std::to_string(node.port);
+            out += '\n';
+        }
+        out += "END\n";
+    } else if (sub == "KEYSLOT") {
+        std::string_view key = protocol::next_token(args);
+        if (key.empty()) {
+            out += "ERROR: CLUSTER KEYSLOT requires key\n";
+            return;
+        }
+        out += std::to_string(cluster::key_slot(key));
+        out += '\n';
+    } else {
+        out += "ERROR: CLUSTER requires SLOTS or KEYSLOT key\n";
+    }
+}
+
+/*
+    SLOWLOG GET [count]: the newest entries (default 10), newest first, terminated by END:
+        ID <id> TIME <unix ms> TOTAL_US <t> LOCK_US <l> EXEC_US <e> WRITE_US <w> [BLOCKED] CMD <command>
+    BLOCKED marks a reply that filled the socket buffer and had to wait for the client.
+    SLOWLOG LEN: the number of entries. SLOWLOG RESET: drop them.
+    Args:
+        args: the subcommand and its argument
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_slowlog(std::string_view args, std::string& out) {
+    SlowLog& slowlog = SlowLog::instance();
+    std::string_view sub = protocol::next_token(args);
+    if (sub == "GET") {
+        int64_t count = 10;
+        std::string_view count_arg = protocol::next_token(args);
+        if (!count_arg.empty() && (!protocol::parse_int(count_arg, count) || count < 0)) {
+            out += "ERROR: invalid count\n";
+            return;
+        }
+        char line[192];
+        for (const SlowLog::Entry& entry : slowlog.latest(size_t(count))) {
+            snprintf(line, sizeof(line), "ID %llu TIME %lld TOTAL_US %.1f LOCK_US %.1f EXEC_US %.1f WRITE_US %.1f%s CMD ",
+                     (unsigned long long)entry.id, (long long)entry.unix_ms,
+                     (entry.lock_ns + entry.exec_ns + entry.write_ns) / 1e3, entry.lock_ns / 1e3,
+                     entry.exec_ns / 1e3, entry.write_ns / 1e3, entry.write_blocked ? " BLOCKED" : "");
+            out += line;
+            for (char c : entry.command) {
+                out += c == '\n' || c == '\r' ? ' ' : c; // one line per entry, whatever the command held
+            }
+            out += '\n';
+        }
+        out += "END\n";
+    } else if (sub == "LEN") {
+        out += std::to_string(slowlog.size());
+        out += '\n';
+    } else if (sub == "RESET") {
+        slowlog.reset();
+        out += "OK\n";
+    } else {
+        out += "ERROR: SLOWLOG requires GET [count], LEN or RESET\n";
+    }
+}
+
+/*
+    SCAN cursor [MATCH pattern] [COUNT n]: up to n keys (default 10) matching the glob
+    pattern (default *), in key order, one per line after the cursor to pass next time
+    and terminated by END. Keys that could break that framing are quoted (append_key).
+    Cursor 0 starts a scan and is returned once it is complete; any other cursor is the
+    hex encoding of the key the previous chunk ended after.
+    Args:
+        args: the cursor and options
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_scan(std::string_view args, std::string& out) {
+    if (!store_.ordered_index()) {
+        out += "ERROR: SCAN needs the ordered index (--ordered-index on)\n";
+        return;
+    }
+    auto nibble = [](char c) {
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    };
+    std::string_view cursor = protocol::next_token(args);
+    std::string after;
+    bool valid = !cursor.empty() && (cursor == "0" || cursor.size() % 2 == 0);
+    for (size_t i = 0; valid && cursor != "0" && i < cursor.size(); i += 2) {
+        int hi = nibble(cursor[i]);
+        int lo = nibble(cursor[i + 1]);
+        valid = hi >= 0 && lo >= 0;
+        after += char(hi << 4 | lo);
+    }
+    std::string_view pattern = "*";
+    int64_t count = 10;
+    for (std::string_view option = protocol::next_token(args); valid && !option.empty();
+         option = protocol::next_token(args)) {
+        std::string_view value = protocol::next_token(args);
+        if (option == "MATCH" && !value.empty()) {
+            pattern = value;
+        } else if (option == "COUNT" && protocol::parse_int(value, count)) {
+            valid = count > 0 && size_t(count) <= KVStore::MAX_SCAN_COUNT;
+        } else {
+            valid = false;
+        }
+    }
+    if (!valid) {
+        out += "ERROR: SCAN requires cursor [MATCH pattern] [COUNT 1-";
+        out += std::to_string(KVStore::MAX_SCAN_COUNT);
+        out += "]\n";
+        return;
+    }
+
+    thread_local std::vector<std::string> keys;
+    thread_local std::string next;
+    if (store_.scan(after, pattern, size_t(count), keys, next)) {
+        for (unsigned char c : next) {
+            out += HEX_DIGITS[c >> 4];
+            out += HEX_DIGITS[c & 15];
+        }
+    } else {
+        out += '0';
+    }
+    out += '\n';
+    for (const std::string& key : keys) {
+        append_key(key, out);
+        out += '\n';
+    }
+    out += "END\n";
+}
+
+/*
+    MGET: look up every key with one read-lock acquisition per shard and reply with one
+    line per key, in request order (the value, or NOT_FOUND).
+    Args:
+        args: the keys
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_mget(std::string_view args, std::string& out) {
+    thread_local std::vector<std::string_view> keys;
+    thread_local std::string values;                        // found values, back to back
+    thread_local std::vector<std::pair<size_t, size_t>> spans; // (offset, length) per key
+
+    protocol::split_tokens(args, keys);
+    if (keys.empty()) {
+        out += "ERROR: MGET requires at least one key\n";
+        return;
+    }
+
+    // values are gathered shard by shard, then emitted in the order the keys were given
+    values.clear();
+    spans.assign(keys.size(), {std::string::npos, 0});
+    // captured by reference: the callback may run on the thread owning the shard
+    store_.multi_view(keys, [&spans = spans, &values = values](size_t i, std::string_view value) {
+        spans[i] = {values.size(), value.size()};
+        values.append(value);
+    });
+
+    uint64_t misses = 0;
+    for (const auto& span : spans) {
+        if (span.first == std::string::npos) {
+            out += "NOT_FOUND\n";
+            misses++;
+        } else {
+            out.append(values, span.first, span.second);
+            out += '\n';
+        }
+    }
+    Stats::instance().lookups(keys.size() - misses, misses);
+}
+
+/*
+    MSET: store every key-value pair with one write-lock acquisition per shard.
+    Args:
+        args: alternating keys and values (values are single tokens here)
+        out: output buffer
+    Returns:
+        void
+*/
+void CommandHandler::execute_mset(std::string_view args, std::string& out) {
+    thread_local std::vector<std::string_view> tokens;
+    thread_local std::vector<std::pair<std::string_view, std::string_view>> entries;
+
+    protocol::split_tokens(args, tokens);
+    if (tokens.empty() || tokens.size() % 2 != 0) {
+        out += "ERROR: MSET requires key value pairs\n";
+        return;
+    }
+
+    entries.clear();
+    for (size_t i = 0; i < tokens.size(); i += 2) {
+        entries.emplace_back(tokens[i], tokens[i + 1]);
+    }
+    store_.mset(entries);
+    out += "OK\n";
+}
+
+/*
+    Append the slab allocator report: one line per size class in use, one line for
+    oversized allocations, terminated by END.
+        CLASS <slot size> SLABS <pages> USED <used>/<slots> UTIL <used %> FILL <bytes used %>
+    FILL is how much of the handed-out slots callers actually requested (internal waste).
+    Args:
+        out: output buffer the report is appended to
+    Returns:
+        void
+*/
+void CommandHandler::append_slab_stats(std::string& out) {
+    std::vector<SlabArena::ClassStats> stats = store_.slab_stats();
+    char line[160];
+    for (size_t i = 0; i + 1 < stats.size(); i++) {
+        const SlabArena::ClassStats& cls = stats[i];
+        if (cls.slabs == 0) {
+            continue;
+        }
+        double util = 100.0 * cls.used / cls.slots;
+        double fill = cls.used ? 100.0 * cls.requested / (cls.used * cls.slot_size) : 0.0;
+        snprintf(line, sizeof(line), "CLASS %zu SLABS %zu USED %zu/%zu UTIL %.1f%% FILL %.1f%%\n",
+                 cls.slot_size, cls.slabs, cls.used, cls.slots, util, fill);
+        out += line;
+    }
+    const SlabArena::ClassStats& large = stats.back();
+    snprintf(line, sizeof(line), "LARGE %zu BYTES %zu\n", large.used, large.requested);
+    out += line;
+    out += "END\n";
+}
+
+/*
+    Append the INFO report: one "STAT <name> <value>" line per statistic, terminated by
+    END. Per-command lines give the call count and latency percentiles in microseconds
+    (bucket upper edges, within 25%); ops_per_sec is the rate since the previous INFO.
+    Args:
+        out: output buffer the report is appended to
+    Returns:
+        void
+*/
+void CommandHandler::append_info(std::string& out) {
+    Stats& stats = Stats::instance();
+    std::unique_ptr<Stats::Totals> totals = stats.collect();
+    char line[160];
+    auto stat = [&](const char* name, auto value) {
+        out += "STAT ";
+        out += name;
+        out += ' ';
+        out += std::to_string(value);
+        out += '\n';
+    };
+
+    uint64_t total_calls = 0;
+    for (size_t t = 0; t < Stats::COMMAND_TYPES; t++) {
+        total_calls += totals->calls[t];
+    }
+    stat("uptime_seconds", uint64_t(stats.uptime()));
+    stat("total_commands", total_calls);
+    snprintf(line, sizeof(line), "STAT ops_per_sec %.1f\n", stats.rate_since_last(total_calls));
+    out += line;
+
+    for (size_t t = 1; t < Stats::COMMAND_TYPES; t++) {
+        if (totals->calls[t] == 0) {
+            continue;
+        }
+        std::string_view name = protocol::command_name(CommandType(t));
+        const auto& latency = totals->latency[t];
+        snprintf(line, sizeof(line), "STAT cmd_%.*s calls=%llu p50_us=%.1f p99_us=%.1f p999_us=%.1f\n",
+                 int(name.size()), name.data(), (unsigned long long)totals->calls[t],
+                 Stats::percentile(latency, 0.5) / 1e3, Stats::percentile(latency, 0.99) / 1e3,
+                 Stats::percentile(latency, 0.999) / 1e3);
+        out += line;
+    }
+
+    uint64_t lookups = totals->hits + totals->misses;
+    stat("get_hits", totals->hits);
+    stat("get_misses", totals->misses);
+    snprintf(line, sizeof(line), "STAT hit_ratio %.4f\n", lookups ? double(totals->hits) / lookups : 0.0);
+    out += line;
+    stat("bytes_in", totals->bytes_in);
+    stat("bytes_out", totals->bytes_out);
+    stat("connected_clients", totals->connected);
+    stat("total_connections", totals->connections_total);
+    stat("rejected_connections", totals->rejected);
+    stat("input_overflows", totals->input_overflows);
+    stat("read_pauses", totals->read_pauses);
+    stat("keys", store_.size());
+    stat("rehashing_shards", store_.rehashing_shards());
+    stat("memory_used", store_.memory_used());
+    stat("maxmemory", store_.memory_limit());
+    stat("evicted_keys", store_.evicted_keys());
+    stat("rss_bytes", Stats::resident_bytes());
+    stat("compress_min", store_.compression_min());
+    stat("compress_calls", totals->compress_calls);
+    stat("compressed_values", totals->compress_kept);
+    snprintf(line, sizeof(line), "STAT compression_ratio %.2f\n",
+             totals->compress_stored_bytes ? double(totals->compress_raw_bytes) / totals->compress_stored_bytes : 0.0);
+    out += line;
+    stat("compress_us", totals->compress_ns / 1000);
+    stat("decompress_calls", totals->decompress_calls);
+    stat("decompress_us", totals->decompress_ns / 1000);
+    if (link_ != nullptr) {
+        snprintf(line, sizeof(line), "STAT role replica\nSTAT primary %s:%d\nSTAT primary_link %s\n",
+                 link_->host().c_str(), link_->port(), link_->up() ? "up" : "down");
+        out += line;
+        stat("full_syncs", link_->full_syncs());
+        stat("records_applied", link_->records_applied());
+    } else {
+        out += "STAT role primary\n";
+    }
+    if (primary_ != nullptr) {
+        stat("connected_replicas", primary_->replicas());
+        stat("full_syncs_sent", primary_->full_syncs());
+    }
+    stat("cluster_enabled", int(cluster_ != nullptr));
+    if (cluster_ != nullptr) {
+        size_t served = 0;
+        for (const SlotMap::Range& range : cluster_->ranges()) {
+            served += range.node == self_ ? size_t(range.last - range.first) + 1 : 0;
+        }
+        stat("cluster_slots_served", served);
+        stat("cluster_slots_assigned", cluster_->assigned());
+        stat("cluster_nodes", cluster_->nodes());
+    }
+    out += "END\n";
+}
@@ -0,0 +1,206 @@
+#include "CoreRouter.hpp"
+#include <stdexcept>
+#include <thread>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*
+    Constructor method for CoreRouter class: one eventfd per core and one queue per
+    ordered pair of cores.
+    Args:
+        cores: number of cores (reactor threads)
+    Returns:
+        void
+*/
+CoreRouter::CoreRouter(size_t cores) {
+    for (size_t i = 0; i < cores; i++) {
+        cores_.push_back(std::make_unique<Core>());
+        cores_[i]->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (cores_[i]->wake_fd < 0) {
+            throw std::runtime_error("Failed to create eventfd");
+        }
+    }
+    for (size_t i = 0; i < cores * cores; i++) {
+        queues_.push_back(std::make_unique<SpscQueue<ForwardBatch*>>(QUEUE_CAPACITY));
+    }
+}
+
+/*
+    Destructor method for CoreRouter class.
+*/
+CoreRouter::~CoreRouter() {
+    for (auto& core : cores_) {
+        if (core->wake_fd != -1) {
+            close(core->wake_fd);
+        }
+    }
+}
+
+/*
+    Get the calling thread's core.
+    Args:
+        none
+    Returns:
+        reference to the thread's core index (SIZE_MAX if it isn't a core)
+*/
+size_t& CoreRouter::current_core() {
+    thread_local size_t core = SIZE_MAX;
+    return core;
+}
+
+/*
+    Register the calling thread as a core, so run_on() runs that core's closures inline.
+    Args:
+        core: the core index
+    Returns:
+        void
+*/
+void CoreRouter::attach(size_t core) {
+    current_core() = core;
+}
+
+/*
+    Queue a batch for another core and wake it if it is asleep. The fence orders the push
+    before the read of the idle flag, pairing with the one in set_idle(): either the
+    receiver sees the batch before blocking, or the sender sees it going to sleep.
+    Args:
+        from: sending core (the calling thread)
+        to: receiving core
+        batch: the batch
+    Returns:
+        false if the queue is full (the batch was not sent)
+*/
+bool CoreRouter::send(size_t from, size_t to, ForwardBatch* batch) {
+    if (!queue(from, to).push(batch)) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    Core& target = *cores_[to];
+    if (target.idle.load(std::memory_order_relaxed) && target.idle.exchange(false)) {
+        wake(to); // only the first sender to see it asleep pays for the syscall
+    }
+    return true;
+}
+
+/*
+    Announce that a core is going to block in epoll_wait, or that it woke up.
+    Args:
+        core: the calling core
+        idle: true before blocking, false after
+    Returns:
+        true if work is already waiting (don't block), false otherwise
+*/
+bool CoreRouter::set_idle(size_t core, bool idle) {
+    Core& self = *cores_[core];
+    if (!idle) {
+        self.idle.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    self.idle.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (self.has_tasks.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    for (size_t from = 0; from < cores_.size(); from++) {
+        if (!queue(from, core).empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Make a core's epoll_wait return.
+    Args:
+        core: the core to wake
+    Returns:
+        void
+*/
+void CoreRouter::wake(size_t core) {
+    uint64_t one = 1;
+    ssize_t written = write(cores_[core]->wake_fd, &one, sizeof(one));
+    (void)written; // can only fail with the counter saturated, and then a wakeup is pending anyway
+}
+
+/*
+    Run a closure on the core that owns a shard and wait until it has run. Once the cores
+    are retired it runs on the calling thread instead, serialized with every other caller.
+    Args:
+        shard: the shard the closure touches
+        fn: the closure
+    Returns:
+        void
+*/
+void CoreRouter::run_on(size_t shard, const std::function<void()>& fn) {
+    size_t core = owner(shard);
+    size_t self = current_core();
+    if (core == self) {
+        fn();
+        return;
+    }
+    if (retired_.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(retired_mtx_);
+        fn();
+        return;
+    }
+
+    Task task;
+    task.fn = &fn;
+    Core& target = *cores_[core];
+    {
+        std::lock_guard<std::mutex> lock(target.mtx);
+        target.tasks.push_back(&task);
+        target.has_tasks.store(true, std::memory_order_relaxed);
+    }
+    wake(core);
+
+    while (!task.done.load(std::memory_order_acquire)) {
+        if (self != SIZE_MAX) {
+            run_tasks(self);
+        } else if (retired_.load(std::memory_order_acquire)) {
+            // the core is gone: run what it left behind, this closure included
+            std::lock_guard<std::mutex> lock(retired_mtx_);
+            run_tasks(core);
+        }
+        std::this_thread::yield();
+    }
+}
+
+/*
+    Run the closures other threads queued for a core.
+    Args:
+        core: the calling core
+    Returns:
+        void
+*/
+void CoreRouter::run_tasks(size_t core) {
+    Core& self = *cores_[core];
+    if (!self.has_tasks.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::vector<Task*> tasks;
+    {
+        std::lock_guard<std::mutex> lock(self.mtx);
+        tasks.swap(self.tasks);
+        self.has_tasks.store(false, std::memory_order_relaxed);
+    }
+    for (Task* task : tasks) {
+        (*task->fn)();
+        task->done.store(true, std::memory_order_release);
+    }
+}
+
+/*
+    Record that a core has no clients left during a shutdown.
+    Args:
+        core: the calling core
+    Returns:
+        true once every core has finished
+*/
+bool CoreRouter::finish(size_t core) {
+    if (!cores_[core]->finished.exchange(true)) {
+        finished_.fetch_add(1);
+    }
+    return finished_.load() == cores_.size();
+}
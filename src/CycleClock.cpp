@@ -0,0 +1,44 @@
+#include "CycleClock.hpp"
+
+namespace cycleclock {
+
+namespace {
+constexpr auto CALIBRATION = std::chrono::milliseconds(10);
+
+/*
+    Measure the tick rate by counting ticks across a steady_clock interval.
+    Args:
+        none
+    Returns:
+        nanoseconds per tick
+*/
+double calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    auto wall_start = std::chrono::steady_clock::now();
+    uint64_t start = now();
+    std::chrono::steady_clock::time_point wall_end;
+    do {
+        wall_end = std::chrono::steady_clock::now();
+    } while (wall_end - wall_start < CALIBRATION);
+    uint64_t ticks = now() - start;
+    double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(wall_end - wall_start).count());
+    return ticks > 0 ? ns / double(ticks) : 1.0;
+#else
+    return 1.0; // ticks are already nanoseconds
+#endif
+}
+}
+
+/*
+    Get the calibrated tick length.
+    Args:
+        none
+    Returns:
+        nanoseconds per tick
+*/
+double ns_per_tick() {
+    static const double ns = calibrate();
+    return ns;
+}
+
+}
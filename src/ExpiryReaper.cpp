@@ -0,0 +1,47 @@
+#include "ExpiryReaper.hpp"
+
+/*
+    Constructor method for ExpiryReaper class; starts the reaper thread.
+    Args:
+        store: the store to reap
+        interval: sleep between passes when nothing is due
+        budget: due timers handled per shard per lock hold
+    Returns:
+        void
+*/
+ExpiryReaper::ExpiryReaper(KVStore& store, std::chrono::milliseconds interval, size_t budget)
+    : store_(store), interval_(interval), budget_(budget) {
+    worker_ = std::thread(&ExpiryReaper::run, this);
+}
+
+/*
+    Destructor method for ExpiryReaper class.
+*/
+ExpiryReaper::~ExpiryReaper() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+}
+
+/*
+    Reaper thread body: sweep the shards, immediately again while expirations are
+    backed up, otherwise once per interval.
+    Args:
+        none
+    Returns:
+        void
+*/
+void ExpiryReaper::run() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+        lock.unlock();
+        size_t backlog = store_.reap_expired(budget_);
+        lock.lock();
+        if (backlog == 0) {
+            cv_.wait_for(lock, interval_, [this] { return stop_; });
+        }
+    }
+}
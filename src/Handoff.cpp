@@ -0,0 +1,187 @@
+#include "Handoff.hpp"
+#include "Snapshot.hpp"
+#include "Encoding.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+constexpr uint32_t HANDOFF_MAGIC = 0x4F48564B; // "KVHO"
+
+// a unix socket address for path; throws if the path doesn't fit
+sockaddr_un unix_address(const std::string& path) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Bad handoff socket path: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+}
+
+/*
+    Constructor method for Handoff class; binds the unix socket and starts waiting for a
+    successor. A stale socket file left by a process that died is replaced.
+    Args:
+        path: unix socket path
+        listen_fd: the TCP listening socket to hand over
+        on_takeover: called on the handoff thread once a successor has the socket
+    Returns:
+        void
+*/
+Handoff::Handoff(const std::string& path, int listen_fd, std::function<void()> on_takeover)
+    : path_(path), listen_fd_(listen_fd), on_takeover_(std::move(on_takeover)) {
+    sockaddr_un address = unix_address(path_);
+    unix_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (unix_fd_ < 0) {
+        throw std::runtime_error("Failed to create handoff socket");
+    }
+    unlink(path_.c_str());
+    if (bind(unix_fd_, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(unix_fd_, 1) < 0) {
+        close(unix_fd_);
+        throw std::runtime_error("Failed to listen on handoff socket " + path_ + ": " + std::strerror(errno));
+    }
+    worker_ = std::thread(&Handoff::run, this);
+}
+
+/*
+    Destructor method for Handoff class.
+*/
+Handoff::~Handoff() {
+    stop_.store(true);
+    shutdown(unix_fd_, SHUT_RDWR); // wakes the blocked accept()
+    worker_.join();
+    close(unix_fd_);
+    if (!taken_over()) {
+        unlink(path_.c_str()); // else already removed, and maybe bound again by the successor
+    }
+}
+
+/*
+    Handoff thread body: wait for a successor, send it the listening socket and let the
+    server stop. Ends after one successful handoff.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Handoff::run() {
+    while (!stop_.load()) {
+        int fd = accept4(unix_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EINTR && !stop_.load()) {
+                std::cerr << "Failed to accept handoff connection" << std::endl;
+            }
+            continue;
+        }
+
+        std::string magic;
+        encoding::put_u32(magic, HANDOFF_MAGIC);
+        struct iovec iov = {magic.data(), magic.size()};
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &listen_fd_, sizeof(int));
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != ssize_t(magic.size())) {
+            std::cerr << "Failed to hand the listening socket over: " << std::strerror(errno) << std::endl;
+            close(fd);
+            continue;
+        }
+
+        successor_fd_.store(fd);
+        unlink(path_.c_str()); // the successor binds its own once we are gone
+        std::cout << "Handing over to a new server" << std::endl;
+        on_takeover_();
+        return;
+    }
+}
+
+/*
+    Stream a snapshot image of the store to the successor.
+    Args:
+        store: the store
+    Returns:
+        void
+*/
+void Handoff::send_data(KVStore& store) {
+    Snapshot::write(store, successor_fd_.load());
+}
+
+/*
+    Take over from a running server: receive its listening socket, then its data, then
+    wait for the end of the stream (the old process exiting).
+    Args:
+        path: the old server's --handoff socket
+        store: the store to load the data into (empty)
+        keys: receives the number of keys loaded
+    Returns:
+        the listening socket
+*/
+int Handoff::take_over(const std::string& path, KVStore& store, size_t& keys) {
+    sockaddr_un address = unix_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create handoff socket");
+    }
+    if (connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("No server to take over at " + path + ": " + std::strerror(err));
+    }
+
+    unsigned char magic[4];
+    struct iovec iov = {magic, sizeof(magic)};
+    alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    struct cmsghdr* cmsg = n == ssize_t(sizeof(magic)) ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg == nullptr || encoding::get_u32(magic) != HANDOFF_MAGIC || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        close(fd);
+        throw std::runtime_error("Bad handoff from " + path);
+    }
+    int listen_fd;
+    std::memcpy(&listen_fd, CMSG_DATA(cmsg), sizeof(int));
+
+    try {
+        std::string image; // arrives once the old server has drained its clients
+        Snapshot::receive(fd, image);
+        keys = Snapshot::load(store, image.data(), image.size());
+
+        char byte;
+        while ((n = read(fd, &byte, 1)) != 0) {
+            if (n < 0 && errno != EINTR) {
+                break; // the stream failed, which also means the old process is gone
+            }
+            if (n > 0) {
+                throw std::runtime_error("Bad handoff from " + path + " (data after the snapshot)");
+            }
+        }
+    } catch (...) {
+        close(listen_fd);
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return listen_fd;
+}
@@ -1,18 +1,1020 @@
 #include "KVStore.hpp"
+#include "AppendLog.hpp"
+#include "Replication.hpp"
+#include "Lz4.hpp"
+#include "Encoding.hpp"
+#include "Stats.hpp"
+#include "CycleClock.hpp"
 #include <mutex>
-#include <shared_mutex>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <charconv>
+
+namespace {
+constexpr uint32_t LFU_INIT = 5;          // starting counter, so new keys aren't the first to go
+constexpr double LFU_LOG_FACTOR = 10.0;   // higher = counter grows more slowly with hits
+constexpr uint32_t LFU_MINUTES_MASK = 0xFFFFFF;
+
+// LRU access clock in 64 ms units; idle times stay comparable for years before it wraps
+uint32_t lru_clock(int64_t now_ms) {
+    return uint32_t(now_ms >> 6);
+}
+
+// LFU decay clock in minutes, kept in the upper 24 bits of Entry::access
+uint32_t lfu_minutes(int64_t now_ms) {
+    return uint32_t(now_ms / 60000) & LFU_MINUTES_MASK;
+}
+
+// LFU counter of an access word after one step of decay per idle minute
+uint32_t lfu_decayed(uint32_t access, uint32_t now_minutes) {
+    uint32_t counter = access & 0xFF;
+    uint32_t idle = (now_minutes - (access >> 8)) & LFU_MINUTES_MASK;
+    return idle >= counter ? 0 : counter - idle;
+}
+
+// format an integer in decimal into buf (at least 20 bytes); returns the digits
+std::string_view format_integer(int64_t v, char* buf) {
+    char* end = std::to_chars(buf, buf + 20, v).ptr;
+    return std::string_view(buf, size_t(end - buf));
+}
+
+// parse a decimal integer written exactly as format_integer() would write it (no sign but
+// '-', no leading zeros), so that storing it natively doesn't change what GET returns
+bool parse_integer(std::string_view s, int64_t& v) {
+    if (s.empty() || s.size() > 20) {
+        return false;
+    }
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc() || end != s.data() + s.size()) {
+        return false;
+    }
+    char buf[20];
+    return format_integer(v, buf) == s;
+}
+
+// decompress a stored value (u32 raw size, then an LZ4 block) and append it to out
+bool unpack_value(std::string_view packed, std::string& out) {
+    if (packed.size() < 4) {
+        return false;
+    }
+    size_t raw_size = encoding::get_u32(reinterpret_cast<const unsigned char*>(packed.data()));
+    size_t base = out.size();
+    out.resize(base + raw_size);
+    uint64_t start = cycleclock::now();
+    bool ok = lz4::decompress(packed.substr(4), &out[base], raw_size);
+    Stats::instance().decompressed(cycleclock::to_ns(cycleclock::now() - start));
+    if (!ok) {
+        out.resize(base);
+    }
+    return ok;
+}
+
+// literal start of a glob pattern, unescaped: every key the pattern matches begins with it
+std::string glob_prefix(std::string_view pattern) {
+    std::string prefix;
+    for (size_t i = 0; i < pattern.size() && pattern[i] != '*' && pattern[i] != '?'; i++) {
+        if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+            i++;
+        }
+        prefix += pattern[i];
+    }
+    return prefix;
+}
+
+// glob match: * is any run of bytes, ? any one byte, and \ makes the next byte literal.
+// a * that fails is retried one byte later, so this is linear in practice
+bool glob_match(std::string_view pattern, std::string_view key) {
+    size_t p = 0;
+    size_t k = 0;
+    size_t star = std::string_view::npos; // pattern position after the last *
+    size_t mark = 0;                      // key position that * currently stops at
+    while (k < key.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = ++p;
+            mark = k;
+            continue;
+        }
+        if (p < pattern.size()) {
+            if (pattern[p] == '?') {
+                p++;
+                k++;
+                continue;
+            }
+            size_t len = pattern[p] == '\\' && p + 1 < pattern.size() ? 2 : 1;
+            if (pattern[p + len - 1] == key[k]) {
+                p += len;
+                k++;
+                continue;
+            }
+        }
+        if (star == std::string_view::npos) {
+            return false;
+        }
+        p = star;
+        k = ++mark;
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+// per-thread xorshift generator for sampling and probabilistic counting
+uint64_t next_random() {
+    thread_local uint64_t state = 0x9E3779B97F4A7C15ULL ^ uint64_t(reinterpret_cast<uintptr_t>(&state));
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+}
+
+/*
+    Constructor method for KVStore class.
+    Args:
+        num_shards: number of independently locked shards (rounded up to a power of two)
+        lock_mode: reader/writer synchronization used by every shard
+    Returns:
+        void
+*/
+KVStore::KVStore(size_t num_shards, LockMode lock_mode) : shard_bits_(0) {
+    while ((size_t(1) << shard_bits_) < num_shards) {
+        shard_bits_++;
+    }
+    shards_ = std::vector<Shard>(size_t(1) << shard_bits_);
+    for (auto& shard : shards_) {
+        shard.mtx.set_mode(lock_mode);
+    }
+}
+
+/*
+    Constructor method for KVStore::Shard. With the node-based backend the map's nodes
+    and bucket array are allocated from the shard arena too.
+*/
+#ifdef KVSTORE_FLAT_MAP
+KVStore::Shard::Shard() : index(&arena), wheel(TimerWheel::now_ms()) {}
+#else
+KVStore::Shard::Shard()
+    : data(size_t(0), KeyHash(), std::equal_to<>(), SlabStlAllocator<Map::value_type>(&arena)),
+      index(&arena), wheel(TimerWheel::now_ms()) {}
+#endif
+
+/*
+    Pick the shard responsible for a key. The key is hashed once here and the
+    high bits of a multiplicative mix select the shard, so the shard choice stays
+    independent of the bucket index the map derives from the same hash.
+    Args:
+        key: the key to locate
+    Returns:
+        index of the owning shard
+*/
+size_t KVStore::shard_index(std::string_view key) const {
+    if (shard_bits_ == 0) {
+        return 0;
+    }
+    size_t h = KeyHash{}(key);
+    uint64_t mixed = static_cast<uint64_t>(h) * 0x9E3779B97F4A7C15ULL; // fibonacci hashing
+    return mixed >> (64 - shard_bits_);
+}
 
 /*
-    Insert or update a key-value pair in the store.
+    Insert or update a key-value pair in the store. Updating an existing key reuses
+    the capacity of the stored value. A large value is compressed and copied into its
+    SharedValue before the lock is taken, and the value it replaces is released after
+    unlocking.
     Args: 
         key: the key to insert or update
         value: the value to insert or update
+        expires_at: unix time in ms at which the key expires (0 = never)
+    Returns:
+        void
+*/
+void KVStore::set(std::string_view key, std::string_view value, int64_t expires_at) {
+    StoredValue stored; // declared before the lock so a replaced value is freed after unlocking
+    prepare_value(value, stored);
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardLock> lock(shard.mtx);
+    set_locked(shard, key, value, expires_at, stored);
+}
+
+/*
+    Decide how a value is stored. With compression on, a value of at least the threshold
+    is LZ4-compressed, and kept that way if it shrank by COMPRESS_MIN_SAVING or more;
+    the time spent shows up in INFO either way. Compressed and large values get their
+    SharedValue here.
+    Args:
+        value: the value as set
+        stored: receives the bytes to keep
+    Returns:
+        void
+*/
+void KVStore::prepare_value(std::string_view value, StoredValue& stored) const {
+    stored.bytes = value;
+    stored.compressed = false;
+    stored.large.reset();
+    if (compress_min_ != 0 && value.size() >= compress_min_) {
+        thread_local std::string packed;
+        packed.clear();
+        encoding::put_u32(packed, uint32_t(value.size()));
+        uint64_t start = cycleclock::now();
+        lz4::compress(value, packed);
+        uint64_t ns = cycleclock::to_ns(cycleclock::now() - start);
+        bool kept = packed.size() <= value.size() - value.size() / COMPRESS_MIN_SAVING;
+        Stats::instance().compressed(value.size(), packed.size(), kept, ns);
+        if (kept) {
+            stored.bytes = packed;
+            stored.compressed = true;
+        }
+    }
+    if (stored.compressed || stored.bytes.size() >= LARGE_VALUE) {
+        stored.large = SharedValue::copy_of(stored.bytes);
+    }
+}
+
+/*
+    Get an entry's value as set, decompressing it if needed.
+    Args:
+        entry: the entry; the caller holds its shard's lock
+    Returns:
+        the value; a decompressed one lives in a thread-local buffer until the next call
+*/
+std::string_view KVStore::expanded(const Entry& entry) {
+    if (entry.form == Form::Bytes) {
+        return entry.view();
+    }
+    if (entry.form == Form::Integer) {
+        thread_local char digits[20];
+        return format_integer(entry.integer(), digits);
+    }
+    thread_local std::string buffer;
+    buffer.clear();
+    unpack_value(entry.large.view(), buffer);
+    return buffer;
+}
+
+/*
+    Insert or update a key-value pair; the caller holds the shard's exclusive lock.
+    A deadline that has already passed (replaying an old log or snapshot) deletes the key.
+    Args:
+        shard: the shard owning key
+        key: the key to insert or update
+        value: the value to insert or update, as logged
+        expires_at: unix time in ms at which the key expires (0 = never)
+        stored: the value prepared by prepare_value(); receives the SharedValue of the value
+            replaced (empty if it had none)
+    Returns:
+        void
+*/
+void KVStore::set_locked(Shard& shard, std::string_view key, std::string_view value, int64_t expires_at,
+                         StoredValue& stored) {
+    auto it = shard.data.find(key);
+    if (expires_at != 0 && expires_at <= TimerWheel::now_ms()) {
+        if (it != shard.data.end()) {
+            erase_locked(shard, it, key);
+        }
+        return;
+    }
+    bool shared = bool(stored.large);
+    if (it != shard.data.end()) {
+        Entry& entry = it->second;
+        shard.large_bytes -= entry.large.size();
+        if (shared) {
+            entry.value.clear();
+            entry.value.shrink_to_fit(); // gives a small value's slot back to the arena
+            entry.large.swap(stored.large);
+        } else {
+            entry.value.assign(stored.bytes);
+            stored.large = std::move(entry.large);
+        }
+        entry.form = stored.compressed ? Form::Compressed : Form::Bytes;
+        touch(entry);
+    } else {
+        it = shard.data.emplace(shard.make_string(key), Entry(shard.make_string(shared ? std::string_view() : stored.bytes))).first;
+        it->second.large.swap(stored.large);
+        it->second.form = stored.compressed ? Form::Compressed : Form::Bytes;
+        it->second.access = initial_access();
+        if (ordered_) {
+            shard.index.insert(key);
+        }
+    }
+    shard.large_bytes += it->second.large.size();
+    it->second.expires_at = expires_at;
+    if (expires_at != 0) {
+        arm_timer(shard, key, it->second);
+    }
+    log_set(key, value, expires_at);
+    if (shard_limit_ != 0 && shard_memory(shard) > shard_limit_) {
+        evict_locked(shard, key);
+    }
+}
+
+/*
+    Set the memory bound and eviction policy.
+    Args:
+        max_bytes: total budget, split evenly across shards (0 = unlimited)
+        policy: which entries to evict first
+    Returns:
+        void
+*/
+void KVStore::set_memory_limit(size_t max_bytes, EvictionPolicy policy) {
+    shard_limit_ = max_bytes == 0 ? 0 : std::max<size_t>(1, max_bytes / shards_.size());
+    policy_ = policy;
+}
+
+/*
+    Bytes a shard charges against its budget: every arena slot in use (keys, values and,
+    with the node-based map, nodes and buckets), the large values, and the flat table's
+    slot array. A large value still being sent after its key was overwritten is no longer
+    charged.
+    Args:
+        shard: the shard; the caller holds its lock
+    Returns:
+        bytes in use
+*/
+size_t KVStore::shard_memory(const Shard& shard) {
+#ifdef KVSTORE_FLAT_MAP
+    return shard.arena.bytes_in_use() + shard.data.table_bytes() + shard.large_bytes;
+#else
+    return shard.arena.bytes_in_use() + shard.large_bytes;
+#endif
+}
+
+/*
+    Access word for a new entry.
+    Args:
+        none
+    Returns:
+        the current LRU clock, or the LFU starting counter stamped with the current minute
+*/
+uint32_t KVStore::initial_access() const {
+    if (shard_limit_ == 0) {
+        return 0;
+    }
+    int64_t now = TimerWheel::now_ms();
+    return policy_ == EvictionPolicy::Lru ? lru_clock(now) : lfu_minutes(now) << 8 | LFU_INIT;
+}
+
+/*
+    Update an entry's access word. Runs under the shard's shared lock, so concurrent
+    readers may race on the same word; relaxed atomics make that well-defined and losing
+    one of two simultaneous updates is harmless for an approximation. The word is only
+    stored when it changes, keeping hot entries' cache lines shared between readers.
+    Args:
+        entry: the entry read or written
+    Returns:
+        void
+*/
+void KVStore::record_access(Entry& entry) const {
+    std::atomic_ref<uint32_t> access(entry.access);
+    int64_t now = TimerWheel::now_ms();
+    uint32_t old = access.load(std::memory_order_relaxed);
+    if (policy_ == EvictionPolicy::Lru) {
+        uint32_t clock = lru_clock(now);
+        if (old != clock) {
+            access.store(clock, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    // logarithmic counter: the chance of an increment falls as the count grows
+    uint32_t minutes = lfu_minutes(now);
+    uint32_t counter = lfu_decayed(old, minutes);
+    if (counter < 255) {
+        double base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+        double p = 1.0 / (base * LFU_LOG_FACTOR + 1.0);
+        if (double(next_random() >> 11) * 0x1.0p-53 < p) {
+            counter++;
+        }
+    }
+    uint32_t updated = minutes << 8 | counter;
+    if (updated != old) {
+        access.store(updated, std::memory_order_relaxed);
+    }
+}
+
+/*
+    Rank an entry for eviction.
+    Args:
+        entry: the candidate
+        now_clock: current LRU clock, or LFU minute
+    Returns:
+        idle time (LRU) or inverted frequency (LFU); higher means evict first
+*/
+uint32_t KVStore::eviction_rank(const Entry& entry, uint32_t now_clock) const {
+    if (policy_ == EvictionPolicy::Lru) {
+        return now_clock - entry.access;
+    }
+    return 255 - lfu_decayed(entry.access, now_clock);
+}
+
+/*
+    Pick a random entry by probing random slots (buckets) of the table. Tables stay at
+    least partly full, so this takes a handful of probes; a table left mostly empty by
+    deletes falls back to its first entry.
+    Args:
+        shard: a shard with at least one entry
+    Returns:
+        iterator to the chosen entry
+*/
+KVStore::Map::iterator KVStore::random_entry(Shard& shard) {
+    for (int probe = 0; probe < 64; probe++) {
+        auto it = shard.data.probe(next_random());
+        if (it != shard.data.end()) {
+            return it;
+        }
+    }
+    return shard.data.begin();
+}
+
+/*
+    Evict until the shard fits its budget. Each round samples a few entries and evicts
+    the one the policy ranks highest (an expired entry is taken right away), which
+    approximates true LRU/LFU without any list that every read would have to update.
+    Args:
+        shard: the shard; the caller holds its exclusive lock
+        keep: the key just written, which is never evicted
+    Returns:
+        void
+*/
+void KVStore::evict_locked(Shard& shard, std::string_view keep) {
+    int64_t now = TimerWheel::now_ms();
+    uint32_t clock = policy_ == EvictionPolicy::Lru ? lru_clock(now) : lfu_minutes(now);
+    while (shard.data.size() > 1 && shard_memory(shard) > shard_limit_) {
+        Map::iterator victim = shard.data.end();
+        uint32_t best = 0;
+        for (size_t i = 0; i < EVICTION_SAMPLES; i++) {
+            Map::iterator it = random_entry(shard);
+            if (std::string_view(it->first) == keep) {
+                continue;
+            }
+            if (it->second.expired(now)) {
+                victim = it;
+                break;
+            }
+            uint32_t rank = eviction_rank(it->second, clock);
+            if (victim == shard.data.end() || rank > best) {
+                victim = it;
+                best = rank;
+            }
+        }
+        if (victim == shard.data.end()) {
+            // every sample was keep (a sparse table falls back to its first entry): take any other
+            victim = shard.data.begin();
+            if (std::string_view(victim->first) == keep) {
+                ++victim;
+            }
+        }
+        erase_locked(shard, victim, std::string_view(victim->first));
+        shard.evicted++;
+    }
+}
+
+/*
+    Sum the memory charged by every shard.
+    Args:
+        none
+    Returns:
+        bytes in use
+*/
+size_t KVStore::memory_used() {
+    size_t total = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            total += shard_memory(shard);
+        });
+    }
+    return total;
+}
+
+/*
+    Count the keys evicted for memory.
+    Args:
+        none
+    Returns:
+        evictions since startup, over all shards
+*/
+size_t KVStore::evicted_keys() {
+    size_t total = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            total += shard.evicted;
+        });
+    }
+    return total;
+}
+
+/*
+    Pre-size every shard's table, so that loading or filling the store up to the expected
+    number of keys never has to grow one.
+    Args:
+        keys: expected number of keys in total
+    Returns:
+        void
+*/
+void KVStore::reserve(size_t keys) {
+    size_t per_shard = (keys + shards_.size() - 1) / shards_.size();
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::unique_lock<ShardLock> lock(shard.mtx);
+            shard.data.reserve(per_shard);
+        });
+    }
+}
+
+/*
+    Count the shards whose table is still being rehashed.
+    Args:
+        none
+    Returns:
+        number of shards with entries left in a draining table
+*/
+size_t KVStore::rehashing_shards() {
+    size_t total = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            total += shard.data.rehashing();
+        });
+    }
+    return total;
+}
+
+/*
+    Count the stored keys. Expired keys still count until they are reaped or touched.
+    Args:
+        none
+    Returns:
+        number of keys over all shards
+*/
+size_t KVStore::size() {
+    size_t total = 0;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            total += shard.data.size();
+        });
+    }
+    return total;
+}
+
+/*
+    Make sure an entry's expiry is covered by a wheel timer. A timer that fires no later
+    than the new deadline is kept (it is re-armed for the rest of the time when it fires);
+    an earlier deadline gets a new timer and the old one goes stale.
+    Args:
+        shard: the shard owning the entry
+        key: the entry's key
+        entry: the entry, with expires_at already updated
+    Returns:
+        void
+*/
+void KVStore::arm_timer(Shard& shard, std::string_view key, Entry& entry) {
+    if (entry.timer_at == 0 || entry.expires_at < entry.timer_at) {
+        shard.wheel.schedule(key, entry.expires_at);
+        entry.timer_at = entry.expires_at;
+    }
+}
+
+/*
+    Erase an entry and log the delete; the caller holds the shard's exclusive lock.
+    Args:
+        shard: the shard owning the entry
+        it: the entry
+        key: its key (logged)
+    Returns:
+        void
+*/
+void KVStore::erase_locked(Shard& shard, Map::iterator it, std::string_view key) {
+    log_del(key);
+    shard.large_bytes -= it->second.large.size();
+    if (ordered_) {
+        shard.index.erase(key);
+    }
+    shard.data.erase(it);
+}
+
+/*
+    Log a write to the append-only file and the replication stream.
+    Args:
+        key: the key written
+        value: the value written
+        expires_at: unix time in ms at which the key expires (0 = never)
+    Returns:
+        void
+*/
+void KVStore::log_set(std::string_view key, std::string_view value, int64_t expires_at) {
+    if (log_ != nullptr) {
+        log_->append_set(key, value, expires_at);
+    }
+    if (replication_ != nullptr) {
+        replication_->append_set(key, value, expires_at);
+    }
+}
+
+/*
+    Log a delete to the append-only file and the replication stream.
+    Args:
+        key: the key removed
+    Returns:
+        void
+*/
+void KVStore::log_del(std::string_view key) {
+    if (log_ != nullptr) {
+        log_->append_del(key);
+    }
+    if (replication_ != nullptr) {
+        replication_->append_del(key);
+    }
+}
+
+/*
+    Log a change of expiry to the append-only file and the replication stream.
+    Args:
+        key: the key
+        expires_at: its new deadline in unix ms (0 = never expires)
+    Returns:
+        void
+*/
+void KVStore::log_expire(std::string_view key, int64_t expires_at) {
+    if (log_ != nullptr) {
+        log_->append_expire(key, expires_at);
+    }
+    if (replication_ != nullptr) {
+        replication_->append_expire(key, expires_at);
+    }
+}
+
+/*
+    Delete a key a reader found expired. The key is looked up again under the exclusive
+    lock since another writer may have refreshed it in between.
+    Args:
+        shard: the shard owning key
+        key: the expired key
+    Returns:
+        void
+*/
+void KVStore::expire_now(Shard& shard, std::string_view key) {
+    std::unique_lock<ShardLock> lock(shard.mtx);
+    auto it = shard.data.find(key);
+    if (it != shard.data.end() && it->second.expired(TimerWheel::now_ms())) {
+        erase_locked(shard, it, key);
+    }
+}
+
+/*
+    Set or clear the expiry of an existing key.
+    Args:
+        key: the key
+        expires_at: unix time in ms at which the key expires (0 = never)
+    Returns:
+        true if the key existed, false otherwise
+*/
+bool KVStore::expire_at(std::string_view key, int64_t expires_at) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardLock> lock(shard.mtx);
+    return expire_locked(shard, key, expires_at);
+}
+
+/*
+    Set or clear the expiry of an existing key; the caller holds the shard's exclusive lock.
+    Args:
+        shard: the shard owning key
+        key: the key
+        expires_at: unix time in ms at which the key expires (0 = never)
+    Returns:
+        true if the key existed, false otherwise
+*/
+bool KVStore::expire_locked(Shard& shard, std::string_view key, int64_t expires_at) {
+    auto it = shard.data.find(key);
+    if (it == shard.data.end()) {
+        return false;
+    }
+    int64_t now = TimerWheel::now_ms();
+    if (it->second.expired(now) || (expires_at != 0 && expires_at <= now)) {
+        bool live = !it->second.expired(now);
+        erase_locked(shard, it, key);
+        return live;
+    }
+    it->second.expires_at = expires_at;
+    if (expires_at != 0) {
+        arm_timer(shard, key, it->second);
+    }
+    log_expire(key, expires_at);
+    return true;
+}
+
+/*
+    Get the remaining time to live of a key.
+    Args:
+        key: the key
+    Returns:
+        ms until the key expires, -1 if it never does, -2 if it doesn't exist
+*/
+int64_t KVStore::ttl(std::string_view key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardLock> lock(shard.mtx);
+    auto it = shard.data.find(key);
+    if (it == shard.data.end()) {
+        return -2;
+    }
+    if (it->second.expires_at == 0) {
+        return -1;
+    }
+    int64_t left = it->second.expires_at - TimerWheel::now_ms();
+    return left > 0 ? left : -2;
+}
+
+/*
+    Add to the integer at a key, all under the shard's exclusive lock, so concurrent
+    increments never lose an update. The sum is kept as 8 native bytes in the entry's
+    inline string, so a counter takes no arena allocation, and later increments skip
+    the parse; it is logged as a plain set of its decimal form.
+    Args:
+        key: the counter's key
+        delta: amount to add (negative to decrement)
+        result: receives the new value
+    Returns:
+        Ok, NotInteger if the value isn't a decimal integer, or Overflow if the sum
+        doesn't fit in 64 bits (the value is left unchanged in both cases)
+*/
+KVStore::IncrResult KVStore::incr(std::string_view key, int64_t delta, int64_t& result) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardLock> lock(shard.mtx);
+    auto it = shard.data.find(key);
+    if (it != shard.data.end() && it->second.expired(TimerWheel::now_ms())) {
+        erase_locked(shard, it, key);
+        it = shard.data.end();
+    }
+    int64_t current = 0;
+    if (it != shard.data.end()) {
+        const Entry& entry = it->second;
+        if (entry.form == Form::Integer) {
+            current = entry.integer();
+        } else if (entry.form != Form::Bytes || entry.large || !parse_integer(entry.value, current)) {
+            return IncrResult::NotInteger;
+        }
+    }
+    if (__builtin_add_overflow(current, delta, &result)) {
+        return IncrResult::Overflow;
+    }
+
+    std::string_view bytes(reinterpret_cast<const char*>(&result), sizeof(result));
+    if (it != shard.data.end()) {
+        Entry& entry = it->second;
+        entry.value.assign(bytes);
+        if (entry.form != Form::Integer) {
+            entry.value.shrink_to_fit(); // a longer decimal string gives its slot back
+        }
+        touch(entry);
+    } else {
+        it = shard.data.emplace(shard.make_string(key), Entry(shard.make_string(bytes))).first;
+        it->second.access = initial_access();
+        if (ordered_) {
+            shard.index.insert(key);
+        }
+    }
+    it->second.form = Form::Integer;
+    if (log_ != nullptr || replication_ != nullptr) {
+        char digits[20];
+        log_set(key, format_integer(result, digits), it->second.expires_at);
+    }
+    if (shard_limit_ != 0 && shard_memory(shard) > shard_limit_) {
+        evict_locked(shard, key);
+    }
+    return IncrResult::Ok;
+}
+
+/*
+    Compare and set: replace a key's value only if it still holds what the caller last
+    read, with the compare and the write under one hold of the shard's exclusive lock.
+    The new value is prepared (and compressed) before the lock is taken, as for set().
+    Args:
+        key: the key
+        expected: the value the key must hold, as GET returns it
+        value: the new value
+    Returns:
+        Ok if the value was replaced, Mismatch if the key holds something else, NotFound
+        if it doesn't exist
+*/
+KVStore::CasResult KVStore::cas(std::string_view key, std::string_view expected, std::string_view value) {
+    StoredValue stored; // declared before the lock so a replaced value is freed after unlocking
+    prepare_value(value, stored);
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardLock> lock(shard.mtx);
+    auto it = shard.data.find(key);
+    if (it == shard.data.end() || it->second.expired(TimerWheel::now_ms())) {
+        return CasResult::NotFound; // an expired key is left to the reaper
+    }
+    if (expanded(it->second) != expected) {
+        return CasResult::Mismatch;
+    }
+    set_locked(shard, key, value, it->second.expires_at, stored);
+    return CasResult::Ok;
+}
+
+/*
+    Walk the shards' ordered indexes from a key on. Each shard contributes the matches
+    among the next count keys it holds within the pattern's literal prefix, under its
+    read lock. Merged, those are only complete up to the smallest key a shard stopped at
+    with more to go, so later ones are dropped and fetched again by the next call. A key
+    present for a whole scan is returned exactly once, whatever is written meanwhile.
+    Args:
+        after: resume after this key (empty = from the start)
+        pattern: glob the keys must match
+        count: most keys returned, and most keys each shard walks per call
+        keys: receives the keys, in order
+        next: receives the key to resume after
+    Returns:
+        true if the scan isn't complete yet
+*/
+bool KVStore::scan(std::string_view after, std::string_view pattern, size_t count, std::vector<std::string>& keys,
+                   std::string& next) {
+    keys.clear();
+    next.clear();
+    count = std::max<size_t>(count, 1);
+    std::string prefix = glob_prefix(pattern);
+    bool more = false;    // some shard stopped with keys left in range
+    std::string frontier; // smallest key such a shard stopped at
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            int64_t now = TimerWheel::now_ms();
+            BPlusTree::Cursor cursor = after < prefix ? shard.index.lower_bound(prefix) : shard.index.upper_bound(after);
+            std::string_view last;
+            size_t walked = 0;
+            for (; cursor.valid() && walked < count; cursor.next(), walked++) {
+                std::string_view key = cursor.key();
+                if (key.compare(0, prefix.size(), prefix) != 0) {
+                    break; // past the keys the pattern can match
+                }
+                last = key;
+                if (glob_match(pattern, key)) {
+                    auto it = shard.data.find(key);
+                    if (it != shard.data.end() && !it->second.expired(now)) {
+                        keys.emplace_back(key);
+                    }
+                }
+            }
+            if (walked == count && cursor.valid() && cursor.key().compare(0, prefix.size(), prefix) == 0) {
+                if (!more || last < frontier) {
+                    frontier.assign(last);
+                }
+                more = true;
+            }
+        });
+    }
+    if (more) {
+        keys.erase(std::remove_if(keys.begin(), keys.end(), [&](const std::string& key) { return key > frontier; }),
+                   keys.end());
+    }
+    std::sort(keys.begin(), keys.end());
+    if (keys.size() > count) {
+        keys.resize(count);
+        next = keys.back();
+        return true;
+    }
+    if (more) {
+        next = std::move(frontier);
+        return true;
+    }
+    return false;
+}
+
+/*
+    Delete expired keys in every shard. Each shard's exclusive lock is held for at most
+    budget timers, so a burst of expirations is spread over several calls instead of
+    stalling the shard's readers. The same lock hold moves up to REHASH_BUDGET entries of
+    a growing table, so a rehash finishes even when no more keys are inserted.
+    Args:
+        budget: due timers handled per shard per call
+    Returns:
+        number of due timers still waiting across all shards
+*/
+size_t KVStore::reap_expired(size_t budget) {
+    size_t backlog = 0;
+    TimerWheel::Timer timer;
+    for (size_t i = 0; i < shards_.size(); i++) {
+        on_shard(i, [&](Shard& shard) {
+            std::unique_lock<ShardLock> lock(shard.mtx);
+            int64_t now = TimerWheel::now_ms();
+            shard.wheel.advance(now);
+            for (size_t done = 0; done < budget && shard.wheel.pop_due(timer); done++) {
+                auto it = shard.data.find(std::string_view(timer.key));
+                if (it == shard.data.end() || it->second.timer_at != timer.deadline) {
+                    continue; // stale: the key was deleted or got an earlier timer since
+                }
+                Entry& entry = it->second;
+                if (entry.expired(now)) {
+                    erase_locked(shard, it, timer.key);
+                } else if (entry.expires_at != 0) { // extended since the timer was armed
+                    entry.timer_at = entry.expires_at;
+                    timer.deadline = entry.expires_at;
+                    shard.wheel.schedule(std::move(timer));
+                } else {
+                    entry.timer_at = 0; // expiry was cleared
+                }
+            }
+            shard.data.rehash_step(REHASH_BUDGET); // idle shards finish growing too
+            backlog += shard.wheel.due_count();
+        });
+    }
+    return backlog;
+}
+
+/*
+    Insert or update many key-value pairs, locking each shard involved once.
+    Args:
+        entries: (key, value) pairs; later entries for the same key win
     Returns:
         void
 */
-void KVStore::set(const std::string& key, const std::string& value) {
-    std::unique_lock<std::shared_timed_mutex> lock(mtx_);
-    data_[key] = value;
+void KVStore::mset(const std::vector<std::pair<std::string_view, std::string_view>>& entries) {
+    thread_local std::vector<std::pair<uint32_t, uint32_t>> groups;
+    auto& order = groups; // a closure naming groups would get the executing thread's copy
+    group_by_shard(entries.size(), [&entries](size_t i) { return entries[i].first; }, order);
+
+    for (size_t g = 0; g < order.size();) {
+        on_shard(order[g].first, [&](Shard& shard) {
+            std::unique_lock<ShardLock> lock(shard.mtx);
+            for (uint32_t current = order[g].first; g < order.size() && order[g].first == current; g++) {
+                const auto& entry = entries[order[g].second];
+                StoredValue stored;
+                prepare_value(entry.second, stored);
+                set_locked(shard, entry.first, entry.second, 0, stored);
+            }
+        });
+    }
+}
+
+/*
+    Apply a batch of logged records, one shard at a time.
+    Args:
+        records: the records, in log order
+    Returns:
+        void
+*/
+void KVStore::apply(const std::vector<AppendLog::Record>& records) {
+    thread_local std::vector<std::pair<uint32_t, uint32_t>> groups;
+    auto& order = groups; // a closure naming groups would get the executing thread's copy
+    group_by_shard(records.size(), [&records](size_t i) { return records[i].key; }, order);
+
+    for (size_t g = 0; g < order.size();) {
+        on_shard(order[g].first, [&](Shard& shard) {
+            std::unique_lock<ShardLock> lock(shard.mtx);
+            for (uint32_t current = order[g].first; g < order.size() && order[g].first == current; g++) {
+                const AppendLog::Record& record = records[order[g].second];
+                switch (record.op) {
+                    case AppendLog::Op::Set:
+                    case AppendLog::Op::SetExpiring: {
+                        StoredValue stored;
+                        prepare_value(record.value, stored);
+                        set_locked(shard, record.key, record.value, record.expires_at, stored);
+                        break;
+                    }
+                    case AppendLog::Op::ExpireAt:
+                        expire_locked(shard, record.key, record.expires_at);
+                        break;
+                    default: {
+                        auto it = shard.data.find(record.key);
+                        if (it != shard.data.end()) {
+                            erase_locked(shard, it, record.key);
+                        }
+                        break;
+                    }
+                }
+            }
+        });
+    }
+}
+
+/*
+    Delete every key. Each shard's keys are copied out first, since an erase
+    invalidates the iterator walking the table.
+    Args:
+        none
+    Returns:
+        void
+*/
+void KVStore::clear() {
+    for (size_t s = 0; s < shards_.size(); s++) {
+        on_shard(s, [&](Shard& shard) {
+            std::unique_lock<ShardLock> lock(shard.mtx);
+            std::vector<std::string> keys;
+            keys.reserve(shard.data.size());
+            for (auto& entry : shard.data) {
+                keys.emplace_back(entry.first);
+            }
+            for (const std::string& key : keys) {
+                auto it = shard.data.find(std::string_view(key));
+                if (it != shard.data.end()) {
+                    erase_locked(shard, it, key);
+                }
+            }
+        });
+    }
 }
 
 /*
@@ -22,13 +1024,91 @@ void KVStore::set(const std::string& key, const std::string& value) {
     Returns:
         the value for the key (empty string if the key is not found)
 */
-std::string KVStore::get(const std::string& key) {
-    std::shared_lock<std::shared_timed_mutex> lock( mtx_);
-    auto it = data_.find(key);
-    if (it != data_.end()) {
-        return it->second;
+std::string KVStore::get(std::string_view key) {
+    std::string value;
+    get(key, value);
+    return value;
+}
+
+/*
+    Append the value for a key to a caller-provided buffer, copying it straight
+    out of the store under the read lock.
+    Args:
+        key: the key to get the value for
+        out: buffer the value is appended to
+    Returns:
+        true if the key was found, false otherwise
+*/
+bool KVStore::get(std::string_view key, std::string& out) {
+    SharedValue shared;
+    if (!get(key, out, shared)) {
+        return false;
+    }
+    out.append(shared.view());
+    return true;
+}
+
+/*
+    Get the value for a key without copying it if it is large: the caller gets its own
+    reference to the stored bytes, which stays valid after the read lock is released
+    even if the key is overwritten or deleted. A compressed value is decompressed into
+    out, after the lock is released.
+    Args:
+        key: the key to get the value for
+        out: buffer a small or compressed value is appended to
+        shared: receives a large value
+    Returns:
+        true if the key was found, false otherwise
+*/
+bool KVStore::get(std::string_view key, std::string& out, SharedValue& shared) {
+    bool compressed = false;
+    if (!get_stored(key, out, shared, compressed)) {
+        return false;
+    }
+    if (compressed) {
+        unpack_value(shared.view(), out);
+        shared.reset();
     }
-    return "";
+    return true;
+}
+
+/*
+    Get the value for a key as it is stored, compressed or not, for clients that
+    decompress it themselves.
+    Args:
+        key: the key to get the value for
+        out: buffer a small value is appended to
+        shared: receives a large or compressed value
+        compressed: set to whether shared holds the compressed form
+    Returns:
+        true if the key was found, false otherwise
+*/
+bool KVStore::get_stored(std::string_view key, std::string& out, SharedValue& shared, bool& compressed) {
+    return view_entry(key, [&](Entry& entry) {
+        compressed = entry.form == Form::Compressed;
+        if (entry.large) {
+            shared = entry.large;
+        } else if (entry.form == Form::Integer) {
+            char digits[20];
+            out.append(format_integer(entry.integer(), digits));
+        } else {
+            out.append(entry.value);
+        }
+    });
+}
+
+/*
+    Check whether a key is present in the store.
+    Args:
+        key: the key to look for
+    Returns:
+        true if the key exists, false otherwise
+*/
+bool KVStore::exists(std::string_view key) {
+    Shard& shard = shard_for(key);
+    std::shared_lock<ShardLock> lock(shard.mtx);
+    auto it = shard.data.find(key);
+    return it != shard.data.end() && !it->second.expired(TimerWheel::now_ms());
 }
 
 /*
@@ -36,13 +1116,62 @@ std::string KVStore::get(const std::string& key) {
     Args: 
         key: the key to remove
     Returns:
-        true if the key was found and removed, false otherwise
+        true if the key was found and removed, false otherwise (an expired key is
+        removed too but reported missing)
 */
-bool KVStore::remove(const std::string& key) {
-    std::unique_lock<std::shared_timed_mutex> lock(mtx_);
-    if (data_.find(key) != data_.end()) {
-        data_.erase(key);
-        return true;
+bool KVStore::remove(std::string_view key) {
+    Shard& shard = shard_for(key);
+    std::unique_lock<ShardLock> lock(shard.mtx);
+    auto it = shard.data.find(key);
+    if (it == shard.data.end()) {
+        return false;
     }
-    return false;
-}
\ No newline at end of file
+    bool live = !it->second.expired(TimerWheel::now_ms());
+    erase_locked(shard, it, key);
+    return live;
+}
+
+/*
+    Collect slab utilization across all shards.
+    Args:
+        none
+    Returns:
+        per-class totals, with oversized allocations as the last entry
+*/
+std::vector<SlabArena::ClassStats> KVStore::slab_stats() {
+    std::vector<SlabArena::ClassStats> total;
+    for (size_t s = 0; s < shards_.size(); s++) {
+        std::vector<SlabArena::ClassStats> stats;
+        on_shard(s, [&](Shard& shard) {
+            std::shared_lock<ShardLock> lock(shard.mtx);
+            stats = shard.arena.stats();
+        });
+        if (total.empty()) {
+            total = stats;
+            continue;
+        }
+        for (size_t i = 0; i < stats.size(); i++) {
+            total[i].slabs += stats[i].slabs;
+            total[i].slots += stats[i].slots;
+            total[i].used += stats[i].used;
+            total[i].requested += stats[i].requested;
+        }
+    }
+    return total;
+}
+
+/*
+    Read every shard lock's contention counters.
+    Args:
+        none
+    Returns:
+        one entry per shard, in shard order
+*/
+std::vector<ShardLock::WaitStats> KVStore::lock_wait_stats() const {
+    std::vector<ShardLock::WaitStats> stats;
+    stats.reserve(shards_.size());
+    for (const auto& shard : shards_) {
+        stats.push_back(shard.mtx.wait_stats());
+    }
+    return stats;
+}
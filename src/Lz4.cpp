@@ -0,0 +1,191 @@
+#include "Lz4.hpp"
+#include <cstdint>
+#include <cstring>
+
+namespace {
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;   // the block must end in at least this many literals
+constexpr size_t MATCH_SAFE = 12;     // and its last match must start this far from the end
+constexpr size_t MAX_OFFSET = 65535;
+constexpr unsigned HASH_BITS = 12;
+constexpr unsigned SKIP_TRIGGER = 6;  // misses before the search starts stepping faster
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// write a length field's overflow past the token's 15: bytes of 255, then the rest
+uint8_t* put_length(uint8_t* op, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = uint8_t(length);
+    return op;
+}
+
+// emit one sequence: literals [anchor, anchor + literals) then a match, or only the
+// literals for the final sequence (match_length == 0)
+uint8_t* put_sequence(uint8_t* op, const uint8_t* anchor, size_t literals, size_t offset, size_t match_length) {
+    uint8_t* token = op++;
+    *token = uint8_t((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) {
+        op = put_length(op, literals - 15);
+    }
+    std::memcpy(op, anchor, literals);
+    op += literals;
+    if (match_length == 0) {
+        return op;
+    }
+    *op++ = uint8_t(offset);
+    *op++ = uint8_t(offset >> 8);
+    size_t extra = match_length - MIN_MATCH;
+    *token |= uint8_t(extra < 15 ? extra : 15);
+    if (extra >= 15) {
+        op = put_length(op, extra - 15);
+    }
+    return op;
+}
+
+// read a length field's overflow; false if the block ends inside it
+bool get_length(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t b;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+}
+
+namespace lz4 {
+
+/*
+    Compress into one LZ4 block. Positions of 4-byte sequences are remembered in a small
+    hash table; a hit is verified, extended both ways and emitted as a match. After a run
+    of misses the search steps over more bytes at a time, so incompressible input is
+    passed through quickly.
+    Args:
+        in: bytes to compress
+        out: buffer the block is appended to
+    Returns:
+        size of the block
+*/
+size_t compress(std::string_view in, std::string& out) {
+    size_t base = out.size();
+    out.resize(base + compress_bound(in.size()));
+    uint8_t* const dst = reinterpret_cast<uint8_t*>(&out[base]);
+    uint8_t* op = dst;
+    const uint8_t* const src = reinterpret_cast<const uint8_t*>(in.data());
+    const uint8_t* const end = src + in.size();
+    const uint8_t* anchor = src;
+
+    if (in.size() > MATCH_SAFE) {
+        const uint8_t* const match_limit = end - LAST_LITERALS; // matches stop before this
+        const uint8_t* const search_limit = end - MATCH_SAFE;   // and start before this
+        uint32_t table[size_t(1) << HASH_BITS] = {};
+        const uint8_t* ip = src + 1;
+        unsigned misses = 1u << SKIP_TRIGGER;
+        while (ip < search_limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash(sequence);
+            const uint8_t* ref = src + table[h];
+            table[h] = uint32_t(ip - src);
+            if (ref >= ip || size_t(ip - ref) > MAX_OFFSET || read32(ref) != sequence) {
+                ip += misses++ >> SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1u << SKIP_TRIGGER;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* match_end = ip + MIN_MATCH;
+            const uint8_t* ref_end = ref + MIN_MATCH;
+            while (match_end < match_limit && *match_end == *ref_end) {
+                match_end++;
+                ref_end++;
+            }
+            op = put_sequence(op, anchor, size_t(ip - anchor), size_t(ip - ref), size_t(match_end - ip));
+            ip = anchor = match_end;
+            if (ip < search_limit) {
+                table[hash(read32(ip - 2))] = uint32_t(ip - 2 - src);
+            }
+        }
+    }
+    op = put_sequence(op, anchor, size_t(end - anchor), 0, 0);
+
+    size_t written = size_t(op - dst);
+    out.resize(base + written);
+    return written;
+}
+
+/*
+    Decompress one LZ4 block, checking every length and offset against the input and
+    the output, so a corrupt or hostile block is rejected instead of overrunning.
+    Args:
+        block: the compressed bytes
+        dst: receives raw_size bytes
+        raw_size: exact decompressed size
+    Returns:
+        true if the block decoded to exactly raw_size bytes
+*/
+bool decompress(std::string_view block, char* dst, size_t raw_size) {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(block.data());
+    const uint8_t* const end = ip + block.size();
+    uint8_t* const out = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* op = out;
+    uint8_t* const out_end = out + raw_size;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(ip, end, literals)) {
+            return false;
+        }
+        if (literals > size_t(end - ip) || literals > size_t(out_end - op)) {
+            return false;
+        }
+        std::memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        if (ip == end) {
+            break; // the final sequence has no match
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = size_t(ip[0]) | size_t(ip[1]) << 8;
+        ip += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !get_length(ip, end, match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || offset > size_t(op - out) || match_length > size_t(out_end - op)) {
+            return false;
+        }
+        const uint8_t* match = op - offset;
+        if (offset >= match_length) {
+            std::memcpy(op, match, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; i++) { // overlapping: repeats the last offset bytes
+                op[i] = match[i];
+            }
+        }
+        op += match_length;
+    }
+    return op == out_end;
+}
+
+}
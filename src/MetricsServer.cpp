@@ -0,0 +1,304 @@
+#include "MetricsServer.hpp"
+#include "Stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <arpa/inet.h>  // htons
+#include <netinet/in.h> // sockaddr_in
+
+namespace {
+constexpr size_t MAX_REQUEST = 8192; // request line + headers; scrapers send a few hundred bytes
+constexpr int READ_TIMEOUT_S = 2;    // a stalled client can't hold up the next scrape for longer
+
+/*
+    Send a whole buffer, retrying on short writes.
+    Args:
+        fd: the socket
+        data: the bytes
+    Returns:
+        false if the connection failed
+*/
+bool send_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(size_t(sent));
+    }
+    return true;
+}
+
+/*
+    Append one sample line: name{labels} value.
+    Args:
+        out: the page
+        name: metric name
+        labels: label pairs without braces (empty for none)
+        value: the sample
+    Returns:
+        void
+*/
+void sample(std::string& out, std::string_view name, std::string_view labels, double value) {
+    char number[32];
+    if (value == double(int64_t(value)) && value < 9007199254740992.0) {
+        snprintf(number, sizeof(number), "%lld", (long long)value); // counters print exactly
+    } else {
+        snprintf(number, sizeof(number), "%.9g", value);
+    }
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += number;
+    out += '\n';
+}
+
+/*
+    Append the HELP and TYPE lines of a metric family.
+    Args:
+        out: the page
+        name: metric name
+        type: counter, gauge or summary
+        help: one-line description
+    Returns:
+        void
+*/
+void family(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+}
+
+/*
+    Constructor method for MetricsServer class; binds the port and starts the thread.
+    Args:
+        store: the store to report on
+        port: HTTP port
+    Returns:
+        void
+*/
+MetricsServer::MetricsServer(KVStore& store, int port) : store_(store) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        throw std::runtime_error("Failed to create metrics socket");
+    }
+    int opt = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(uint16_t(port));
+    if (bind(listen_fd_, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd_, 16) < 0) {
+        close(listen_fd_);
+        throw std::runtime_error("Failed to listen on metrics port " + std::to_string(port));
+    }
+    worker_ = std::thread(&MetricsServer::run, this);
+}
+
+/*
+    Destructor method for MetricsServer class.
+*/
+MetricsServer::~MetricsServer() {
+    stop_.store(true);
+    shutdown(listen_fd_, SHUT_RDWR); // wakes the blocked accept()
+    worker_.join();
+    close(listen_fd_);
+}
+
+/*
+    Listener thread body: accept and answer one scrape at a time until stopped.
+    Args:
+        none
+    Returns:
+        void
+*/
+void MetricsServer::run() {
+    while (!stop_.load()) {
+        int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno != EINTR && !stop_.load()) {
+                std::cerr << "Failed to accept metrics connection" << std::endl;
+            }
+            continue;
+        }
+        serve(client_fd);
+        close(client_fd);
+    }
+}
+
+/*
+    Read one HTTP request and answer it.
+    Args:
+        client_fd: the accepted socket
+    Returns:
+        void
+*/
+void MetricsServer::serve(int client_fd) {
+    struct timeval timeout {READ_TIMEOUT_S, 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // read up to the blank line that ends the headers
+    std::string request;
+    char chunk[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos) {
+        if (request.size() >= MAX_REQUEST) {
+            return;
+        }
+        ssize_t n = read(client_fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        request.append(chunk, size_t(n));
+    }
+
+    // request line: METHOD SP target SP version
+    std::string_view line(request);
+    line = line.substr(0, line.find_first_of("\r\n"));
+    std::string_view method = line.substr(0, line.find(' '));
+    std::string_view target = line.substr(std::min(line.size(), method.size() + 1));
+    target = target.substr(0, target.find(' '));
+    target = target.substr(0, target.find('?'));
+
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET" && method != "HEAD") {
+        status = "405 Method Not Allowed";
+        body = "only GET is supported\n";
+    } else if (target != "/metrics") {
+        status = "404 Not Found";
+        body = "try /metrics\n";
+    } else {
+        body = render();
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n";
+    response += status[0] == '2' ? "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                 : "Content-Type: text/plain; charset=utf-8\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    if (method != "HEAD") {
+        response += body;
+    }
+    send_all(client_fd, response);
+}
+
+/*
+    Build the metrics page in the Prometheus text exposition format (version 0.0.4).
+    Args:
+        none
+    Returns:
+        the page
+*/
+std::string MetricsServer::render() {
+    Stats& stats = Stats::instance();
+    std::unique_ptr<Stats::Totals> totals = stats.collect();
+    std::string out;
+    char labels[96];
+
+    family(out, "kvstore_uptime_seconds", "gauge", "Seconds since the server started.");
+    sample(out, "kvstore_uptime_seconds", "", stats.uptime());
+
+    family(out, "kvstore_commands_total", "counter", "Commands executed, by command.");
+    for (size_t t = 1; t < Stats::COMMAND_TYPES; t++) {
+        std::string_view name = protocol::command_name(CommandType(t));
+        snprintf(labels, sizeof(labels), "command=\"%.*s\"", int(name.size()), name.data());
+        sample(out, "kvstore_commands_total", labels, double(totals->calls[t]));
+    }
+
+    family(out, "kvstore_command_duration_seconds", "summary",
+           "Command execution time, by command (quantiles are bucket upper bounds, within 25%).");
+    for (size_t t = 1; t < Stats::COMMAND_TYPES; t++) {
+        if (totals->calls[t] == 0) {
+            continue;
+        }
+        std::string_view name = protocol::command_name(CommandType(t));
+        for (double q : {0.5, 0.99, 0.999}) {
+            snprintf(labels, sizeof(labels), "command=\"%.*s\",quantile=\"%g\"", int(name.size()), name.data(), q);
+            sample(out, "kvstore_command_duration_seconds", labels, Stats::percentile(totals->latency[t], q) / 1e9);
+        }
+        snprintf(labels, sizeof(labels), "command=\"%.*s\"", int(name.size()), name.data());
+        sample(out, "kvstore_command_duration_seconds_sum", labels, totals->latency_sum[t] / 1e9);
+        sample(out, "kvstore_command_duration_seconds_count", labels, double(totals->calls[t]));
+    }
+
+    family(out, "kvstore_keyspace_hits_total", "counter", "GET/MGET lookups that found the key.");
+    sample(out, "kvstore_keyspace_hits_total", "", double(totals->hits));
+    family(out, "kvstore_keyspace_misses_total", "counter", "GET/MGET lookups that missed.");
+    sample(out, "kvstore_keyspace_misses_total", "", double(totals->misses));
+    family(out, "kvstore_net_input_bytes_total", "counter", "Bytes read from data port clients.");
+    sample(out, "kvstore_net_input_bytes_total", "", double(totals->bytes_in));
+    family(out, "kvstore_net_output_bytes_total", "counter", "Bytes written to data port clients.");
+    sample(out, "kvstore_net_output_bytes_total", "", double(totals->bytes_out));
+    family(out, "kvstore_connected_clients", "gauge", "Open data port connections.");
+    sample(out, "kvstore_connected_clients", "", double(totals->connected));
+    family(out, "kvstore_connections_total", "counter", "Data port connections accepted.");
+    sample(out, "kvstore_connections_total", "", double(totals->connections_total));
+    family(out, "kvstore_rejected_connections_total", "counter", "Connections turned away at the client limit.");
+    sample(out, "kvstore_rejected_connections_total", "", double(totals->rejected));
+    family(out, "kvstore_input_overflows_total", "counter", "Clients disconnected for exceeding the input buffer limit.");
+    sample(out, "kvstore_input_overflows_total", "", double(totals->input_overflows));
+    family(out, "kvstore_read_pauses_total", "counter", "Times a client stopped being read until its replies drained.");
+    sample(out, "kvstore_read_pauses_total", "", double(totals->read_pauses));
+
+    family(out, "kvstore_keys", "gauge", "Keys stored, including expired keys not yet reaped.");
+    sample(out, "kvstore_keys", "", double(store_.size()));
+    family(out, "kvstore_rehashing_shards", "gauge", "Shards whose table is still growing incrementally.");
+    sample(out, "kvstore_rehashing_shards", "", double(store_.rehashing_shards()));
+    family(out, "kvstore_memory_used_bytes", "gauge", "Memory charged against maxmemory.");
+    sample(out, "kvstore_memory_used_bytes", "", double(store_.memory_used()));
+    family(out, "kvstore_maxmemory_bytes", "gauge", "Configured memory bound (0 = unlimited).");
+    sample(out, "kvstore_maxmemory_bytes", "", double(store_.memory_limit()));
+    family(out, "kvstore_evicted_keys_total", "counter", "Keys evicted to stay under maxmemory.");
+    sample(out, "kvstore_evicted_keys_total", "", double(store_.evicted_keys()));
+    family(out, "kvstore_compressed_values_total", "counter", "Values stored LZ4-compressed.");
+    sample(out, "kvstore_compressed_values_total", "", double(totals->compress_kept));
+    family(out, "kvstore_compression_input_bytes_total", "counter", "Size of the values stored compressed, before compression.");
+    sample(out, "kvstore_compression_input_bytes_total", "", double(totals->compress_raw_bytes));
+    family(out, "kvstore_compression_output_bytes_total", "counter", "Size of the values stored compressed, after compression.");
+    sample(out, "kvstore_compression_output_bytes_total", "", double(totals->compress_stored_bytes));
+    family(out, "kvstore_compress_seconds_total", "counter", "Time spent compressing values, kept or not.");
+    sample(out, "kvstore_compress_seconds_total", "", totals->compress_ns / 1e9);
+    family(out, "kvstore_decompress_seconds_total", "counter", "Time spent decompressing values.");
+    sample(out, "kvstore_decompress_seconds_total", "", totals->decompress_ns / 1e9);
+    family(out, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+    sample(out, "process_resident_memory_bytes", "", double(Stats::resident_bytes()));
+
+    std::vector<ShardLock::WaitStats> locks = store_.lock_wait_stats();
+    family(out, "kvstore_shard_lock_contended_total", "counter",
+           "Shard lock acquisitions that could not be granted immediately.");
+    for (size_t i = 0; i < locks.size(); i++) {
+        snprintf(labels, sizeof(labels), "shard=\"%zu\"", i);
+        sample(out, "kvstore_shard_lock_contended_total", labels, double(locks[i].contended));
+    }
+    family(out, "kvstore_shard_lock_wait_seconds_total", "counter", "Time spent waiting for shard locks.");
+    for (size_t i = 0; i < locks.size(); i++) {
+        snprintf(labels, sizeof(labels), "shard=\"%zu\"", i);
+        sample(out, "kvstore_shard_lock_wait_seconds_total", labels, locks[i].wait_ns / 1e9);
+    }
+    return out;
+}
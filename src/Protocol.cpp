@@ -0,0 +1,590 @@
+#include "Protocol.hpp"
+#include "Encoding.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace protocol {
+
+/*
+    Map a command verb to its type. Verbs are packed into a 64-bit integer and matched
+    with a single switch instead of a chain of string compares.
+    Args:
+        verb: the command word
+    Returns:
+        the command type (Unknown if the verb is not recognised)
+*/
+CommandType classify(std::string_view verb) {
+    if (verb.size() > 8) {
+        return CommandType::Unknown;
+    }
+    switch (pack_verb(verb)) {
+        case pack_verb("SET"): return CommandType::Set;
+        case pack_verb("GET"): return CommandType::Get;
+        case pack_verb("DEL"): return CommandType::Del;
+        case pack_verb("MGET"): return CommandType::MGet;
+        case pack_verb("MSET"): return CommandType::MSet;
+        case pack_verb("SLABS"): return CommandType::Slabs;
+        case pack_verb("BGSAVE"): return CommandType::BgSave;
+        case pack_verb("LASTSAVE"): return CommandType::LastSave;
+        case pack_verb("EXPIRE"): return CommandType::Expire;
+        case pack_verb("TTL"): return CommandType::Ttl;
+        case pack_verb("INFO"): return CommandType::Info;
+        case pack_verb("SLOWLOG"): return CommandType::SlowLog;
+        case pack_verb("SCAN"): return CommandType::Scan;
+        case pack_verb("INCR"): return CommandType::Incr;
+        case pack_verb("INCRBY"): return CommandType::IncrBy;
+        case pack_verb("DECR"): return CommandType::Decr;
+        case pack_verb("DECRBY"): return CommandType::DecrBy;
+        case pack_verb("CAS"): return CommandType::Cas;
+        case pack_verb("CLUSTER"): return CommandType::Cluster;
+        default: return CommandType::Unknown;
+    }
+}
+
+/*
+    Lower-case name of a command type, as used in reports.
+    Args:
+        type: the command type
+    Returns:
+        the name ("none" and "unknown" for the non-commands)
+*/
+std::string_view command_name(CommandType type) {
+    switch (type) {
+        case CommandType::None: return "none";
+        case CommandType::Set: return "set";
+        case CommandType::Get: return "get";
+        case CommandType::Del: return "del";
+        case CommandType::MGet: return "mget";
+        case CommandType::MSet: return "mset";
+        case CommandType::Slabs: return "slabs";
+        case CommandType::BgSave: return "bgsave";
+        case CommandType::LastSave: return "lastsave";
+        case CommandType::Expire: return "expire";
+        case CommandType::Ttl: return "ttl";
+        case CommandType::Info: return "info";
+        case CommandType::SlowLog: return "slowlog";
+        case CommandType::Scan: return "scan";
+        case CommandType::Incr: return "incr";
+        case CommandType::IncrBy: return "incrby";
+        case CommandType::Decr: return "decr";
+        case CommandType::DecrBy: return "decrby";
+        case CommandType::Cas: return "cas";
+        case CommandType::Cluster: return "cluster";
+        case CommandType::Unknown: return "unknown";
+    }
+    return "unknown";
+}
+
+/*
+    Split one whitespace-delimited token off the front of a string view.
+    Args:
+        rest: remaining input; advanced to just past the token
+    Returns:
+        the token, or an empty view if only whitespace was left
+*/
+std::string_view next_token(std::string_view& rest) {
+    size_t start = 0;
+    while (start < rest.size() && is_space(rest[start])) {
+        start++;
+    }
+    size_t end = start;
+    while (end < rest.size() && !is_space(rest[end])) {
+        end++;
+    }
+    std::string_view token = rest.substr(start, end - start);
+    rest.remove_prefix(end);
+    return token;
+}
+
+/*
+    Split one whitespace-delimited token off the back of a string view.
+    Args:
+        rest: remaining input; shortened to just before the token
+    Returns:
+        the token, or an empty view if only whitespace was left
+*/
+std::string_view last_token(std::string_view& rest) {
+    size_t end = rest.size();
+    while (end > 0 && is_space(rest[end - 1])) {
+        end--;
+    }
+    size_t start = end;
+    while (start > 0 && !is_space(rest[start - 1])) {
+        start--;
+    }
+    std::string_view token = rest.substr(start, end - start);
+    rest = rest.substr(0, start);
+    return token;
+}
+
+/*
+    Split the rest of a line into whitespace-delimited tokens.
+    Args:
+        rest: input to split
+        tokens: receives the tokens (views into rest)
+    Returns:
+        void
+*/
+void split_tokens(std::string_view rest, std::vector<std::string_view>& tokens) {
+    tokens.clear();
+    for (std::string_view token = next_token(rest); !token.empty(); token = next_token(rest)) {
+        tokens.push_back(token);
+    }
+}
+
+/*
+    Parse a signed decimal integer that makes up a whole token.
+    Args:
+        token: the digits, optionally preceded by '-'
+        value: receives the number
+    Returns:
+        false if the token is empty, has other characters or overflows int64_t
+*/
+bool parse_int(std::string_view token, int64_t& value) {
+    bool negative = !token.empty() && token[0] == '-';
+    if (negative) {
+        token.remove_prefix(1);
+    }
+    if (token.empty() || token.size() > 19) {
+        return false;
+    }
+    uint64_t magnitude = 0;
+    for (char c : token) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        magnitude = magnitude * 10 + uint64_t(c - '0');
+    }
+    if (magnitude > uint64_t(INT64_MAX) + (negative ? 1 : 0)) {
+        return false;
+    }
+    value = negative ? int64_t(0 - magnitude) : int64_t(magnitude);
+    return true;
+}
+
+/*
+    Parse one command line.
+    Args:
+        line: the line without its trailing newline
+        cmd: receives the verb, its type and the remaining arguments
+    Returns:
+        false if the line was blank, true otherwise
+*/
+bool parse_line(std::string_view line, Command& cmd) {
+    std::string_view rest = line;
+    cmd.verb = next_token(rest);
+    if (cmd.verb.empty()) {
+        cmd.type = CommandType::None;
+        return false;
+    }
+    cmd.type = classify(cmd.verb);
+    cmd.args = rest;
+    return true;
+}
+
+}
+
+namespace protocol::binary {
+
+/*
+    Parse one binary request frame.
+    Args:
+        input: unread bytes, starting at a frame boundary
+        req: receives the opcode and views of the key and value
+        consumed: receives the frame size on success
+    Returns:
+        Ok, Incomplete if more bytes are needed, or Invalid for a malformed header
+*/
+ParseResult parse_request(std::string_view input, Request& req, size_t& consumed) {
+    if (input.size() < HEADER_SIZE) {
+        return ParseResult::Incomplete;
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(input.data());
+    if (p[0] != REQUEST_MAGIC || p[1] > uint8_t(LAST_OPCODE)) {
+        return ParseResult::Invalid;
+    }
+    size_t key_len = size_t(p[2]) | size_t(p[3]) << 8;
+    uint32_t value_len = encoding::get_u32(p + 4);
+    if (value_len > MAX_VALUE) {
+        return ParseResult::Invalid;
+    }
+    size_t total = HEADER_SIZE + key_len + value_len;
+    if (input.size() < total) {
+        return ParseResult::Incomplete;
+    }
+    req.op = static_cast<Opcode>(p[1]);
+    req.key = input.substr(HEADER_SIZE, key_len);
+    req.value = input.substr(HEADER_SIZE + key_len, value_len);
+    consumed = total;
+    return ParseResult::Ok;
+}
+
+/*
+    Size the rest of a partly received frame, so the receive buffer can make room for all
+    of it at once.
+    Args:
+        input: unread bytes, starting at a frame boundary
+    Returns:
+        bytes still missing of the first frame (0 if unknown or complete)
+*/
+size_t missing_bytes(std::string_view input) {
+    if (input.size() < HEADER_SIZE) {
+        return 0;
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(input.data());
+    uint32_t value_len = encoding::get_u32(p + 4);
+    if (p[0] != REQUEST_MAGIC || value_len > MAX_VALUE) {
+        return 0;
+    }
+    size_t total = HEADER_SIZE + (size_t(p[2]) | size_t(p[3]) << 8) + value_len;
+    return total > input.size() ? total - input.size() : 0;
+}
+
+/*
+    Parse one binary response frame.
+    Args:
+        input: unread bytes, starting at a frame boundary
+        resp: receives the status, flags and a view of the body
+        consumed: receives the frame size on success
+    Returns:
+        Ok, Incomplete if more bytes are needed, or Invalid for a malformed header
+*/
+ParseResult parse_response(std::string_view input, Response& resp, size_t& consumed) {
+    if (input.size() < HEADER_SIZE) {
+        return ParseResult::Incomplete;
+    }
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(input.data());
+    if (p[0] != RESPONSE_MAGIC || p[1] > uint8_t(Status::Error)) {
+        return ParseResult::Invalid;
+    }
+    uint32_t body_len = encoding::get_u32(p + 4);
+    if (input.size() - HEADER_SIZE < body_len) {
+        return ParseResult::Incomplete;
+    }
+    resp.status = static_cast<Status>(p[1]);
+    resp.flags = p[2];
+    resp.body = input.substr(HEADER_SIZE, body_len);
+    consumed = HEADER_SIZE + body_len;
+    return ParseResult::Ok;
+}
+
+/*
+    Append a request frame.
+    Args:
+        out: output buffer
+        op: request opcode
+        key: the key (at most 65535 bytes)
+        value: the value, or the command line for Text
+    Returns:
+        void
+*/
+void append_request(std::string& out, Opcode op, std::string_view key, std::string_view value) {
+    out.push_back(char(REQUEST_MAGIC));
+    out.push_back(char(op));
+    out.push_back(char(key.size() & 0xFF));
+    out.push_back(char(key.size() >> 8));
+    encoding::put_u32(out, uint32_t(value.size()));
+    out.append(key);
+    out.append(value);
+}
+
+/*
+    Append a response header.
+    Args:
+        out: output buffer
+        status: response status
+        body_len: size of the body that will follow
+        flags: FLAG_* bits describing the body
+    Returns:
+        void
+*/
+void append_header(std::string& out, Status status, uint32_t body_len, uint8_t flags) {
+    out.push_back(char(RESPONSE_MAGIC));
+    out.push_back(char(status));
+    out.push_back(char(flags));
+    out.push_back('\0');
+    encoding::put_u32(out, body_len);
+}
+
+/*
+    Append a complete response frame.
+    Args:
+        out: output buffer
+        status: response status
+        body: response body
+    Returns:
+        void
+*/
+void append_response(std::string& out, Status status, std::string_view body) {
+    append_header(out, status, uint32_t(body.size()));
+    out.append(body);
+}
+
+}
+
+/*
+    Constructor method for ReadBuffer class.
+    Args:
+        initial_capacity: starting size of the buffer in bytes
+    Returns:
+        void
+*/
+ReadBuffer::ReadBuffer(size_t initial_capacity)
+    : buf_(new char[initial_capacity]), capacity_(initial_capacity), initial_capacity_(initial_capacity) {}
+
+/*
+    Ensure there are at least n writable bytes at the tail. Consumed bytes at the front are
+    reclaimed first (moving only the unread remainder, usually one partial line); the buffer
+    doubles only if that is not enough.
+    Args:
+        n: number of bytes the caller wants to write
+    Returns:
+        pointer to the first writable byte
+*/
+char* ReadBuffer::prepare(size_t n) {
+    if (capacity_ - tail_ >= n) {
+        return buf_.get() + tail_;
+    }
+
+    size_t unread = tail_ - head_;
+    if (capacity_ - unread >= n && head_ > 0) { // compaction alone frees enough room
+        std::memmove(buf_.get(), buf_.get() + head_, unread);
+    } else {
+        size_t new_capacity = capacity_ * 2;
+        while (new_capacity - unread < n) {
+            new_capacity *= 2;
+        }
+        std::unique_ptr<char[]> grown(new char[new_capacity]);
+        std::memcpy(grown.get(), buf_.get() + head_, unread);
+        buf_ = std::move(grown);
+        capacity_ = new_capacity;
+    }
+    head_ = 0;
+    tail_ = unread;
+    return buf_.get() + tail_;
+}
+
+/*
+    Make room for the next socket read. Sizing the space to the rest of a request whose
+    length is known grows the buffer once instead of doubling it read after read, and the
+    adaptive size lets a client streaming large values fill the buffer with few syscalls
+    while one sending short commands keeps the initial allocation.
+    Args:
+        want: bytes known to be on their way (0 if unknown)
+    Returns:
+        pointer to the first writable byte; writable() bytes are offered
+*/
+char* ReadBuffer::prepare_read(size_t want) {
+    size_t need = std::max(want, read_size_);
+    if (head_ == tail_ && capacity_ > initial_capacity_ && capacity_ / 4 > need) {
+        // drained after a huge request: don't keep its buffer for the connection's lifetime
+        capacity_ = std::max(initial_capacity_, need);
+        buf_.reset(new char[capacity_]);
+        head_ = tail_ = scanned_ = 0;
+    }
+    char* dst = prepare(need);
+    offered_ = writable();
+    return dst;
+}
+
+/*
+    Mark bytes read into the space prepare_read() offered as readable and adapt the size
+    of the next read to how full this one came back.
+    Args:
+        n: number of bytes read
+    Returns:
+        void
+*/
+void ReadBuffer::commit_read(size_t n) {
+    commit(n);
+    if (n == offered_) {
+        read_size_ = std::min(read_size_ * 2, MAX_READ);
+    } else if (n < read_size_ / 2) {
+        read_size_ = std::max(read_size_ / 2, MIN_READ);
+    }
+}
+
+/*
+    Advance the read cursor.
+    Args:
+        n: number of bytes to mark as consumed
+    Returns:
+        void
+*/
+void ReadBuffer::consume(size_t n) {
+    head_ += n;
+    scanned_ = scanned_ > n ? scanned_ - n : 0;
+    if (head_ == tail_) { // fully drained: rewind for free
+        head_ = tail_ = 0;
+    }
+}
+
+/*
+    Pop the next complete line from the buffer. The search resumes where the previous
+    unsuccessful call stopped, so a long line arriving in many reads is scanned once.
+    Args:
+        line: receives a view of the line (valid until the next prepare())
+    Returns:
+        true if a complete line was available, false otherwise
+*/
+bool ReadBuffer::next_line(std::string_view& line) {
+    const char* start = buf_.get() + head_;
+    size_t unread = tail_ - head_;
+    const char* nl = static_cast<const char*>(std::memchr(start + scanned_, '\n', unread - scanned_));
+    if (nl == nullptr) {
+        scanned_ = unread;
+        return false;
+    }
+
+    size_t len = nl - start;
+    line = std::string_view(start, len);
+    if (!line.empty() && line.back() == '\r') { // tolerate CRLF clients (telnet, nc -C)
+        line.remove_suffix(1);
+    }
+    scanned_ = 0;
+    head_ += len + 1;
+    if (head_ == tail_) {
+        head_ = tail_ = 0;
+    }
+    return true;
+}
+
+/*
+    Find the next complete line without consuming it.
+    Args:
+        line: receives a view of the line (valid until the next prepare())
+        length: receives the bytes to consume() to pop the line, newline included
+    Returns:
+        true if a complete line was available, false otherwise
+*/
+bool ReadBuffer::peek_line(std::string_view& line, size_t& length) {
+    const char* start = buf_.get() + head_;
+    size_t unread = tail_ - head_;
+    const char* nl = static_cast<const char*>(std::memchr(start + scanned_, '\n', unread - scanned_));
+    if (nl == nullptr) {
+        scanned_ = unread;
+        return false;
+    }
+
+    length = size_t(nl - start) + 1;
+    line = std::string_view(start, length - 1);
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    return true;
+}
+
+/*
+    Append a value by reference: it is sent from the shared copy, after the bytes
+    appended so far.
+    Args:
+        value: the value
+    Returns:
+        void
+*/
+void WriteBuffer::append(SharedValue value) {
+    spliced_ += value.size();
+    values_.push_back({bytes_.size(), std::move(value)});
+}
+
+/*
+    Move another buffer's contents behind this one's.
+    Args:
+        other: the buffer to take from; emptied
+    Returns:
+        void
+*/
+void WriteBuffer::append(WriteBuffer&& other) {
+    if (empty()) {
+        bytes_.swap(other.bytes_);
+        values_.swap(other.values_);
+        std::swap(spliced_, other.spliced_);
+        other.clear();
+        return;
+    }
+    for (Splice& splice : other.values_) {
+        values_.push_back({bytes_.size() + splice.at, std::move(splice.value)});
+    }
+    bytes_.append(other.bytes_);
+    spliced_ += other.spliced_;
+    other.clear();
+}
+
+/*
+    Drop all contents, releasing the value references.
+    Args:
+        none
+    Returns:
+        void
+*/
+void WriteBuffer::clear() {
+    bytes_.clear();
+    values_.clear();
+    spliced_ = 0;
+}
+
+/*
+    Describe the unsent part of the stream for writev()/sendmsg(): runs of plain bytes
+    alternate with the referenced values, with empty pieces left out.
+    Args:
+        offset: bytes of the stream already sent
+        iov: receives the pieces
+        max: capacity of iov
+    Returns:
+        number of iovecs filled in (less than the whole stream if max ran out)
+*/
+size_t WriteBuffer::gather(size_t offset, iovec* iov, size_t max) const {
+    size_t count = 0;
+    auto piece = [&](const char* data, size_t len) {
+        if (len <= offset) {
+            offset -= len;
+            return;
+        }
+        iov[count].iov_base = const_cast<char*>(data + offset);
+        iov[count].iov_len = len - offset;
+        count++;
+        offset = 0;
+    };
+    size_t pos = 0;
+    for (const Splice& splice : values_) {
+        if (count == max) {
+            return count;
+        }
+        piece(bytes_.data() + pos, splice.at - pos);
+        pos = splice.at;
+        if (count == max) {
+            return count;
+        }
+        piece(splice.value.view().data(), splice.value.size());
+    }
+    if (count < max) {
+        piece(bytes_.data() + pos, bytes_.size() - pos);
+    }
+    return count;
+}
+
+/*
+    Copy every referenced value into the plain bytes, for consumers that need one
+    contiguous reply.
+    Args:
+        none
+    Returns:
+        void
+*/
+void WriteBuffer::flatten() {
+    if (values_.empty()) {
+        return;
+    }
+    std::string flat;
+    flat.reserve(size());
+    size_t pos = 0;
+    for (const Splice& splice : values_) {
+        flat.append(bytes_, pos, splice.at - pos);
+        flat.append(splice.value.view());
+        pos = splice.at;
+    }
+    flat.append(bytes_, pos, std::string::npos);
+    bytes_.swap(flat);
+    values_.clear();
+    spliced_ = 0;
+}
@@ -0,0 +1,735 @@
+#include "Reactor.hpp"
+#include "AppendLog.hpp"
+#include "ClientLimits.hpp"
+#include "CoreRouter.hpp"
+#include "Stats.hpp"
+#include "SlowLog.hpp"
+#include "CycleClock.hpp"
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <climits>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+namespace {
+constexpr int MAX_EVENTS = 256;        // events handled per epoll_wait
+constexpr size_t MAX_IOVECS = 64;      // pieces of a reply stream passed to one sendmsg()
+
+// reply bytes of a connection not written yet: the output, and the replies of requests
+// run here that wait behind forwarded ones in thread-per-core mode
+size_t unsent(const Connection& conn) {
+    size_t pending = conn.out.size() - conn.out_offset;
+    return conn.slots.empty() ? pending : pending + conn.slots.back().reply.size();
+}
+}
+
+/*
+    Constructor method for Reactor class.
+    Args:
+        listen_fd: non-blocking listening socket shared by all reactors
+        handler: command handler used to execute client commands
+        gate: admission and buffer limits shared by all reactors
+        router: thread-per-core message passing (nullptr for a plain reactor)
+        core: this reactor's core index when router is set
+    Returns:
+        void
+*/
+Reactor::Reactor(int listen_fd, CommandHandler& handler, ClientGate& gate, CoreRouter* router, size_t core)
+    : listen_fd_(listen_fd), epoll_fd_(-1), handler_(handler), gate_(gate), log_(handler.store().log()),
+      router_(router), core_(core) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+
+    // EPOLLEXCLUSIVE: wake only one reactor per incoming connection instead of all of them
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = nullptr; // nullptr marks the listening socket
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0) {
+        close(epoll_fd_);
+        throw std::runtime_error("Failed to register listening socket");
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = this; // marks the gate's shutdown eventfd
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, gate_.shutdown_fd(), &ev) < 0) {
+        close(epoll_fd_);
+        throw std::runtime_error("Failed to register shutdown eventfd");
+    }
+
+    if (router_ != nullptr) {
+        ev.events = EPOLLIN;
+        ev.data.ptr = router_; // marks the wakeup eventfd
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, router_->wake_fd(core_), &ev) < 0) {
+            close(epoll_fd_);
+            throw std::runtime_error("Failed to register wakeup eventfd");
+        }
+        filling_.assign(router_->cores(), nullptr);
+    }
+}
+
+/*
+    Destructor method for Reactor class.
+*/
+Reactor::~Reactor() {
+    for (auto& entry : connections_) {
+        close(entry.first);
+        gate_.release();
+    }
+    if (epoll_fd_ != -1) {
+        close(epoll_fd_);
+    }
+    for (ForwardBatch* batch : filling_) {
+        delete batch;
+    }
+}
+
+/*
+    Run the event loop until a shutdown has drained it.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Reactor::run() {
+    struct epoll_event events[MAX_EVENTS];
+    if (router_ != nullptr) {
+        router_->attach(core_);
+    }
+
+    while (!draining_ || !drained()) {
+        int timeout = -1;
+        if (router_ != nullptr && (!unsent_.empty() || router_->set_idle(core_, true))) {
+            timeout = 0; // other cores are waiting on us: just poll the sockets
+        } else if (draining_) {
+            timeout = drain_wait();
+        }
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+        if (router_ != nullptr) {
+            router_->set_idle(core_, false);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("epoll_wait failed");
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == nullptr) { // new connections on the listener
+                accept_clients();
+                continue;
+            }
+            if (events[i].data.ptr == this) { // the server is shutting down
+                begin_drain();
+                continue;
+            }
+            if (events[i].data.ptr == router_) { // woken by another core
+                uint64_t count;
+                ssize_t drained = read(router_->wake_fd(core_), &count, sizeof(count));
+                (void)drained;
+                continue;
+            }
+
+            Connection& conn = *static_cast<Connection*>(events[i].data.ptr);
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                close_connection(conn);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                if (!flush(conn)) {
+                    continue; // connection was closed
+                }
+                // replies are out: run the requests the output limit held back
+                if (!conn.want_write && !conn.in.empty() && !conn.awaiting_sync && conn.forwarded == 0 &&
+                    !serve(conn)) {
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLIN) {
+                handle_readable(conn);
+            }
+        }
+
+        if (router_ != nullptr) {
+            router_->run_tasks(core_);
+            drain_inbox();
+            send_batches(); // everything forwarded this iteration, one batch per core
+        }
+        flush_after_sync();
+    }
+}
+
+/*
+    Accept every pending connection on the listening socket.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Reactor::accept_clients() {
+    while (true) {
+        int client_fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "Failed to accept client connection" << std::endl;
+            }
+            return; // nothing left to accept (or another reactor got it)
+        }
+        if (!gate_.admit(client_fd)) {
+            continue; // over the client limit: already told and closed
+        }
+
+        // responses are already batched per read, so don't let Nagle hold them back
+        int nodelay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        auto conn = std::make_unique<Connection>(client_fd);
+        conn->id = ++next_id_;
+        struct epoll_event ev {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = conn.get();
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+            close(client_fd);
+            gate_.release();
+            continue;
+        }
+        connections_.emplace(client_fd, std::move(conn));
+        Stats::instance().connection_opened();
+    }
+}
+
+/*
+    Read available bytes from a client, execute every complete line and flush the responses.
+    A client whose unparsed input outgrew the input limit is dropped instead.
+    Args:
+        conn: the readable connection
+    Returns:
+        void
+*/
+void Reactor::handle_readable(Connection& conn) {
+    size_t want = conn.framing == Framing::Binary ? protocol::binary::missing_bytes(conn.in.data()) : 0;
+    if (gate_.input_exceeded(conn.in.size(), want)) {
+        reject_input(conn);
+        return;
+    }
+    char* dst = conn.in.prepare_read(want);
+    ssize_t bytes_read = read(conn.fd, dst, conn.in.writable());
+    if (bytes_read == 0) { // the peer is done sending (or a shutdown stopped reading)
+        conn.eof = true;
+        if (close_if_answered(conn)) {
+            update_interest(conn, conn.want_write); // the end of input would be reported on every wait
+        }
+        return;
+    }
+    if (bytes_read < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            close_connection(conn);
+        }
+        return;
+    }
+    conn.in.commit_read(size_t(bytes_read));
+    Stats::instance().bytes_in(uint64_t(bytes_read));
+    serve(conn);
+}
+
+/*
+    Execute every complete request buffered for a connection and send the replies. Under
+    the output limit that takes rounds: requests run until their replies reach the limit,
+    and the next round starts once those are written, or when EPOLLOUT reports the socket
+    drained. A paused connection is left alone until then.
+    Args:
+        conn: the connection
+    Returns:
+        false if the connection was closed, true otherwise
+*/
+bool Reactor::serve(Connection& conn) {
+    size_t limit = gate_.limits().output_limit;
+    while (!conn.paused) {
+        size_t before = conn.in.size();
+        bool ok;
+        if (router_ != nullptr) {
+            current_ = &conn;
+            ok = handler_.process(conn.in, conn.framing, *this, limit);
+            current_ = nullptr;
+        } else {
+            ok = handler_.process(conn.in, conn.out, conn.framing, limit == 0 ? 0 : conn.out_offset + limit);
+        }
+        conn.held = limit != 0 && !conn.in.empty() && unsent(conn) >= limit;
+        if (!ok) {
+            if (flush(conn)) { // best effort: deliver the error before hanging up
+                close_connection(conn);
+            }
+            SlowLog::instance().batch_written(0, false);
+            return false;
+        }
+        if (!send_replies(conn)) {
+            return false;
+        }
+        if (conn.in.size() == before || conn.in.empty() || conn.want_write || conn.awaiting_sync ||
+            conn.forwarded > 0) {
+            break; // nothing left to run now, or its turn comes once the replies are out
+        }
+    }
+    return true;
+}
+
+/*
+    Flush a connection's replies, or hold them for the log sync in fsync-always mode.
+    Args:
+        conn: the connection
+    Returns:
+        false if the connection was closed, true otherwise
+*/
+bool Reactor::send_replies(Connection& conn) {
+    if (conn.awaiting_sync) {
+        return true; // goes out with the others after the sync
+    }
+    // in fsync-always mode hold the replies until the records this batch appended are durable
+    if (needs_sync()) {
+        conn.awaiting_sync = true;
+        awaiting_sync_.push_back(&conn);
+        return true;
+    }
+    uint64_t start = cycleclock::now();
+    bool open = flush(conn);
+    SlowLog::instance().batch_written(cycleclock::now() - start, open && conn.want_write);
+    return open;
+}
+
+/*
+    Whether replies must wait for the log: fsync-always mode with records appended (here,
+    or by other cores for requests forwarded from here) that this reactor hasn't synced.
+    Args:
+        none
+    Returns:
+        true if replies have to wait for flush_after_sync()
+*/
+bool Reactor::needs_sync() const {
+    return log_ != nullptr && log_->policy() == FsyncPolicy::Always &&
+           std::max(AppendLog::thread_sequence(), forwarded_seq_) > synced_seq_;
+}
+
+/*
+    Group commit for the event loop: wait once for the log to sync everything this
+    reactor appended during the iteration, then release all the held replies. Requests
+    the output limit held back run once their connection's replies are out; their own
+    replies wait for the next iteration's sync.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Reactor::flush_after_sync() {
+    if (awaiting_sync_.empty()) {
+        return;
+    }
+    uint64_t start = cycleclock::now(); // the sync wait counts as reply write time
+    uint64_t seq = std::max(AppendLog::thread_sequence(), forwarded_seq_);
+    bool durable = log_->wait_durable(seq);
+    synced_seq_ = seq;
+
+    std::vector<Connection*> held;
+    held.swap(awaiting_sync_); // serving below may hold replies for the next sync
+    bool blocked = false;
+    for (Connection* conn : held) {
+        conn->awaiting_sync = false;
+        if (!durable) {
+            close_connection(*conn); // can't promise durability: drop the unacknowledged replies
+        } else if (flush(*conn)) {
+            blocked |= conn->want_write;
+            if (!conn->want_write && !conn->in.empty() && conn->forwarded == 0) {
+                serve(*conn);
+            }
+        }
+    }
+    SlowLog::instance().batch_written(cycleclock::now() - start, blocked);
+}
+
+/*
+    Write as much pending output as the socket accepts, arming EPOLLOUT for the rest.
+    Large values are written by sendmsg straight from the store's copies.
+    Args:
+        conn: the connection to flush
+    Returns:
+        false if the connection was closed, true otherwise
+*/
+bool Reactor::flush(Connection& conn) {
+    struct iovec iov[MAX_IOVECS];
+    while (conn.out_offset < conn.out.size()) {
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = conn.out.gather(conn.out_offset, iov, MAX_IOVECS);
+        ssize_t written = sendmsg(conn.fd, &msg, MSG_NOSIGNAL); // a vanished peer is an error, not SIGPIPE
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                update_interest(conn, true); // wait until the socket drains
+                return true;
+            }
+            close_connection(conn); // connection most likely broken
+            return false;
+        }
+        conn.out_offset += written;
+        Stats::instance().bytes_out(uint64_t(written));
+    }
+
+    conn.out.clear();
+    conn.out_offset = 0;
+    update_interest(conn, false);
+    return close_if_answered(conn);
+}
+
+/*
+    Register or unregister write interest for a connection. While the socket is blocked
+    with replies at the output limit, or with requests the limit held back, read interest
+    is dropped too (backpressure: the client's requests wait in the socket until it reads
+    its replies), as it is for good once the input ended.
+    Args:
+        conn: the connection to update
+        want_write: whether EPOLLOUT should be armed
+    Returns:
+        void
+*/
+void Reactor::update_interest(Connection& conn, bool want_write) {
+    size_t limit = gate_.limits().output_limit;
+    bool paused = want_write && limit != 0 && (conn.held || conn.out.size() - conn.out_offset >= limit);
+    bool reading = !paused && !conn.eof;
+    if (conn.want_write == want_write && conn.paused == paused && conn.reading == reading) {
+        return;
+    }
+    if (paused && !conn.paused) {
+        Stats::instance().read_paused();
+    }
+    struct epoll_event ev {};
+    // no EPOLLRDHUP without EPOLLIN either: a half-closed peer would report it on every wait
+    ev.events = (reading ? EPOLLIN | EPOLLRDHUP : 0) | (want_write ? EPOLLOUT : 0);
+    ev.data.ptr = &conn;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &ev);
+    conn.want_write = want_write;
+    conn.paused = paused;
+    conn.reading = reading;
+}
+
+/*
+    Drop a client whose request outgrew the input limit, telling it why (best effort).
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void Reactor::reject_input(Connection& conn) {
+    gate_.reject_input(conn.framing, conn.out);
+    // replies held for the log sync must not go out ahead of it
+    if (conn.awaiting_sync || flush(conn)) {
+        close_connection(conn);
+    }
+}
+
+/*
+    Close a client connection and release its state.
+    Args:
+        conn: the connection to close
+    Returns:
+        void
+*/
+void Reactor::close_connection(Connection& conn) {
+    if (conn.awaiting_sync) {
+        awaiting_sync_.erase(std::find(awaiting_sync_.begin(), awaiting_sync_.end(), &conn));
+    }
+    int fd = conn.fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections_.erase(fd); // destroys conn
+    gate_.release();
+    Stats::instance().connection_closed();
+}
+
+/*
+    Close a connection whose input ended once everything it sent has been answered and
+    the replies are written (with no request held back, waiting for the log or for
+    another core).
+    Args:
+        conn: the connection
+    Returns:
+        false if the connection was closed, true otherwise
+*/
+bool Reactor::close_if_answered(Connection& conn) {
+    if (!conn.eof || conn.held || unsent(conn) != 0 || conn.awaiting_sync || conn.forwarded != 0 ||
+        !conn.slots.empty()) {
+        return true;
+    }
+    close_connection(conn);
+    return false;
+}
+
+/*
+    Start a graceful shutdown: stop accepting and stop reading every connection. A
+    shutdown(SHUT_RD) still lets the requests already in the socket be read, then reads
+    as the end of input, so each connection is closed once those are answered.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Reactor::begin_drain() {
+    draining_ = true;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, listen_fd_, nullptr);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, gate_.shutdown_fd(), nullptr); // level-triggered and never reset
+    drain_deadline_ = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(int64_t(gate_.limits().drain_timeout_ms));
+    for (auto& entry : connections_) {
+        shutdown(entry.first, SHUT_RD);
+    }
+}
+
+/*
+    During a shutdown: drop the connections still open at the drain deadline, and tell
+    whether the loop may end. In thread-per-core mode that waits for every core, since
+    the others' connections may still forward requests here.
+    Args:
+        none
+    Returns:
+        true once this reactor (and every other core) has no connection left
+*/
+bool Reactor::drained() {
+    if (!connections_.empty() && gate_.limits().drain_timeout_ms != 0 &&
+        std::chrono::steady_clock::now() >= drain_deadline_) {
+        std::vector<Connection*> open;
+        for (auto& entry : connections_) {
+            open.push_back(entry.second.get());
+        }
+        for (Connection* conn : open) {
+            close_connection(*conn);
+        }
+    }
+    if (!connections_.empty()) {
+        return false;
+    }
+    return router_ == nullptr || router_->finish(core_);
+}
+
+/*
+    epoll_wait timeout while draining: until the drain deadline, and in thread-per-core
+    mode short enough to notice the other cores finishing.
+    Args:
+        none
+    Returns:
+        the timeout in ms (-1 = none)
+*/
+int Reactor::drain_wait() const {
+    int timeout = -1;
+    if (gate_.limits().drain_timeout_ms != 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(drain_deadline_ -
+                                                                          std::chrono::steady_clock::now());
+        timeout = int(std::clamp<int64_t>(left.count() + 1, 0, INT_MAX));
+    }
+    if (router_ != nullptr && (timeout < 0 || timeout > 10)) {
+        timeout = 10;
+    }
+    return timeout;
+}
+
+/*
+    Handle every batch other cores sent: run the requests they forwarded here and send
+    the batches back answered, and deliver the answers to requests forwarded from here.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Reactor::drain_inbox() {
+    ForwardBatch* batch;
+    for (size_t from = 0; from < router_->cores(); from++) {
+        while (from != core_ && router_->receive(from, core_, batch)) {
+            if (batch->answered) {
+                deliver(*batch);
+                batch->clear();
+                spare_.emplace_back(batch);
+            } else {
+                run_batch(*batch);
+                send_batch(from, batch);
+            }
+        }
+    }
+}
+
+/*
+    Run the requests of a batch forwarded to this core, which owns all of their keys.
+    Args:
+        batch: the batch; its replies are filled in
+    Returns:
+        void
+*/
+void Reactor::run_batch(ForwardBatch& batch) {
+    std::string_view requests = batch.requests;
+    size_t offset = 0;
+    for (const ForwardBatch::Item& item : batch.items) {
+        size_t before = batch.replies.size();
+        handler_.execute_request(item.framing, requests.substr(offset, item.length), batch.replies);
+        batch.reply_lengths.push_back(uint32_t(batch.replies.size() - before));
+        offset += item.length;
+    }
+    batch.log_seq = AppendLog::thread_sequence(); // the sender's replies wait for this in fsync-always mode
+    batch.answered = true;
+    SlowLog::instance().batch_written(0, false); // the replies are written by the sending core
+}
+
+/*
+    Put the answers of a batch into their connections' reply slots, move every run of
+    ready slots to the output and send it. A connection with no request left unanswered
+    resumes the requests it held back.
+    Args:
+        batch: an answered batch this core sent
+    Returns:
+        void
+*/
+void Reactor::deliver(ForwardBatch& batch) {
+    size_t offset = 0;
+    for (size_t i = 0; i < batch.items.size(); i++) {
+        const ForwardBatch::Item& item = batch.items[i];
+        uint32_t length = batch.reply_lengths[i];
+        auto it = connections_.find(item.fd);
+        if (it != connections_.end() && it->second->id == item.conn) { // else: closed since
+            Connection& conn = *it->second;
+            Connection::Slot& slot = conn.slots[item.slot - conn.slots_base];
+            slot.reply.bytes().assign(batch.replies, offset, length);
+            slot.ready = true;
+            conn.forwarded--;
+            if (!conn.answered) {
+                conn.answered = true;
+                answered_.push_back(&conn);
+            }
+        }
+        offset += length;
+    }
+    forwarded_seq_ = std::max(forwarded_seq_, batch.log_seq);
+
+    for (Connection* conn : answered_) {
+        conn->answered = false;
+        while (!conn->slots.empty() && conn->slots.front().ready) {
+            conn->out.append(std::move(conn->slots.front().reply));
+            conn->slots.pop_front();
+            conn->slots_base++;
+        }
+        if (conn->forwarded == 0 && !conn->in.empty()) {
+            serve(*conn);
+        } else {
+            send_replies(*conn);
+        }
+    }
+    answered_.clear();
+}
+
+/*
+    Send the batches filled this iteration, after any still waiting for queue room.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Reactor::send_batches() {
+    if (!unsent_.empty()) {
+        std::vector<bool> blocked(router_->cores(), false); // keep each queue's batches in order
+        size_t kept = 0;
+        for (auto& entry : unsent_) {
+            if (!blocked[entry.first] && router_->send(core_, entry.first, entry.second)) {
+                continue;
+            }
+            blocked[entry.first] = true;
+            unsent_[kept++] = entry;
+        }
+        unsent_.resize(kept);
+    }
+    for (size_t to = 0; to < filling_.size(); to++) {
+        if (filling_[to] != nullptr) {
+            send_batch(to, filling_[to]);
+            filling_[to] = nullptr;
+        }
+    }
+}
+
+/*
+    Send one batch to a core, or keep it for later if that core's queue is full.
+    Args:
+        to: the receiving core
+        batch: the batch
+    Returns:
+        void
+*/
+void Reactor::send_batch(size_t to, ForwardBatch* batch) {
+    bool queued = std::any_of(unsent_.begin(), unsent_.end(), [to](const auto& entry) { return entry.first == to; });
+    if (queued || !router_->send(core_, to, batch)) {
+        unsent_.emplace_back(to, batch);
+    }
+}
+
+/*
+    RequestRouter: hand a request for a key another core owns to that core's batch.
+    Args:
+        shard: the shard the request touches
+        framing: the request's framing
+        request: the raw request
+    Returns:
+        true if it was forwarded, false if this core owns the shard
+*/
+bool Reactor::forward(size_t shard, Framing framing, std::string_view request) {
+    size_t to = router_->owner(shard);
+    if (to == core_) {
+        return false;
+    }
+    ForwardBatch*& batch = filling_[to];
+    if (batch == nullptr) {
+        if (spare_.empty()) {
+            batch = new ForwardBatch();
+        } else {
+            batch = spare_.back().release();
+            spare_.pop_back();
+        }
+    }
+    Connection& conn = *current_;
+    batch->items.push_back({conn.fd, conn.id, conn.slots_base + conn.slots.size(), uint32_t(request.size()), framing});
+    batch->requests.append(request);
+    conn.slots.push_back({WriteBuffer(), false});
+    conn.forwarded++;
+    return true;
+}
+
+/*
+    RequestRouter: where the reply of a request run here goes. Straight to the output
+    unless forwarded requests before it are unanswered; then into a ready slot behind them.
+    Args:
+        none
+    Returns:
+        the buffer to append to
+*/
+WriteBuffer& Reactor::reply_buffer() {
+    Connection& conn = *current_;
+    if (conn.slots.empty()) {
+        return conn.out;
+    }
+    if (!conn.slots.back().ready) {
+        conn.slots.push_back({WriteBuffer(), true});
+    }
+    return conn.slots.back().reply;
+}
+
+/*
+    RequestRouter: reply bytes of the connection in current_ waiting to be written.
+    Args:
+        none
+    Returns:
+        the byte count
+*/
+size_t Reactor::backlog() const {
+    return unsent(*current_);
+}
@@ -0,0 +1,539 @@
+#include "Replication.hpp"
+#include "Snapshot.hpp"
+#include "Encoding.hpp"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <arpa/inet.h>   // htons, inet_ntop
+#include <netinet/in.h>  // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+
+namespace {
+constexpr size_t MAX_LINE = 64;        // handshake lines
+constexpr int HANDSHAKE_TIMEOUT_S = 5; // a replica must send SYNC within this
+constexpr size_t APPLY_BATCH = 4096;   // resync records applied per KVStore::apply() call
+constexpr size_t FRAME_HEADER = 4;     // u32 length
+
+/*
+    Send a whole buffer, retrying on short writes.
+    Args:
+        fd: the socket
+        data: the bytes
+    Returns:
+        false if the connection failed
+*/
+bool send_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(size_t(sent));
+    }
+    return true;
+}
+
+/*
+    Receive exactly len bytes.
+    Args:
+        fd: the socket
+        out: receives the bytes (resized to len)
+        len: number of bytes
+    Returns:
+        false on error, timeout or end of stream
+*/
+bool recv_exact(int fd, std::string& out, size_t len) {
+    out.resize(len);
+    for (size_t got = 0; got < len;) {
+        ssize_t n = recv(fd, &out[got], len - got, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        got += size_t(n);
+    }
+    return true;
+}
+
+/*
+    Receive one newline-terminated handshake line, a byte at a time so nothing after
+    it is consumed.
+    Args:
+        fd: the socket
+        line: receives the line without its newline (and without a trailing \r)
+    Returns:
+        false on error, end of stream or a line longer than MAX_LINE
+*/
+bool recv_line(int fd, std::string& line) {
+    line.clear();
+    char c;
+    while (line.size() <= MAX_LINE) {
+        ssize_t n = recv(fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        if (c == '\n') {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            return true;
+        }
+        line.push_back(c);
+    }
+    return false;
+}
+
+/*
+    Set a socket's receive timeout.
+    Args:
+        fd: the socket
+        ms: timeout in milliseconds
+    Returns:
+        void
+*/
+void set_recv_timeout(int fd, int ms) {
+    struct timeval tv {};
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/*
+    Describe the peer of a connected socket.
+    Args:
+        fd: the socket
+    Returns:
+        "address:port", or "unknown"
+*/
+std::string peer_name(int fd) {
+    struct sockaddr_in address {};
+    socklen_t len = sizeof(address);
+    char text[INET_ADDRSTRLEN];
+    if (getpeername(fd, (struct sockaddr*) &address, &len) < 0 || address.sin_family != AF_INET ||
+        inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text)) == nullptr) {
+        return "unknown";
+    }
+    return std::string(text) + ":" + std::to_string(ntohs(address.sin_port));
+}
+}
+
+/*
+    Constructor method for ReplicationServer class; binds the port and starts accepting.
+    Args:
+        store: the store whose writes are replicated
+        port: replication port
+    Returns:
+        void
+*/
+ReplicationServer::ReplicationServer(KVStore& store, int port) : store_(store) {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        throw std::runtime_error("Failed to create replication socket");
+    }
+    int opt = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(uint16_t(port));
+    if (bind(listen_fd_, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(listen_fd_, 16) < 0) {
+        close(listen_fd_);
+        throw std::runtime_error("Failed to listen on replication port " + std::to_string(port));
+    }
+    acceptor_ = std::thread(&ReplicationServer::run, this);
+}
+
+/*
+    Destructor method for ReplicationServer class.
+*/
+ReplicationServer::~ReplicationServer() {
+    stop_.store(true);
+    shutdown(listen_fd_, SHUT_RDWR); // wakes the blocked accept()
+    acceptor_.join();
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (Replica& replica : replicas_) {
+            shutdown(replica.fd, SHUT_RDWR); // fails a send or handshake in progress
+        }
+    }
+    cv_.notify_all();
+    for (Replica& replica : replicas_) {
+        replica.worker.join();
+        close(replica.fd);
+    }
+    close(listen_fd_);
+}
+
+/*
+    Queue a SET for the replicas.
+    Args:
+        key: the key written
+        value: the value written
+        expires_at: unix time in ms at which the key expires (0 = never)
+    Returns:
+        void
+*/
+void ReplicationServer::append_set(std::string_view key, std::string_view value, int64_t expires_at) {
+    append_record(expires_at != 0 ? AppendLog::Op::SetExpiring : AppendLog::Op::Set, key, value, expires_at);
+}
+
+/*
+    Queue a DEL for the replicas.
+    Args:
+        key: the key removed
+    Returns:
+        void
+*/
+void ReplicationServer::append_del(std::string_view key) {
+    append_record(AppendLog::Op::Del, key, std::string_view(), 0);
+}
+
+/*
+    Queue a change of expiry for the replicas.
+    Args:
+        key: the key
+        expires_at: its new deadline in unix ms (0 = never expires)
+    Returns:
+        void
+*/
+void ReplicationServer::append_expire(std::string_view key, int64_t expires_at) {
+    append_record(AppendLog::Op::ExpireAt, key, std::string_view(), expires_at);
+}
+
+/*
+    Encode a record and add it to the queue of every registered replica. A queue that
+    was empty first gets room for its frame header, so it can be sent as it is. The
+    caller holds the shard lock, which orders this against a snapshot of that shard:
+    a write that sees no replica registered is already in the store when it is copied.
+    Args:
+        op: the mutation
+        key: key it applies to
+        value: new value (empty for deletes)
+        expires_at: deadline carried by SetExpiring and ExpireAt records
+    Returns:
+        void
+*/
+void ReplicationServer::append_record(AppendLog::Op op, std::string_view key, std::string_view value,
+                                      int64_t expires_at) {
+    if (active_.load(std::memory_order_acquire) == 0) {
+        return;
+    }
+    thread_local std::string record;
+    record.clear();
+    AppendLog::encode(op, key, value, expires_at, record);
+
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (Replica& replica : replicas_) {
+            if (!replica.registered || replica.dropped) {
+                continue;
+            }
+            if (replica.queue.empty()) {
+                replica.queue.append(FRAME_HEADER, '\0');
+                wake = true;
+            }
+            replica.queue += record;
+            if (replica.queue.size() > MAX_BACKLOG) {
+                replica.dropped = true;
+                std::string().swap(replica.queue);
+                wake = true;
+            }
+        }
+    }
+    if (wake) {
+        cv_.notify_all();
+    }
+}
+
+/*
+    Acceptor thread body: start a thread per replica, joining those that have finished.
+    Args:
+        none
+    Returns:
+        void
+*/
+void ReplicationServer::run() {
+    while (!stop_.load()) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (stop_.load()) {
+                break;
+            }
+            continue; // EINTR, a connection aborted before it was accepted, ...
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto it = replicas_.begin(); it != replicas_.end();) {
+            if (it->done) {
+                it->worker.join();
+                close(it->fd);
+                it = replicas_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        Replica& replica = replicas_.emplace_back();
+        replica.fd = fd;
+        replica.worker = std::thread(&ReplicationServer::serve, this, std::ref(replica));
+    }
+}
+
+/*
+    Replica thread body: wait for SYNC, send the full resync, then stream. The replica
+    is registered before the snapshot starts, so every write the snapshot may miss is
+    queued behind it.
+    Args:
+        replica: the connection (its fd is closed by whoever joins this thread)
+    Returns:
+        void
+*/
+void ReplicationServer::serve(Replica& replica) {
+    std::string peer = peer_name(replica.fd);
+    set_recv_timeout(replica.fd, HANDSHAKE_TIMEOUT_S * 1000);
+    int opt = 1;
+    setsockopt(replica.fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    std::string line;
+    if (recv_line(replica.fd, line) && line == "SYNC") {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            replica.registered = true;
+            active_.fetch_add(1, std::memory_order_release);
+        }
+        try {
+            auto start = std::chrono::steady_clock::now();
+            if (!send_all(replica.fd, "FULLRESYNC\n")) {
+                throw std::runtime_error("connection lost");
+            }
+            Snapshot::write(store_, replica.fd);
+            full_syncs_.fetch_add(1, std::memory_order_relaxed);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Replication: full resync sent to " << peer << " in " << ms << " ms" << std::endl;
+            stream(replica);
+        } catch (const std::exception& e) {
+            std::cerr << "Replication: replica " << peer << ": " << e.what() << std::endl;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (replica.registered) {
+        replica.registered = false;
+        active_.fetch_sub(1, std::memory_order_release);
+    }
+    std::string().swap(replica.queue);
+    replica.done = true;
+}
+
+/*
+    Send a replica its queued records, a frame per wakeup, until it goes away, falls too
+    far behind or the server stops. Without writes a heartbeat frame goes out every
+    HEARTBEAT_MS.
+    Args:
+        replica: the registered replica
+    Returns:
+        void (throws std::runtime_error when the replica is dropped or disconnects)
+*/
+void ReplicationServer::stream(Replica& replica) {
+    std::string batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait_for(lock, std::chrono::milliseconds(HEARTBEAT_MS),
+                         [&] { return !replica.queue.empty() || replica.dropped || stop_.load(); });
+            if (replica.dropped) {
+                throw std::runtime_error("fell too far behind, dropped");
+            }
+            if (stop_.load()) {
+                return;
+            }
+            batch.clear();
+            batch.swap(replica.queue); // the queue keeps the capacity of the last batch
+        }
+        if (batch.empty()) {
+            batch.append(FRAME_HEADER, '\0'); // heartbeat
+        }
+        encoding::set_u32(batch, 0, uint32_t(batch.size() - FRAME_HEADER));
+        if (!send_all(replica.fd, batch)) {
+            throw std::runtime_error("connection lost");
+        }
+    }
+}
+
+/*
+    Constructor method for ReplicaLink class; starts the replication thread.
+    Args:
+        store: the store to keep in sync
+        host: primary host name or address
+        port: the primary's replication port
+    Returns:
+        void
+*/
+ReplicaLink::ReplicaLink(KVStore& store, std::string host, int port)
+    : store_(store), host_(std::move(host)), port_(port) {
+    worker_ = std::thread(&ReplicaLink::run, this);
+}
+
+/*
+    Destructor method for ReplicaLink class.
+*/
+ReplicaLink::~ReplicaLink() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_.store(true);
+        if (fd_ >= 0) {
+            shutdown(fd_, SHUT_RDWR); // fails the blocked recv()
+        }
+    }
+    cv_.notify_all();
+    worker_.join();
+}
+
+/*
+    Replication thread body: connect, sync and stream; after a failure wait RETRY_MS
+    and start over. A primary that stays unreachable is reported only once.
+    Args:
+        none
+    Returns:
+        void
+*/
+void ReplicaLink::run() {
+    bool reported = false;
+    while (!stop_.load()) {
+        int fd = connect_primary();
+        if (fd >= 0) {
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                fd_ = fd;
+            }
+            try {
+                session(fd);
+            } catch (const std::exception& e) {
+                if (!stop_.load()) {
+                    std::cerr << "Replication from " << host_ << ":" << port_ << ": " << e.what() << std::endl;
+                }
+            }
+            up_.store(false);
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                fd_ = -1;
+            }
+            close(fd);
+            reported = false;
+        } else if (!reported) {
+            std::cerr << "Replication: cannot connect to " << host_ << ":" << port_ << ", retrying" << std::endl;
+            reported = true;
+        }
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait_for(lock, std::chrono::milliseconds(RETRY_MS), [&] { return stop_.load(); });
+    }
+}
+
+/*
+    Open a connection to the primary's replication port.
+    Args:
+        none
+    Returns:
+        the connected socket, or -1
+*/
+int ReplicaLink::connect_primary() {
+    struct addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = nullptr;
+    if (getaddrinfo(host_.c_str(), std::to_string(port_).c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* a = addresses; a != nullptr && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+/*
+    One connection to the primary: request a full resync, replace the store's contents
+    with it, then apply stream frames until the connection fails.
+    Args:
+        fd: the connected socket
+    Returns:
+        void (throws std::runtime_error when the connection fails or the stream is corrupt)
+*/
+void ReplicaLink::session(int fd) {
+    set_recv_timeout(fd, READ_TIMEOUT_MS);
+    std::string line;
+    if (!send_all(fd, "SYNC\n") || !recv_line(fd, line)) {
+        throw std::runtime_error("connection lost during handshake");
+    }
+    if (line != "FULLRESYNC") {
+        throw std::runtime_error("unexpected handshake reply: " + line);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string image;
+    Snapshot::receive(fd, image);
+    store_.clear();
+    std::vector<AppendLog::Record> batch;
+    batch.reserve(APPLY_BATCH);
+    size_t keys = Snapshot::visit(image.data(), image.size(),
+                                  [&](std::string_view key, std::string_view value, int64_t expires_at) {
+                                      AppendLog::Op op = expires_at != 0 ? AppendLog::Op::SetExpiring : AppendLog::Op::Set;
+                                      batch.push_back({op, key, value, expires_at});
+                                      if (batch.size() == APPLY_BATCH) {
+                                          store_.apply(batch);
+                                          batch.clear();
+                                      }
+                                  });
+    store_.apply(batch);
+    std::string().swap(image);
+    full_syncs_.fetch_add(1, std::memory_order_relaxed);
+    up_.store(true);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Replication: synced " << keys << " keys from " << host_ << ":" << port_ << " in " << ms << " ms"
+              << std::endl;
+
+    std::string header;
+    std::string frame;
+    while (!stop_.load()) {
+        if (!recv_exact(fd, header, FRAME_HEADER)) {
+            throw std::runtime_error("connection lost");
+        }
+        size_t length = encoding::get_u32(reinterpret_cast<const unsigned char*>(header.data()));
+        if (length == 0) {
+            continue; // heartbeat
+        }
+        if (!recv_exact(fd, frame, length)) {
+            throw std::runtime_error("connection lost");
+        }
+        batch.clear();
+        size_t used = AppendLog::decode(frame, [&](AppendLog::Op op, std::string_view key, std::string_view value,
+                                                   int64_t expires_at) {
+            batch.push_back({op, key, value, expires_at});
+        });
+        if (used != length) {
+            throw std::runtime_error("corrupt replication frame");
+        }
+        store_.apply(batch);
+        applied_.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+}
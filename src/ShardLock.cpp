@@ -0,0 +1,98 @@
+#include "ShardLock.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr int SPINS_BEFORE_YIELD = 128;
+
+// tell the CPU we're spinning (frees pipeline resources for the sibling hyperthread)
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+/*
+    Spin until a condition holds, yielding the CPU after a short burst so a waiter never
+    holds up the thread it is waiting for on an oversubscribed machine.
+    Args:
+        done: the condition
+    Returns:
+        void
+*/
+template <typename F>
+void spin_until(F&& done) {
+    for (int spins = 0; !done(); spins++) {
+        if (spins < SPINS_BEFORE_YIELD) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+}
+
+/*
+    Select the lock's mode, allocating the reader slots when they are needed.
+    Args:
+        mode: Shared, ReaderSlots or Owner
+    Returns:
+        void
+*/
+void ShardLock::set_mode(LockMode mode) {
+    mode_ = mode;
+    if (mode == LockMode::ReaderSlots && !slots_) {
+        slots_ = std::make_unique<Slot[]>(READER_SLOTS);
+    }
+}
+
+/*
+    Writer side: with the flag raised, wait until every reader that got in before it left.
+    Args:
+        none
+    Returns:
+        void
+*/
+void ShardLock::wait_for_readers() {
+    size_t i = 0;
+    while (i < READER_SLOTS && slots_[i].readers.load(std::memory_order_seq_cst) == 0) {
+        i++;
+    }
+    if (i == READER_SLOTS) {
+        return; // no reader inside: nothing to wait for, nothing to time
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (; i < READER_SLOTS; i++) {
+        std::atomic<uint32_t>& readers = slots_[i].readers;
+        spin_until([&readers] { return readers.load(std::memory_order_seq_cst) == 0; });
+    }
+    record_wait(start);
+}
+
+/*
+    Reader side: wait for the current writer to finish before trying again.
+    Args:
+        none
+    Returns:
+        void
+*/
+void ShardLock::wait_for_writer() {
+    auto start = std::chrono::steady_clock::now();
+    spin_until([this] { return !writer_.load(std::memory_order_acquire); });
+    record_wait(start);
+}
+
+/*
+    Count one contended acquisition.
+    Args:
+        start: when the caller started waiting
+    Returns:
+        void
+*/
+void ShardLock::record_wait(std::chrono::steady_clock::time_point start) {
+    auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    contended_.fetch_add(1, std::memory_order_relaxed);
+    wait_ns_.fetch_add(uint64_t(waited.count()), std::memory_order_relaxed);
+    thread_wait_ns() += uint64_t(waited.count());
+}
@@ -0,0 +1,194 @@
+#include "SlabAllocator.hpp"
+#include <algorithm>
+#include <new>
+
+namespace {
+constexpr size_t SLOT_ALIGN = 16;       // every slot size is a multiple of this
+constexpr size_t SMALL_LIMIT = 1024;    // sizes up to here use the direct lookup table
+
+/*
+    Build the slot size table: every 16 bytes up to 128, then roughly 1.25x steps
+    (rounded to 16 bytes) up to MAX_SLOT, bounding internal waste at ~25%.
+    Args:
+        none
+    Returns:
+        ascending list of slot sizes
+*/
+std::vector<size_t> build_classes() {
+    std::vector<size_t> sizes;
+    for (size_t s = SLOT_ALIGN; s <= 128; s += SLOT_ALIGN) {
+        sizes.push_back(s);
+    }
+    while (sizes.back() < SlabArena::MAX_SLOT) {
+        size_t next = sizes.back() * 5 / 4;
+        next = (next + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+        sizes.push_back(std::min(next, SlabArena::MAX_SLOT));
+    }
+    return sizes;
+}
+
+/*
+    Build the table mapping (n + 15) / 16 to a class index for small sizes.
+    Args:
+        sizes: the slot size table
+    Returns:
+        class index for each 16-byte step up to SMALL_LIMIT
+*/
+std::vector<unsigned char> build_small_lookup(const std::vector<size_t>& sizes) {
+    std::vector<unsigned char> lookup(SMALL_LIMIT / SLOT_ALIGN + 1);
+    for (size_t i = 0; i < lookup.size(); i++) {
+        size_t n = i * SLOT_ALIGN;
+        lookup[i] = static_cast<unsigned char>(std::lower_bound(sizes.begin(), sizes.end(), n) - sizes.begin());
+    }
+    return lookup;
+}
+
+// never destroyed: stores with static storage duration still free into their arenas at exit
+const std::vector<unsigned char>& small_lookup() {
+    static const auto* lookup = new std::vector<unsigned char>(build_small_lookup(SlabArena::class_sizes()));
+    return *lookup;
+}
+}
+
+/*
+    Get the slot size table shared by all arenas.
+    Args:
+        none
+    Returns:
+        ascending list of slot sizes
+*/
+const std::vector<size_t>& SlabArena::class_sizes() {
+    static const auto* sizes = new std::vector<size_t>(build_classes()); // leaked, like small_lookup()
+    return *sizes;
+}
+
+/*
+    Constructor method for SlabArena class.
+*/
+SlabArena::SlabArena() {
+    const auto& sizes = class_sizes();
+    classes_.resize(sizes.size());
+    for (size_t i = 0; i < sizes.size(); i++) {
+        classes_[i].stats.slot_size = sizes[i];
+    }
+}
+
+/*
+    Destructor method for SlabArena class.
+*/
+SlabArena::~SlabArena() {
+    for (void* slab : slabs_) {
+        ::operator delete(slab, std::align_val_t(SLOT_ALIGN));
+    }
+}
+
+/*
+    Find the size class serving a request.
+    Args:
+        n: requested size in bytes (at most MAX_SLOT)
+    Returns:
+        index of the smallest class whose slots fit n bytes
+*/
+size_t SlabArena::class_index(size_t n) {
+    if (n <= SMALL_LIMIT) {
+        return small_lookup()[(n + SLOT_ALIGN - 1) / SLOT_ALIGN];
+    }
+    const auto& sizes = class_sizes();
+    return std::lower_bound(sizes.begin(), sizes.end(), n) - sizes.begin();
+}
+
+/*
+    Give a class a fresh slab. Slots are handed out from it with a bump pointer rather
+    than threaded onto the free list up front, so pages are only touched once used.
+    Args:
+        cls: the size class to refill
+    Returns:
+        void
+*/
+void SlabArena::refill(SizeClass& cls) {
+    size_t slot_size = cls.stats.slot_size;
+    size_t count = SLAB_SIZE / slot_size;
+    char* slab = static_cast<char*>(::operator new(count * slot_size, std::align_val_t(SLOT_ALIGN)));
+    slabs_.push_back(slab);
+
+    cls.bump = slab;
+    cls.bump_left = count;
+    cls.stats.slabs++;
+    cls.stats.slots += count;
+}
+
+/*
+    Allocate n bytes, reusing a freed slot of the matching class when one exists.
+    Args:
+        n: number of bytes requested
+    Returns:
+        pointer to at least n bytes, 16-byte aligned
+*/
+void* SlabArena::allocate(size_t n) {
+    if (n > MAX_SLOT) {
+        large_.used++;
+        large_.requested += n;
+        in_use_ += n;
+        return ::operator new(n, std::align_val_t(SLOT_ALIGN));
+    }
+
+    SizeClass& cls = classes_[class_index(n)];
+    cls.stats.used++;
+    cls.stats.requested += n;
+    in_use_ += cls.stats.slot_size;
+    if (cls.free_list != nullptr) { // reuse a freed slot
+        FreeSlot* slot = cls.free_list;
+        cls.free_list = slot->next;
+        return slot;
+    }
+    if (cls.bump_left == 0) {
+        refill(cls);
+    }
+    void* slot = cls.bump;
+    cls.bump += cls.stats.slot_size;
+    cls.bump_left--;
+    return slot;
+}
+
+/*
+    Return memory to its size class's free list (or to the heap for oversized blocks).
+    Args:
+        p: pointer returned by allocate
+        n: the size that was passed to allocate
+    Returns:
+        void
+*/
+void SlabArena::deallocate(void* p, size_t n) {
+    if (n > MAX_SLOT) {
+        large_.used--;
+        large_.requested -= n;
+        in_use_ -= n;
+        ::operator delete(p, std::align_val_t(SLOT_ALIGN));
+        return;
+    }
+
+    SizeClass& cls = classes_[class_index(n)];
+    FreeSlot* slot = static_cast<FreeSlot*>(p);
+    slot->next = cls.free_list;
+    cls.free_list = slot;
+    cls.stats.used--;
+    cls.stats.requested -= n;
+    in_use_ -= cls.stats.slot_size;
+}
+
+/*
+    Snapshot the utilization of every size class.
+    Args:
+        none
+    Returns:
+        one entry per class, followed by an entry (slot_size 0) for oversized allocations
+*/
+std::vector<SlabArena::ClassStats> SlabArena::stats() const {
+    std::vector<ClassStats> out;
+    out.reserve(classes_.size() + 1);
+    for (const auto& cls : classes_) {
+        out.push_back(cls.stats);
+    }
+    out.push_back(large_);
+    return out;
+}
@@ -0,0 +1,162 @@
+#include "SlowLog.hpp"
+#include "CycleClock.hpp"
+#include "TimerWheel.hpp"
+#include <algorithm>
+
+namespace {
+// slow commands of the current batch; handed in early if no batch_written() comes
+constexpr size_t MAX_HELD = 64;
+
+thread_local std::vector<SlowLog::Entry> held;
+}
+
+/*
+    Get the process-wide slow log.
+    Args:
+        none
+    Returns:
+        the instance (intentionally leaked so it outlives every thread)
+*/
+SlowLog& SlowLog::instance() {
+    static SlowLog* log = new SlowLog();
+    return *log;
+}
+
+/*
+    Set the threshold and the number of entries kept (older entries are dropped).
+    Args:
+        threshold_us: minimum command time to log in microseconds (< 0: off, 0: everything)
+        max_len: entries to keep
+    Returns:
+        void
+*/
+void SlowLog::configure(int64_t threshold_us, size_t max_len) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    threshold_us_ = threshold_us;
+    max_len_ = max_len;
+    while (entries_.size() > max_len_) {
+        entries_.pop_front();
+    }
+    uint64_t ticks = threshold_us < 0 || max_len == 0 ? UINT64_MAX : cycleclock::from_ns(uint64_t(threshold_us) * 1000);
+    threshold_ticks_.store(ticks, std::memory_order_relaxed);
+}
+
+/*
+    Keep a slow command until its batch's reply is written.
+    Args:
+        ticks: the command's duration
+        lock_ns: time it spent waiting for shard locks
+        verb: the command word
+        args: its arguments (copied, truncated to MAX_COMMAND_BYTES)
+    Returns:
+        void
+*/
+void SlowLog::hold(uint64_t ticks, uint64_t lock_ns, std::string_view verb, std::string_view args) {
+    if (held.size() >= MAX_HELD) {
+        append(held); // the caller doesn't report writes; don't hold on forever
+    }
+    Entry entry;
+    entry.unix_ms = TimerWheel::now_ms();
+    uint64_t total = cycleclock::to_ns(ticks);
+    entry.lock_ns = lock_ns < total ? lock_ns : total;
+    entry.exec_ns = total - entry.lock_ns;
+    entry.command.assign(verb);
+    while (!args.empty() && (args.front() == ' ' || args.front() == '\t')) {
+        args.remove_prefix(1);
+    }
+    if (!args.empty()) {
+        entry.command += ' ';
+        entry.command.append(args.substr(0, MAX_COMMAND_BYTES - std::min(MAX_COMMAND_BYTES, entry.command.size())));
+    }
+    if (entry.command.size() > MAX_COMMAND_BYTES) {
+        entry.command.resize(MAX_COMMAND_BYTES);
+    }
+    held.push_back(std::move(entry));
+}
+
+/*
+    Finish the current batch: the held slow commands get its write time, and a slow write
+    without a slow command is logged on its own.
+    Args:
+        ticks: cycleclock time spent writing the batch's replies
+        blocked: whether part of the output was left waiting for the socket
+    Returns:
+        void
+*/
+void SlowLog::batch_written(uint64_t ticks, bool blocked) {
+    uint64_t threshold = threshold_ticks_.load(std::memory_order_relaxed);
+    if (held.empty()) {
+        if (ticks < threshold) {
+            return;
+        }
+        Entry entry;
+        entry.unix_ms = TimerWheel::now_ms();
+        entry.command = "(reply write)";
+        held.push_back(std::move(entry));
+    }
+    uint64_t write_ns = cycleclock::to_ns(ticks);
+    for (Entry& entry : held) {
+        entry.write_ns = write_ns;
+        entry.write_blocked = blocked;
+    }
+    append(held);
+}
+
+/*
+    Move entries into the log, numbering them.
+    Args:
+        batch: the entries; emptied
+    Returns:
+        void
+*/
+void SlowLog::append(std::vector<Entry>& batch) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (Entry& entry : batch) {
+        entry.id = next_id_++;
+        entries_.push_back(std::move(entry));
+    }
+    while (entries_.size() > max_len_) {
+        entries_.pop_front();
+    }
+    batch.clear();
+}
+
+/*
+    Copy the newest entries.
+    Args:
+        count: maximum number of entries
+    Returns:
+        the entries, newest first
+*/
+std::vector<SlowLog::Entry> SlowLog::latest(size_t count) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    std::vector<Entry> out;
+    for (auto it = entries_.rbegin(); it != entries_.rend() && out.size() < count; ++it) {
+        out.push_back(*it);
+    }
+    return out;
+}
+
+/*
+    Count the logged entries.
+    Args:
+        none
+    Returns:
+        number of entries kept
+*/
+size_t SlowLog::size() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return entries_.size();
+}
+
+/*
+    Drop every entry (ids keep counting).
+    Args:
+        none
+    Returns:
+        void
+*/
+void SlowLog::reset() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    entries_.clear();
+}
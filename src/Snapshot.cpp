@@ -0,0 +1,563 @@
+#include "Snapshot.hpp"
+#include "AppendLog.hpp"
+#include "Checksum.hpp"
+#include "Encoding.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace {
+constexpr char FILE_MAGIC[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr char END_MAGIC[8] = {'K', 'V', 'S', 'N', 'A', 'P', 'E', 'N'};
+constexpr uint32_t BLOCK_MAGIC = 0x4B42564B; // "KVBK"
+constexpr uint32_t VERSION = 2;     // version 2 added per-record expiry
+constexpr uint32_t VERSION_NO_TTL = 1; // still loaded
+constexpr size_t FILE_HEADER = 16;
+constexpr size_t BLOCK_HEADER = 20;
+constexpr size_t TRAILER = 24;
+
+/*
+    Write a whole buffer to a file descriptor, retrying short writes.
+    Args:
+        fd: destination file descriptor
+        data: bytes to write
+        len: number of bytes
+        socket: fd is a socket (sent with MSG_NOSIGNAL, so a peer that went away is an
+            error instead of a SIGPIPE)
+    Returns:
+        void (throws std::runtime_error on failure)
+*/
+void write_out(int fd, const char* data, size_t len, bool socket) {
+    while (len > 0) {
+        ssize_t n = socket ? ::send(fd, data, len, MSG_NOSIGNAL) : ::write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Snapshot write failed: ") + std::strerror(errno));
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// a block being filled with one shard's entries
+struct BlockBuilder {
+    std::string bytes;
+    uint32_t records = 0;
+
+    void start(uint32_t shard) {
+        bytes.clear();
+        records = 0;
+        encoding::put_u32(bytes, BLOCK_MAGIC);
+        encoding::put_u32(bytes, shard);
+        bytes.append(12, '\0'); // records, payload length, checksum: filled in by finish()
+    }
+
+    void add(std::string_view key, std::string_view value, int64_t expires_at) {
+        encoding::put_u32(bytes, uint32_t(key.size()));
+        encoding::put_u32(bytes, uint32_t(value.size()));
+        encoding::put_u64(bytes, uint64_t(expires_at));
+        bytes.append(key);
+        bytes.append(value);
+        records++;
+    }
+
+    size_t payload_size() const { return bytes.size() - BLOCK_HEADER; }
+
+    void finish() {
+        encoding::set_u32(bytes, 8, records);
+        encoding::set_u32(bytes, 12, uint32_t(payload_size()));
+        encoding::set_u32(bytes, 16, crc32c(bytes.data() + BLOCK_HEADER, payload_size()));
+    }
+};
+
+struct BlockRef {
+    uint32_t shard;
+    const unsigned char* header;
+};
+
+/*
+    Read exactly len bytes from a stream.
+    Args:
+        fd: the stream
+        out: buffer the bytes are appended to
+        len: number of bytes
+    Returns:
+        void (throws std::runtime_error on error or end of stream)
+*/
+void read_in(int fd, std::string& out, size_t len) {
+    size_t base = out.size();
+    out.resize(base + len);
+    for (size_t got = 0; got < len;) {
+        ssize_t n = ::read(fd, &out[base + got], len - got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error(n == 0 ? std::string("Snapshot stream ended early")
+                                            : std::string("Snapshot read failed: ") + std::strerror(errno));
+        }
+        got += size_t(n);
+    }
+}
+
+// what the header and trailer of an image say
+struct ImageLayout {
+    uint32_t version;
+    uint32_t shards;
+    uint64_t index_offset;
+    std::vector<BlockRef> blocks;
+};
+
+/*
+    Check an image's framing and read its block index.
+    Args:
+        base: the image
+        len: size of the image
+    Returns:
+        the layout (throws std::runtime_error if the image is corrupt)
+*/
+ImageLayout read_layout(const unsigned char* base, size_t len) {
+    const unsigned char* end = base + len;
+    if (len < FILE_HEADER + TRAILER || std::memcmp(base, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 ||
+        std::memcmp(end - sizeof(END_MAGIC), END_MAGIC, sizeof(END_MAGIC)) != 0) {
+        throw std::runtime_error("Not a snapshot file (bad magic)");
+    }
+    ImageLayout layout;
+    layout.version = encoding::get_u32(base + 8);
+    if (layout.version != VERSION && layout.version != VERSION_NO_TTL) {
+        throw std::runtime_error("Unsupported snapshot version");
+    }
+    layout.shards = encoding::get_u32(base + 12);
+
+    const unsigned char* trailer = end - TRAILER;
+    uint32_t block_count = encoding::get_u32(trailer);
+    uint32_t index_crc = encoding::get_u32(trailer + 4);
+    layout.index_offset = encoding::get_u64(trailer + 8);
+    if (layout.index_offset > len - TRAILER || (len - TRAILER - layout.index_offset) != uint64_t(block_count) * 8 ||
+        crc32c(base + layout.index_offset, size_t(block_count) * 8) != index_crc) {
+        throw std::runtime_error("Snapshot block index is corrupt");
+    }
+
+    layout.blocks.reserve(block_count);
+    for (uint32_t i = 0; i < block_count; i++) {
+        uint64_t offset = encoding::get_u64(base + layout.index_offset + 8 * i);
+        if (offset < FILE_HEADER || offset + BLOCK_HEADER > layout.index_offset) {
+            throw std::runtime_error("Snapshot block offset out of range");
+        }
+        layout.blocks.push_back({encoding::get_u32(base + offset + 4), base + offset});
+    }
+    return layout;
+}
+
+/*
+    Verify one block and pass its records on.
+    Args:
+        block: pointer to the block header
+        end: end of the snapshot image
+        version: format version of the image (version 1 records have no expiry)
+        insert: called as insert(key, value, expires_at) for every record
+    Returns:
+        number of records read (throws std::runtime_error if the block is corrupt)
+*/
+template <typename Insert>
+size_t read_block(const unsigned char* block, const unsigned char* end, uint32_t version, Insert&& insert) {
+    if (end - block < ptrdiff_t(BLOCK_HEADER) || encoding::get_u32(block) != BLOCK_MAGIC) {
+        throw std::runtime_error("Snapshot block header is corrupt");
+    }
+    uint32_t records = encoding::get_u32(block + 8);
+    uint32_t payload_len = encoding::get_u32(block + 12);
+    uint32_t crc = encoding::get_u32(block + 16);
+    const unsigned char* p = block + BLOCK_HEADER;
+    if (size_t(end - p) < payload_len || crc32c(p, payload_len) != crc) {
+        throw std::runtime_error("Snapshot block checksum mismatch");
+    }
+
+    const unsigned char* payload_end = p + payload_len;
+    size_t record_header = version == VERSION_NO_TTL ? 8 : 16;
+    for (uint32_t i = 0; i < records; i++) {
+        if (size_t(payload_end - p) < record_header) {
+            throw std::runtime_error("Snapshot record is truncated");
+        }
+        uint32_t key_len = encoding::get_u32(p);
+        uint32_t value_len = encoding::get_u32(p + 4);
+        int64_t expires_at = record_header == 16 ? int64_t(encoding::get_u64(p + 8)) : 0;
+        p += record_header;
+        if (size_t(payload_end - p) < size_t(key_len) + value_len) {
+            throw std::runtime_error("Snapshot record is truncated");
+        }
+        std::string_view key(reinterpret_cast<const char*>(p), key_len);
+        std::string_view value(reinterpret_cast<const char*>(p) + key_len, value_len);
+        insert(key, value, expires_at);
+        p += key_len + value_len;
+    }
+    return records;
+}
+}
+
+/*
+    Stream a snapshot of the store to a file descriptor.
+    Args:
+        store: the store to snapshot
+        fd: destination (file or socket)
+    Returns:
+        void
+*/
+void Snapshot::write(KVStore& store, int fd) {
+    struct stat st;
+    bool socket = fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+    std::string header(FILE_MAGIC, sizeof(FILE_MAGIC));
+    encoding::put_u32(header, VERSION);
+    encoding::put_u32(header, uint32_t(store.shard_count()));
+    write_out(fd, header.data(), header.size(), socket);
+
+    uint64_t offset = header.size();
+    std::vector<uint64_t> index;
+    std::vector<std::string> blocks;
+    BlockBuilder builder;
+
+    for (size_t shard = 0; shard < store.shard_count(); shard++) {
+        // copy the shard out under its read lock, then write without holding it
+        blocks.clear();
+        builder.start(uint32_t(shard));
+        store.for_each_in_shard(shard, [&](std::string_view key, std::string_view value, int64_t expires_at) {
+            builder.add(key, value, expires_at);
+            if (builder.payload_size() >= BLOCK_TARGET) {
+                builder.finish();
+                blocks.push_back(std::move(builder.bytes));
+                builder.start(uint32_t(shard));
+            }
+        });
+        if (builder.records > 0) {
+            builder.finish();
+            blocks.push_back(std::move(builder.bytes));
+        }
+
+        for (const std::string& block : blocks) {
+            index.push_back(offset);
+            write_out(fd, block.data(), block.size(), socket);
+            offset += block.size();
+        }
+    }
+
+    std::string tail;
+    for (uint64_t block_offset : index) {
+        encoding::put_u64(tail, block_offset);
+    }
+    uint32_t index_crc = crc32c(tail.data(), tail.size());
+    encoding::put_u32(tail, uint32_t(index.size()));
+    encoding::put_u32(tail, index_crc);
+    encoding::put_u64(tail, offset);
+    tail.append(END_MAGIC, sizeof(END_MAGIC));
+    write_out(fd, tail.data(), tail.size(), socket);
+}
+
+/*
+    Read one image off a stream that may carry more data after it. The image doesn't
+    state its size up front, so it is read piece by piece: the header, then blocks for
+    as long as the next word is a block magic, then the index (one offset per block
+    read) and the trailer. The first word after the blocks can't be a block magic: it
+    is the low half of the first block's offset, or a block count of 0.
+    Args:
+        fd: the stream, positioned at the start of an image
+        image: receives the image
+    Returns:
+        void (throws std::runtime_error on a read error or corrupt framing)
+*/
+void Snapshot::receive(int fd, std::string& image) {
+    image.clear();
+    read_in(fd, image, FILE_HEADER);
+    if (std::memcmp(image.data(), FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        throw std::runtime_error("Not a snapshot stream (bad magic)");
+    }
+    size_t blocks = 0;
+    while (true) {
+        size_t at = image.size();
+        read_in(fd, image, 4);
+        if (encoding::get_u32(reinterpret_cast<const unsigned char*>(image.data() + at)) != BLOCK_MAGIC) {
+            break;
+        }
+        read_in(fd, image, BLOCK_HEADER - 4);
+        read_in(fd, image, encoding::get_u32(reinterpret_cast<const unsigned char*>(image.data() + at + 12)));
+        blocks++;
+    }
+    read_in(fd, image, blocks * 8 + TRAILER - 4); // the word already read starts the index or the trailer
+}
+
+/*
+    Save a snapshot to a file atomically: readers of path see either the previous
+    snapshot or the complete new one.
+    Args:
+        store: the store to snapshot
+        path: destination file
+    Returns:
+        void
+*/
+void Snapshot::save(KVStore& store, const std::string& path) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create snapshot file " + tmp);
+    }
+    try {
+        write(store, fd);
+        if (fsync(fd) != 0) {
+            throw std::runtime_error("Failed to sync snapshot file " + tmp);
+        }
+    } catch (...) {
+        close(fd);
+        unlink(tmp.c_str());
+        throw;
+    }
+    close(fd);
+
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        throw std::runtime_error("Failed to move snapshot into place at " + path);
+    }
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) { // make the rename itself durable
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+/*
+    Load a snapshot image. When the image was taken with the same shard count as the store,
+    each worker takes whole shards so no two threads touch the same shard lock; otherwise
+    blocks are handed out individually and keys are re-routed by set() (on one thread if
+    the store's shards have no locks).
+    Args:
+        store: destination store
+        data: the snapshot image
+        len: size of the image
+        threads: worker threads (0 = one per core)
+    Returns:
+        number of keys loaded
+*/
+size_t Snapshot::load(KVStore& store, const char* data, size_t len, size_t threads) {
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(data);
+    ImageLayout layout = read_layout(base, len);
+    const std::vector<BlockRef>& blocks = layout.blocks;
+    uint32_t snapshot_shards = layout.shards;
+    uint64_t index_offset = layout.index_offset;
+    uint32_t version = layout.version;
+
+    // group work: one unit per shard if the layouts match, else one unit per block
+    std::vector<std::vector<const unsigned char*>> units;
+    if (snapshot_shards == store.shard_count()) {
+        units.resize(snapshot_shards);
+        for (const BlockRef& block : blocks) {
+            if (block.shard >= snapshot_shards) {
+                throw std::runtime_error("Snapshot block shard out of range");
+            }
+            units[block.shard].push_back(block.header);
+        }
+    } else {
+        for (const BlockRef& block : blocks) {
+            units.push_back({block.header});
+        }
+        if (store.lock_mode() == LockMode::Owner) {
+            threads = 1; // re-routed keys would meet in shards without locks
+        }
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::max<size_t>(1, std::min(threads, units.size()));
+
+    std::atomic<size_t> next_unit{0};
+    std::atomic<size_t> loaded{0};
+    std::mutex error_mtx;
+    std::string error;
+
+    auto worker = [&] {
+        try {
+            size_t count = 0;
+            for (size_t u; (u = next_unit.fetch_add(1)) < units.size();) {
+                for (const unsigned char* block : units[u]) {
+                    count += read_block(block, base + index_offset, version,
+                                        [&store](std::string_view key, std::string_view value, int64_t expires_at) {
+                                            store.set(key, value, expires_at); // expired since the save: dropped
+                                        });
+                }
+            }
+            loaded += count;
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(error_mtx);
+            error = e.what();
+            next_unit = units.size(); // stop the other workers early
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+    return loaded;
+}
+
+/*
+    Read every record of an image in order, on the calling thread.
+    Args:
+        data: the snapshot image
+        len: size of the image
+        fn: called as fn(key, value, expires_at) per record; the views point into data
+    Returns:
+        number of records read (throws std::runtime_error if the image is corrupt)
+*/
+size_t Snapshot::visit(const char* data, size_t len, const RecordFn& fn) {
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(data);
+    ImageLayout layout = read_layout(base, len);
+    size_t records = 0;
+    for (const BlockRef& block : layout.blocks) {
+        records += read_block(block.header, base + layout.index_offset, layout.version, fn);
+    }
+    return records;
+}
+
+/*
+    Map a snapshot file into memory and load it.
+    Args:
+        store: destination store
+        path: snapshot file
+        threads: worker threads (0 = one per core)
+    Returns:
+        number of keys loaded (0 if the file doesn't exist)
+*/
+size_t Snapshot::load_file(KVStore& store, const std::string& path, size_t threads) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        throw std::runtime_error("Failed to open snapshot file " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat snapshot file " + path);
+    }
+    size_t len = st.st_size;
+    void* map = len ? mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        throw std::runtime_error("Failed to map snapshot file " + path);
+    }
+    madvise(map, len, MADV_WILLNEED); // start readahead for all workers at once
+
+    try {
+        size_t keys = load(store, static_cast<const char*>(map), len, threads);
+        munmap(map, len);
+        return keys;
+    } catch (...) {
+        munmap(map, len);
+        throw;
+    }
+}
+
+/*
+    Constructor method for BackgroundSaver class.
+    Args:
+        store: the store to snapshot
+        path: snapshot file to write
+    Returns:
+        void
+*/
+BackgroundSaver::BackgroundSaver(KVStore& store, std::string path) : store_(store), path_(std::move(path)) {}
+
+/*
+    Destructor method for BackgroundSaver class.
+*/
+BackgroundSaver::~BackgroundSaver() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+/*
+    Start a background save.
+    Args:
+        none
+    Returns:
+        true if a save was started, false if one is already running
+*/
+bool BackgroundSaver::start() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (running_.exchange(true)) {
+        return false;
+    }
+    if (worker_.joinable()) { // reap the previous (finished) save
+        worker_.join();
+    }
+    worker_ = std::thread(&BackgroundSaver::run, this);
+    return true;
+}
+
+/*
+    Save in the foreground, as on shutdown. A save already running finishes first; its
+    image may predate the latest writes, so this one is taken anyway.
+    Args:
+        none
+    Returns:
+        true if the snapshot was written
+*/
+bool BackgroundSaver::save() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    running_ = true;
+    return run();
+}
+
+/*
+    Save body, on the background thread or in save(): checkpoint the log, write the
+    snapshot, then drop the log records the snapshot supersedes if the checkpoint
+    rotated the log.
+    Args:
+        none
+    Returns:
+        true if the snapshot was written
+*/
+bool BackgroundSaver::run() {
+    AppendLog* log = store_.log();
+    bool saved = false;
+    try {
+        // without a rotation the checkpoint file is not ours to drop: it may be the one the
+        // writer still appends to after failing to reopen the log
+        bool checkpointed = log != nullptr && log->begin_checkpoint();
+        Snapshot::save(store_, path_);
+        if (checkpointed) {
+            log->end_checkpoint();
+        }
+        last_save_ = std::time(nullptr);
+        saved = true;
+        std::cout << "Background save to " << path_ << " finished" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Background save failed: " << e.what() << std::endl;
+    }
+    running_ = false;
+    return saved;
+}
@@ -0,0 +1,190 @@
+#include "Stats.hpp"
+#include <cstdio>
+#include <unistd.h>
+
+// a thread's claim on a counter block, given back when the thread exits
+struct StatsThreadHandle {
+    Stats::Counters* block = nullptr;
+
+    ~StatsThreadHandle() {
+        if (block != nullptr) {
+            Stats::instance().release(block);
+        }
+    }
+};
+
+/*
+    Get the process-wide statistics instance.
+    Args:
+        none
+    Returns:
+        the instance (intentionally leaked so it outlives every thread)
+*/
+Stats& Stats::instance() {
+    static Stats* stats = new Stats();
+    return *stats;
+}
+
+/*
+    Get the calling thread's counter block, claiming one on first use.
+    Args:
+        none
+    Returns:
+        the block
+*/
+Stats::Counters& Stats::local() {
+    thread_local StatsThreadHandle handle;
+    if (handle.block == nullptr) {
+        handle.block = acquire();
+    }
+    return *handle.block;
+}
+
+/*
+    Hand out a block: a retired one if available, else a new one.
+    Args:
+        none
+    Returns:
+        the block, owned by the caller's thread until it exits
+*/
+Stats::Counters* Stats::acquire() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!free_.empty()) {
+        Counters* block = free_.back();
+        free_.pop_back();
+        return block;
+    }
+    blocks_.push_back(std::make_unique<Counters>());
+    return blocks_.back().get();
+}
+
+/*
+    Return an exiting thread's block for reuse; its counts stay in the totals.
+    Args:
+        block: the block
+    Returns:
+        void
+*/
+void Stats::release(Counters* block) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    free_.push_back(block);
+}
+
+/*
+    Sum every thread's counters.
+    Args:
+        none
+    Returns:
+        the totals
+*/
+std::unique_ptr<Stats::Totals> Stats::collect() {
+    auto totals = std::make_unique<Totals>();
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (const auto& block : blocks_) {
+        for (size_t t = 0; t < COMMAND_TYPES; t++) {
+            totals->calls[t] += block->calls[t].load(std::memory_order_relaxed);
+            totals->latency_sum[t] += block->latency_sum[t].load(std::memory_order_relaxed);
+            for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+                totals->latency[t][b] += block->latency[t][b].load(std::memory_order_relaxed);
+            }
+        }
+        totals->hits += block->hits.load(std::memory_order_relaxed);
+        totals->misses += block->misses.load(std::memory_order_relaxed);
+        totals->bytes_in += block->bytes_in.load(std::memory_order_relaxed);
+        totals->bytes_out += block->bytes_out.load(std::memory_order_relaxed);
+        totals->connections_total += block->connections_total.load(std::memory_order_relaxed);
+        totals->connected += block->connected.load(std::memory_order_relaxed);
+        totals->rejected += block->rejected.load(std::memory_order_relaxed);
+        totals->input_overflows += block->input_overflows.load(std::memory_order_relaxed);
+        totals->read_pauses += block->read_pauses.load(std::memory_order_relaxed);
+        totals->compress_calls += block->compress_calls.load(std::memory_order_relaxed);
+        totals->compress_kept += block->compress_kept.load(std::memory_order_relaxed);
+        totals->compress_raw_bytes += block->compress_raw_bytes.load(std::memory_order_relaxed);
+        totals->compress_stored_bytes += block->compress_stored_bytes.load(std::memory_order_relaxed);
+        totals->compress_ns += block->compress_ns.load(std::memory_order_relaxed);
+        totals->decompress_calls += block->decompress_calls.load(std::memory_order_relaxed);
+        totals->decompress_ns += block->decompress_ns.load(std::memory_order_relaxed);
+    }
+    return totals;
+}
+
+/*
+    Find a quantile in a latency histogram.
+    Args:
+        buckets: per-bucket counts
+        q: quantile in [0, 1]
+    Returns:
+        upper edge (ns) of the bucket holding the quantile, 0 if the histogram is empty
+*/
+uint64_t Stats::percentile(const uint64_t (&buckets)[LATENCY_BUCKETS], double q) {
+    uint64_t total = 0;
+    for (uint64_t count : buckets) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = uint64_t(q * double(total - 1)) + 1;
+    uint64_t seen = 0;
+    constexpr size_t SUB = size_t(1) << LATENCY_SUB_BITS;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            if (i < SUB) {
+                return i;
+            }
+            unsigned shift = unsigned(i / SUB) - 1;
+            return ((uint64_t(i % SUB) + SUB + 1) << shift) - 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Read the process's resident set size from /proc/self/statm.
+    Args:
+        none
+    Returns:
+        bytes resident, including allocator and buffer overhead (0 if unavailable)
+*/
+uint64_t Stats::resident_bytes() {
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return 0;
+    }
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    if (fscanf(statm, "%lu %lu", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE));
+}
+
+/*
+    Time since startup.
+    Args:
+        none
+    Returns:
+        seconds
+*/
+double Stats::uptime() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+}
+
+/*
+    Command rate over the interval since the previous call.
+    Args:
+        total_calls: commands executed so far
+    Returns:
+        commands per second
+*/
+double Stats::rate_since_last(uint64_t total_calls) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - last_sample_time_).count();
+    double rate = seconds > 0 ? double(total_calls - last_sample_calls_) / seconds : 0.0;
+    last_sample_time_ = now;
+    last_sample_calls_ = total_calls;
+    return rate;
+}
@@ -0,0 +1,159 @@
+#include "TimerWheel.hpp"
+#include <utility>
+#include <time.h>
+
+namespace {
+constexpr int64_t SLOT_MASK = int64_t(TimerWheel::SLOTS) - 1;
+constexpr int64_t WHEEL_SPAN = int64_t(1) << (TimerWheel::LEVEL_BITS * TimerWheel::LEVELS); // ticks
+
+/*
+    Convert a deadline to the first tick at or after it.
+    Args:
+        deadline_ms: unix time in ms
+    Returns:
+        the tick whose processing guarantees the deadline has passed
+*/
+int64_t tick_of(int64_t deadline_ms) {
+    return (deadline_ms + TimerWheel::TICK_MS - 1) / TimerWheel::TICK_MS;
+}
+}
+
+/*
+    Constructor method for TimerWheel class.
+    Args:
+        now_ms: current unix time in ms
+    Returns:
+        void
+*/
+TimerWheel::TimerWheel(int64_t now_ms) : current_(now_ms / TICK_MS) {}
+
+/*
+    Read the coarse realtime clock. Deadlines are wall-clock times so that they keep
+    their meaning across restarts (snapshots and the append-only log store them as is).
+    Args:
+        none
+    Returns:
+        current unix time in ms
+*/
+int64_t TimerWheel::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+    Arm a timer.
+    Args:
+        key: the key the timer belongs to
+        deadline_ms: unix time in ms at which it fires
+    Returns:
+        void
+*/
+void TimerWheel::schedule(std::string_view key, int64_t deadline_ms) {
+    schedule(Timer{std::string(key), deadline_ms});
+}
+
+/*
+    Arm a timer, taking ownership of its key.
+    Args:
+        timer: the key and deadline
+    Returns:
+        void
+*/
+void TimerWheel::schedule(Timer timer) {
+    int64_t tick = tick_of(timer.deadline);
+    file(std::move(timer), tick);
+}
+
+/*
+    File a timer into the slot covering its tick: the lowest level whose span reaches
+    it. Deadlines beyond the top level are parked at its far end and re-filed from there.
+    Args:
+        timer: the timer to file
+        tick: the tick it fires at
+    Returns:
+        void
+*/
+void TimerWheel::file(Timer&& timer, int64_t tick) {
+    if (tick < current_) {
+        due_.push_back(std::move(timer));
+        return;
+    }
+    int64_t delta = tick - current_;
+    if (delta >= WHEEL_SPAN) {
+        tick = current_ + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+    size_t level = 0;
+    while (delta >= (int64_t(1) << (LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    levels_[level][(tick >> (LEVEL_BITS * level)) & SLOT_MASK].push_back(std::move(timer));
+    pending_++;
+}
+
+/*
+    Re-file every timer of the current slot of a level into the levels below it.
+    Args:
+        level: the level to cascade (>= 1)
+    Returns:
+        void
+*/
+void TimerWheel::cascade(size_t level) {
+    std::vector<Timer> timers;
+    timers.swap(levels_[level][(current_ >> (LEVEL_BITS * level)) & SLOT_MASK]);
+    pending_ -= timers.size();
+    for (Timer& timer : timers) {
+        int64_t tick = tick_of(timer.deadline);
+        file(std::move(timer), tick);
+    }
+}
+
+/*
+    Process every tick up to the current time. Once nothing is left in the wheel the
+    clock jumps straight to now, so an idle wheel costs nothing to advance.
+    Args:
+        now_ms: current unix time in ms
+    Returns:
+        void
+*/
+void TimerWheel::advance(int64_t now_ms) {
+    int64_t target = now_ms / TICK_MS;
+    while (current_ <= target && pending_ > 0) {
+        if ((current_ & SLOT_MASK) == 0) {
+            // level 0 wrapped: pull the next slot of each level down, as far as levels wrapped too
+            for (size_t level = 1; level < LEVELS; level++) {
+                cascade(level);
+                if (((current_ >> (LEVEL_BITS * level)) & SLOT_MASK) != 0) {
+                    break;
+                }
+            }
+        }
+        std::vector<Timer>& slot = levels_[0][current_ & SLOT_MASK];
+        pending_ -= slot.size();
+        for (Timer& timer : slot) {
+            due_.push_back(std::move(timer));
+        }
+        slot.clear();
+        current_++;
+    }
+    if (current_ <= target) {
+        current_ = target + 1;
+    }
+}
+
+/*
+    Take one timer off the due list.
+    Args:
+        out: receives the timer
+    Returns:
+        false if no timer is due
+*/
+bool TimerWheel::pop_due(Timer& out) {
+    if (due_.empty()) {
+        return false;
+    }
+    out = std::move(due_.back());
+    due_.pop_back();
+    return true;
+}
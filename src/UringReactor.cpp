@@ -0,0 +1,824 @@
+#include "UringReactor.hpp"
+#include "AppendLog.hpp"
+#include "ClientLimits.hpp"
+#include "Stats.hpp"
+#include "SlowLog.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+namespace {
+constexpr unsigned SQ_ENTRIES = 1024;
+constexpr unsigned CQ_ENTRIES = 8192;  // completions can pile up faster than submissions
+constexpr unsigned BUFFERS = 1024;     // receive buffers per reactor (a power of two)
+constexpr size_t BUFFER_SIZE = 4096;   // larger reads arrive as several completions
+constexpr uint16_t BUFFER_GROUP = 0;
+
+// the operation a completion belongs to, in the low bits of user_data (connections are 8-aligned)
+enum Tag : uint64_t {
+    TAG_ACCEPT = 1, TAG_RECV = 2, TAG_SEND = 3, TAG_PROBE = 4, TAG_PROVIDE = 5, TAG_CANCEL = 6,
+    TAG_SHUTDOWN = 7 // the gate's shutdown eventfd became readable, then the drain deadline passed
+};
+constexpr uint64_t TAG_MASK = 7;
+
+uint64_t user_data(UringConnection* conn, Tag tag) {
+    return reinterpret_cast<uint64_t>(conn) | tag;
+}
+
+UringConnection* connection_of(uint64_t data) {
+    return reinterpret_cast<UringConnection*>(data & ~TAG_MASK);
+}
+
+std::string error_text(const char* what, int err) {
+    return std::string(what) + ": " + std::strerror(err);
+}
+
+// whether a connection with nothing left to send should be closed: after a protocol
+// violation, or once its input ended and every request it sent has run
+bool finished(const UringConnection& conn) {
+    return conn.hangup || (conn.eof && !conn.paused);
+}
+}
+
+/*
+    Constructor method for UringReactor class: builds the reactor in the buffer mode this
+    kernel supports.
+    Args:
+        listen_fd: listening socket shared by all reactors
+        handler: command handler used to execute client commands
+        gate: admission and buffer limits shared by all reactors
+    Returns:
+        void
+*/
+UringReactor::UringReactor(int listen_fd, CommandHandler& handler, ClientGate& gate)
+    : UringReactor(listen_fd, handler, gate, buffer_mode(handler, gate)) {}
+
+/*
+    Constructor method for UringReactor class: sets up the rings and the receive buffers
+    and checks the kernel supports everything the loop relies on.
+    Args:
+        listen_fd: listening socket shared by all reactors
+        handler: command handler used to execute client commands
+        gate: admission and buffer limits shared by all reactors
+        mode: whether to register a buffer ring or use provide-buffers requests
+    Returns:
+        void
+*/
+UringReactor::UringReactor(int listen_fd, CommandHandler& handler, ClientGate& gate, BufferMode mode)
+    : listen_fd_(listen_fd), handler_(handler), gate_(gate), log_(handler.store().log()) {
+    try {
+        setup_rings();
+        setup_buffers(mode);
+        if (!probe()) {
+            throw std::runtime_error("io_uring lacks multishot recv with provided buffers (needs Linux 6.0)");
+        }
+    } catch (...) {
+        teardown();
+        throw;
+    }
+}
+
+/*
+    Decide once per process whether receive buffers can go through a registered buffer
+    ring. A throwaway reactor that never serves anything registers one and probes it,
+    for kernels that accept the registration yet never pick buffers from it (the probe
+    ends with ENOBUFS). Its ring goes away with its ring fd before any reactor that
+    serves clients is built, so no live ring ever has its buffer ring swapped out.
+    Args:
+        handler: command handler the throwaway reactor is built with
+        gate: limits the throwaway reactor is built with
+    Returns:
+        Ring if the probe received through the buffer ring, else Provided
+*/
+UringReactor::BufferMode UringReactor::buffer_mode(CommandHandler& handler, ClientGate& gate) {
+    static const BufferMode mode = [&] {
+        try {
+            UringReactor trial(-1, handler, gate, BufferMode::Ring);
+            return BufferMode::Ring;
+        } catch (const std::runtime_error&) {
+            return BufferMode::Provided; // if that fails too, the real constructor reports it
+        }
+    }();
+    return mode;
+}
+
+/*
+    Destructor method for UringReactor class.
+*/
+UringReactor::~UringReactor() {
+    for (auto& entry : connections_) {
+        close(entry.first);
+        gate_.release();
+    }
+    teardown();
+}
+
+/*
+    Create the ring and map its submission queue, completion queue and SQE array.
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::setup_rings() {
+    io_uring_params params {};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = CQ_ENTRIES;
+    int fd = int(syscall(__NR_io_uring_setup, SQ_ENTRIES, &params));
+    if (fd < 0 && errno == EINVAL) { // COOP_TASKRUN is 5.19+; the rest of the checks come later
+        params = {};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = CQ_ENTRIES;
+        fd = int(syscall(__NR_io_uring_setup, SQ_ENTRIES, &params));
+    }
+    if (fd < 0) {
+        throw std::runtime_error(error_text("io_uring_setup failed", errno));
+    }
+    ring_.fd = fd;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        throw std::runtime_error("io_uring is too old (needs single mmap and no-drop completions)");
+    }
+
+    // one mapping holds both rings
+    ring_.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring_.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    size_t size = std::max(ring_.sq_map_size, ring_.cq_map_size);
+    void* rings = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (rings == MAP_FAILED) {
+        throw std::runtime_error(error_text("Failed to map io_uring rings", errno));
+    }
+    ring_.sq_map = ring_.cq_map = rings;
+    ring_.sq_map_size = ring_.cq_map_size = size;
+
+    ring_.sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, ring_.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        throw std::runtime_error(error_text("Failed to map io_uring SQEs", errno));
+    }
+    ring_.sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* base = static_cast<char*>(rings);
+    ring_.sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    ring_.sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    ring_.sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    ring_.sq_entries = params.sq_entries;
+    ring_.cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    ring_.cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    ring_.cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    ring_.cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    // SQE i always sits in array slot i, so the indirection array never changes
+    unsigned* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+}
+
+/*
+    Allocate the receive buffers and hand them to the kernel: through a registered buffer
+    ring (5.19+), or as classic provided buffers where the ring can't be registered or
+    doesn't work.
+    Args:
+        mode: whether to try the buffer ring
+    Returns:
+        void
+*/
+void UringReactor::setup_buffers(BufferMode mode) {
+    buffers_ = std::make_unique<char[]>(BUFFERS * BUFFER_SIZE);
+    if (mode == BufferMode::Provided) {
+        provide_buffers(0, BUFFERS);
+        return;
+    }
+
+    buf_ring_size_ = BUFFERS * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        throw std::runtime_error(error_text("Failed to allocate the buffer ring", errno));
+    }
+    buf_ring_ = static_cast<io_uring_buf_ring*>(ring);
+
+    io_uring_buf_reg reg {};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = BUFFERS;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = nullptr;
+        provide_buffers(0, BUFFERS);
+        return;
+    }
+    for (unsigned i = 0; i < BUFFERS; i++) {
+        recycle_buffer(uint16_t(i));
+    }
+}
+
+/*
+    Queue a classic provide-buffers request for a run of consecutive buffers. It is
+    submitted with the next io_uring_enter, so it costs no syscall of its own.
+    Args:
+        first: id of the first buffer
+        count: number of buffers
+    Returns:
+        void
+*/
+void UringReactor::provide_buffers(uint16_t first, unsigned count) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = int(count);
+    sqe->addr = reinterpret_cast<uint64_t>(buffers_.get() + size_t(first) * BUFFER_SIZE);
+    sqe->len = uint32_t(BUFFER_SIZE);
+    sqe->off = first;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = TAG_PROVIDE;
+}
+
+/*
+    Run a multishot recv with a provided buffer over a socketpair: the one feature the
+    ring setup can't reveal (it needs 6.0; the registrations above work from 5.19).
+    Args:
+        none
+    Returns:
+        true if the recv delivered a byte into a provided buffer and stayed armed
+*/
+bool UringReactor::probe() {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        throw std::runtime_error(error_text("socketpair failed", errno));
+    }
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = pair[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = TAG_PROBE;
+
+    bool supported = false;
+    bool armed = write(pair[1], "x", 1) == 1;
+    while (armed) {
+        if (enter(1) < 0 && errno != EINTR) {
+            break;
+        }
+        io_uring_cqe cqe;
+        while (pop_cqe(cqe)) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                recycle_buffer(uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            if (cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE)) {
+                supported = true;
+                close(pair[1]); // ends the recv with a final completion
+                pair[1] = -1;
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                armed = false;
+            }
+        }
+    }
+    if (pair[1] != -1) {
+        close(pair[1]);
+    }
+    close(pair[0]);
+    return supported;
+}
+
+/*
+    Release the ring, its mappings and the buffer ring.
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::teardown() {
+    if (ring_.fd != -1) {
+        close(ring_.fd); // cancels whatever is still in flight
+        ring_.fd = -1;
+    }
+    if (ring_.sqes != nullptr) {
+        munmap(ring_.sqes, ring_.sqes_size);
+        ring_.sqes = nullptr;
+    }
+    if (ring_.sq_map != nullptr) {
+        munmap(ring_.sq_map, ring_.sq_map_size);
+        ring_.sq_map = ring_.cq_map = nullptr;
+    }
+    if (buf_ring_ != nullptr) {
+        munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = nullptr;
+    }
+}
+
+/*
+    Claim the next submission queue entry, submitting what is queued if the ring is full.
+    The kernel only reads the queue inside io_uring_enter, so the tail can be published
+    before the caller fills the entry in. Throws std::runtime_error if the head is past
+    the tail (the ring memory was overwritten), where waiting for room would never end.
+    Args:
+        none
+    Returns:
+        a zeroed entry
+*/
+io_uring_sqe* UringReactor::next_sqe() {
+    unsigned tail = *ring_.sq_tail;
+    while (true) {
+        unsigned queued = tail - std::atomic_ref<unsigned>(*ring_.sq_head).load(std::memory_order_acquire);
+        if (queued > ring_.sq_entries) {
+            throw std::runtime_error("io_uring submission queue is corrupt (head " +
+                                     std::to_string(*ring_.sq_head) + ", tail " + std::to_string(tail) + ")");
+        }
+        if (queued < ring_.sq_entries) {
+            break;
+        }
+        if (enter(0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            throw std::runtime_error(error_text("io_uring_enter failed", errno));
+        }
+    }
+    io_uring_sqe* sqe = &ring_.sqes[tail & ring_.sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    std::atomic_ref<unsigned>(*ring_.sq_tail).store(tail + 1, std::memory_order_release);
+    unsubmitted_++;
+    return sqe;
+}
+
+/*
+    Take the next completion off the ring.
+    Args:
+        cqe: receives the completion
+    Returns:
+        false if the completion queue is empty
+*/
+bool UringReactor::pop_cqe(io_uring_cqe& cqe) {
+    unsigned head = *ring_.cq_head;
+    if (head == std::atomic_ref<unsigned>(*ring_.cq_tail).load(std::memory_order_acquire)) {
+        return false;
+    }
+    cqe = ring_.cqes[head & ring_.cq_mask];
+    std::atomic_ref<unsigned>(*ring_.cq_head).store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/*
+    Submit every queued entry and optionally wait for completions, in one syscall.
+    Args:
+        wait_for: completions to wait for (0 = just submit)
+    Returns:
+        entries submitted, or -1 with errno set
+*/
+int UringReactor::enter(unsigned wait_for) {
+    int submitted = int(syscall(__NR_io_uring_enter, ring_.fd, unsubmitted_, wait_for,
+                                wait_for > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+    if (submitted > 0) {
+        unsubmitted_ -= unsigned(submitted);
+    }
+    return submitted;
+}
+
+/*
+    Hand a receive buffer back to the kernel.
+    Args:
+        id: buffer id
+    Returns:
+        void
+*/
+void UringReactor::recycle_buffer(uint16_t id) {
+    if (buf_ring_ == nullptr) {
+        provide_buffers(id, 1);
+        return;
+    }
+    // the ring is an array of entries with the tail in bufs[0].resv. Not buf_ring_->bufs:
+    // older uapi headers put it after an empty struct, one byte (padded to 8) in C++
+    io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_ & (BUFFERS - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_.get() + size_t(id) * BUFFER_SIZE);
+    buf.len = uint32_t(BUFFER_SIZE);
+    buf.bid = id;
+    buf_tail_++;
+    std::atomic_ref<uint16_t>(buf_ring_->tail).store(buf_tail_, std::memory_order_release);
+}
+
+/*
+    Queue a multishot accept on the listening socket.
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::arm_accept() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = TAG_ACCEPT;
+    accept_armed_ = true;
+}
+
+/*
+    Queue a poll for the gate's shutdown eventfd.
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::arm_shutdown_poll() {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = gate_.shutdown_fd();
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = TAG_SHUTDOWN;
+}
+
+/*
+    Queue a multishot recv drawing from the reactor's buffer ring.
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void UringReactor::arm_recv(UringConnection& conn) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = user_data(&conn, TAG_RECV);
+    conn.recv_armed = true;
+}
+
+/*
+    Queue a cancel of the connection's multishot recv; it then ends with -ECANCELED (data
+    it delivered before still arrives first).
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void UringReactor::cancel_recv(UringConnection& conn) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data(&conn, TAG_RECV);
+    sqe->user_data = TAG_CANCEL;
+}
+
+/*
+    Queue a send of the connection's pending replies (the unsent rest of the previous
+    send first). Must not be called while a send is in flight. Replies that reference
+    large values go out with sendmsg, straight from the store's copies.
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void UringReactor::start_send(UringConnection& conn) {
+    if (conn.sending.empty()) {
+        if (conn.out.empty()) {
+            return;
+        }
+        conn.sending.append(std::move(conn.out)); // out keeps collecting replies while this one is in flight
+        conn.sent = 0;
+    }
+    io_uring_sqe* sqe = next_sqe();
+    sqe->fd = conn.fd;
+    if (conn.sending.has_values()) {
+        conn.msg = msghdr{};
+        conn.msg.msg_iov = conn.iov;
+        conn.msg.msg_iovlen = conn.sending.gather(conn.sent, conn.iov, UringConnection::SEND_IOVECS);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+        sqe->len = 1;
+    } else {
+        const std::string& bytes = conn.sending.bytes();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = reinterpret_cast<uint64_t>(bytes.data() + conn.sent);
+        sqe->len = uint32_t(std::min<size_t>(bytes.size() - conn.sent, UINT32_MAX));
+    }
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data(&conn, TAG_SEND);
+    conn.send_inflight = true;
+}
+
+/*
+    Run the event loop until a shutdown has drained it.
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::run() {
+    arm_accept();
+    arm_shutdown_poll();
+
+    while (!draining_ || accept_armed_ || !connections_.empty()) {
+        // one syscall submits every send and re-arm queued last iteration and waits
+        if (enter(1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            throw std::runtime_error(error_text("io_uring_enter failed", errno));
+        }
+
+        io_uring_cqe cqe;
+        while (pop_cqe(cqe)) {
+            switch (cqe.user_data & TAG_MASK) {
+                case TAG_ACCEPT:
+                    on_accept(cqe);
+                    break;
+                case TAG_RECV:
+                    on_recv(*connection_of(cqe.user_data), cqe);
+                    break;
+                case TAG_SEND:
+                    on_send(*connection_of(cqe.user_data), cqe);
+                    break;
+                case TAG_SHUTDOWN:
+                    on_shutdown();
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        send_replies();
+
+        for (UringConnection* conn : finished_) {
+            int fd = conn->fd;
+            close(fd);
+            connections_.erase(fd); // destroys conn
+            gate_.release();
+            Stats::instance().connection_closed();
+        }
+        finished_.clear();
+    }
+}
+
+/*
+    A client arrived (or the multishot accept ended and must be re-armed).
+    Args:
+        cqe: the accept completion; res is the new socket
+    Returns:
+        void
+*/
+void UringReactor::on_accept(const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        accept_armed_ = false;
+        if (!draining_) {
+            arm_accept();
+        }
+    }
+    if (cqe.res < 0) {
+        if (cqe.res != -EINTR && cqe.res != -EAGAIN && cqe.res != -ECONNABORTED && cqe.res != -ECANCELED) {
+            std::cerr << "Failed to accept client connection: " << std::strerror(-cqe.res) << std::endl;
+        }
+        return;
+    }
+
+    int client_fd = cqe.res;
+    if (!gate_.admit(client_fd)) {
+        return; // over the client limit: already told and closed
+    }
+    // responses are already batched per read, so don't let Nagle hold them back
+    int nodelay = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    auto conn = std::make_unique<UringConnection>(client_fd);
+    arm_recv(*conn);
+    connections_.emplace(client_fd, std::move(conn));
+    Stats::instance().connection_opened();
+}
+
+/*
+    The server is shutting down (first completion): cancel the accept, stop reading the
+    connections and arm the drain deadline. A shutdown(SHUT_RD) still lets the requests
+    already in a socket be received, then ends its stream, so each connection is closed
+    once those are answered. At the deadline (second completion), close whatever is left.
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::on_shutdown() {
+    if (draining_) {
+        for (auto& entry : connections_) {
+            begin_close(*entry.second);
+        }
+        return;
+    }
+    draining_ = true;
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = TAG_ACCEPT;
+    sqe->user_data = TAG_CANCEL;
+    for (auto& entry : connections_) {
+        shutdown(entry.first, SHUT_RD);
+    }
+
+    size_t ms = gate_.limits().drain_timeout_ms;
+    if (ms != 0) {
+        drain_timeout_.tv_sec = int64_t(ms / 1000);
+        drain_timeout_.tv_nsec = int64_t(ms % 1000) * 1000000;
+        sqe = next_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = reinterpret_cast<uint64_t>(&drain_timeout_);
+        sqe->len = 1;
+        sqe->user_data = TAG_SHUTDOWN;
+    }
+}
+
+/*
+    Data (or the end of the stream) arrived: copy it out of the ring buffer, execute every
+    complete request and queue the replies. A client whose unparsed input outgrows the
+    input limit is sent an error and closed.
+    Args:
+        conn: the connection
+        cqe: the recv completion
+    Returns:
+        void
+*/
+void UringReactor::on_recv(UringConnection& conn, const io_uring_cqe& cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        conn.recv_armed = false;
+    }
+
+    if (cqe.res > 0) {
+        uint16_t id = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        size_t n = size_t(cqe.res);
+        // room for all of a partly received binary frame at once, not one buffer at a time
+        size_t want = conn.framing == Framing::Binary ? protocol::binary::missing_bytes(conn.in.data()) : 0;
+        bool exceeded = gate_.input_exceeded(conn.in.size() + n, want > n ? want - n : 0);
+        if (!exceeded) {
+            std::memcpy(conn.in.prepare_read(std::max(n, want)), buffers_.get() + size_t(id) * BUFFER_SIZE, n);
+            conn.in.commit(n);
+        }
+        recycle_buffer(id);
+        Stats::instance().bytes_in(n);
+
+        if (conn.closing || conn.hangup) {
+            // whatever still arrives is dropped
+        } else if (exceeded) {
+            gate_.reject_input(conn.framing, conn.out);
+            conn.hangup = true;
+            if (!conn.queued) {
+                conn.queued = true;
+                replies_.push_back(&conn);
+            }
+        } else if (!conn.paused) { // else it waits in conn.in until the replies drain
+            serve(conn);
+        }
+    } else if (cqe.res == 0) { // the peer is done sending (or a shutdown stopped reading)
+        conn.eof = true;
+        if (!conn.paused && !conn.queued && !conn.send_inflight) {
+            begin_close(conn); // nothing left to answer
+        }
+    } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) { // a socket error
+        begin_close(conn);
+    }
+
+    // a recv ends without an error when the buffer ring ran dry (or cancelled by a pause
+    // that is already over); start another
+    if (!conn.recv_armed && !conn.closing && !conn.hangup && !conn.eof && !conn.paused) {
+        arm_recv(conn);
+    }
+    release_if_idle(conn);
+}
+
+/*
+    Execute the complete requests buffered for a connection, up to the output limit, and
+    queue the replies. Reaching the limit pauses the connection: its recv is cancelled
+    until the replies in flight and queued behind them drop below the limit again.
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void UringReactor::serve(UringConnection& conn) {
+    size_t limit = gate_.limits().output_limit;
+    size_t inflight = conn.sending.size() - conn.sent;
+    // process() counts only out, so leave it the room the send in flight doesn't take
+    size_t out_limit = limit == 0 ? 0 : conn.out.size() + (limit > inflight ? limit - inflight : 1);
+    if (!handler_.process(conn.in, conn.out, conn.framing, out_limit)) {
+        conn.hangup = true; // deliver the error, then close
+    }
+    SlowLog::instance().batch_written(0, false); // sends complete asynchronously
+    if (!conn.queued && (!conn.out.empty() || conn.hangup)) {
+        conn.queued = true;
+        replies_.push_back(&conn);
+    }
+    if (limit != 0 && !conn.hangup && inflight + conn.out.size() >= limit) {
+        conn.paused = true;
+        Stats::instance().read_paused();
+        if (conn.recv_armed) {
+            cancel_recv(conn);
+        }
+    }
+}
+
+/*
+    A send finished: continue with its unsent rest, or with the replies that queued up
+    behind it.
+    Args:
+        conn: the connection
+        cqe: the send completion; res is the bytes sent
+    Returns:
+        void
+*/
+void UringReactor::on_send(UringConnection& conn, const io_uring_cqe& cqe) {
+    conn.send_inflight = false;
+    if (cqe.res < 0) {
+        begin_close(conn); // connection most likely broken
+    } else if (!conn.closing) {
+        conn.sent += size_t(cqe.res);
+        Stats::instance().bytes_out(uint64_t(cqe.res));
+        if (conn.sent == conn.sending.size()) {
+            conn.sending.clear();
+            conn.sent = 0;
+        }
+        size_t limit = gate_.limits().output_limit;
+        if (conn.paused && !conn.hangup && conn.sending.size() - conn.sent + conn.out.size() < limit) {
+            conn.paused = false; // run what arrived meanwhile, then read again
+            serve(conn);
+            if (!conn.paused && !conn.recv_armed && !conn.eof) {
+                arm_recv(conn);
+            }
+        }
+        if (!conn.sending.empty() || !conn.out.empty()) {
+            start_send(conn);
+        } else if (finished(conn)) {
+            begin_close(conn);
+        }
+    }
+    release_if_idle(conn);
+}
+
+/*
+    Queue sends for every connection that produced replies this iteration. In fsync-always
+    mode, first wait once for the log to sync everything the batch appended (group commit).
+    Args:
+        none
+    Returns:
+        void
+*/
+void UringReactor::send_replies() {
+    if (replies_.empty()) {
+        return;
+    }
+    bool durable = true;
+    if (log_ != nullptr && log_->policy() == FsyncPolicy::Always && AppendLog::thread_sequence() > synced_seq_) {
+        uint64_t seq = AppendLog::thread_sequence();
+        durable = log_->wait_durable(seq);
+        synced_seq_ = seq;
+    }
+
+    for (UringConnection* conn : replies_) {
+        conn->queued = false;
+        if (conn->closing) {
+            continue;
+        }
+        if (!durable) {
+            begin_close(*conn); // can't promise durability: drop the unacknowledged replies
+        } else if (!conn->send_inflight) {
+            start_send(*conn); // otherwise the completion picks the new replies up
+            if (!conn->send_inflight && finished(*conn)) {
+                begin_close(*conn);
+            }
+        }
+    }
+    replies_.clear();
+}
+
+/*
+    Shut a connection down. Its recv and any send in flight complete with an error or
+    end of stream; the connection is freed once both have.
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void UringReactor::begin_close(UringConnection& conn) {
+    if (conn.closing) {
+        return;
+    }
+    conn.closing = true;
+    shutdown(conn.fd, SHUT_RDWR);
+    release_if_idle(conn);
+}
+
+/*
+    Schedule a closed connection for freeing once no operation refers to it any more.
+    Args:
+        conn: the connection
+    Returns:
+        void
+*/
+void UringReactor::release_if_idle(UringConnection& conn) {
+    if (conn.closing && !conn.recv_armed && !conn.send_inflight && !conn.released) {
+        conn.released = true;
+        finished_.push_back(&conn);
+    }
+}
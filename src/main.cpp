@@ -1,18 +1,459 @@
 #include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cctype>
 #include "KVStore.hpp"
 #include "server.hpp"
+#include "AppendLog.hpp"
+#include "Snapshot.hpp"
+#include "ExpiryReaper.hpp"
+#include "MetricsServer.hpp"
+#include "SlowLog.hpp"
+#include "Replication.hpp"
+#include "Cluster.hpp"
+#include "Handoff.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <vector>
+#include <stdexcept>
 
-int main() {
-    KVStore store;
+namespace {
+std::atomic<Server*> running_server{nullptr}; // what SIGTERM and SIGINT stop
 
-    Server server(store, 8080);
+// signal handler: begin a graceful shutdown (a second signal gets the default action)
+void request_shutdown(int) {
+    Server* server = running_server.load();
+    if (server != nullptr) {
+        server->stop();
+    }
+}
+
+// stops the server on SIGTERM and SIGINT while in scope
+struct StopOnSignal {
+    explicit StopOnSignal(Server& server) {
+        running_server.store(&server);
+        struct sigaction action {};
+        action.sa_handler = request_shutdown;
+        action.sa_flags = SA_RESTART | SA_RESETHAND;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGTERM, &action, nullptr);
+        sigaction(SIGINT, &action, nullptr);
+    }
+    ~StopOnSignal() { running_server.store(nullptr); }
+};
+}
+
+/*
+    Parse a byte count with an optional k/m/g suffix (powers of 1024), e.g. "512mb".
+    Args:
+        text: the option value
+        bytes: receives the count
+    Returns:
+        false if the text is not a valid size
+*/
+static bool parse_size(const std::string& text, size_t& bytes) {
+    char* end = nullptr;
+    unsigned long long n = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    std::string suffix(end);
+    for (char& c : suffix) {
+        c = char(std::tolower(static_cast<unsigned char>(c)));
+    }
+    if (suffix == "k" || suffix == "kb") {
+        n <<= 10;
+    } else if (suffix == "m" || suffix == "mb") {
+        n <<= 20;
+    } else if (suffix == "g" || suffix == "gb") {
+        n <<= 30;
+    } else if (!suffix.empty() && suffix != "b") {
+        return false;
+    }
+    bytes = size_t(n);
+    return true;
+}
+
+/*
+    Parse a CPU list such as "0-7,16,18" (ranges inclusive).
+    Args:
+        text: the option value
+        cpus: receives the CPUs in the order given
+    Returns:
+        false if the text is not a valid list
+*/
+static bool parse_cpu_list(const std::string& text, std::vector<int>& cpus) {
+    cpus.clear();
+    const char* p = text.c_str();
+    while (*p != '\0') {
+        char* end = nullptr;
+        long first = std::strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = std::strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first) {
+                return false;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(int(cpu));
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return false;
+        }
+    }
+    return !cpus.empty();
+}
+
+/*
+    Print command line usage.
+    Args:
+        prog: program name (argv[0])
+    Returns:
+        void
+*/
+static void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --port N      port to listen on (default 8080)\n"
+              << "  --shards N    number of store lock shards (default " << KVStore::DEFAULT_SHARDS << ")\n"
+              << "  --mode M      connection model: epoll (default), uring (io_uring, falls back to epoll), threaded,\n"
+              << "                or percore (each event loop thread owns shard % threads, no locks)\n"
+              << "  --threads N   event loop threads in epoll, uring and percore mode (default: one per core)\n"
+              << "  --pin-cpus L  pin event loop thread i to the i-th CPU of a list like 0-7,16 (default: unpinned)\n"
+              << "  --max-clients N   connections served at once, 0 = unlimited (default 10000)\n"
+              << "  --max-input N     unparsed request bytes per connection before it is dropped, 0 = unlimited (default 1gb)\n"
+              << "  --output-limit N  unsent reply bytes at which a connection stops being read, 0 = unlimited (default 1mb)\n"
+              << "  --drain-timeout MS on SIGTERM/SIGINT, how long clients get to finish their requests, 0 = no limit (default 5000)\n"
+              << "  --handoff PATH  let a new server started with --takeover PATH take over the port and the data\n"
+              << "  --takeover PATH take over the port and the data of the server whose --handoff is PATH\n"
+              << "  --aof PATH    append-only file to replay at startup and log writes to\n"
+              << "  --aof-fsync P always, never, or a sync interval in ms (default 1000)\n"
+              << "  --snapshot PATH snapshot file loaded at startup and written by BGSAVE and on shutdown\n"
+              << "  --read-lock L shard locking: shared (default) or slots (per-thread reader slots, read-mostly loads)\n"
+              << "  --ordered-index on|off keep keys ordered too, for SCAN (default: off)\n"
+              << "  --reserve N   pre-size the tables for N keys, e.g. 50m (default: grow as needed)\n"
+              << "  --maxmemory N memory bound for keys and values, e.g. 512mb (default: unlimited)\n"
+              << "  --maxmemory-policy P lru (default) or lfu: which keys to evict at the bound\n"
+              << "  --compress-min N LZ4-compress values of at least N bytes, e.g. 4kb (default: off)\n"
+              << "  --metrics-port N serve Prometheus metrics at http://host:N/metrics (default: off)\n"
+              << "  --repl-port N accept replicas on port N and stream writes to them (default: off)\n"
+              << "  --replicaof H:P run as a read-only replica of the primary whose --repl-port is H:P\n"
+              << "  --cluster L   serve part of a cluster laid out as first-last@host:port,... (same list on every node)\n"
+              << "  --cluster-self H:P this node's address in the --cluster list (default 127.0.0.1:<port>)\n"
+              << "  --slowlog-us N  log commands slower than N us in SLOWLOG, -1 = off (default " << SlowLog::DEFAULT_THRESHOLD_US << ")\n"
+              << "  --slowlog-len N slow log entries kept (default " << SlowLog::DEFAULT_MAX_LEN << ")\n";
+}
+
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    size_t shards = KVStore::DEFAULT_SHARDS;
+    std::string aof_path;
+    std::string snapshot_path;
+    FsyncPolicy fsync_policy = FsyncPolicy::Interval;
+    long fsync_interval_ms = 1000;
+    size_t max_memory = 0;
+    size_t compress_min = 0;
+    size_t reserve = 0;
+    bool ordered_index = false;
+    EvictionPolicy eviction = EvictionPolicy::Lru;
+    LockMode lock_mode = LockMode::Shared;
+    int metrics_port = 0;
+    int repl_port = 0;
+    std::string primary_host;
+    int primary_port = 0;
+    std::string cluster_spec;
+    std::string cluster_self;
+    std::string handoff_path;
+    std::string takeover_path;
+    int64_t slowlog_us = SlowLog::DEFAULT_THRESHOLD_US;
+    size_t slowlog_len = SlowLog::DEFAULT_MAX_LEN;
+
+    // parse command line options
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) { // every remaining option takes a value
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (arg == "--port") {
+            config.port = std::atoi(argv[++i]);
+        } else if (arg == "--shards") {
+            shards = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--threads") {
+            config.threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--pin-cpus") {
+            if (!parse_cpu_list(argv[++i], config.cpus)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--max-clients") {
+            config.limits.max_clients = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--max-input") {
+            if (!parse_size(argv[++i], config.limits.max_input)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--output-limit") {
+            if (!parse_size(argv[++i], config.limits.output_limit)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--drain-timeout") {
+            config.limits.drain_timeout_ms = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--handoff") {
+            handoff_path = argv[++i];
+        } else if (arg == "--takeover") {
+            takeover_path = argv[++i];
+        } else if (arg == "--slowlog-us") {
+            slowlog_us = std::atoll(argv[++i]);
+        } else if (arg == "--slowlog-len") {
+            slowlog_len = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--metrics-port") {
+            metrics_port = std::atoi(argv[++i]);
+        } else if (arg == "--repl-port") {
+            repl_port = std::atoi(argv[++i]);
+        } else if (arg == "--replicaof") {
+            std::string primary = argv[++i];
+            size_t colon = primary.rfind(':');
+            primary_port = colon == std::string::npos ? 0 : std::atoi(primary.c_str() + colon + 1);
+            if (colon == 0 || primary_port <= 0 || primary_port > 65535) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            primary_host = primary.substr(0, colon);
+        } else if (arg == "--cluster") {
+            cluster_spec = argv[++i];
+        } else if (arg == "--cluster-self") {
+            cluster_self = argv[++i];
+        } else if (arg == "--snapshot") {
+            snapshot_path = argv[++i];
+        } else if (arg == "--aof") {
+            aof_path = argv[++i];
+        } else if (arg == "--aof-fsync") {
+            std::string policy = argv[++i];
+            if (policy == "always") {
+                fsync_policy = FsyncPolicy::Always;
+            } else if (policy == "never") {
+                fsync_policy = FsyncPolicy::Never;
+            } else {
+                fsync_policy = FsyncPolicy::Interval;
+                fsync_interval_ms = std::atol(policy.c_str());
+                if (fsync_interval_ms <= 0) {
+                    print_usage(argv[0]);
+                    return 1;
+                }
+            }
+        } else if (arg == "--maxmemory") {
+            if (!parse_size(argv[++i], max_memory)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--ordered-index") {
+            std::string setting = argv[++i];
+            if (setting != "on" && setting != "off") {
+                print_usage(argv[0]);
+                return 1;
+            }
+            ordered_index = setting == "on";
+        } else if (arg == "--reserve") {
+            if (!parse_size(argv[++i], reserve)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--compress-min") {
+            if (!parse_size(argv[++i], compress_min)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--maxmemory-policy") {
+            std::string policy = argv[++i];
+            if (policy == "lru") {
+                eviction = EvictionPolicy::Lru;
+            } else if (policy == "lfu") {
+                eviction = EvictionPolicy::Lfu;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--read-lock") {
+            std::string mode = argv[++i];
+            if (mode == "shared") {
+                lock_mode = LockMode::Shared;
+            } else if (mode == "slots") {
+                lock_mode = LockMode::ReaderSlots;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--mode") {
+            std::string mode = argv[++i];
+            if (mode == "epoll") {
+                config.mode = ServerMode::Epoll;
+            } else if (mode == "threaded") {
+                config.mode = ServerMode::Threaded;
+            } else if (mode == "uring") {
+                config.mode = ServerMode::Uring;
+            } else if (mode == "percore") {
+                config.mode = ServerMode::PerCore;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (config.port <= 0 || config.port > 65535 || metrics_port < 0 || metrics_port > 65535 || repl_port < 0 ||
+        repl_port > 65535 || shards == 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (config.mode == ServerMode::PerCore) {
+        lock_mode = LockMode::Owner; // every shard is confined to its core
+    }
+
+    SlowLog::instance().configure(slowlog_us, slowlog_len); // also calibrates the cycle clock
+    KVStore store(shards, lock_mode);
+    store.set_memory_limit(max_memory, eviction); // before loading, so a snapshot can't overshoot either
+    store.set_compression(compress_min);          // and loaded values are compressed too
+    store.reserve(reserve);
+    if (ordered_index) {
+        store.enable_ordered_index();
+    }
+    std::unique_ptr<AppendLog> log;
+    std::unique_ptr<BackgroundSaver> saver;
 
     try {
-        server.start();
+        if (!takeover_path.empty()) {
+            // the predecessor's data already includes its snapshot and log
+            auto start = std::chrono::steady_clock::now();
+            size_t keys = 0;
+            config.listen_fd = Handoff::take_over(takeover_path, store, keys);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Took over the listening socket and " << keys << " keys from " << takeover_path << " in "
+                      << ms << " ms" << std::endl;
+        } else if (!snapshot_path.empty()) {
+            auto start = std::chrono::steady_clock::now();
+            size_t keys = Snapshot::load_file(store, snapshot_path);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Loaded " << keys << " keys from " << snapshot_path << " in " << ms << " ms" << std::endl;
+        }
+        if (!snapshot_path.empty()) {
+            saver = std::make_unique<BackgroundSaver>(store, snapshot_path);
+        }
+
+        if (!aof_path.empty() && takeover_path.empty()) {
+            // rebuild the writes since the snapshot: an unfinished checkpoint first, then the live log
+            auto apply = [&store](AppendLog::Op op, std::string_view key, std::string_view value, int64_t expires_at) {
+                switch (op) {
+                    case AppendLog::Op::Set:
+                    case AppendLog::Op::SetExpiring:
+                        store.set(key, value, expires_at);
+                        break;
+                    case AppendLog::Op::ExpireAt:
+                        store.expire_at(key, expires_at);
+                        break;
+                    default:
+                        store.remove(key);
+                        break;
+                }
+            };
+            size_t records = AppendLog::replay(AppendLog::checkpoint_path(aof_path), apply);
+            records += AppendLog::replay(aof_path, apply);
+            std::cout << "Replayed " << records << " records from " << aof_path << std::endl;
+        }
+        if (!aof_path.empty()) { // after a takeover, the predecessor has closed it by now
+            log = std::make_unique<AppendLog>(aof_path, fsync_policy, std::chrono::milliseconds(fsync_interval_ms));
+            store.attach_log(log.get());
+        }
+
+        SlotMap slots; // outlives the server, whose connections read it
+        uint32_t cluster_node = SlotMap::NO_NODE;
+        std::string self = cluster_self.empty() ? "127.0.0.1:" + std::to_string(config.port) : cluster_self;
+        if (!cluster_spec.empty()) {
+            slots = SlotMap::parse(cluster_spec);
+            std::string host;
+            int port = 0;
+            cluster_node = cluster::parse_address(self, host, port) ? slots.find(host, port) : SlotMap::NO_NODE;
+            if (cluster_node == SlotMap::NO_NODE) {
+                throw std::runtime_error("--cluster-self " + self + " is not a node of the cluster");
+            }
+        }
+
+        // before the background threads: in percore mode it routes their store access
+        Server server(store, config);
+        server.handler().set_saver(saver.get());
+        StopOnSignal stop_on_signal(server);
+        std::unique_ptr<Handoff> handoff; // destroyed before the server its callback stops
+        if (!handoff_path.empty()) {
+            handoff = std::make_unique<Handoff>(handoff_path, server.listen_fd(), [&server] { server.stop(); });
+            std::cout << "Accepting a successor on " << handoff_path << std::endl;
+        }
+
+        if (cluster_node != SlotMap::NO_NODE) {
+            server.handler().set_cluster(&slots, cluster_node);
+            std::cout << "Cluster node " << self << " of " << slots.nodes() << ", " << slots.assigned() << "/"
+                      << cluster::SLOTS << " slots assigned" << std::endl;
+        }
+
+        // writes reach the replicas through the store; destroyed after the reaper, which writes too
+        std::unique_ptr<ReplicationServer> replication;
+        if (repl_port != 0) {
+            replication = std::make_unique<ReplicationServer>(store, repl_port);
+            store.attach_replication(replication.get());
+            server.handler().set_replication(replication.get());
+            std::cout << "Replication on port " << repl_port << std::endl;
+        }
+        std::unique_ptr<ReplicaLink> link;
+        if (!primary_host.empty()) {
+            link = std::make_unique<ReplicaLink>(store, primary_host, primary_port);
+            server.handler().set_replica_link(link.get());
+            std::cout << "Replica of " << primary_host << ":" << primary_port << std::endl;
+        }
+
+        ExpiryReaper reaper(store); // deletes expired keys in the background (logged like DELs)
+
+        std::unique_ptr<MetricsServer> metrics;
+        if (metrics_port != 0) {
+            metrics = std::make_unique<MetricsServer>(store, metrics_port);
+            std::cout << "Metrics on port " << metrics_port << std::endl;
+        }
+
+        server.start(); // returns once stopped by a signal or a successor, with the clients drained
+
+        // the store is final now (only the reaper may still expire keys): hand it over, or save it
+        auto start = std::chrono::steady_clock::now();
+        if (handoff && handoff->taken_over()) {
+            handoff->send_data(store);
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Handed the data over in " << ms << " ms" << std::endl;
+        } else if (saver) {
+            if (saver->save()) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                std::cout << "Saved " << snapshot_path << " in " << ms << " ms" << std::endl;
+            }
+        }
+        // the append-only log is written out and synced as it closes
     } catch (const std::exception& e) {
         std::cerr << "Server error: " << e.what() << std::endl;
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,14 +1,31 @@
 #include "server.hpp"
+#include "Reactor.hpp"
+#include "UringReactor.hpp"
+#include "CoreRouter.hpp"
+#include "AppendLog.hpp"
+#include "Stats.hpp"
+#include "SlowLog.hpp"
+#include "CycleClock.hpp"
 #include <iostream>
+#include <memory>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <thread>
+#include <pthread.h>
+#include <sched.h>
 #include <stdexcept>
-#include <cstring>  // strcmp, strtok
-#include <sstream>  // parsing strings
-#include <vector>   // splitting commands
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 #include <arpa/inet.h> // htons
 #include <netinet/in.h> // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
 
 /*
     Constructor method for Server class.
@@ -18,7 +35,63 @@
     Returns:
         void
 */
-Server::Server(KVStore& store, int port) : store_(store), port_(port), server_fd_(-1) {
+Server::Server(KVStore& store, int port) : Server(store, ServerConfig{port}) {}
+
+/*
+    Constructor method for Server class.
+    Args:
+        store: reference to the KVStore instance
+        config: listening port, serving mode, thread count and client limits
+    Returns:
+        void
+*/
+Server::Server(KVStore& store, const ServerConfig& config)
+    : store_(store), handler_(store), config_(config), port_(config.port), server_fd_(-1), gate_(config.limits) {
+    if (config_.threads == 0) {
+        config_.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    open_listener();
+
+    if (config_.mode == ServerMode::PerCore) {
+        // from here on, whatever reaches another core's shards runs on that core; the
+        // reaper and the metrics thread started before start() simply wait for the cores
+        if (store_.lock_mode() != LockMode::Owner) {
+            close(server_fd_);
+            throw std::runtime_error("Thread-per-core mode needs a store with LockMode::Owner");
+        }
+        router_ = std::make_unique<CoreRouter>(config_.threads);
+        CoreRouter* router = router_.get();
+        store_.set_shard_executor([router](size_t shard, const std::function<void()>& fn) {
+            router->run_on(shard, fn);
+        });
+    }
+}
+
+/*
+    Set up the listening socket: bind and listen on the configured port, or adopt one
+    handed over by the server this one replaces, which is already listening (its port
+    is whatever it was bound to).
+    Args:
+        none
+    Returns:
+        void
+*/
+void Server::open_listener() {
+    if (config_.listen_fd >= 0) {
+        server_fd_ = config_.listen_fd;
+        int listening = 0;
+        socklen_t listening_len = sizeof(listening);
+        struct sockaddr_in address {};
+        socklen_t address_len = sizeof(address);
+        if (getsockopt(server_fd_, SOL_SOCKET, SO_ACCEPTCONN, &listening, &listening_len) < 0 || !listening ||
+            getsockname(server_fd_, (struct sockaddr*) &address, &address_len) < 0 || address.sin_family != AF_INET) {
+            close(server_fd_);
+            throw std::runtime_error("Handed over socket is not a listening TCP socket");
+        }
+        port_ = ntohs(address.sin_port);
+        return;
+    }
+
     // create socket
     server_fd_ = socket(AF_INET, SOCK_STREAM, 0); // IPv4, TCP
     if (server_fd_ < 0) { // socket creation error
@@ -55,6 +128,9 @@ Server::Server(KVStore& store, int port) : store_(store), port_(port), server_fd
     Destructor method for Server class.
 */
 Server::~Server() {
+    if (router_) {
+        store_.set_shard_executor(nullptr);
+    }
     if (server_fd_ != -1) {
         close(server_fd_);
         std::cout << "Server shutting down" << std::endl;
@@ -62,7 +138,8 @@ Server::~Server() {
 }
 
 /*
-    Start the server to accept incoming connections. Runs a listening loop.
+    Start the server to accept incoming connections. Runs until stop() was called and
+    the connections have drained.
     Args:
         none
     Returns:
@@ -71,16 +148,64 @@ Server::~Server() {
 void Server::start() {
     std::cout << "Server starting on port " << port_ << std::endl;
 
+    if (config_.mode == ServerMode::Epoll) {
+        run_event_loop();
+    } else if (config_.mode == ServerMode::Uring) {
+        run_uring();
+    } else if (config_.mode == ServerMode::PerCore) {
+        run_per_core();
+    } else {
+        run_threaded();
+    }
+    std::cout << "Server stopped serving clients" << std::endl;
+}
+
+/*
+    Accept loop for threaded mode: every client gets its own blocking thread. Clients past
+    the connection limit are turned away before a thread is spawned for them. The loop
+    waits in poll() for a client or the shutdown; the listener is non-blocking so that a
+    client taken by someone else in between (a successor sharing the socket) can't block it.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Server::run_threaded() {
     struct sockaddr_in client_address; // stores client IP address and port
-    socklen_t client_address_len = sizeof(client_address); // needed for accept()
+    socklen_t client_address_len; // needed for accept()
+    int flags = fcntl(server_fd_, F_GETFL, 0);
+    if (flags < 0 || fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Failed to make listening socket non-blocking");
+    }
+    struct pollfd fds[2] = {{server_fd_, POLLIN, 0}, {gate_.shutdown_fd(), POLLIN, 0}};
 
     while (true) {
-        // call accept() to get a client socket
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("poll failed");
+        }
+        if (fds[1].revents & POLLIN) { // shutting down
+            break;
+        }
+
+        // call accept() to get a client socket (accepted sockets are blocking)
+        client_address_len = sizeof(client_address);
         int client_fd = accept(server_fd_, (struct sockaddr*) &client_address, &client_address_len);
         if (client_fd < 0) { // accept() error
-            std::cerr << "Failed to accept client connection" << std::endl;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                std::cerr << "Failed to accept client connection" << std::endl;
+            }
             continue; // skip to next iteration
         }
+        if (!gate_.admit(client_fd)) {
+            continue; // over the client limit: already told and closed
+        }
+
+        // responses are already batched per read, so don't let Nagle hold them back
+        int nodelay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 
         /*
             Spawn a new thread to handle this client
@@ -88,101 +213,289 @@ void Server::start() {
             Client_fd: client socket passed to handle_client()
             Detach: thread runs independently of the main thread
         */
-        std::thread(&Server::handle_client, this, client_fd).detach();
+        {
+            std::lock_guard<std::mutex> lock(clients_mtx_);
+            client_fds_.insert(client_fd);
+        }
+        try {
+            std::thread(&Server::handle_client, this, client_fd).detach();
+        } catch (const std::system_error& e) { // out of threads: shed this client, keep serving
+            std::cerr << "Failed to start client thread: " << e.what() << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(clients_mtx_);
+                client_fds_.erase(client_fd);
+            }
+            close(client_fd);
+            gate_.release();
+        }
     }
+    drain_client_threads();
 }
 
 /*
-    Handle a single client connection.
+    Threaded mode shutdown. shutdown(SHUT_RD) makes a client thread's blocking read
+    return the requests already in the socket and then the end of input, so the thread
+    answers them and exits. At the drain deadline the connections still open are cut,
+    which also fails the write of a thread stuck on a client that doesn't read.
+    Args:
+        none
+    Returns:
+        void, once every client thread has released its client
+*/
+void Server::drain_client_threads() {
+    auto shutdown_all = [this](int how) {
+        std::lock_guard<std::mutex> lock(clients_mtx_);
+        for (int fd : client_fds_) {
+            shutdown(fd, how);
+        }
+    };
+    shutdown_all(SHUT_RD);
+
+    size_t timeout_ms = gate_.limits().drain_timeout_ms;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(int64_t(timeout_ms));
+    bool cut = false;
+    while (gate_.clients() > 0) {
+        if (!cut && timeout_ms != 0 && std::chrono::steady_clock::now() >= deadline) {
+            shutdown_all(SHUT_RDWR);
+            cut = true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+/*
+    Event loop mode: a fixed number of reactors share the non-blocking listening socket.
+    The calling thread runs the first reactor itself.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Server::run_event_loop() {
+    int flags = fcntl(server_fd_, F_GETFL, 0);
+    if (flags < 0 || fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Failed to make listening socket non-blocking");
+    }
+
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    for (size_t i = 0; i < config_.threads; i++) {
+        reactors.push_back(std::make_unique<Reactor>(server_fd_, handler_, gate_));
+    }
+    std::cout << "Serving with " << reactors.size() << " event loop thread(s)" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < reactors.size(); i++) {
+        threads.emplace_back([this, reactor = reactors[i].get(), i] {
+            pin_reactor(i);
+            reactor->run();
+        });
+    }
+    pin_reactor(0);
+    reactors[0]->run();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+/*
+    io_uring mode: like run_event_loop() but every reactor drives its connections through
+    an io_uring. Falls back to epoll if the kernel can't run the io_uring reactor.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Server::run_uring() {
+    std::vector<std::unique_ptr<UringReactor>> reactors;
+    try {
+        for (size_t i = 0; i < config_.threads; i++) {
+            reactors.push_back(std::make_unique<UringReactor>(server_fd_, handler_, gate_));
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "io_uring unavailable (" << e.what() << "), falling back to epoll" << std::endl;
+        reactors.clear();
+        run_event_loop();
+        return;
+    }
+    std::cout << "Serving with " << reactors.size() << " io_uring thread(s)" << std::endl;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < reactors.size(); i++) {
+        threads.emplace_back([this, reactor = reactors[i].get(), i] {
+            pin_reactor(i);
+            reactor->run();
+        });
+    }
+    pin_reactor(0);
+    reactors[0]->run();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+/*
+    Thread-per-core mode: reactor i is core i of the router and the only thread that
+    touches the shards core i owns. Clients connect to whichever core accepts them.
+    Args:
+        none
+    Returns:
+        void
+*/
+void Server::run_per_core() {
+    int flags = fcntl(server_fd_, F_GETFL, 0);
+    if (flags < 0 || fcntl(server_fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Failed to make listening socket non-blocking");
+    }
+
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    for (size_t i = 0; i < config_.threads; i++) {
+        reactors.push_back(std::make_unique<Reactor>(server_fd_, handler_, gate_, router_.get(), i));
+    }
+    std::cout << "Serving with " << reactors.size() << " cores owning " << store_.shard_count()
+              << " shards" << std::endl;
+    if (store_.shard_count() < reactors.size()) {
+        std::cerr << "Warning: fewer shards than cores; " << reactors.size() - store_.shard_count()
+                  << " core(s) own no keys" << std::endl;
+    }
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < reactors.size(); i++) {
+        threads.emplace_back([this, reactor = reactors[i].get(), i] {
+            pin_reactor(i);
+            reactor->run();
+        });
+    }
+    pin_reactor(0);
+    reactors[0]->run();
+
+    for (auto& t : threads) {
+        t.join();
+    }
+    router_->retire(); // the shards stay reachable for the threads still running, now without cores
+}
+
+/*
+    Pin the calling thread to its reactor's configured CPU. Failure only warns: the
+    reactor still works unpinned.
+    Args:
+        i: reactor index
+    Returns:
+        void
+*/
+void Server::pin_reactor(size_t i) const {
+    if (config_.cpus.empty()) {
+        return;
+    }
+    int cpu = config_.cpus[i % config_.cpus.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        std::cerr << "Failed to pin reactor " << i << " to CPU " << cpu << ": " << std::strerror(err) << std::endl;
+    }
+}
+
+/*
+    Write an entire reply stream to a blocking socket, retrying on short writes. Values
+    the stream references go out with sendmsg, without being copied.
+    Args:
+        fd: the socket file descriptor
+        out: the replies
+    Returns:
+        true if every byte was written, false if the connection failed
+*/
+static bool write_all(int fd, const WriteBuffer& out) {
+    struct iovec iov[64];
+    size_t offset = 0;
+    while (offset < out.size()) {
+        struct msghdr msg {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = out.gather(offset, iov, 64);
+        ssize_t written = sendmsg(fd, &msg, MSG_NOSIGNAL); // a vanished peer is an error, not SIGPIPE
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue; // interrupted before anything was written
+            }
+            return false;
+        }
+        offset += size_t(written);
+    }
+    return true;
+}
+
+/*
+    Handle a single client connection. All commands parsed out of one read are executed
+    first and their responses are flushed together, so pipelined clients pay one write
+    per read instead of one per command. Under the output limit a read is served in
+    rounds, each written before the next runs; the blocking write is the backpressure.
     Args:
         client_socket: the socket file descriptor for the client
     Returns:
         void
 */
 void Server::handle_client(int client_socket) {
-    // create a buffer
-    std::string buffer;
-    char chunk[1024] = {0}; // 1024 bytes buffer for data, initialized to 0
+    ReadBuffer buffer; // receive buffer parsed in place
+    Framing framing = Framing::Unknown;
+    WriteBuffer responses; // replies for the current round, flushed with one write
+    size_t output_limit = gate_.limits().output_limit;
+    Stats::instance().connection_opened();
 
-    while (true) {
-        memset(chunk, 0, sizeof(chunk)); // clear chunk
+    bool open = true;
+    while (open) {
+        size_t want = framing == Framing::Binary ? protocol::binary::missing_bytes(buffer.data()) : 0;
+        if (gate_.input_exceeded(buffer.size(), want)) { // request too large to buffer
+            gate_.reject_input(framing, responses);
+            write_all(client_socket, responses);
+            break;
+        }
 
-        // read data from socket
-        ssize_t bytes_read = read(client_socket, chunk, sizeof(chunk) - 1);
+        // read data from socket straight into the buffer's free space
+        char* dst = buffer.prepare_read(want);
+        ssize_t bytes_read = read(client_socket, dst, buffer.writable());
         if (bytes_read <= 0) { // connection closed or error
             break; // exit loop
         }
-        chunk[bytes_read] = '\0'; // null-terminate the string
-        buffer += chunk; // append chunk to buffer
+        buffer.commit_read(size_t(bytes_read));
+        Stats::instance().bytes_in(uint64_t(bytes_read));
 
-        size_t pos;
-        while ((pos = buffer.find('\n')) != std::string::npos) {
-            std::string line = buffer.substr(0, pos); // extract one line
-            buffer.erase(0, pos + 1); // remove the line from the buffer
+        size_t before;
+        do {
+            before = buffer.size();
+            bool keep_open = handler_.process(buffer, responses, framing, output_limit);
 
-            if (line.empty()) {
-                continue; // skip empty lines
+            // in fsync-always mode, acknowledge writes only once they are on disk
+            uint64_t write_start = cycleclock::now();
+            AppendLog* log = store_.log();
+            if (log != nullptr && !log->wait_durable(AppendLog::thread_sequence())) {
+                SlowLog::instance().batch_written(0, false);
+                open = false; // can't promise durability: drop the unacknowledged replies
+                break;
             }
 
-            // parse command (SET, GET, DEL)
-            std::istringstream iss(line);
-            std::string command;
-            iss >> command; // extract command
-
-            std::string response;
-
-            // based on command, call the appropriate KVStore function
-            if (command == "SET") { // handle SET command
-                std::string key, value;
-                iss >> key; // extract key
-                std::getline(iss, value); // extract value from rest of line
-
-                if (!value.empty() && value[0] == ' ') {
-                    value.erase(0, 1); // remove leading spaces
-                }
-
-                if (!key.empty() && !value.empty()) {
-                    store_.set(key, value);
-                    response = "OK\n";
-                } else { // invalid command
-                    response = "ERROR: SET requires key and value\n";
-                }
-            } else if (command == "GET") { // handle GET command
-                std::string key;
-                iss >> key; // extract key
-
-                if (!key.empty()) {
-                    std::string value = store_.get(key);
-                    if (!value.empty()) {
-                        response = value + "\n";
-                    } else {
-                        response = "NOT_FOUND\n";
-                    }
-                } else {
-                    response = "ERROR: GET requires key\n";
-                }
-            } else if (command == "DEL") {
-                std::string key;
-                iss >> key; // extract key
-
-                if (!key.empty()) {
-                    bool deleted = store_.remove(key);
-                    response = deleted ? "DELETED\n" : "NOT_FOUND\n";
-                } else {
-                    response = "ERROR: DEL requires key\n";
-                }
-            } else {
-                response = "ERROR: Unknown command\n";
+            // send all responses and handle errors (a blocking write includes any wait for the client)
+            bool written = write_all(client_socket, responses);
+            SlowLog::instance().batch_written(cycleclock::now() - write_start, false);
+            if (!written) { // connection most likely broken
+                open = false;
+                break;
             }
-
-            // send response and handle errors
-            int bytes_written = write(client_socket, response.c_str(), response.length());
-            if (bytes_written < 0) { // connnection most likely broken
-                close(client_socket);
-                return;
+            Stats::instance().bytes_out(responses.size());
+            responses.clear();
+            if (!keep_open) { // protocol violation
+                open = false;
+                break;
             }
-        }
+        } while (buffer.size() != before && !buffer.empty()); // requests the output limit held back
+    }
+
+    Stats::instance().connection_closed();
+    {
+        std::lock_guard<std::mutex> lock(clients_mtx_);
+        client_fds_.erase(client_socket); // before close(): the fd number may be reused right away
     }
-    
     close(client_socket);
-}
\ No newline at end of file
+    gate_.release(); // last: once every client is released, a stopped server may be destroyed
+}
@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""
+Binary protocol test for KVStore
+Checks the length-prefixed framing (arbitrary bytes in keys and values, pipelining,
+text passthrough) and measures pipelined SET/GET throughput over one connection. Against
+--mode percore, the TEXT frames sent from several connections at once check that a wrapped
+single-key command runs on the core owning its key. With --compress-min, matching the
+server's, checks that large compressible values are stored and returned LZ4-compressed
+"""
+
+import random
+import struct
+import time
+from concurrent.futures import ThreadPoolExecutor
+import argparse
+import sys
+
+from kvtest import BinaryClient, Checks, OP_TEXT, OP_GET, OP_SET, OP_DEL, OP_GET_COMPRESSED, \
+    STATUS_OK, STATUS_NOT_FOUND, STATUS_ERROR, FLAG_LZ4
+
+
+def lz4_unpack(body):
+    """Decode a FLAG_LZ4 body: u32 raw size, then one LZ4 block"""
+    raw_size, = struct.unpack_from('<I', body)
+    block, pos, out = body, 4, bytearray()
+
+    def length(n):
+        nonlocal pos
+        if n == 15:
+            while True:
+                b = block[pos]
+                pos += 1
+                n += b
+                if b != 255:
+                    break
+        return n
+
+    while pos < len(block):
+        token = block[pos]
+        pos += 1
+        literals = length(token >> 4)
+        out += block[pos:pos + literals]
+        pos += literals
+        if pos == len(block):
+            break
+        offset = block[pos] | block[pos + 1] << 8
+        pos += 2
+        for _ in range(length(token & 15) + 4):
+            out.append(out[-offset])
+    if len(out) != raw_size:
+        raise ValueError(f"LZ4 body decoded to {len(out)} bytes, expected {raw_size}")
+    return bytes(out)
+
+
+def compressed_values(client):
+    """INFO compressed_values, read over a TEXT frame"""
+    for line in client.call(OP_TEXT, value=b'INFO')[1].decode().split('\n'):
+        parts = line.split(' ')
+        if len(parts) == 3 and parts[:2] == ['STAT', 'compressed_values']:
+            return int(parts[2])
+    raise ValueError("INFO has no compressed_values")
+
+
+def run_functional_tests(client, host, port, compress_min):
+    """Exercise every opcode; returns the number of failed checks"""
+    check = Checks()
+
+    blob = bytes(range(256)) * 4 + b' \n\r\n trailing'
+    check("SET binary value", client.call(OP_SET, b'bin:key', blob), (STATUS_OK, b''))
+    check("GET binary value", client.call(OP_GET, b'bin:key'), (STATUS_OK, blob))
+    check("key with spaces", client.call(OP_SET, b'a key\nwith newline', b'v'), (STATUS_OK, b''))
+    check("GET key with spaces", client.call(OP_GET, b'a key\nwith newline'), (STATUS_OK, b'v'))
+    check("DEL existing", client.call(OP_DEL, b'bin:key'), (STATUS_OK, b''))
+    check("GET missing", client.call(OP_GET, b'bin:key'), (STATUS_NOT_FOUND, b''))
+    check("DEL missing", client.call(OP_DEL, b'bin:key'), (STATUS_NOT_FOUND, b''))
+    check("TEXT passthrough", client.call(OP_TEXT, value=b'MSET t1 x t2 y'), (STATUS_OK, b'OK'))
+    check("TEXT multi-line reply", client.call(OP_TEXT, value=b'MGET t1 t2'), (STATUS_OK, b'x\ny'))
+    client.call(OP_DEL, b'counter')
+    check("TEXT INCRBY", client.call(OP_TEXT, value=b'INCRBY counter 41'), (STATUS_OK, b'41'))
+    check("TEXT INCR", client.call(OP_TEXT, value=b'INCR counter'), (STATUS_OK, b'42'))
+    check("GET native integer", client.call(OP_GET, b'counter'), (STATUS_OK, b'42'))
+    check("TEXT CAS", client.call(OP_TEXT, value=b'CAS counter 42 done'), (STATUS_OK, b'OK'))
+    check("GET after CAS", client.call(OP_GET, b'counter'), (STATUS_OK, b'done'))
+    check("TEXT error", client.call(OP_TEXT, value=b'NOPE'), (STATUS_ERROR, b'ERROR: Unknown command'))
+
+    frames = [client.frame(OP_SET, f'p{i}'.encode(), f'v{i}'.encode()) for i in range(100)]
+    frames += [client.frame(OP_GET, f'p{i}'.encode()) for i in range(100)]
+    responses = client.pipeline(frames)
+    check("pipelined batch", responses[100:], [(STATUS_OK, f'v{i}'.encode()) for i in range(100)])
+
+    # values from 16 KiB up are stored and sent by reference; check both sides of the cutoff
+    sizes = (16383, 16384, 300000, 4 << 20)
+    large = {size: bytes((i * 7 + size) & 0xFF for i in range(size)) for size in sizes}
+    frames = [client.frame(OP_SET, f'large:{size}'.encode(), value) for size, value in large.items()]
+    frames += [client.frame(OP_GET, f'large:{size}'.encode()) for size in sizes]
+    frames.append(client.frame(OP_SET, b'large:300000', b'small now'))
+    frames.append(client.frame(OP_GET, b'large:300000'))
+    responses = client.pipeline(frames)
+    check("pipelined large GETs", responses[len(sizes):2 * len(sizes)], [(STATUS_OK, large[size]) for size in sizes])
+    check("large value overwritten", responses[-1], (STATUS_OK, b'small now'))
+
+    # GET_COMPRESSED returns values the server keeps compressed (--compress-min) as stored;
+    # either way the decoded value must match
+    text = b''.join(b'{"id": %d, "name": "user%d", "active": true}\n' % (i, i) for i in range(2000))
+    stored_before = compressed_values(client)
+    client.call(OP_SET, b'compressible', text)
+    client.sock.sendall(client.frame(OP_GET_COMPRESSED, b'compressible'))
+    status, flags, body = client.read_response(with_flags=True)
+    check("GET_COMPRESSED value", (status, lz4_unpack(body) if flags & FLAG_LZ4 else body), (STATUS_OK, text))
+    print(f"  (value came back {'compressed, %d of %d bytes' % (len(body), len(text)) if flags & FLAG_LZ4 else 'uncompressed'})")
+    check("GET of compressible value", client.call(OP_GET, b'compressible'), (STATUS_OK, text))
+    check("GET_COMPRESSED small value", client.call(OP_GET_COMPRESSED, b't1'), (STATUS_OK, b'x'))
+    check("GET_COMPRESSED missing", client.call(OP_GET_COMPRESSED, b'nope'), (STATUS_NOT_FOUND, b''))
+    if compress_min:
+        check("compressible value stored compressed", bool(flags & FLAG_LZ4), True)
+        check("compressed body smaller than the value", len(body) < len(text) // 2, True)
+        check("INFO compressed_values counts it", compressed_values(client) > stored_before, True)
+        # under the threshold, or not worth compressing: stored and returned as set
+        below = text[:compress_min - 1]
+        noise = random.Random(7).randbytes(compress_min * 2)
+        for name, value in (("value under --compress-min", below), ("incompressible value", noise)):
+            client.call(OP_SET, b'raw', value)
+            client.sock.sendall(client.frame(OP_GET_COMPRESSED, b'raw'))
+            check(f"GET_COMPRESSED of {name}", client.read_response(with_flags=True), (STATUS_OK, 0, value))
+        # values compressed by SET and by MSET, read back through GET, MGET and text GET
+        frames = [client.frame(OP_SET, f'z{i}'.encode(), text[i:]) for i in range(8)]
+        frames.append(client.frame(OP_TEXT, value=b'MSET zm ' + text.replace(b' ', b'_').replace(b'\n', b'.')))
+        client.pipeline(frames)
+        check("GETs of compressed values", client.pipeline([client.frame(OP_GET, f'z{i}'.encode()) for i in range(8)]),
+              [(STATUS_OK, text[i:]) for i in range(8)])
+        flat = text.replace(b' ', b'_').replace(b'\n', b'.')
+        check("MGET of a compressed value", client.call(OP_TEXT, value=b'MGET zm nope'), (STATUS_OK, flat + b'\nNOT_FOUND'))
+        check("text GET of an MSET value", client.call(OP_TEXT, value=b'GET zm'), (STATUS_OK, flat))
+
+    # wrapped single-key commands from several connections: in percore mode most keys
+    # belong to another core than the one receiving the frame, which must forward it. Half
+    # the connections send plain SETs, so the owners write those shards at the same time
+    writers = [BinaryClient(host, port) for _ in range(4)]
+    def write(n):
+        if n % 2:
+            frames = [client.frame(OP_SET, f'route:{n}:{i}'.encode(), f'v{i}'.encode()) for i in range(500)]
+        else:
+            frames = [client.frame(OP_TEXT, value=f'SET route:{n}:{i} v{i}'.encode()) for i in range(500)]
+        return writers[n].pipeline(frames) == [(STATUS_OK, b'' if n % 2 else b'OK')] * len(frames)
+    with ThreadPoolExecutor(len(writers)) as executor:
+        written = list(executor.map(write, range(len(writers))))
+    for writer in writers:
+        writer.close()
+    check("TEXT and plain SETs from several connections", written, [True] * len(writers))
+    keys = [(f'route:{n}:{i}'.encode(), f'v{i}'.encode()) for n in range(len(writers)) for i in range(500)]
+    responses = client.pipeline([client.frame(OP_TEXT, value=b'GET ' + key) for key, _ in keys])
+    check("TEXT GET of keys on every core", responses, [(STATUS_OK, value) for _, value in keys])
+    responses = client.pipeline([client.frame(OP_GET, key) for key, _ in keys])
+    check("GET of every key", responses, [(STATUS_OK, value) for _, value in keys])
+    return check.failures
+
+
+def run_throughput_test(client, num_ops, depth, value_size):
+    """Pipelined SET then GET throughput"""
+    value = b'x' * value_size
+    results = {}
+    for name, make in (('SET', lambda i: client.frame(OP_SET, f'bench:{i}'.encode(), value)),
+                       ('GET', lambda i: client.frame(OP_GET, f'bench:{i}'.encode()))):
+        start = time.perf_counter()
+        for base in range(0, num_ops, depth):
+            client.pipeline([make(i) for i in range(base, min(base + depth, num_ops))])
+        results[name] = num_ops / (time.perf_counter() - start)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Binary protocol test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  # Functional checks plus a 100,000-op throughput run
+  python3 binary_protocol.py --ops 100000
+
+  # Large values, deeper pipeline
+  python3 binary_protocol.py --ops 20000 --value-size 65536 --pipeline 8
+
+  # Routing of wrapped text commands (kvstore_server --mode percore --threads 4)
+  python3 binary_protocol.py
+
+  # Values stored LZ4-compressed (kvstore_server --compress-min 4096)
+  python3 binary_protocol.py --compress-min 4096
+        """
+    )
+    parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
+    parser.add_argument('--port', type=int, default=8080, help='Server port (default: 8080)')
+    parser.add_argument('--ops', type=int, default=20000, help='Operations per throughput phase (default: 20000)')
+    parser.add_argument('--pipeline', type=int, default=32, help='Frames per round trip (default: 32)')
+    parser.add_argument('--value-size', type=int, default=100, help='Value size in bytes (default: 100)')
+    parser.add_argument('--compress-min', type=int, default=0,
+                        help="The server's --compress-min in bytes, at most 80000; checks values are stored compressed (default: off)")
+    args = parser.parse_args()
+
+    try:
+        client = BinaryClient(args.host, args.port)
+    except Exception as e:
+        print(f"Error: Cannot connect to server: {e}")
+        sys.exit(1)
+
+    print("=" * 60)
+    print("KVStore Binary Protocol Test")
+    print("=" * 60)
+    try:
+        failures = run_functional_tests(client, args.host, args.port, args.compress_min)
+        results = run_throughput_test(client, args.ops, args.pipeline, args.value_size)
+    finally:
+        client.close()
+
+    print("=" * 60)
+    for name, throughput in results.items():
+        print(f"{name} throughput: {throughput:,.0f} ops/sec (pipeline {args.pipeline}, {args.value_size}-byte values)")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
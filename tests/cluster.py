@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""
+Cluster mode test for KVStore
+Checks a running cluster (every node started with the same --cluster layout): CLUSTER
+SLOTS covers all slots and agrees across nodes, CLUSTER KEYSLOT matches CRC-16 with hash
+tags, MOVED redirects name the owner (text and binary), and keys written by following
+the redirects are all readable from their owners.
+"""
+
+import argparse
+import sys
+
+from kvtest import LineClient, BinaryClient, Checks, OP_GET, OP_SET, STATUS_OK, STATUS_ERROR
+
+SLOTS = 16384
+
+
+def crc16(data):
+    """CRC-16/XMODEM, as the server hashes keys"""
+    crc = 0
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) & 0xFFFF if crc & 0x8000 else (crc << 1) & 0xFFFF
+    return crc
+
+
+def key_slot(key):
+    start = key.find('{')
+    if start >= 0:
+        end = key.find('}', start + 1)
+        if end > start + 1:
+            key = key[start + 1:end]
+    return crc16(key.encode()) % SLOTS
+
+
+def parse_slots(lines):
+    """CLUSTER SLOTS lines -> [(first, last, 'host:port')]"""
+    ranges = []
+    for line in lines:
+        first, last, address = line.split()
+        ranges.append((int(first), int(last), address))
+    return ranges
+
+
+def owner(ranges, slot):
+    for first, last, address in ranges:
+        if first <= slot <= last:
+            return address
+    return None
+
+
+def by_address_client(clients, host, address):
+    """The client of the node at address ('host:port')"""
+    return next(c for port, c in clients.items() if f'{host}:{port}' == address)
+
+
+def run_tests(host, ports, keys):
+    """Returns the number of failed checks"""
+    check = Checks()
+
+    clients = {port: LineClient(host, port) for port in ports}
+    try:
+        layouts = [parse_slots(c.lines('CLUSTER SLOTS')) for c in clients.values()]
+        ranges = layouts[0]
+        check("every node reports the same layout", all(layout == ranges for layout in layouts), True)
+        check("layout covers all slots", sum(last - first + 1 for first, last, _ in ranges), SLOTS)
+
+        first = clients[ports[0]]
+        check("KEYSLOT foo", first.call('CLUSTER KEYSLOT foo'), str(key_slot('foo')))
+        check("KEYSLOT with a hash tag", first.call('CLUSTER KEYSLOT {user1000}.following'),
+              str(key_slot('user1000')))
+        check("hash tags share a slot", key_slot('{user1000}.following'), key_slot('{user1000}.followers'))
+        check("CLUSTER requires a subcommand", first.call('CLUSTER').startswith('ERROR'), True)
+
+        # find a local and a foreign key for the first node
+        me = f'{host}:{ports[0]}'
+        nodes = {address for _, _, address in ranges}
+        local = next(f'local:{i}' for i in range(10000) if owner(ranges, key_slot(f'local:{i}')) == me)
+        foreign = next(f'foreign:{i}' for i in range(10000) if owner(ranges, key_slot(f'foreign:{i}')) != me) \
+            if len(nodes) > 1 else None
+        local2 = next(f'local:{i}' for i in range(10000) if owner(ranges, key_slot(f'local:{i}')) == me
+                      and key_slot(f'local:{i}') != key_slot(local))
+
+        check("local key served", first.call(f'SET {local} v'), 'OK')
+        check("local key read back", first.call(f'GET {local}'), 'v')
+        if foreign is not None:
+            slot = key_slot(foreign)
+            moved = f'ERROR: MOVED {slot} {owner(ranges, slot)}'
+            check("foreign SET redirected", first.call(f'SET {foreign} v'), moved)
+            check("foreign GET redirected", first.call(f'GET {foreign}'), moved)
+            check("foreign INCR redirected", first.call(f'INCR {foreign}'), moved)
+            elsewhere = owner(ranges, slot)
+            foreign2 = next(f'foreign:{i}' for i in range(10000) if owner(ranges, key_slot(f'foreign:{i}')) == elsewhere
+                            and key_slot(f'foreign:{i}') != slot)
+            first.send([f'MGET {local} {local2}'])
+            check("MGET of local keys in different slots", [first.readline(), first.readline()], ['v', 'NOT_FOUND'])
+            check("MGET of foreign keys of one node redirected", first.call(f'MGET {foreign} {foreign2}'), moved)
+            check("MSET of foreign keys of one node redirected", first.call(f'MSET {foreign} a {foreign2} b'), moved)
+
+            # keys of several nodes: every node refuses outright instead of redirecting to another
+            other = by_address_client(clients, host, elsewhere)
+            for name, client in (("this node", first), ("the foreign key's node", other)):
+                check(f"MGET across nodes refused by {name}",
+                      client.call(f'MGET {local} {foreign}').startswith('ERROR: CROSSSLOT'), True)
+                check(f"MSET across nodes refused by {name}",
+                      client.call(f'MSET {local} a {foreign} b').startswith('ERROR: CROSSSLOT'), True)
+            check("refused MSET left the local key", first.call(f'GET {local}'), 'v')
+            check("refused MSET wrote no foreign key", other.call(f'GET {foreign}'), 'NOT_FOUND')
+
+            binary = BinaryClient(host, ports[0])
+            status, body = binary.call(OP_SET, foreign.encode(), b'v')
+            check("binary SET redirected", (status, body.decode()), (STATUS_ERROR, moved))
+            status, body = binary.call(OP_GET, local.encode())
+            check("binary GET of a local key", (status, body), (STATUS_OK, b'v'))
+            binary.close()
+
+        # write through the owners (as a client following MOVED would) and read everything back
+        by_address = {f'{host}:{port}': c for port, c in clients.items()}
+        redirects = 0
+        for i in range(keys):
+            key = f'cluster:{i}'
+            reply = first.call(f'SET {key} value-{i}')
+            if reply.startswith('ERROR: MOVED '):
+                redirects += 1
+                reply = by_address[reply.split()[3]].call(f'SET {key} value-{i}')
+            if reply != 'OK':
+                check(f"SET {key}", reply, 'OK')
+                break
+        missing = sum(by_address[owner(ranges, key_slot(f'cluster:{i}'))].call(f'GET cluster:{i}') != f'value-{i}'
+                      for i in range(keys))
+        check(f"{keys} keys readable from their owners", missing, 0)
+        if len(nodes) > 1:
+            check("some keys were redirected", redirects > 0, True)
+    finally:
+        for c in clients.values():
+            c.close()
+    return check.failures
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Cluster mode test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  # L=0-8191@127.0.0.1:8080,8192-16383@127.0.0.1:8081
+  # kvstore_server --port 8080 --cluster $L
+  # kvstore_server --port 8081 --cluster $L
+  python3 cluster.py --ports 8080,8081
+        """
+    )
+    parser.add_argument('--host', default='127.0.0.1', help='Host of the nodes, as in the layout (default: 127.0.0.1)')
+    parser.add_argument('--ports', default='8080,8081', help='Comma-separated node ports (default: 8080,8081)')
+    parser.add_argument('--keys', type=int, default=1000, help='Keys written across the cluster (default: 1000)')
+    args = parser.parse_args()
+    ports = [int(p) for p in args.ports.split(',')]
+
+    print("=" * 60)
+    print("KVStore Cluster Test")
+    print("=" * 60)
+    try:
+        failures = run_tests(args.host, ports, args.keys)
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+    print("=" * 60)
+    print(f"{failures} check(s) failed" if failures else "All checks passed")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+"""
+Counter and compare-and-set test for KVStore
+Starts the server binary itself, with an append-only file. Checks INCR, INCRBY, DECR,
+DECRBY and CAS replies, including overflow at both ends of int64 and values that are not
+integers the way GET returns them; that concurrent INCRs and CAS retry loops never lose
+an update; that a counter keeps its TTL; and that a restart replaying the AOF brings the
+counters back.
+"""
+
+import os
+import signal
+import subprocess
+import tempfile
+import argparse
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+from kvtest import LineClient, Checks
+from handoff import start_server, wait_ready
+
+INT64_MAX = 2**63 - 1
+INT64_MIN = -2**63
+NOT_INTEGER = 'ERROR: value is not an integer or out of range'
+OVERFLOW = 'ERROR: increment or decrement would overflow'
+
+
+def check_replies(check, client):
+    print("Replies:")
+    client.call('DEL c:new')
+    check("INCR of a missing key starts at 0", client.call('INCR c:new'), '1')
+    check("INCRBY", client.call('INCRBY c:new 41'), '42')
+    check("DECR", client.call('DECR c:new'), '41')
+    check("DECRBY", client.call('DECRBY c:new 50'), '-9')
+    check("INCRBY a negative delta", client.call('INCRBY c:new -1'), '-10')
+    check("DECRBY a negative delta", client.call('DECRBY c:new -10'), '0')
+    check("GET returns the decimal value", client.call('GET c:new'), '0')
+    check("DECR of a missing key", client.call('DECR c:down'), '-1')
+    check("INCRBY requires a delta", client.call('INCRBY c:new'), 'ERROR: INCRBY requires key and delta')
+    check("INCRBY delta must be an integer", client.call('INCRBY c:new 1.5'), 'ERROR: INCRBY requires key and delta')
+    check("INCRBY delta must fit int64", client.call(f'INCRBY c:new {INT64_MAX + 1}'),
+          'ERROR: INCRBY requires key and delta')
+    check("INCR requires a key", client.call('INCR'), 'ERROR: INCR requires key')
+
+    # a string counts as an integer only if it is written the way GET returns it
+    client.call('SET c:parsed 100')
+    check("INCR of a SET integer", client.call('INCR c:parsed'), '101')
+    for value in ('abc', '007', '-0', '+5', '1 2', '12a', str(INT64_MAX + 1)):
+        client.call(f'SET c:bad {value}')
+        check(f"INCR of {value!r} refused", client.call('INCR c:bad'), NOT_INTEGER)
+        check(f"{value!r} is left as it was", client.call('GET c:bad'), value)
+
+    # overflow at both ends leaves the counter unchanged
+    client.call(f'SET c:max {INT64_MAX}')
+    check("INCR past INT64_MAX refused", client.call('INCR c:max'), OVERFLOW)
+    check("INCRBY past INT64_MAX refused", client.call(f'INCRBY c:max {INT64_MAX}'), OVERFLOW)
+    check("INT64_MAX unchanged", client.call('GET c:max'), str(INT64_MAX))
+    check("DECR from INT64_MAX", client.call('DECR c:max'), str(INT64_MAX - 1))
+    client.call(f'SET c:min {INT64_MIN}')
+    check("DECR past INT64_MIN refused", client.call('DECR c:min'), OVERFLOW)
+    check("INCRBY past INT64_MIN refused", client.call('INCRBY c:min -1'), OVERFLOW)
+    check("DECRBY INT64_MIN refused", client.call(f'DECRBY c:zero {INT64_MIN}'), OVERFLOW)
+    check("INT64_MIN unchanged", client.call('GET c:min'), str(INT64_MIN))
+    check("INCRBY INT64_MIN to INT64_MIN", client.call(f'INCRBY c:tomin {INT64_MIN}'), str(INT64_MIN))
+    check("INCRBY INT64_MAX from INT64_MIN", client.call(f'INCRBY c:min {INT64_MAX}'), '-1')
+
+    client.call('SET c:cas old')
+    check("CAS mismatch", client.call('CAS c:cas other new'), 'MISMATCH')
+    check("CAS mismatch leaves the value", client.call('GET c:cas'), 'old')
+    check("CAS match", client.call('CAS c:cas old new value'), 'OK')
+    check("CAS sets the rest of the line", client.call('GET c:cas'), 'new value')
+    check("CAS of a missing key", client.call('CAS c:missing old new'), 'NOT_FOUND')
+    check("CAS does not create the key", client.call('GET c:missing'), 'NOT_FOUND')
+    check("CAS compares a counter by its decimal form", client.call('CAS c:new 0 zero'), 'OK')
+    check("CAS requires a new value", client.call('CAS c:cas new'),
+          'ERROR: CAS requires key, expected value and new value')
+
+    # both keep the key's TTL
+    client.call('SET c:ttl 5 EX 600')
+    check("INCR of a key with a TTL", client.call('INCR c:ttl'), '6')
+    ttl = client.call('TTL c:ttl')
+    check("INCR keeps the TTL", ttl.isdigit() and 0 < int(ttl) <= 600, True)
+    check("CAS of a key with a TTL", client.call('CAS c:ttl 6 seven'), 'OK')
+    ttl = client.call('TTL c:ttl')
+    check("CAS keeps the TTL", ttl.isdigit() and 0 < int(ttl) <= 600, True)
+
+
+def incr_worker(host, port, increments, batch=500):
+    client = LineClient(host, port)
+    replies = []
+    for start in range(0, increments, batch):
+        replies += client.pipeline(['INCR c:shared'] * min(batch, increments - start))
+    client.close()
+    return replies
+
+
+def cas_worker(host, port, updates):
+    """Increments c:casloop by GET then CAS, retrying on MISMATCH; returns the retries"""
+    client = LineClient(host, port)
+    retries = 0
+    done = 0
+    while done < updates:
+        value = client.call('GET c:casloop')
+        if client.call(f'CAS c:casloop {value} {int(value) + 1}') == 'OK':
+            done += 1
+        else:
+            retries += 1
+    client.close()
+    return retries
+
+
+def check_concurrency(check, host, port, threads, increments):
+    print("Concurrency:")
+    client = LineClient(host, port)
+    client.call('DEL c:shared')
+    with ThreadPoolExecutor(max_workers=threads) as pool:
+        results = list(pool.map(lambda _: incr_worker(host, port, increments), range(threads)))
+    total = threads * increments
+    check(f"{threads} x {increments} INCRs", client.call('GET c:shared'), str(total))
+    # every reply is a distinct value: no two increments saw the same count
+    seen = {int(r) for replies in results for r in replies if r.lstrip('-').isdigit()}
+    check("each INCR returned a distinct value", seen == set(range(1, total + 1)), True)
+
+    client.call('SET c:casloop 0')
+    updates = max(increments // 50, 1)
+    with ThreadPoolExecutor(max_workers=threads) as pool:
+        retries = sum(pool.map(lambda _: cas_worker(host, port, updates), range(threads)))
+    check(f"{threads} x {updates} CAS updates", client.call('GET c:casloop'), str(threads * updates))
+    print(f"  ({retries} CAS retries on MISMATCH)")
+    client.close()
+    return total
+
+
+def run_tests(binary, host, port, mode, threads, increments):
+    """Returns the number of failed checks"""
+    check = Checks()
+    aof = os.path.join(tempfile.mkdtemp(prefix='kvstore-counters-'), 'appendonly.aof')
+    args = ['--port', str(port), '--mode', mode, '--threads', '4', '--aof', aof]
+    if mode == 'percore':
+        args += ['--shards', '16']
+
+    server = start_server(binary, args)
+    try:
+        check("server started", wait_ready(host, port), True)
+        client = LineClient(host, port)
+        check_replies(check, client)
+        total = check_concurrency(check, host, port, threads, increments)
+        expected = {key: client.call(f'GET {key}') for key in ('c:shared', 'c:casloop', 'c:max', 'c:min', 'c:down')}
+        client.close()
+        server.send_signal(signal.SIGTERM)
+        check("server exited cleanly", server.wait(timeout=30), 0)
+    finally:
+        if server.poll() is None:
+            server.kill()
+            server.wait()
+
+    print("AOF replay:")
+    server = start_server(binary, args)
+    try:
+        check("server restarted", wait_ready(host, port), True)
+        client = LineClient(host, port)
+        for key, value in expected.items():
+            check(f"{key} replayed", client.call(f'GET {key}'), value)
+        check("a replayed counter still increments", client.call('INCR c:shared'), str(total + 1))
+        ttl = client.call('TTL c:ttl')
+        check("a replayed TTL is kept", ttl.isdigit() and 0 < int(ttl) <= 600, True)
+        client.close()
+    finally:
+        server.send_signal(signal.SIGTERM)
+        try:
+            server.wait(timeout=30)
+        except subprocess.TimeoutExpired:
+            server.kill()
+            server.wait()
+    return check.failures
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Counter and compare-and-set test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  python3 counters.py --server build/kvstore_server
+  python3 counters.py --server build/kvstore_server --mode percore --port 8090
+        """
+    )
+    parser.add_argument('--server', default='build/kvstore_server', help='Server binary (default: build/kvstore_server)')
+    parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
+    parser.add_argument('--port', type=int, default=8080, help='Port the test server uses (default: 8080)')
+    parser.add_argument('--mode', default='epoll', choices=['epoll', 'uring', 'threaded', 'percore'],
+                        help='Server --mode (default: epoll)')
+    parser.add_argument('--threads', type=int, default=8, help='Concurrent clients (default: 8)')
+    parser.add_argument('--increments', type=int, default=10000, help='INCRs per client (default: 10000)')
+    args = parser.parse_args()
+
+    print("=" * 60)
+    print("KVStore Counter and CAS Test")
+    print("=" * 60)
+    try:
+        failures = run_tests(args.server, args.host, args.port, args.mode, args.threads, args.increments)
+    except (OSError, ValueError, subprocess.TimeoutExpired) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+    print("=" * 60)
+    print(f"{failures} check(s) failed" if failures else "All checks passed")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
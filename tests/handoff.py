@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""
+Graceful shutdown and handoff test for KVStore
+Starts the server binary itself. First a SIGTERM while a client has a large pipeline in
+flight: every request it sent is still answered, the server exits cleanly and its final
+snapshot brings the data back on restart. Then a handoff: a server started with
+--takeover takes the port and the data of one started with --handoff, while a client
+connecting during the switch is served by the new process without a refused connection.
+"""
+
+import os
+import signal
+import subprocess
+import tempfile
+import time
+import argparse
+import sys
+
+from kvtest import LineClient, Checks
+
+
+def start_server(binary, args):
+    return subprocess.Popen([binary] + args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+
+
+def wait_ready(host, port, timeout=10.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            LineClient(host, port).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def write_keys(client, prefix, count):
+    client.send([f'SET {prefix}:{i} value-{i}' for i in range(count)])
+    return sum(client.readline() == 'OK' for _ in range(count))
+
+
+def count_keys(client, prefix, count):
+    client.send([f'GET {prefix}:{i}' for i in range(count)])
+    return sum(client.readline() == f'value-{i}' for i in range(count))
+
+
+def run_tests(binary, host, port, mode, keys):
+    """Returns the number of failed checks"""
+    check = Checks()
+
+    workdir = tempfile.mkdtemp(prefix='kvstore-handoff-')
+    snapshot = os.path.join(workdir, 'dump.kvs')
+    handoff = os.path.join(workdir, 'handoff.sock')
+    base = ['--port', str(port), '--mode', mode, '--threads', '2']
+    if mode == 'percore':
+        base += ['--shards', '16']
+
+    # graceful shutdown with a pipeline in flight
+    print("Shutdown:")
+    server = start_server(binary, base + ['--snapshot', snapshot])
+    try:
+        check("server started", wait_ready(host, port), True)
+        client = LineClient(host, port)
+        check(f"{keys} keys written", write_keys(client, 'shutdown', keys), keys)
+        busy = LineClient(host, port)
+        busy.call('GET shutdown:0') # being served: connections still in the backlog are reset at exit
+        busy.send([f'GET shutdown:{i % keys}' for i in range(keys)])
+        server.send_signal(signal.SIGTERM)
+        replies = [busy.readline() for _ in range(keys)]
+        check("the pipeline in flight was answered", sum(r.startswith('value-') for r in replies), keys)
+        check("clients are disconnected after draining", busy.closed() and client.closed(), True)
+        busy.close()
+        client.close()
+        check("server exited cleanly", server.wait(timeout=30), 0)
+    finally:
+        if server.poll() is None:
+            server.kill()
+            server.wait()
+    check("final snapshot written", os.path.exists(snapshot), True)
+
+    server = start_server(binary, base + ['--snapshot', snapshot])
+    try:
+        check("server restarted", wait_ready(host, port), True)
+        client = LineClient(host, port)
+        check("keys are back after the restart", count_keys(client, 'shutdown', keys), keys)
+        client.close()
+    finally:
+        server.send_signal(signal.SIGTERM)
+        server.wait(timeout=30)
+
+    # handoff to a new process
+    print("Handoff:")
+    old = start_server(binary, base + ['--handoff', handoff])
+    new = None
+    try:
+        check("old server started", wait_ready(host, port), True)
+        client = LineClient(host, port)
+        check(f"{keys} keys written", write_keys(client, 'handoff', keys), keys)
+        client.call('SET handoff:ttl v')
+        client.call('EXPIRE handoff:ttl 600')
+
+        new = start_server(binary, base + ['--takeover', handoff, '--handoff', handoff])
+        check("old server exited cleanly", old.wait(timeout=30), 0)
+        check("the old server's clients are disconnected", client.closed(), True)
+        client.close()
+
+        # connects to the backlog of the shared socket: never refused, served by the new server
+        late = LineClient(host, port)
+        check("new server has the keys", count_keys(late, 'handoff', keys), keys)
+        ttl = late.call('TTL handoff:ttl')
+        check("expiry survives the handoff", ttl.isdigit() and 0 < int(ttl) <= 600, True)
+        check("new server takes writes", late.call('SET handoff:after yes'), 'OK')
+        late.close()
+        check("new server still running", new.poll(), None)
+    finally:
+        for process in (old, new):
+            if process is not None and process.poll() is None:
+                process.send_signal(signal.SIGTERM)
+                try:
+                    process.wait(timeout=30)
+                except subprocess.TimeoutExpired:
+                    process.kill()
+                    process.wait()
+    return check.failures
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Graceful shutdown and handoff test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  python3 handoff.py --server build/kvstore_server
+  python3 handoff.py --server build/kvstore_server --mode threaded --port 8090
+        """
+    )
+    parser.add_argument('--server', default='build/kvstore_server', help='Server binary (default: build/kvstore_server)')
+    parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
+    parser.add_argument('--port', type=int, default=8080, help='Port the test servers use (default: 8080)')
+    parser.add_argument('--mode', default='epoll', choices=['epoll', 'uring', 'threaded', 'percore'],
+                        help='Server --mode (default: epoll)')
+    parser.add_argument('--keys', type=int, default=5000, help='Keys written (default: 5000)')
+    args = parser.parse_args()
+
+    print("=" * 60)
+    print("KVStore Shutdown and Handoff Test")
+    print("=" * 60)
+    try:
+        failures = run_tests(args.server, args.host, args.port, args.mode, args.keys)
+    except (OSError, ValueError, subprocess.TimeoutExpired) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+    print("=" * 60)
+    print(f"{failures} check(s) failed" if failures else "All checks passed")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
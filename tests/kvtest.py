@@ -0,0 +1,126 @@
+"""
+Shared helpers for the KVStore test scripts
+Line-protocol and binary-protocol clients, the INFO parser and the PASS/FAIL check
+counter. The scripts in this directory import it from their own directory, so run them
+from anywhere as python3 tests/<script>.py
+"""
+
+import socket
+import struct
+
+# binary protocol (Protocol.hpp)
+REQUEST_MAGIC = 0x80
+RESPONSE_MAGIC = 0x81
+OP_TEXT, OP_GET, OP_SET, OP_DEL, OP_GET_COMPRESSED = 0, 1, 2, 3, 4
+STATUS_OK, STATUS_NOT_FOUND, STATUS_ERROR = 0, 1, 2
+FLAG_LZ4 = 1
+
+
+class LineClient:
+    def __init__(self, host='localhost', port=8080, rcvbuf=0):
+        if rcvbuf:
+            # set before connecting, so the window is sized for it and never autotuned
+            self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+            self.sock.settimeout(10.0)
+            self.sock.connect((host, port))
+        else:
+            self.sock = socket.create_connection((host, port), timeout=10.0)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.file = self.sock.makefile('rb')
+
+    def call(self, command):
+        self.sock.sendall((command + '\n').encode())
+        return self.readline()
+
+    def lines(self, command):
+        """A multi-line reply terminated by END (or a single error line, not returned)"""
+        self.sock.sendall((command + '\n').encode())
+        reply = []
+        while True:
+            line = self.readline()
+            if line == 'END' or line.startswith('ERROR'):
+                return reply
+            reply.append(line)
+
+    def send(self, commands):
+        """Send a pipeline without reading the replies"""
+        self.sock.sendall(''.join(c + '\n' for c in commands).encode())
+
+    def pipeline(self, commands):
+        self.send(commands)
+        return [self.readline() for _ in commands]
+
+    def readline(self):
+        return self.file.readline().decode().rstrip('\n')
+
+    def closed(self):
+        """Whether the server hung up (a reset counts: it may close with our bytes unread)"""
+        try:
+            return self.file.readline() == b''
+        except ConnectionResetError:
+            return True
+
+    def close(self):
+        self.file.close() # the socket only closes once its file object is gone too
+        self.sock.close()
+
+
+class BinaryClient:
+    def __init__(self, host='localhost', port=8080):
+        self.sock = socket.create_connection((host, port), timeout=10.0)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buffer = b''
+
+    @staticmethod
+    def frame(op, key=b'', value=b''):
+        return struct.pack('<BBHI', REQUEST_MAGIC, op, len(key), len(value)) + key + value
+
+    def _read_exact(self, n):
+        while len(self.buffer) < n:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            self.buffer += chunk
+        data, self.buffer = self.buffer[:n], self.buffer[n:]
+        return data
+
+    def read_response(self, with_flags=False):
+        magic, status, flags, _, length = struct.unpack('<BBBBI', self._read_exact(8))
+        if magic != RESPONSE_MAGIC:
+            raise ValueError(f"bad response magic {magic:#x}")
+        body = self._read_exact(length)
+        return (status, flags, body) if with_flags else (status, body)
+
+    def pipeline(self, frames):
+        self.sock.sendall(b''.join(frames))
+        return [self.read_response() for _ in frames]
+
+    def call(self, op, key=b'', value=b''):
+        return self.pipeline([self.frame(op, key, value)])[0]
+
+    def close(self):
+        self.sock.close()
+
+
+def info(client):
+    """INFO as a dict of STAT name -> value"""
+    stats = {}
+    for line in client.lines('INFO'):
+        parts = line.split(' ', 2)
+        if len(parts) == 3 and parts[0] == 'STAT':
+            stats[parts[1]] = parts[2]
+    return stats
+
+
+class Checks:
+    """Prints a PASS/FAIL line per check and counts the failures"""
+
+    def __init__(self):
+        self.failures = 0
+
+    def __call__(self, name, got, expected):
+        ok = got == expected
+        self.failures += not ok
+        print(f"  {'PASS' if ok else 'FAIL'}: {name}" + ('' if ok else f" (got {got!r}, expected {expected!r})"))
+        return ok
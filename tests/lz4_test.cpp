@@ -0,0 +1,151 @@
+/*
+    Unit test for the LZ4 block codec (include/Lz4.hpp): inputs of every shape must
+    round-trip, and truncated, corrupt or mis-sized blocks must be refused without
+    writing past the output buffer.
+
+    Usage: kvstore_lz4_test (exits non-zero if any check fails)
+*/
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "Lz4.hpp"
+
+static int failures = 0;
+
+static void check(const char* name, bool ok) {
+    if (!ok) {
+        std::printf("FAIL: %s\n", name);
+        failures++;
+    }
+}
+
+// bytes written after the output must stay this value
+static constexpr char GUARD = char(0xA5);
+static constexpr size_t GUARD_SIZE = 64;
+
+// decompress block into a raw_size buffer followed by a guard region; false if the
+// decoder refused it, and a failed check if it touched the guard either way
+static bool decode(const char* name, std::string_view block, size_t raw_size, std::string& out) {
+    std::vector<char> buf(raw_size + GUARD_SIZE, GUARD);
+    bool ok = lz4::decompress(block, buf.data(), raw_size);
+    bool guard_intact = true;
+    for (size_t i = raw_size; i < buf.size(); i++) {
+        guard_intact &= buf[i] == GUARD;
+    }
+    check(name, guard_intact);
+    out.assign(buf.data(), raw_size);
+    return ok;
+}
+
+static void round_trip(const char* name, const std::string& in) {
+    std::string block;
+    size_t n = lz4::compress(in, block);
+    check(name, n == block.size() && n <= lz4::compress_bound(in.size()));
+    std::string out;
+    check(name, decode(name, block, in.size(), out) && out == in);
+    // a block appended after other bytes decodes the same
+    std::string prefixed = "prefix";
+    lz4::compress(in, prefixed);
+    check(name, prefixed.compare(6, std::string::npos, block) == 0);
+}
+
+static std::string random_bytes(std::mt19937& rng, size_t n) {
+    std::string s(n, '\0');
+    for (char& c : s) {
+        c = char(rng());
+    }
+    return s;
+}
+
+static void test_round_trips() {
+    std::mt19937 rng(42);
+    round_trip("empty", "");
+    round_trip("one byte", "x");
+    round_trip("short literal", "hello");
+    round_trip("12 bytes (shortest with a match)", "abcabcabcabc");
+    round_trip("run of one byte", std::string(100000, 'a'));
+    round_trip("overlapping match, offset 2", std::string(1000, 'a') + "ab" + std::string(5000, 'b'));
+    std::string period3;
+    for (int i = 0; i < 3000; i++) {
+        period3 += "xyz";
+    }
+    round_trip("period-3 repeat", period3);
+    round_trip("random 64 KiB", random_bytes(rng, 65536));
+    for (size_t n : {1, 5, 14, 15, 16, 270, 271, 65535, 65536, 65537}) {
+        round_trip("random, length near a boundary", random_bytes(rng, n));
+    }
+    std::string text;
+    for (int i = 0; i < 20000; i++) {
+        text += "{\"id\": " + std::to_string(i) + ", \"name\": \"user" + std::to_string(i % 97) + "\"}\n";
+    }
+    round_trip("JSON-like text", text);
+    std::string mixed;
+    for (int i = 0; i < 200; i++) {
+        mixed += random_bytes(rng, rng() % 300);
+        mixed += std::string(rng() % 300, char('a' + i % 26));
+        mixed += text.substr(rng() % 10000, rng() % 500);
+    }
+    round_trip("mixed literals and matches", mixed);
+    // matches further back than the 64 KiB window must not be used
+    std::string far = random_bytes(rng, 1000);
+    round_trip("repeat past the window", far + random_bytes(rng, 70000) + far);
+
+    std::string packed;
+    lz4::compress(std::string(100000, 'a'), packed);
+    check("long run compresses", packed.size() < 1000);
+}
+
+static void test_corrupt_blocks() {
+    std::mt19937 rng(7);
+    std::string text;
+    for (int i = 0; i < 2000; i++) {
+        text += "line " + std::to_string(i % 50) + " of the test input\n";
+    }
+    std::string block;
+    lz4::compress(text, block);
+    std::string out;
+
+    check("wrong raw_size (short) refused", !decode("guard, short raw_size", block, text.size() - 1, out));
+    check("wrong raw_size (long) refused", !decode("guard, long raw_size", block, text.size() + 1, out));
+    check("zero raw_size refused", !decode("guard, zero raw_size", block, 0, out));
+    for (size_t cut = 0; cut < block.size(); cut += 1 + cut / 8) {
+        check("truncated block refused", !decode("guard, truncated", block.substr(0, cut), text.size(), out));
+    }
+
+    // hand-built sequences: token (literal count, match length - 4), literals, offset
+    const char zero_offset[] = {char(0x10), 'a', 0, 0, char(0x00)};
+    check("zero offset refused", !decode("guard, zero offset", std::string_view(zero_offset, 5), 20, out));
+    const char offset_past_start[] = {char(0x10), 'a', 2, 0, char(0x00)};
+    check("offset before the output refused",
+          !decode("guard, offset before output", std::string_view(offset_past_start, 5), 20, out));
+    const char match_too_long[] = {char(0x1F), 'a', 1, 0, char(0xFF), char(0x10)};
+    check("match past raw_size refused",
+          !decode("guard, long match", std::string_view(match_too_long, 6), 100, out));
+    const char literals_past_end[] = {char(0xF0), char(0xFF), char(0xFF), 'a'};
+    check("literal length past the block refused",
+          !decode("guard, long literals", std::string_view(literals_past_end, 4), 600, out));
+    const char length_unterminated[] = {char(0xF0), char(0xFF)};
+    check("unterminated length refused",
+          !decode("guard, unterminated length", std::string_view(length_unterminated, 2), 300, out));
+
+    // garbage and bit flips: refused or decoded, but never out of bounds
+    for (int i = 0; i < 2000; i++) {
+        decode("guard, garbage", random_bytes(rng, rng() % 200), rng() % 2000, out);
+        std::string flipped = block;
+        flipped[rng() % flipped.size()] ^= char(1 << (rng() % 8));
+        decode("guard, bit flip", flipped, text.size(), out);
+    }
+}
+
+int main() {
+    test_round_trips();
+    test_corrupt_blocks();
+    if (failures) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("lz4: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""
+Overload test for KVStore
+Checks the client limits of a server started with small --max-clients, --max-input and
+--output-limit values: connections past the limit are turned away with an error while
+the admitted ones keep working, a request larger than the input limit gets an error and
+a closed connection, and a client that pipelines far more replies than the output limit
+without reading them gets paused (INFO read_pauses) yet still receives every reply.
+"""
+
+import time
+import argparse
+import sys
+
+from kvtest import LineClient, Checks, info
+
+
+def run_tests(host, port, max_clients, max_input, output_limit, threaded):
+    """Returns the number of failed checks"""
+    check = Checks()
+
+    control = LineClient(host, port)
+    before = info(control)
+
+    # connection limit: the control connection is one of the admitted clients
+    admitted = [LineClient(host, port) for _ in range(max_clients - 1)]
+    check("admitted clients are served", all(c.call('GET overload:missing') == 'NOT_FOUND' for c in admitted), True)
+    extra = LineClient(host, port)
+    check("client past the limit rejected", extra.readline(), 'ERROR: max number of clients reached')
+    check("rejected client disconnected", extra.closed(), True)
+    extra.close()
+    admitted.pop().close()
+    time.sleep(0.2) # the server notices the close
+    again = LineClient(host, port)
+    check("a freed slot admits a new client", again.call('GET overload:missing'), 'NOT_FOUND')
+    again.close()
+    for c in admitted:
+        c.close()
+    time.sleep(0.2)
+
+    # input limit: a line that never ends
+    big = LineClient(host, port)
+    try:
+        big.sock.sendall(b'SET huge ' + b'x' * (max_input + (1 << 20)))
+    except OSError:
+        pass # the server may hang up while we are still sending
+    check("oversized request rejected", big.readline(), 'ERROR: request exceeds the input buffer limit')
+    check("oversized request disconnected", big.closed(), True)
+    big.close()
+
+    # output limit: a client that sends a large pipeline before reading anything
+    value = 'v' * 4096
+    control.call(f'SET overload:value {value}')
+    count = max(2048, 64 * output_limit // len(value)) # past the server's send buffer (up to 4mb)
+    slow = LineClient(host, port, rcvbuf=65536) # small enough for the replies to back up
+    slow.sock.sendall(('GET overload:value\n' * count).encode())
+    time.sleep(0.5)
+    paused = int(info(control).get('read_pauses', 0)) - int(before.get('read_pauses', 0))
+    if not threaded: # there the blocking write holds the reader back, uncounted
+        check("slow reader was paused", paused > 0, True)
+    check("other clients still served", control.call('GET overload:missing'), 'NOT_FOUND')
+    replies = [slow.readline() for _ in range(count)]
+    check(f"slow reader got all {count} replies", sum(r == value for r in replies), count)
+    check("slow reader still served after draining", slow.call('GET overload:missing'), 'NOT_FOUND')
+    slow.close()
+
+    after = info(control)
+    check("rejected_connections counted", int(after['rejected_connections']) > int(before['rejected_connections']), True)
+    check("input_overflows counted", int(after['input_overflows']) > int(before['input_overflows']), True)
+    control.close()
+    return check.failures
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Overload test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  # kvstore_server --max-clients 8 --max-input 1mb --output-limit 64kb
+  python3 overload.py --max-clients 8 --max-input 1mb --output-limit 64kb
+        """
+    )
+    parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
+    parser.add_argument('--port', type=int, default=8080, help='Server port (default: 8080)')
+    parser.add_argument('--max-clients', type=int, default=8, help="The server's --max-clients (default: 8)")
+    parser.add_argument('--max-input', default='1mb', help="The server's --max-input (default: 1mb)")
+    parser.add_argument('--output-limit', default='64kb', help="The server's --output-limit (default: 64kb)")
+    parser.add_argument('--threaded', action='store_true', help='The server runs in --mode threaded')
+    args = parser.parse_args()
+
+    def size(text):
+        units = {'kb': 1 << 10, 'k': 1 << 10, 'mb': 1 << 20, 'm': 1 << 20, 'gb': 1 << 30, 'g': 1 << 30}
+        for suffix, scale in units.items():
+            if text.lower().endswith(suffix):
+                return int(text[:-len(suffix)]) * scale
+        return int(text)
+
+    print("=" * 60)
+    print("KVStore Overload Test")
+    print("=" * 60)
+    try:
+        failures = run_tests(args.host, args.port, args.max_clients, size(args.max_input), size(args.output_limit),
+                             args.threaded)
+    except (OSError, ValueError, KeyError) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+    print("=" * 60)
+    print(f"{failures} check(s) failed" if failures else "All checks passed")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
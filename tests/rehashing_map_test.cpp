@@ -0,0 +1,220 @@
+/*
+    Randomized test of RehashingMap (include/RehashingMap.hpp) over both backends,
+    std::unordered_map and FlatHashMap: a long run of random inserts, lookups, erases,
+    rehash_step(), probe() and reserve() calls, checked against a std::map after every
+    operation and by iterating the whole map while elements sit in both tables.
+
+    Usage: kvstore_rehashing_map_test [ops] [seed] (exits non-zero if any check fails)
+*/
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "FlatHashMap.hpp"
+#include "RehashingMap.hpp"
+
+static int failures = 0;
+
+static void check(const char* backend, const char* name, bool ok) {
+    if (!ok) {
+        if (failures < 20) {
+            std::printf("FAIL: %s: %s\n", backend, name);
+        }
+        failures++;
+    }
+}
+
+// what the run exercised, so a run that never reached a case is a failure too
+struct Coverage {
+    size_t rehashes = 0;          // times a draining table appeared
+    size_t draining_erases = 0;   // erases that removed an element from the draining table
+    size_t draining_emptied = 0;  // of those, the ones that emptied it
+    size_t duplicate_inserts = 0; // inserts of a key still in the draining table
+    size_t present_inserts = 0;   // inserts of a present key while rehashing
+    size_t steps = 0;             // rehash_step() calls that moved elements
+    size_t probe_hits = 0;
+    size_t reserves = 0;          // reserve() calls made during a rehash
+    size_t iterations = 0;        // whole-map iterations made during a rehash
+};
+
+template <typename Map>
+static void check_iteration(const char* backend, Map& map, const std::map<std::string, int>& reference) {
+    std::set<std::string> seen;
+    bool values_match = true;
+    for (auto& [key, value] : map) {
+        seen.insert(key);
+        auto it = reference.find(key);
+        values_match &= it != reference.end() && it->second == value;
+    }
+    check(backend, "iteration visits each element once", seen.size() == reference.size());
+    check(backend, "iteration sees the reference values", values_match);
+    size_t counted = 0;
+    for (auto it = map.begin(); it != map.end(); it++) {
+        counted++;
+    }
+    check(backend, "iteration length is size()", counted == map.size());
+}
+
+// step a rehash down to its last few elements, then finish it by erasing them: iteration
+// visits the draining table last, and migration takes its elements in iteration order
+template <typename Map>
+static void drain_by_erase(const char* backend, Map& map, std::map<std::string, int>& reference,
+                           Coverage& seen) {
+    while (map.rehash_step(1) > 2 * Map::REHASH_STEP) {
+    }
+    size_t left = map.rehash_step(0);
+    std::vector<std::string> keys;
+    for (auto& element : map) {
+        keys.push_back(element.first);
+    }
+    keys.erase(keys.begin(), keys.end() - left);
+
+    // the last key outlives the elements this insert migrates: it must not be inserted twice
+    size_t size = map.size();
+    auto [it, inserted] = map.emplace(keys.back(), -1);
+    check(backend, "emplace of a draining key finds it", !inserted && it->second == reference[keys.back()]);
+    check(backend, "emplace of a draining key keeps the size", map.size() == size);
+    seen.duplicate_inserts += map.rehashing();
+
+    for (const std::string& key : keys) {
+        size_t before = map.rehash_step(0);
+        auto found = map.find(key);
+        check(backend, "draining key found", found != map.end());
+        map.erase(found);
+        reference.erase(key);
+        size_t after = map.rehash_step(0);
+        seen.draining_erases += after < before;
+        seen.draining_emptied += before > 0 && after == 0;
+    }
+    check(backend, "erasing the draining table ends the rehash", !map.rehashing());
+    check_iteration(backend, map, reference);
+}
+
+template <typename Table>
+static void run(const char* backend, size_t ops, uint64_t seed) {
+    RehashingMap<Table> map;
+    std::map<std::string, int> reference;
+    std::mt19937_64 rng(seed);
+    Coverage seen;
+    bool was_rehashing = false;
+    size_t key_space = 60000;
+
+    for (size_t op = 0; op < ops; op++) {
+        // grow for the first half, then mostly erase, so rehashes start and drain both ways
+        bool growing = op < ops / 2;
+        std::string key = "key:" + std::to_string(rng() % key_space);
+        int value = int(rng() % 1000000);
+        size_t draining_before = map.rehash_step(0);
+        unsigned dice = rng() % 100;
+
+        if (dice < (growing ? 55u : 25u)) {
+            bool rehashing = map.rehashing();
+            auto [it, inserted] = map.emplace(key, value);
+            auto [ref, ref_inserted] = reference.emplace(key, value);
+            check(backend, "emplace inserts only new keys", inserted == ref_inserted);
+            check(backend, "emplace returns the element", it != map.end() && it->first == key &&
+                                                           it->second == ref->second);
+            seen.present_inserts += !inserted && rehashing;
+        } else if (dice < (growing ? 75u : 80u)) {
+            auto it = map.find(key);
+            bool present = reference.erase(key) > 0;
+            check(backend, "find before erase", (it != map.end()) == present);
+            if (it != map.end()) {
+                map.erase(it);
+                size_t draining_after = map.rehash_step(0);
+                if (draining_after < draining_before) {
+                    seen.draining_erases++;
+                    seen.draining_emptied += draining_after == 0;
+                }
+            }
+        } else if (dice < 90) {
+            auto it = map.find(key);
+            auto ref = reference.find(key);
+            check(backend, "find agrees with the reference", (it == map.end()) == (ref == reference.end()));
+            if (it != map.end() && ref != reference.end()) {
+                check(backend, "find returns the value", it->first == key && it->second == ref->second);
+                it->second = value; // writes through find() land in whichever table holds it
+                ref->second = value;
+            }
+        } else if (dice < 95) {
+            size_t n = rng() % 64;
+            size_t left = map.rehash_step(n);
+            check(backend, "rehash_step moves at most n", left <= draining_before &&
+                                                          (draining_before == 0 || draining_before - left <= n));
+            seen.steps += left < draining_before;
+        } else {
+            auto it = map.probe(rng());
+            if (it != map.end()) {
+                auto ref = reference.find(it->first);
+                check(backend, "probe returns a live element", ref != reference.end() && ref->second == it->second);
+                seen.probe_hits++;
+            }
+        }
+
+        if (map.rehashing() && !was_rehashing) {
+            seen.rehashes++;
+            check_iteration(backend, map, reference); // just after the swap: most elements draining
+            seen.iterations++;
+            if (seen.rehashes % 3 == 1) {
+                drain_by_erase(backend, map, reference, seen);
+            } else if (seen.rehashes % 3 == 2) { // reserve mid-rehash finishes it first
+                map.reserve(map.size() + 1000);
+                check(backend, "reserve finishes the rehash", !map.rehashing());
+                check_iteration(backend, map, reference);
+                seen.reserves++;
+            }
+        }
+        if (map.rehashing() && op % 997 == 0) {
+            check_iteration(backend, map, reference);
+            seen.iterations++;
+        }
+        was_rehashing = map.rehashing();
+        check(backend, "size matches the reference", map.size() == reference.size());
+        if (failures >= 20) {
+            break;
+        }
+    }
+    check_iteration(backend, map, reference);
+
+    // drain to empty through erases only: each one may come from either table
+    while (!reference.empty()) {
+        auto it = map.find(reference.begin()->first);
+        check(backend, "final erase finds the key", it != map.end());
+        if (it == map.end()) {
+            break;
+        }
+        map.erase(it);
+        reference.erase(reference.begin());
+    }
+    check(backend, "empty at the end", map.empty() && map.begin() == map.end() && !map.rehashing());
+
+    std::printf("  %s: %zu rehashes, %zu erases from the draining table (%zu emptied it), %zu inserts of a "
+                "present key (%zu still draining), %zu steps, %zu probe hits, %zu reserves, %zu iterations "
+                "while rehashing\n",
+                backend, seen.rehashes, seen.draining_erases, seen.draining_emptied, seen.present_inserts,
+                seen.duplicate_inserts, seen.steps, seen.probe_hits, seen.reserves, seen.iterations);
+    check(backend, "a rehash happened", seen.rehashes >= 3);
+    check(backend, "erased from the draining table", seen.draining_erases > 0 && seen.draining_emptied > 0);
+    check(backend, "inserted a key still in the draining table", seen.duplicate_inserts > 0);
+    check(backend, "rehash_step moved elements", seen.steps > 0);
+    check(backend, "probe found elements", seen.probe_hits > 0);
+    check(backend, "reserved during a rehash", seen.reserves > 0);
+    check(backend, "iterated during a rehash", seen.iterations > 0);
+}
+
+int main(int argc, char* argv[]) {
+    size_t ops = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 400000;
+    uint64_t seed = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1;
+    run<std::unordered_map<std::string, int>>("unordered_map", ops, seed);
+    run<FlatHashMap<std::string, int>>("FlatHashMap", ops, seed);
+    if (failures) {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("rehashing map: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Replication test for KVStore
+Writes through a primary and checks that a replica (started with --replicaof pointing at
+the primary's --repl-port) converges to the same data, refuses writes, and reports its
+link in INFO. Then measures how long writes take to show up on the replica.
+"""
+
+import time
+import argparse
+import sys
+
+from kvtest import LineClient, Checks, info
+
+
+def wait_for(replica, key, expected, timeout=5.0):
+    """Poll the replica until GET key returns expected; returns the wait in seconds, or None"""
+    start = time.perf_counter()
+    while time.perf_counter() - start < timeout:
+        if replica.call(f'GET {key}') == expected:
+            return time.perf_counter() - start
+        time.sleep(0.001)
+    return None
+
+
+def run_functional_tests(primary, replica, keys):
+    """Returns the number of failed checks"""
+    check = Checks()
+
+    check("replica link up", info(replica).get('primary_link'), 'up')
+    check("replica role", info(replica).get('role'), 'replica')
+    check("primary sees the replica", int(info(primary).get('connected_replicas', 0)) >= 1, True)
+
+    primary.pipeline([f'SET repl:{i} value-{i}' for i in range(keys)])
+    primary.call('SET repl:ttl v EX 300')
+    primary.call('MSET repl:m1 a repl:m2 b')
+    primary.call('DEL repl:m2')
+    primary.call('DEL repl:counter')
+    primary.call('INCRBY repl:counter 41')
+    primary.call('INCR repl:counter')
+    primary.call('SET repl:cas old')
+    primary.call('CAS repl:cas old new')
+    primary.call('SET repl:persist v EX 300')
+    primary.call('EXPIRE repl:persist 100')
+    primary.call('SET repl:last done')
+
+    check("stream reaches the replica", wait_for(replica, 'repl:last', 'done') is not None, True)
+    got = replica.pipeline([f'GET repl:{i}' for i in range(keys)])
+    check(f"{keys} keys replicated", got, [f'value-{i}' for i in range(keys)])
+    check("MSET replicated", replica.call('GET repl:m1'), 'a')
+    check("DEL replicated", replica.call('GET repl:m2'), 'NOT_FOUND')
+    check("INCR replicated", replica.call('GET repl:counter'), '42')
+    check("CAS replicated", replica.call('GET repl:cas'), 'new')
+    ttl = replica.call('TTL repl:ttl')
+    check("TTL replicated", ttl.lstrip('-').isdigit() and 290 <= int(ttl) <= 300, True)
+    ttl = replica.call('TTL repl:persist')
+    check("EXPIRE replicated", ttl.lstrip('-').isdigit() and 90 <= int(ttl) <= 100, True)
+
+    readonly = 'ERROR: READONLY this server is a replica; write to the primary'
+    check("replica refuses SET", replica.call('SET repl:x y'), readonly)
+    check("replica refuses INCR", replica.call('INCR repl:counter'), readonly)
+    check("refused write not applied", replica.call('GET repl:x'), 'NOT_FOUND')
+    return check.failures
+
+
+def run_lag_test(primary, replica, rounds):
+    """Time from a SET acknowledged by the primary until the replica returns it"""
+    lags = []
+    for i in range(rounds):
+        primary.call(f'SET repl:lag {i}')
+        lag = wait_for(replica, 'repl:lag', str(i))
+        if lag is not None:
+            lags.append(lag * 1000)
+    return sorted(lags)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Replication test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  # primary: kvstore_server --port 8080 --repl-port 9000
+  # replica: kvstore_server --port 8081 --replicaof localhost:9000
+  python3 replication.py --primary-port 8080 --replica-port 8081
+        """
+    )
+    parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
+    parser.add_argument('--primary-port', type=int, default=8080, help='Primary port (default: 8080)')
+    parser.add_argument('--replica-port', type=int, default=8081, help='Replica port (default: 8081)')
+    parser.add_argument('--keys', type=int, default=1000, help='Keys written in the functional test (default: 1000)')
+    parser.add_argument('--rounds', type=int, default=200, help='Writes timed in the lag test (default: 200)')
+    args = parser.parse_args()
+
+    try:
+        primary = LineClient(args.host, args.primary_port)
+        replica = LineClient(args.host, args.replica_port)
+    except Exception as e:
+        print(f"Error: Cannot connect to server: {e}")
+        sys.exit(1)
+
+    print("=" * 60)
+    print("KVStore Replication Test")
+    print("=" * 60)
+    try:
+        failures = run_functional_tests(primary, replica, args.keys)
+        lags = run_lag_test(primary, replica, args.rounds)
+    finally:
+        primary.close()
+        replica.close()
+
+    print("=" * 60)
+    if lags:
+        print(f"Replication lag: p50 {lags[len(lags) // 2]:.2f} ms, p99 {lags[int(len(lags) * 0.99)]:.2f} ms, "
+              f"max {lags[-1]:.2f} ms ({len(lags)}/{args.rounds} writes seen)")
+    print(f"{failures} check(s) failed" if failures else "All checks passed")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
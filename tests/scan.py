@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+"""
+SCAN test for KVStore
+Checks the ordered key index of a server started with --ordered-index on: after writing
+many keys and deleting most of them (whole runs and scattered single keys, so index nodes
+underflow and merge or borrow), full scans at several COUNT sizes return exactly the live
+keys in order, MATCH prefixes and ?/* patterns return exactly the live keys they match,
+keys stored through binary SETs that would break the line framing (END, a newline, ...)
+come back quoted and decode to themselves, and keys left alone during a scan are all
+returned while others are written and deleted.
+"""
+
+import fnmatch
+import random
+import time
+import argparse
+import sys
+
+from kvtest import LineClient, BinaryClient, Checks, OP_SET, OP_DEL
+
+BATCH = 1000 # commands per pipeline
+ESCAPES = {'\\': b'\\', '"': b'"', 'n': b'\n', 'r': b'\r', 't': b'\t'}
+
+
+def unquote(line):
+    """A key as SCAN writes it: as is, or double-quoted with escapes if it would break the framing"""
+    if not line.startswith('"'):
+        return line
+    if len(line) < 2 or not line.endswith('"'):
+        raise ValueError(f"bad quoted key {line!r}")
+    key = b''
+    body = line[1:-1]
+    i = 0
+    while i < len(body):
+        if body[i] != '\\':
+            key += body[i].encode()
+            i += 1
+        elif body[i + 1] == 'x':
+            key += bytes([int(body[i + 2:i + 4], 16)])
+            i += 4
+        else:
+            key += ESCAPES[body[i + 1]]
+            i += 2
+    return key.decode('utf-8', 'surrogateescape')
+
+
+def scan(client, pattern=None, count=None, between=None):
+    """Every key a full scan returns, in order; between(chunk) runs after each chunk"""
+    keys = []
+    cursor = '0'
+    chunks = 0
+    while True:
+        command = f'SCAN {cursor}' + (f' MATCH {pattern}' if pattern else '') + (f' COUNT {count}' if count else '')
+        reply = client.lines(command)
+        if not reply:
+            raise ValueError(f"bad reply to {command}")
+        cursor = reply[0]
+        keys += [unquote(line) for line in reply[1:]]
+        chunks += 1
+        if between is not None:
+            between(chunks)
+        if cursor == '0':
+            return keys
+
+
+def run_pipelined(client, commands):
+    for base in range(0, len(commands), BATCH):
+        client.pipeline(commands[base:base + BATCH])
+
+
+def run_tests(host, port, client, keys, deletes, seed):
+    """Returns the number of failed checks"""
+    check = Checks()
+    rng = random.Random(seed)
+    ns = f'scan{int(time.time() * 1000)}:' # other keys in the server sort before or after these
+    names = [f'{ns}k{i}' for i in range(keys)]
+    run_pipelined(client, [f'SET {name} v' for name in names])
+
+    # runs of neighbouring keys (whole leaves empty out), then scattered ones
+    ordered = sorted(names)
+    doomed = set()
+    while len(doomed) < deletes // 2:
+        start = rng.randrange(len(ordered))
+        doomed.update(ordered[start:start + rng.randint(20, 400)])
+    doomed.update(rng.sample(sorted(set(names) - doomed), max(0, deletes - len(doomed))))
+    run_pipelined(client, [f'DEL {name}' for name in doomed])
+    live = sorted(set(names) - doomed)
+    print(f"  ({len(names)} keys written, {len(doomed)} deleted, {len(live)} live)")
+
+    for count in (None, 37, 10000):
+        got = scan(client, count=count)
+        check(f"full scan, COUNT {count or 'default'}: in order, no repeats", got, sorted(set(got)))
+        check(f"full scan, COUNT {count or 'default'}: the live keys", [k for k in got if k.startswith(ns)], live)
+    check("COUNT 1 (a slice only: a round trip per key)", scan(client, pattern=f'{ns}k1*', count=1),
+          [k for k in live if k.startswith(f'{ns}k1')])
+
+    patterns = [f'{ns}*', f'{ns}k2*', f'{ns}k12*', f'{ns}k?', f'{ns}k1?3', f'{ns}k*7', f'{ns}*1*9', f'{ns}k?0*']
+    for pattern in patterns:
+        check(f"MATCH {pattern[len(ns):]}", scan(client, pattern=pattern, count=37),
+              [k for k in live if fnmatch.fnmatchcase(k, pattern)])
+    check("MATCH without hits", scan(client, pattern=f'{ns}none*', count=37), [])
+
+    client.pipeline([f'SET {ns}star*x v', f'SET {ns}starfx v'])
+    check("escaped * is literal", scan(client, pattern=f'{ns}star\\*x'), [f'{ns}star*x'])
+    check("unescaped * matches both", scan(client, pattern=f'{ns}star*x'), [f'{ns}star*x', f'{ns}starfx'])
+    client.pipeline([f'DEL {ns}star*x', f'DEL {ns}starfx'])
+
+    # keys stored through binary SETs that would break the line framing come back quoted
+    odd = [b'END', b'ERROR: not an error', b'"quoted"', b'line\nbreak', b'tab\tcr\r',
+           b'back\\slash\x00nul', b'\xff\xfe', 'caf\u00e9'.encode()]
+    plain = [f'{ns}inner"quote', f'{ns}inner\\backslash', f'{ns}with space']
+    binary = BinaryClient(host, port)
+    binary.pipeline([binary.frame(OP_SET, key, b'v') for key in odd + [k.encode() for k in plain]])
+    decoded = sorted(k.decode('utf-8', 'surrogateescape') for k in odd)
+    check("odd keys round-trip, in order", [k for k in scan(client, count=3) if not k.startswith(ns)
+                                            and k in decoded], decoded)
+    check("END is a key, not the terminator", scan(client, pattern='END'), ['END'])
+    check("a key line starting with ERROR", scan(client, pattern='ERROR*'), ['ERROR: not an error'])
+    check("a newline in a key", scan(client, pattern='line?break'), ['line\nbreak'])
+    for key in plain:
+        check(f"{key[len(ns):]!r} written as is", client.lines(f'SCAN 0 MATCH {key.replace(" ", "?").replace(chr(92), "?")}'),
+              ['0', key])
+    check("quoted on the wire", client.lines('SCAN 0 MATCH END'), ['0', '"END"'])
+    binary.pipeline([binary.frame(OP_DEL, key) for key in odd + [k.encode() for k in plain]])
+    binary.close()
+
+    # writes and deletes between the chunks of a scan: keys untouched throughout are all
+    # returned, once each, and nothing deleted before the scan reaches it comes back
+    writer = LineClient(host, port)
+    touched = set()
+    def churn(chunk):
+        batch = rng.sample(live, 20)
+        touched.update(batch)
+        commands = [f'DEL {k}' for k in batch] + [f'SET {ns}new{chunk}:{i} v' for i in range(20)]
+        touched.update(f'{ns}new{chunk}:{i}' for i in range(20))
+        writer.pipeline(commands)
+    got = scan(client, pattern=f'{ns}*', count=500, between=churn)
+    writer.close()
+    check("scan during writes: in order, no repeats", got, sorted(set(got)))
+    check("scan during writes: every untouched key", [k for k in got if k not in touched],
+          [k for k in live if k not in touched])
+    check("scan during writes: nothing deleted returned", [k for k in got if k in doomed], [])
+
+    remaining = scan(client, pattern=f'{ns}*', count=10000)
+    run_pipelined(client, [f'DEL {k}' for k in remaining])
+    check("cleanup", scan(client, pattern=f'{ns}*', count=10000), [])
+    return check.failures
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='SCAN test for KVStore',
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        epilog="""
+Examples:
+  # kvstore_server --ordered-index on
+  python3 scan.py
+
+  # more keys, most of them deleted
+  python3 scan.py --keys 100000 --deletes 80000
+        """
+    )
+    parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
+    parser.add_argument('--port', type=int, default=8080, help='Server port (default: 8080)')
+    parser.add_argument('--keys', type=int, default=30000, help='Keys written (default: 30000)')
+    parser.add_argument('--deletes', type=int, default=18000, help='Keys deleted again (default: 18000)')
+    parser.add_argument('--seed', type=int, default=1, help='Seed for the deleted keys (default: 1)')
+    args = parser.parse_args()
+
+    try:
+        client = LineClient(args.host, args.port)
+    except Exception as e:
+        print(f"Error: Cannot connect to server: {e}")
+        sys.exit(1)
+
+    print("=" * 60)
+    print("KVStore SCAN Test")
+    print("=" * 60)
+    try:
+        failures = run_tests(args.host, args.port, client, args.keys, min(args.deletes, args.keys), args.seed)
+    except (OSError, ValueError) as e:
+        print(f"Error: {e}")
+        sys.exit(1)
+    finally:
+        client.close()
+    print("=" * 60)
+    print(f"{failures} check(s) failed" if failures else "All checks passed")
+    print("=" * 60)
+    sys.exit(1 if failures else 0)
+
+
+if __name__ == '__main__':
+    main()
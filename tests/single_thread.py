@@ -62,6 +62,31 @@ class KVStoreClient:
                 self.sock = None
             return f"ERROR: {str(e)}"
     
+    def send_pipeline(self, commands):
+        """Send a batch of commands in one write and read one response line per command"""
+        # skip the liveness probe: its extra small write stalls on Nagle + delayed ACK
+        sock = self.sock if (self.reuse_connection and self.sock) else self._get_socket()
+        try:
+            sock.sendall(''.join(c + '\n' for c in commands).encode())
+
+            response = b''
+            while response.count(b'\n') < len(commands):
+                chunk = sock.recv(65536)
+                if not chunk:
+                    break
+                response += chunk
+
+            if not self.reuse_connection:
+                sock.close()
+
+            return response.decode().split('\n')[:len(commands)]
+        except Exception as e:
+            if not self.reuse_connection and sock:
+                sock.close()
+            if self.reuse_connection:
+                self.sock = None
+            return [f"ERROR: {str(e)}"] * len(commands)
+
     def close(self):
         """Close persistent connection if exists"""
         if self.sock:
@@ -148,6 +173,50 @@ def run_throughput_test(client, num_ops, workload='mixed'):
     }
 
 
+def run_pipelined_test(client, num_ops, workload='mixed', depth=16):
+    """Run a throughput test sending commands in pipelined batches of `depth`"""
+    successes = 0
+    errors = 0
+
+    def command_for(i):
+        if workload == 'set' or (workload == 'mixed' and i % 2 == 0):
+            return f"SET test_key_{i} test_value_{i}", lambda r: r == "OK"
+        key = f"test_key_{i - 1}" if workload == 'mixed' else f"test_key_{i}"
+        return f"GET {key}", lambda r: not r.startswith("ERROR") and r != "NOT_FOUND"
+
+    # Pre-populate keys for GET-only tests
+    if workload == 'get':
+        print("Pre-populating keys...", end='', flush=True)
+        for start in range(0, num_ops, depth):
+            client.send_pipeline([f"SET test_key_{i} test_value_{i}"
+                                  for i in range(start, min(start + depth, num_ops))])
+        print(" done")
+
+    print(f"Running {num_ops:,} operations (pipeline depth {depth})...", end='', flush=True)
+    start_time = time.perf_counter()
+
+    for start in range(0, num_ops, depth):
+        batch = [command_for(i) for i in range(start, min(start + depth, num_ops))]
+        results = client.send_pipeline([cmd for cmd, _ in batch])
+        for (_, check), result in zip(batch, results):
+            if check(result):
+                successes += 1
+            else:
+                errors += 1
+
+    end_time = time.perf_counter()
+    elapsed = end_time - start_time
+    print(" done")
+
+    return {
+        'total_ops': num_ops,
+        'successes': successes,
+        'errors': errors,
+        'elapsed': elapsed,
+        'throughput': num_ops / elapsed
+    }
+
+
 def main():
     parser = argparse.ArgumentParser(
         description='Single-threaded throughput test for KVStore',
@@ -165,6 +234,9 @@ Examples:
 
   # Use persistent connection for better performance
   python3 single_thread_throughput.py --ops 100000 --reuse-connection
+
+  # Pipeline 32 commands per round trip
+  python3 single_thread_throughput.py --ops 100000 --reuse-connection --pipeline 32
         """
     )
     parser.add_argument('--host', default='localhost', help='Server host (default: localhost)')
@@ -174,6 +246,8 @@ Examples:
                        help='Workload type: set (write-only), get (read-only), mixed (50/50) (default: mixed)')
     parser.add_argument('--reuse-connection', action='store_true',
                        help='Reuse a single connection instead of creating new ones (better throughput)')
+    parser.add_argument('--pipeline', type=int, default=1,
+                       help='Commands sent per round trip; >1 enables pipelining (default: 1)')
     
     args = parser.parse_args()
     
@@ -196,12 +270,16 @@ Examples:
     print(f"Operations: {args.ops:,}")
     print(f"Workload: {args.workload}")
     print(f"Connection reuse: {args.reuse_connection}")
+    print(f"Pipeline depth: {args.pipeline}")
     print("=" * 60)
     
     client = KVStoreClient(args.host, args.port, args.reuse_connection)
     
     try:
-        results = run_throughput_test(client, args.ops, args.workload)
+        if args.pipeline > 1:
+            results = run_pipelined_test(client, args.ops, args.workload, args.pipeline)
+        else:
+            results = run_throughput_test(client, args.ops, args.workload)
         
         print("\n" + "=" * 60)
         print("Results")